@@ -0,0 +1,31 @@
+# Links the AnimCore static library, include from projects built on top of it
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+# Build directory of the library wherever the including project sits, e.g. AnimCore/tests
+win32:CONFIG(release, debug|release): ANIMCORE_DIR = $$shadowed($$PWD)/release
+else:win32:CONFIG(debug, debug|release): ANIMCORE_DIR = $$shadowed($$PWD)/debug
+else: ANIMCORE_DIR = $$shadowed($$PWD)
+
+LIBS += -L$$ANIMCORE_DIR -lAnimCore
+win32-msvc*: PRE_TARGETDEPS += $$ANIMCORE_DIR/AnimCore.lib
+else: PRE_TARGETDEPS += $$ANIMCORE_DIR/libAnimCore.a
+
+QT += concurrent
+
+# Assimp is needed by the loader inside the library
+unix: !macx {
+    # Found on the linker's search path, distributions put it in lib64 or multiarch directories
+    LIBS += -lassimp
+    # shm_open() for the pose publisher
+    LIBS += -lrt
+}
+
+macx {
+    LIBS += -L/usr/local/lib -lassimp
+}
+
+win32 {
+    LIBS += -L"C:/Assimp3/lib/Release" -lassimp
+}
@@ -0,0 +1,64 @@
+#-------------------------------------------------
+#
+# Model loading, clips, skeletons and pose evaluation, without any GL or window
+#
+#-------------------------------------------------
+
+# QtCore only, the math types are the library's own, see mathtypes.h
+QT       += core concurrent
+QT       -= gui widgets
+CONFIG      += C++11 staticlib
+
+TARGET = AnimCore
+TEMPLATE = lib
+
+SOURCES += mathtypes.cpp \
+    modelloader.cpp \
+    modelasset.cpp \
+    assetoptimizer.cpp \
+    cliplibrary.cpp \
+    clipstream.cpp \
+    skeleton.cpp \
+    posekernels.cpp \
+    poseevaluator.cpp \
+    posepublisher.cpp \
+    posestream.cpp \
+    bounds.cpp \
+    skinweights.cpp \
+    morphtargets.cpp \
+    instancebvh.cpp \
+    meshpicker.cpp
+
+HEADERS += mathtypes.h \
+    qtconversions.h \
+    modelloader.h \
+    modelasset.h \
+    assetoptimizer.h \
+    cliplibrary.h \
+    clipstream.h \
+    skeleton.h \
+    posekernels.h \
+    poseevaluator.h \
+    posepublisher.h \
+    posestream.h \
+    bounds.h \
+    skinweights.h \
+    morphtargets.h \
+    instancebvh.h \
+    meshpicker.h \
+    memoryusage.h
+
+# Morph target animations need Assimp 4 or later, Windows builds still use Assimp 3
+unix: !macx {
+    INCLUDEPATH +=  /usr/include
+    DEFINES += ASSIMP_MORPH_ANIMATIONS
+}
+
+macx {
+    INCLUDEPATH +=  /usr/local/include
+    DEFINES += ASSIMP_MORPH_ANIMATIONS
+}
+
+win32 {
+    INCLUDEPATH += "C:/Assimp3/include"
+}
@@ -0,0 +1,328 @@
+#include "assetoptimizer.h"
+#include "modelloader.h"
+#include "cliplibrary.h"
+#include "clipstream.h"
+#include <QFileInfo>
+#include <QHash>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Vertex cache optimization, after Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+const int VertexCacheSize = 32;
+
+float vertexScore(int cachePosition, int remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        // The last triangle's vertices get a fixed score so the next triangle doesn't just reuse them
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = std::pow(1.0f - float(cachePosition - 3) / (VertexCacheSize - 3), 1.5f);
+    }
+
+    // Favour vertices with few triangles left so they get finished off
+    score += 2.0f / std::sqrt(float(remainingTriangles));
+    return score;
+}
+
+void optimizeTriangleOrder(unsigned int *indices, int indexCount, unsigned int vertexOffset, unsigned int vertexCount)
+{
+    const int triangleCount = indexCount / 3;
+    if (triangleCount < 2 || vertexCount == 0)
+        return;
+
+    QVector<int> remaining(vertexCount, 0);
+    QVector<int> cachePosition(vertexCount, -1);
+    QVector<float> score(vertexCount);
+
+    // Triangles using each vertex, the first remaining[v] entries are the ones not yet emitted
+    QVector<int> adjacencyStart(vertexCount + 1, 0);
+    for (int ii=0; ii<triangleCount*3; ++ii)
+        ++remaining[indices[ii] - vertexOffset];
+    for (unsigned int iv=0; iv<vertexCount; ++iv)
+        adjacencyStart[iv+1] = adjacencyStart[iv] + remaining[iv];
+
+    QVector<int> adjacency(triangleCount * 3);
+    QVector<int> fill = adjacencyStart;
+    for (int it=0; it<triangleCount; ++it) {
+        for (int ic=0; ic<3; ++ic)
+            adjacency[fill[indices[it*3+ic] - vertexOffset]++] = it;
+    }
+
+    for (unsigned int iv=0; iv<vertexCount; ++iv)
+        score[iv] = vertexScore(-1, remaining[iv]);
+
+    QVector<float> triangleScore(triangleCount);
+    QVector<bool> emitted(triangleCount, false);
+    int bestTriangle = 0;
+    for (int it=0; it<triangleCount; ++it) {
+        triangleScore[it] = score[indices[it*3] - vertexOffset]
+                          + score[indices[it*3+1] - vertexOffset]
+                          + score[indices[it*3+2] - vertexOffset];
+        if (triangleScore[it] > triangleScore[bestTriangle])
+            bestTriangle = it;
+    }
+
+    QVector<unsigned int> output;
+    output.reserve(triangleCount * 3);
+    QVector<int> cache;
+    QVector<int> newCache;
+    int scanPosition = 0;
+
+    for (int emittedCount=0; emittedCount<triangleCount; ++emittedCount) {
+        if (bestTriangle < 0) {
+            // Nothing adjacent to the cache is left, continue with the next unemitted triangle
+            while (emitted[scanPosition])
+                ++scanPosition;
+            bestTriangle = scanPosition;
+        }
+
+        emitted[bestTriangle] = true;
+        newCache.clear();
+        for (int ic=0; ic<3; ++ic) {
+            const unsigned int index = indices[bestTriangle*3+ic];
+            const int vertex = index - vertexOffset;
+            output.append(index);
+            if (!newCache.contains(vertex))
+                newCache.append(vertex);
+
+            // Remove the triangle from this vertex's remaining list
+            int *begin = adjacency.data() + adjacencyStart[vertex];
+            for (int ia=0; ia<remaining[vertex]; ++ia) {
+                if (begin[ia] == bestTriangle) {
+                    qSwap(begin[ia], begin[remaining[vertex]-1]);
+                    break;
+                }
+            }
+            --remaining[vertex];
+        }
+
+        for (int ii=0; ii<cache.size(); ++ii) {
+            if (!newCache.contains(cache[ii]))
+                newCache.append(cache[ii]);
+        }
+
+        // Vertices pushed out of the cache lose their cache bonus
+        for (int ii=VertexCacheSize; ii<newCache.size(); ++ii) {
+            cachePosition[newCache[ii]] = -1;
+            score[newCache[ii]] = vertexScore(-1, remaining[newCache[ii]]);
+        }
+        if (newCache.size() > VertexCacheSize)
+            newCache.resize(VertexCacheSize);
+        qSwap(cache, newCache);
+
+        for (int ii=0; ii<cache.size(); ++ii) {
+            cachePosition[cache[ii]] = ii;
+            score[cache[ii]] = vertexScore(ii, remaining[cache[ii]]);
+        }
+
+        // Rescore the triangles touching the cache and pick the best one
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (int ii=0; ii<cache.size(); ++ii) {
+            const int vertex = cache[ii];
+            const int *begin = adjacency.constData() + adjacencyStart[vertex];
+            for (int ia=0; ia<remaining[vertex]; ++ia) {
+                const int triangle = begin[ia];
+                triangleScore[triangle] = score[indices[triangle*3] - vertexOffset]
+                                        + score[indices[triangle*3+1] - vertexOffset]
+                                        + score[indices[triangle*3+2] - vertexOffset];
+                if (triangleScore[triangle] > bestScore) {
+                    bestScore = triangleScore[triangle];
+                    bestTriangle = triangle;
+                }
+            }
+        }
+    }
+
+    std::copy(output.constBegin(), output.constEnd(), indices);
+}
+
+template <typename T>
+int removeRepeatedKeys(QVector<QPair<double, T> > &keys, float tolerance)
+{
+    if (keys.size() < 2)
+        return 0;
+
+    // Playback holds each key until the next one, so a key equal to the one before it changes nothing
+    int kept = 1;
+    for (int ii=1; ii<keys.size(); ++ii) {
+        const T &previous = keys[kept-1].second;
+        const T &current = keys[ii].second;
+        if ((current - previous).length() > tolerance)
+            keys[kept++] = keys[ii];
+    }
+
+    const int removed = keys.size() - kept;
+    keys.resize(kept);
+    return removed;
+}
+
+int removeRepeatedRotationKeys(QVector<QPair<double, Quaternion> > &keys, float tolerance)
+{
+    if (keys.size() < 2)
+        return 0;
+
+    int kept = 1;
+    for (int ii=1; ii<keys.size(); ++ii) {
+        const Quaternion &previous = keys[kept-1].second;
+        const Quaternion &current = keys[ii].second;
+        const float dot = previous.scalar()*current.scalar() + previous.x()*current.x()
+                        + previous.y()*current.y() + previous.z()*current.z();
+        if (1.0f - qAbs(dot) > tolerance)
+            keys[kept++] = keys[ii];
+    }
+
+    const int removed = keys.size() - kept;
+    keys.resize(kept);
+    return removed;
+}
+
+int compressChannel(NodeAnimation &anim, float tolerance)
+{
+    int removed = 0;
+    removed += removeRepeatedKeys(anim.positionKeys, tolerance);
+    removed += removeRepeatedKeys(anim.scalingKeys, tolerance);
+    removed += removeRepeatedRotationKeys(anim.rotationKeys, tolerance);
+    return removed;
+}
+
+}
+
+int AssetOptimizer::generateLods(ModelLoader &model, int levels)
+{
+    QVector<float> *vertices;
+    QVector<unsigned int> *indices;
+    model.getBufferData(&vertices, 0, &indices);
+
+    int lodCount = 0;
+    QVector<QSharedPointer<Mesh> > meshes = model.getMeshes();
+    for (int im=0; im<meshes.size(); ++im) {
+        Mesh &mesh = *meshes[im];
+        mesh.lods.clear();
+        if (mesh.vertexCount == 0)
+            continue;
+
+        Vector3 minimum, maximum;
+        const float *positions = vertices->constData() + mesh.vertexOffset * 3;
+        minimum = maximum = Vector3(positions[0], positions[1], positions[2]);
+        for (unsigned int iv=1; iv<mesh.vertexCount; ++iv) {
+            for (int ic=0; ic<3; ++ic) {
+                minimum[ic] = qMin(minimum[ic], positions[iv*3+ic]);
+                maximum[ic] = qMax(maximum[ic], positions[iv*3+ic]);
+            }
+        }
+        const Vector3 extent = maximum - minimum;
+
+        unsigned int previousCount = mesh.indexCount;
+        QVector<unsigned int> remap(mesh.vertexCount);
+
+        for (int level=1; level<=levels; ++level) {
+            // Each level halves the grid resolution, which keeps roughly an eighth of the vertices
+            const int resolution = qMax(1, int(std::cbrt(float(mesh.vertexCount)) / (1 << (level-1))));
+
+            QHash<quint64, unsigned int> cellVertex;
+            for (unsigned int iv=0; iv<mesh.vertexCount; ++iv) {
+                quint64 key = 0;
+                for (int ic=0; ic<3; ++ic) {
+                    const float t = extent[ic] > 0.0f ? (positions[iv*3+ic] - minimum[ic]) / extent[ic] : 0.0f;
+                    key = key * (resolution + 1) + quint64(qBound(0, int(t * resolution), resolution));
+                }
+
+                // The first vertex in a cell represents it, so the reduced mesh reuses existing vertex data
+                QHash<quint64, unsigned int>::const_iterator it = cellVertex.constFind(key);
+                if (it == cellVertex.constEnd())
+                    it = cellVertex.insert(key, mesh.vertexOffset + iv);
+                remap[iv] = it.value();
+            }
+
+            MeshLod lod;
+            lod.indexOffset = indices->size();
+            for (unsigned int ii=mesh.indexOffset; ii<mesh.indexOffset+mesh.indexCount; ii+=3) {
+                const unsigned int a = remap[(*indices)[ii] - mesh.vertexOffset];
+                const unsigned int b = remap[(*indices)[ii+1] - mesh.vertexOffset];
+                const unsigned int c = remap[(*indices)[ii+2] - mesh.vertexOffset];
+                if (a == b || b == c || a == c)
+                    continue;
+                indices->append(a);
+                indices->append(b);
+                indices->append(c);
+            }
+            lod.indexCount = indices->size() - lod.indexOffset;
+
+            // Stop once clustering no longer removes anything, or nothing is left to draw
+            if (lod.indexCount == 0 || lod.indexCount >= previousCount) {
+                indices->resize(lod.indexOffset);
+                break;
+            }
+
+            mesh.lods.append(lod);
+            previousCount = lod.indexCount;
+            ++lodCount;
+        }
+    }
+    return lodCount;
+}
+
+void AssetOptimizer::optimizeVertexCache(ModelLoader &model)
+{
+    QVector<unsigned int> *indices;
+    model.getBufferData(0, 0, &indices);
+
+    QVector<QSharedPointer<Mesh> > meshes = model.getMeshes();
+    for (int im=0; im<meshes.size(); ++im) {
+        Mesh &mesh = *meshes[im];
+        unsigned int *data = indices->data();
+        optimizeTriangleOrder(data + mesh.indexOffset, mesh.indexCount, mesh.vertexOffset, mesh.vertexCount);
+        for (int il=0; il<mesh.lods.size(); ++il)
+            optimizeTriangleOrder(data + mesh.lods[il].indexOffset, mesh.lods[il].indexCount, mesh.vertexOffset, mesh.vertexCount);
+    }
+}
+
+int AssetOptimizer::compressClips(ModelLoader &model, float tolerance)
+{
+    QSharedPointer<ClipLibrary> library = model.getClipLibrary();
+
+    int removed = 0;
+    for (int ic=0; ic<library->clipCount(); ++ic) {
+        if (library->streamedClip(ic))
+            continue;
+        QSharedPointer<AnimationClip> clip = ClipLibrary::decode(library->encodedClip(ic));
+        for (int ii=0; ii<clip->channels.size(); ++ii)
+            removed += compressChannel(clip->channels[ii].animation, tolerance);
+        library->replaceClip(ic, clip->channels);
+    }
+    return removed;
+}
+
+int AssetOptimizer::streamClips(ModelLoader &model, const QString &assetPath, double minSeconds, double blockSeconds)
+{
+    QSharedPointer<ClipLibrary> library = model.getClipLibrary();
+    const QVector<QSharedPointer<Animation> > animations = model.getNodeAnimations();
+    const QFileInfo asset(assetPath);
+
+    int streamed = 0;
+    for (int ic=0; ic<library->clipCount() && ic<animations.size(); ++ic) {
+        // Clips without a tick rate play at 25 ticks per second, like Scene does
+        const double ticksPerSecond = animations[ic]->ticksPerSecond != 0.0 ? animations[ic]->ticksPerSecond : 25.0;
+        if (library->streamedClip(ic) || animations[ic]->duration / ticksPerSecond < minSeconds)
+            continue;
+
+        const QString streamPath = asset.absoluteDir().filePath(QString("%1.%2.a3cs").arg(asset.completeBaseName()).arg(ic));
+        QSharedPointer<AnimationClip> clip = ClipLibrary::decode(library->encodedClip(ic));
+        QSharedPointer<StreamedClip> stream(new StreamedClip);
+        if (!StreamedClip::write(streamPath, clip->channels, blockSeconds * ticksPerSecond, model.clipBounds(ic))
+                || !stream->open(streamPath))
+            continue;
+
+        library->setStreamedClip(ic, stream);
+        ++streamed;
+    }
+    return streamed;
+}
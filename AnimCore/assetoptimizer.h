@@ -0,0 +1,26 @@
+#ifndef ASSETOPTIMIZER_H
+#define ASSETOPTIMIZER_H
+
+#include <QString>
+
+class ModelLoader;
+
+// Offline optimization stages run by the asset converter on a loaded model before it is written out
+class AssetOptimizer
+{
+public:
+    // Append reduced detail index ranges to every mesh using vertex clustering
+    static int generateLods(ModelLoader &model, int levels);
+
+    // Reorder the triangles of every mesh (and its lods) for post-transform vertex cache reuse
+    static void optimizeVertexCache(ModelLoader &model);
+
+    // Drop animation keys that repeat the previous key, returns the number of keys removed
+    static int compressClips(ModelLoader &model, float tolerance);
+
+    // Moves clips lasting at least minSeconds into block streams next to the asset, see StreamedClip.
+    // Returns the number of clips streamed.
+    static int streamClips(ModelLoader &model, const QString &assetPath, double minSeconds, double blockSeconds);
+};
+
+#endif // ASSETOPTIMIZER_H
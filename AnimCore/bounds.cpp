@@ -0,0 +1,420 @@
+#include "bounds.h"
+#include "modelloader.h"
+#include "skeleton.h"
+#include <QtConcurrent>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define BOUNDS_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Vertices per task, smaller ranges aren't worth a thread
+const int ChunkSize = 64 * 1024;
+
+BoundingBox computeRange(const float *positions, int count)
+{
+    BoundingBox box;
+    int ii = 0;
+
+#ifdef BOUNDS_SSE
+    if (count >= 4) {
+        // Four vertices are three registers laid out xyzx yzxy zxyz, each register position
+        // always holds the same components, so the lanes are only sorted out at the end
+        __m128 min0 = _mm_loadu_ps(positions), min1 = _mm_loadu_ps(positions + 4), min2 = _mm_loadu_ps(positions + 8);
+        __m128 max0 = min0, max1 = min1, max2 = min2;
+        for (ii = 4; ii + 4 <= count; ii += 4) {
+            const float *p = positions + ii * 3;
+            const __m128 v0 = _mm_loadu_ps(p), v1 = _mm_loadu_ps(p + 4), v2 = _mm_loadu_ps(p + 8);
+            min0 = _mm_min_ps(min0, v0); max0 = _mm_max_ps(max0, v0);
+            min1 = _mm_min_ps(min1, v1); max1 = _mm_max_ps(max1, v1);
+            min2 = _mm_min_ps(min2, v2); max2 = _mm_max_ps(max2, v2);
+        }
+
+        float mn[12], mx[12];
+        _mm_storeu_ps(mn, min0); _mm_storeu_ps(mn + 4, min1); _mm_storeu_ps(mn + 8, min2);
+        _mm_storeu_ps(mx, max0); _mm_storeu_ps(mx + 4, max1); _mm_storeu_ps(mx + 8, max2);
+        for (int iv=0; iv<4; ++iv) {
+            box.extend(Vector3(mn[iv*3], mn[iv*3+1], mn[iv*3+2]));
+            box.extend(Vector3(mx[iv*3], mx[iv*3+1], mx[iv*3+2]));
+        }
+    }
+#endif
+
+    for (; ii<count; ++ii)
+        box.extend(Vector3(positions[ii*3], positions[ii*3+1], positions[ii*3+2]));
+    return box;
+}
+
+BoundingBox computeTransformedRange(const float *positions, int count, const Affine3x4 &transformation)
+{
+    BoundingBox box;
+    int ii = 0;
+
+#ifdef BOUNDS_SSE
+    if (count > 0) {
+        // Columns of the row major matrix, the fourth lane is unused
+        const float *m = transformation.m;
+        const __m128 c0 = _mm_setr_ps(m[0], m[4], m[8], 0.0f), c1 = _mm_setr_ps(m[1], m[5], m[9], 0.0f);
+        const __m128 c2 = _mm_setr_ps(m[2], m[6], m[10], 0.0f), c3 = _mm_setr_ps(m[3], m[7], m[11], 0.0f);
+
+        __m128 minimum = _mm_set1_ps(FLT_MAX), maximum = _mm_set1_ps(-FLT_MAX);
+        for (; ii<count; ++ii) {
+            const float *p = positions + ii * 3;
+            __m128 v = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), c3);
+            v = _mm_add_ps(v, _mm_mul_ps(c1, _mm_set1_ps(p[1])));
+            v = _mm_add_ps(v, _mm_mul_ps(c2, _mm_set1_ps(p[2])));
+            minimum = _mm_min_ps(minimum, v);
+            maximum = _mm_max_ps(maximum, v);
+        }
+
+        float mn[4], mx[4];
+        _mm_storeu_ps(mn, minimum);
+        _mm_storeu_ps(mx, maximum);
+        box.extend(BoundingBox(Vector3(mn[0], mn[1], mn[2]), Vector3(mx[0], mx[1], mx[2])));
+    }
+#endif
+
+    for (; ii<count; ++ii)
+        box.extend(transformation.map(Vector3(positions[ii*3], positions[ii*3+1], positions[ii*3+2])));
+    return box;
+}
+
+void reduceBox(BoundingBox &result, const BoundingBox &box)
+{
+    result.extend(box);
+}
+
+void nodeBoundsRecursive(const Node *node, Affine3x4 transformation, const QVector<float> &vertices, BoundingBox &box)
+{
+    transformation = transformation * node->transformation;
+
+    for (int ii=0; ii<node->meshes.size(); ++ii) {
+        const Mesh &mesh = *node->meshes[ii];
+        box.extend(Bounds::compute(vertices.constData() + mesh.vertexOffset * 3, mesh.vertexCount, &transformation));
+    }
+
+    for (int ii=0; ii<node->nodes.size(); ++ii)
+        nodeBoundsRecursive(&node->nodes[ii], transformation, vertices, box);
+}
+
+// Ticks that together reach every key combination of the clip
+QVector<double> sampleTicks(const AnimationClip &clip)
+{
+    QVector<double> times;
+    for (int ii=0; ii<clip.channels.size(); ++ii) {
+        const NodeAnimation &anim = clip.channels[ii].animation;
+        for (int ik=0; ik<anim.positionKeys.size(); ++ik)
+            times.append(anim.positionKeys[ik].first);
+        for (int ik=0; ik<anim.rotationKeys.size(); ++ik)
+            times.append(anim.rotationKeys[ik].first);
+        for (int ik=0; ik<anim.scalingKeys.size(); ++ik)
+            times.append(anim.scalingKeys[ik].first);
+    }
+    std::sort(times.begin(), times.end());
+    times.erase(std::unique(times.begin(), times.end()), times.end());
+
+    // On every key, between every pair and past the end, whichever way the key lookup rounds
+    QVector<double> ticks;
+    ticks.reserve(times.size() * 2);
+    for (int ii=0; ii<times.size(); ++ii) {
+        ticks.append(times[ii]);
+        ticks.append(ii + 1 < times.size() ? (times[ii] + times[ii+1]) * 0.5 : times[ii] + 1.0);
+    }
+    return ticks;
+}
+
+BoundingBox poseBounds(const Skeleton &skeleton, const QVector<const Node*> &nodes,
+                       const QHash<const Mesh*, SkinnedBoxes::MeshBoxes> &meshBoxes)
+{
+    BoundingBox box;
+    for (int joint=0; joint<nodes.size(); ++joint) {
+        const Node *node = nodes[joint];
+        if (node->meshes.isEmpty())
+            continue;
+
+        const Affine3x4 &nodeWorld = skeleton.worldMatrix(joint);
+        for (int ii=0; ii<node->meshes.size(); ++ii) {
+            const SkinnedBoxes::MeshBoxes &boxes = meshBoxes[node->meshes[ii].data()];
+            box.extend(boxes.unskinned.transformed(nodeWorld));
+            for (int ib=0; ib<boxes.bones.size(); ++ib) {
+                if (boxes.boneJoints[ib] < 0 || boxes.bones[ib].isEmpty())
+                    continue;
+                const Affine3x4 bone = skeleton.worldMatrix(boxes.boneJoints[ib]) * boxes.boneOffsets[ib];
+                box.extend(boxes.bones[ib].transformed(bone));
+            }
+        }
+    }
+    return box;
+}
+
+}
+
+void BoundingBox::extend(const Vector3 &point)
+{
+    minimum = Vector3(qMin(minimum.x(), point.x()), qMin(minimum.y(), point.y()), qMin(minimum.z(), point.z()));
+    maximum = Vector3(qMax(maximum.x(), point.x()), qMax(maximum.y(), point.y()), qMax(maximum.z(), point.z()));
+}
+
+void BoundingBox::extend(const BoundingBox &box)
+{
+    if (box.isEmpty())
+        return;
+    extend(box.minimum);
+    extend(box.maximum);
+}
+
+BoundingBox BoundingBox::transformed(const Affine3x4 &matrix) const
+{
+    BoundingBox box;
+    if (isEmpty())
+        return box;
+
+    for (int corner=0; corner<8; ++corner) {
+        const Vector3 point(corner & 1 ? maximum.x() : minimum.x(),
+                            corner & 2 ? maximum.y() : minimum.y(),
+                            corner & 4 ? maximum.z() : minimum.z());
+        box.extend(matrix.map(point));
+    }
+    return box;
+}
+
+Frustum::Frustum(const float *viewProjection)
+{
+    // Each clip plane is the last row plus or minus one of the others, row r is every fourth value
+    const float *m = viewProjection;
+    for (int ii=0; ii<3; ++ii) {
+        m_planes[ii*2].normal = Vector3(m[3] + m[ii], m[7] + m[4 + ii], m[11] + m[8 + ii]);
+        m_planes[ii*2].offset = m[15] + m[12 + ii];
+        m_planes[ii*2+1].normal = Vector3(m[3] - m[ii], m[7] - m[4 + ii], m[11] - m[8 + ii]);
+        m_planes[ii*2+1].offset = m[15] - m[12 + ii];
+    }
+}
+
+bool Frustum::intersects(const BoundingBox &box) const
+{
+    if (box.isEmpty())
+        return false;
+
+    // The corner furthest along each plane's normal decides
+    for (int ii=0; ii<6; ++ii) {
+        const Vector3 &normal = m_planes[ii].normal;
+        const Vector3 corner(normal.x() >= 0.0f ? box.maximum.x() : box.minimum.x(),
+                             normal.y() >= 0.0f ? box.maximum.y() : box.minimum.y(),
+                             normal.z() >= 0.0f ? box.maximum.z() : box.minimum.z());
+        if (Vector3::dotProduct(normal, corner) + m_planes[ii].offset < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+Frustum::Containment Frustum::classify(const BoundingBox &box) const
+{
+    if (box.isEmpty())
+        return Outside;
+
+    // The corner furthest along a plane's normal decides if it's outside, the nearest one if it's inside
+    Containment containment = Inside;
+    for (int ii=0; ii<6; ++ii) {
+        const Vector3 &normal = m_planes[ii].normal;
+        const Vector3 far(normal.x() >= 0.0f ? box.maximum.x() : box.minimum.x(),
+                          normal.y() >= 0.0f ? box.maximum.y() : box.minimum.y(),
+                          normal.z() >= 0.0f ? box.maximum.z() : box.minimum.z());
+        if (Vector3::dotProduct(normal, far) + m_planes[ii].offset < 0.0f)
+            return Outside;
+
+        const Vector3 near(normal.x() >= 0.0f ? box.minimum.x() : box.maximum.x(),
+                           normal.y() >= 0.0f ? box.minimum.y() : box.maximum.y(),
+                           normal.z() >= 0.0f ? box.minimum.z() : box.maximum.z());
+        if (Vector3::dotProduct(normal, near) + m_planes[ii].offset < 0.0f)
+            containment = Intersecting;
+    }
+    return containment;
+}
+
+Ray::Ray(const Vector3 &origin, const Vector3 &direction) :
+    origin(origin)
+  , direction(direction)
+{
+    // Zero components become infinities, which the slab test handles
+    for (int ii=0; ii<3; ++ii)
+        inverseDirection[ii] = direction[ii] != 0.0f ? 1.0f / direction[ii] : FLT_MAX;
+}
+
+bool Ray::intersects(const BoundingBox &box, float maxDistance, float &distance) const
+{
+    if (box.isEmpty())
+        return false;
+
+    float near = 0.0f, far = maxDistance;
+    for (int ii=0; ii<3; ++ii) {
+        float t0 = (box.minimum[ii] - origin[ii]) * inverseDirection[ii];
+        float t1 = (box.maximum[ii] - origin[ii]) * inverseDirection[ii];
+        if (t0 > t1)
+            qSwap(t0, t1);
+        near = qMax(near, t0);
+        far = qMin(far, t1);
+        if (near > far)
+            return false;
+    }
+    distance = near;
+    return true;
+}
+
+bool Ray::intersectsTriangle(const Vector3 &a, const Vector3 &b, const Vector3 &c, float &distance) const
+{
+    // Moeller-Trumbore
+    const Vector3 edge1 = b - a;
+    const Vector3 edge2 = c - a;
+    const Vector3 p = Vector3::crossProduct(direction, edge2);
+    const float determinant = Vector3::dotProduct(edge1, p);
+    if (qAbs(determinant) < 1e-12f)
+        return false;
+
+    const float inverse = 1.0f / determinant;
+    const Vector3 s = origin - a;
+    const float u = Vector3::dotProduct(s, p) * inverse;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    const Vector3 q = Vector3::crossProduct(s, edge1);
+    const float v = Vector3::dotProduct(direction, q) * inverse;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    distance = Vector3::dotProduct(edge2, q) * inverse;
+    return distance >= 0.0f;
+}
+
+Ray Ray::transformed(const Affine3x4 &matrix) const
+{
+    return Ray(matrix.map(origin), matrix.mapVector(direction));
+}
+
+BoundingBox Bounds::compute(const float *positions, int count, const Affine3x4 *transformation)
+{
+    if (count <= ChunkSize) {
+        return transformation ? computeTransformedRange(positions, count, *transformation)
+                              : computeRange(positions, count);
+    }
+
+    QVector<int> chunks;
+    for (int first=0; first<count; first+=ChunkSize)
+        chunks.append(first);
+
+    return QtConcurrent::blockingMappedReduced<BoundingBox>(chunks, [=](int first) -> BoundingBox {
+        const int chunkCount = qMin(ChunkSize, count - first);
+        return transformation ? computeTransformedRange(positions + first * 3, chunkCount, *transformation)
+                              : computeRange(positions + first * 3, chunkCount);
+    }, reduceBox);
+}
+
+QVector<BoundingBox> Bounds::meshBounds(const QVector<float> &vertices, const QVector<QSharedPointer<Mesh> > &meshes)
+{
+    QVector<BoundingBox> boxes(meshes.size());
+    for (int ii=0; ii<meshes.size(); ++ii)
+        boxes[ii] = compute(vertices.constData() + meshes[ii]->vertexOffset * 3, meshes[ii]->vertexCount);
+    return boxes;
+}
+
+BoundingBox Bounds::nodeBounds(const Node *rootNode, const QVector<float> &vertices)
+{
+    BoundingBox box;
+    if (rootNode)
+        nodeBoundsRecursive(rootNode, Affine3x4::identity(), vertices, box);
+    return box;
+}
+
+QVector<BoundingBox> Bounds::boneBounds(const Mesh &mesh, const QVector<float> &vertices,
+                                        const QVector<int> &boneIndices, const QVector<float> &boneWeights,
+                                        BoundingBox &unskinned)
+{
+    QVector<BoundingBox> boxes(mesh.boneNames.size());
+    unskinned = BoundingBox();
+
+    const float *positions = vertices.constData() + mesh.vertexOffset * 3;
+    const bool hasBoneData = boneIndices.size() >= int(mesh.vertexOffset + mesh.vertexCount) * 4;
+    if (!hasBoneData || boxes.isEmpty()) {
+        unskinned = compute(positions, mesh.vertexCount);
+        return boxes;
+    }
+
+    for (unsigned int iv=0; iv<mesh.vertexCount; ++iv) {
+        const Vector3 position(positions[iv*3], positions[iv*3+1], positions[iv*3+2]);
+        const int slot = (mesh.vertexOffset + iv) * 4;
+
+        bool skinned = false;
+        for (int ib=0; ib<4; ++ib) {
+            const int bone = boneIndices[slot + ib];
+            if (bone < 0 || bone >= boxes.size() || boneWeights[slot + ib] <= 0.0f)
+                continue;
+            boxes[bone].extend(position);
+            skinned = true;
+        }
+        if (!skinned)
+            unskinned.extend(position);
+    }
+    return boxes;
+}
+
+SkinnedBoxes Bounds::skinnedBoxes(const Node *rootNode, const QVector<QSharedPointer<Mesh> > &meshes,
+                                  const QVector<float> &vertices,
+                                  const QVector<int> &boneIndices, const QVector<float> &boneWeights)
+{
+    SkinnedBoxes skinned;
+    if (!rootNode)
+        return skinned;
+
+    // Joint indices of the bones are the same for every clip, as is which vertices they move
+    Skeleton bindSkeleton;
+    bindSkeleton.build(rootNode);
+    skinned.rootTransformation = rootNode->transformation;
+    for (int im=0; im<meshes.size(); ++im) {
+        const Mesh &mesh = *meshes[im];
+        SkinnedBoxes::MeshBoxes &boxes = skinned.meshes[&mesh];
+        boxes.bones = boneBounds(mesh, vertices, boneIndices, boneWeights, boxes.unskinned);
+        boxes.boneOffsets = mesh.boneOffsets;
+        boxes.boneJoints.resize(mesh.boneNames.size());
+        for (int ib=0; ib<mesh.boneNames.size(); ++ib)
+            boxes.boneJoints[ib] = bindSkeleton.jointIndex(mesh.boneNames[ib]);
+    }
+    return skinned;
+}
+
+BoundingBox Bounds::clipBounds(const Node *rootNode, const SkinnedBoxes &boxes,
+                               QSharedPointer<ClipLibrary> library, int clip)
+{
+    if (!rootNode || !library || clip < 0 || clip >= library->clipCount())
+        return BoundingBox();
+
+    // Streams carry their bounds, walking through them would read the whole clip
+    const QSharedPointer<StreamedClip> stream = library->streamedClip(clip);
+    if (stream)
+        return stream->bounds();
+
+    QVector<const Node*> nodes;
+    ModelLoader::flattenNodes(rootNode, nodes);
+
+    Skeleton skeleton;
+    skeleton.setClipLibrary(library);
+    skeleton.build(rootNode);
+    skeleton.setAnimation(clip);
+    // The root may have moved since, e.g. into unit coordinates. Its channel wins if it's animated.
+    skeleton.setLocalTransformation(0, boxes.rootTransformation);
+
+    const QSharedPointer<const AnimationClip> animationClip = library->clip(clip);
+    const QVector<double> ticks = animationClip ? sampleTicks(*animationClip) : QVector<double>();
+    if (ticks.isEmpty()) {
+        skeleton.update(0.0);
+        return poseBounds(skeleton, nodes, boxes.meshes);
+    }
+
+    BoundingBox box;
+    for (int ii=0; ii<ticks.size(); ++ii) {
+        skeleton.update(ticks[ii]);
+        box.extend(poseBounds(skeleton, nodes, boxes.meshes));
+    }
+    return box;
+}
@@ -0,0 +1,129 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <QVector>
+#include <QHash>
+#include <QSharedPointer>
+#include <cfloat>
+#include "mathtypes.h"
+
+struct Node;
+struct Mesh;
+class ClipLibrary;
+
+// Axis aligned bounding box, empty until something is added
+struct BoundingBox
+{
+    BoundingBox() : minimum(FLT_MAX, FLT_MAX, FLT_MAX), maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+    BoundingBox(const Vector3 &minimum, const Vector3 &maximum) : minimum(minimum), maximum(maximum) {}
+
+    Vector3 minimum;
+    Vector3 maximum;
+
+    bool isEmpty() const { return minimum.x() > maximum.x(); }
+    Vector3 center() const { return (minimum + maximum) * 0.5f; }
+    Vector3 size() const { return isEmpty() ? Vector3() : maximum - minimum; }
+
+    void extend(const Vector3 &point);
+    void extend(const BoundingBox &box);
+
+    // Box around the eight transformed corners, exact for scaling and translation
+    BoundingBox transformed(const Affine3x4 &matrix) const;
+};
+
+// Half line from origin along direction. Direction needn't be unit length, distances are measured
+// in multiples of it, so they stay valid when the ray is moved into another space.
+struct Ray
+{
+    Ray() {}
+    Ray(const Vector3 &origin, const Vector3 &direction);
+
+    Vector3 origin;
+    Vector3 direction;
+    Vector3 inverseDirection;
+
+    // Distance where the ray enters the box, or 0 if it starts inside
+    bool intersects(const BoundingBox &box, float maxDistance, float &distance) const;
+    // Both sides count, models aren't guaranteed to be closed
+    bool intersectsTriangle(const Vector3 &a, const Vector3 &b, const Vector3 &c, float &distance) const;
+
+    Ray transformed(const Affine3x4 &matrix) const;
+};
+
+// View volume planes of a projection * view matrix, 16 floats column major like QMatrix4x4 stores them
+class Frustum
+{
+public:
+    enum Containment {
+        Outside,
+        Intersecting,
+        Inside
+    };
+
+    explicit Frustum(const float *viewProjection);
+
+    // Conservative, a box near a corner may pass although it's outside
+    bool intersects(const BoundingBox &box) const;
+    // Also tells apart boxes completely inside, whose contents need no further tests
+    Containment classify(const BoundingBox &box) const;
+
+private:
+    struct Plane {
+        Vector3 normal;         // points inwards
+        float offset;
+    };
+    Plane m_planes[6];
+};
+
+// Bind space boxes of the vertices each bone of each mesh moves, taken once at load. Enough to bound
+// the model in any pose later on, without going through the vertices again.
+struct SkinnedBoxes
+{
+    SkinnedBoxes() : rootTransformation(Affine3x4::identity()) {}
+
+    struct MeshBoxes
+    {
+        QVector<BoundingBox> bones;         // indexed like Mesh::boneNames
+        QVector<Affine3x4> boneOffsets;
+        QVector<int> boneJoints;            // skeleton joint of every bone, -1 if missing
+        BoundingBox unskinned;
+    };
+
+    QHash<const Mesh*, MeshBoxes> meshes;
+    Affine3x4 rootTransformation;           // of the root node when the boxes were taken
+};
+
+// Bounding box computations over the shared vertex arrays of a model.
+// Every mesh's vertices are visited once through its vertex range, large ranges are split across
+// the thread pool and reduced with SSE where available.
+class Bounds
+{
+public:
+    // Box of count xyz positions, optionally transformed first
+    static BoundingBox compute(const float *positions, int count, const Affine3x4 *transformation = 0);
+
+    // Bind pose box of every mesh in its own space
+    static QVector<BoundingBox> meshBounds(const QVector<float> &vertices, const QVector<QSharedPointer<Mesh> > &meshes);
+
+    // Bind pose box of the whole model, every mesh transformed by the nodes it hangs from
+    static BoundingBox nodeBounds(const Node *rootNode, const QVector<float> &vertices);
+
+    // Boxes of the vertices each bone of the mesh influences, in the mesh's bind space and indexed
+    // like Mesh::boneNames. unskinned gets the vertices no bone influences.
+    static QVector<BoundingBox> boneBounds(const Mesh &mesh, const QVector<float> &vertices,
+                                           const QVector<int> &boneIndices, const QVector<float> &boneWeights,
+                                           BoundingBox &unskinned);
+
+    // Bone boxes of every mesh along with the joints and offsets moving them
+    static SkinnedBoxes skinnedBoxes(const Node *rootNode, const QVector<QSharedPointer<Mesh> > &meshes,
+                                     const QVector<float> &vertices,
+                                     const QVector<int> &boneIndices, const QVector<float> &boneWeights);
+
+    // Box of the whole model over every pose one clip of the library can produce, in the space
+    // nodeBounds() had when the boxes were taken. Poses step from key to key, so sampling once
+    // between every pair of key times finds them all. Streamed clips carry their box already.
+    static BoundingBox clipBounds(const Node *rootNode, const SkinnedBoxes &boxes,
+                                  QSharedPointer<ClipLibrary> library, int clip);
+};
+
+#endif // BOUNDS_H
@@ -0,0 +1,265 @@
+#include "cliplibrary.h"
+#include "clipstream.h"
+#include <QDataStream>
+#include <QMutexLocker>
+#include <QtConcurrent>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+
+bool channelLessThan(const ClipChannel &a, const ClipChannel &b)
+{
+    return a.joint < b.joint;
+}
+
+qint64 channelBytes(const ClipChannel &channel)
+{
+    const NodeAnimation &anim = channel.animation;
+    return sizeof(ClipChannel)
+            + anim.positionKeys.size() * sizeof(QPair<double, Vector3>)
+            + anim.rotationKeys.size() * sizeof(QPair<double, Quaternion>)
+            + anim.scalingKeys.size() * sizeof(QPair<double, Vector3>);
+}
+
+}
+
+ClipLibrary::ClipLibrary() :
+    m_memoryBudget(32 * 1024 * 1024)
+  , m_useCounter(0)
+{
+    m_prefetchPool.setMaxThreadCount(1);
+}
+
+void ClipLibrary::setMemoryBudget(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_memoryBudget = bytes;
+    evict(-1);
+}
+
+qint64 ClipLibrary::memoryBudget() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_memoryBudget;
+}
+
+int ClipLibrary::clipCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.size();
+}
+
+int ClipLibrary::addClip(const QVector<ClipChannel> &channels)
+{
+    return addEncodedClip(encode(channels));
+}
+
+int ClipLibrary::addEncodedClip(const QByteArray &encoded)
+{
+    QMutexLocker locker(&m_mutex);
+    Entry entry;
+    entry.encoded = encoded;
+    m_entries.append(entry);
+    m_statistics.encodedBytes += encoded.size();
+    return m_entries.size() - 1;
+}
+
+void ClipLibrary::replaceClip(int clip, const QVector<ClipChannel> &channels)
+{
+    const QByteArray encoded = encode(channels);
+
+    QMutexLocker locker(&m_mutex);
+    Entry &entry = m_entries[clip];
+    m_statistics.encodedBytes += encoded.size() - entry.encoded.size();
+    if (entry.decoded)
+        m_statistics.residentBytes -= entry.decoded->bytes;
+    entry.encoded = encoded;
+    entry.decoded.clear();
+    entry.stream.clear();
+    ++entry.generation;
+}
+
+QByteArray ClipLibrary::encodedClip(int clip) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.value(clip).encoded;
+}
+
+void ClipLibrary::setStreamedClip(int clip, QSharedPointer<StreamedClip> stream)
+{
+    QMutexLocker locker(&m_mutex);
+    Entry &entry = m_entries[clip];
+    m_statistics.encodedBytes -= entry.encoded.size();
+    if (entry.decoded)
+        m_statistics.residentBytes -= entry.decoded->bytes;
+    entry.encoded.clear();
+    entry.decoded.clear();
+    entry.stream = stream;
+    ++entry.generation;
+}
+
+int ClipLibrary::addStreamedClip(QSharedPointer<StreamedClip> stream)
+{
+    QMutexLocker locker(&m_mutex);
+    Entry entry;
+    entry.stream = stream;
+    m_entries.append(entry);
+    return m_entries.size() - 1;
+}
+
+QSharedPointer<StreamedClip> ClipLibrary::streamedClip(int clip) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.value(clip).stream;
+}
+
+QSharedPointer<const AnimationClip> ClipLibrary::clip(int clip)
+{
+    for (;;) {
+        QByteArray encoded;
+        int generation;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (clip < 0 || clip >= m_entries.size())
+                return QSharedPointer<const AnimationClip>();
+
+            Entry &entry = m_entries[clip];
+            if (entry.stream)
+                return QSharedPointer<const AnimationClip>();
+            entry.lastUse = ++m_useCounter;
+            if (entry.decoded) {
+                ++m_statistics.hits;
+                return entry.decoded;
+            }
+            encoded = entry.encoded;
+            generation = entry.generation;
+        }
+
+        // Decode without holding the lock, other clips stay available meanwhile. If the clip was
+        // replaced in between, start over with its new keys.
+        const QSharedPointer<const AnimationClip> decoded = makeResident(clip, generation, decode(encoded));
+        if (decoded)
+            return decoded;
+    }
+}
+
+void ClipLibrary::prefetch(const QVector<int> &clips)
+{
+    QMutexLocker locker(&m_mutex);
+    foreach (int clip, clips) {
+        if (clip < 0 || clip >= m_entries.size() || m_entries[clip].decoded || m_entries[clip].stream)
+            continue;
+
+        ++m_statistics.prefetches;
+        const QByteArray encoded = m_entries[clip].encoded;
+        const int generation = m_entries[clip].generation;
+        QtConcurrent::run(&m_prefetchPool, [this, clip, generation, encoded]() {
+            makeResident(clip, generation, decode(encoded));
+        });
+    }
+}
+
+QSharedPointer<const AnimationClip> ClipLibrary::makeResident(int clip, int generation, QSharedPointer<const AnimationClip> decoded)
+{
+    QMutexLocker locker(&m_mutex);
+    Entry &entry = m_entries[clip];
+
+    // Replaced while decoding, the keys are outdated
+    if (entry.generation != generation)
+        return QSharedPointer<const AnimationClip>();
+
+    // Someone else may have decoded it meanwhile
+    if (entry.decoded)
+        return entry.decoded;
+
+    ++m_statistics.decodes;
+    entry.decoded = decoded;
+    if (entry.lastUse == 0)
+        entry.lastUse = ++m_useCounter;
+    m_statistics.residentBytes += decoded->bytes;
+    evict(clip);
+    return decoded;
+}
+
+void ClipLibrary::evict(int keep)
+{
+    while (m_statistics.residentBytes > m_memoryBudget) {
+        int oldest = -1;
+        for (int ii=0; ii<m_entries.size(); ++ii) {
+            if (ii == keep || !m_entries[ii].decoded)
+                continue;
+            if (oldest == -1 || m_entries[ii].lastUse < m_entries[oldest].lastUse)
+                oldest = ii;
+        }
+        if (oldest == -1)
+            return;
+
+        m_statistics.residentBytes -= m_entries[oldest].decoded->bytes;
+        m_entries[oldest].decoded.clear();
+        ++m_statistics.evictions;
+    }
+}
+
+ClipLibrary::Statistics ClipLibrary::statistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_statistics;
+}
+
+QByteArray ClipLibrary::encode(const QVector<ClipChannel> &channels)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    out << quint32(channels.size());
+    for (int ii=0; ii<channels.size(); ++ii) {
+        const NodeAnimation &anim = channels[ii].animation;
+        out << qint32(channels[ii].joint);
+        out << anim.positionKeys << anim.rotationKeys << anim.scalingKeys;
+        out << qint32(anim.preState) << qint32(anim.postState);
+    }
+    return qCompress(data);
+}
+
+QSharedPointer<AnimationClip> ClipLibrary::decode(const QByteArray &encoded)
+{
+    QSharedPointer<AnimationClip> clip(new AnimationClip);
+    clip->bytes = sizeof(AnimationClip);
+
+    const QByteArray data = qUncompress(encoded);
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    // Joint, three key counts and both states make a channel at least, a corrupt count must not
+    // allocate more channels than the data could hold
+    quint32 count = 0;
+    in >> count;
+    if (in.status() != QDataStream::Ok || qint64(count) * 24 > in.device()->bytesAvailable()) {
+        if (in.status() == QDataStream::Ok)
+            qDebug() << "Error: Corrupt animation clip";
+        count = 0;
+    }
+
+    clip->channels.resize(count);
+    for (quint32 ii=0; ii<count; ++ii) {
+        ClipChannel &channel = clip->channels[ii];
+        qint32 joint, preState, postState;
+        in >> joint;
+        in >> channel.animation.positionKeys >> channel.animation.rotationKeys >> channel.animation.scalingKeys;
+        in >> preState >> postState;
+        channel.joint = joint;
+        channel.animation.preState = AnimState(preState);
+        channel.animation.postState = AnimState(postState);
+        clip->bytes += channelBytes(channel);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        qDebug() << "Error: Corrupt animation clip";
+        clip->channels.clear();
+    }
+
+    std::sort(clip->channels.begin(), clip->channels.end(), channelLessThan);
+    return clip;
+}
@@ -0,0 +1,94 @@
+#ifndef CLIPLIBRARY_H
+#define CLIPLIBRARY_H
+
+#include <QMutex>
+#include <QByteArray>
+#include <QThreadPool>
+#include "modelloader.h"
+
+class StreamedClip;
+
+// Keys of one animated joint. Joints are numbered breadth first, see ModelLoader::flattenNodes.
+struct ClipChannel
+{
+    int joint;
+    NodeAnimation animation;
+};
+
+// Decoded clip, only joints the clip animates have a channel
+struct AnimationClip
+{
+    AnimationClip() : bytes(0) {}
+
+    QVector<ClipChannel> channels;  // sorted by joint
+    qint64 bytes;                   // approximate memory use
+};
+
+// Animation clips of one model. Clips are kept compressed and decoded on first use, decoded clips
+// are evicted least recently used once they exceed the memory budget. Clips handed out stay
+// valid for as long as they are referenced, even after eviction. Long clips can be streamed from
+// disk instead, players read those block by block through a ClipStreamer. All functions are thread
+// safe.
+class ClipLibrary
+{
+public:
+    ClipLibrary();
+
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryBudget() const;
+
+    int clipCount() const;
+    int addClip(const QVector<ClipChannel> &channels);
+    int addEncodedClip(const QByteArray &encoded);
+    void replaceClip(int clip, const QVector<ClipChannel> &channels);
+    QByteArray encodedClip(int clip) const;
+
+    // Replaces the clip's keys with a stream, or adds one
+    void setStreamedClip(int clip, QSharedPointer<StreamedClip> stream);
+    int addStreamedClip(QSharedPointer<StreamedClip> stream);
+    QSharedPointer<StreamedClip> streamedClip(int clip) const;
+
+    // Decodes the clip if it isn't resident, returns null for invalid and streamed clips
+    QSharedPointer<const AnimationClip> clip(int clip);
+
+    // Hint that these clips will be played soon, they are decoded in the background
+    void prefetch(const QVector<int> &clips);
+
+    struct Statistics {
+        Statistics() : decodes(0), hits(0), evictions(0), prefetches(0), residentBytes(0), encodedBytes(0) {}
+        int decodes;
+        int hits;
+        int evictions;
+        int prefetches;
+        qint64 residentBytes;       // decoded clips held by the library
+        qint64 encodedBytes;
+    };
+    Statistics statistics() const;
+
+    static QByteArray encode(const QVector<ClipChannel> &channels);
+    static QSharedPointer<AnimationClip> decode(const QByteArray &encoded);
+
+private:
+    struct Entry {
+        Entry() : lastUse(0), generation(0) {}
+        QByteArray encoded;
+        QSharedPointer<const AnimationClip> decoded;
+        QSharedPointer<StreamedClip> stream;
+        quint64 lastUse;
+        int generation;             // bumped whenever the keys change, decodes of older ones are dropped
+    };
+
+    // Null if the clip changed since the encoded bytes were taken at generation
+    QSharedPointer<const AnimationClip> makeResident(int clip, int generation, QSharedPointer<const AnimationClip> decoded);
+    void evict(int keep);
+
+    mutable QMutex m_mutex;
+    QVector<Entry> m_entries;
+    qint64 m_memoryBudget;
+    quint64 m_useCounter;
+    Statistics m_statistics;
+
+    QThreadPool m_prefetchPool;     // last, so pending prefetches finish before anything else goes
+};
+
+#endif // CLIPLIBRARY_H
@@ -0,0 +1,295 @@
+#include "clipstream.h"
+#include <QDataStream>
+#include <QSaveFile>
+#include <QMutexLocker>
+#include <QtConcurrent>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const quint32 StreamMagic = 0x41334353;     // "A3CS"
+const quint32 StreamVersion = 1;
+
+template <typename T>
+bool keyBefore(const QPair<double, T> &key, double tick)
+{
+    return key.first < tick;
+}
+
+// Keys sampled anywhere in [start, end): the last one before start, or the first key if there is
+// none, followed by the keys inside the range. The last block takes every key to the end.
+template <typename T>
+void sliceKeys(const QVector<QPair<double, T> > &keys, double start, double end, bool lastBlock,
+               QVector<QPair<double, T> > &out)
+{
+    out.clear();
+    if (keys.isEmpty())
+        return;
+
+    const int inside = std::lower_bound(keys.constBegin(), keys.constEnd(), start, keyBefore<T>) - keys.constBegin();
+    const int first = qMax(0, inside - 1);
+    for (int ii=first; ii<keys.size(); ++ii) {
+        if (ii != first && !lastBlock && keys[ii].first >= end)
+            break;
+        out.append(keys[ii]);
+    }
+}
+
+double lastKeyTime(const QVector<ClipChannel> &channels)
+{
+    double last = 0.0;
+    for (int ii=0; ii<channels.size(); ++ii) {
+        const NodeAnimation &anim = channels[ii].animation;
+        if (!anim.positionKeys.isEmpty())
+            last = qMax(last, anim.positionKeys.last().first);
+        if (!anim.rotationKeys.isEmpty())
+            last = qMax(last, anim.rotationKeys.last().first);
+        if (!anim.scalingKeys.isEmpty())
+            last = qMax(last, anim.scalingKeys.last().first);
+    }
+    return last;
+}
+
+}
+
+StreamedClip::StreamedClip() :
+    m_blockTicks(1.0)
+  , m_dataOffset(0)
+  , m_encodedBytes(0)
+{
+
+}
+
+bool StreamedClip::write(const QString &filePath, const QVector<ClipChannel> &channels, double blockTicks,
+                         const BoundingBox &bounds)
+{
+    if (blockTicks <= 0.0)
+        return false;
+
+    // Blocks are encoded like whole clips, so they decode with the library's own decoder
+    const int blockCount = int(std::floor(lastKeyTime(channels) / blockTicks)) + 1;
+    QVector<QByteArray> blocks(blockCount);
+    QVector<ClipChannel> slice(channels.size());
+    for (int ib=0; ib<blockCount; ++ib) {
+        const double start = ib * blockTicks;
+        const double end = start + blockTicks;
+        const bool lastBlock = ib == blockCount - 1;
+        for (int ic=0; ic<channels.size(); ++ic) {
+            const NodeAnimation &anim = channels[ic].animation;
+            slice[ic].joint = channels[ic].joint;
+            slice[ic].animation.preState = anim.preState;
+            slice[ic].animation.postState = anim.postState;
+            sliceKeys(anim.positionKeys, start, end, lastBlock, slice[ic].animation.positionKeys);
+            sliceKeys(anim.rotationKeys, start, end, lastBlock, slice[ic].animation.rotationKeys);
+            sliceKeys(anim.scalingKeys, start, end, lastBlock, slice[ic].animation.scalingKeys);
+        }
+        blocks[ib] = ClipLibrary::encode(slice);
+    }
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Error: Unable to write clip stream" << filePath << file.errorString();
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << StreamMagic << StreamVersion << blockTicks << bounds.minimum << bounds.maximum;
+    out << quint32(blockCount);
+    qint64 offset = 0;
+    for (int ib=0; ib<blockCount; ++ib) {
+        out << offset << quint32(blocks[ib].size());
+        offset += blocks[ib].size();
+    }
+    for (int ib=0; ib<blockCount; ++ib)
+        out.writeRawData(blocks[ib].constData(), blocks[ib].size());
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        qDebug() << "Error: Failed writing clip stream" << filePath;
+        return false;
+    }
+    return true;
+}
+
+bool StreamedClip::open(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Error: Unable to open clip stream" << filePath;
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version, blockCount;
+    in >> magic >> version;
+    if (in.status() != QDataStream::Ok || magic != StreamMagic || version != StreamVersion) {
+        qDebug() << "Error: Not a clip stream" << filePath;
+        return false;
+    }
+
+    // Offset and size of every block, rejected before the table is allocated if they can't fit
+    in >> m_blockTicks >> m_bounds.minimum >> m_bounds.maximum >> blockCount;
+    if (in.status() != QDataStream::Ok || qint64(blockCount) * (8 + 4) > file.size() - file.pos()) {
+        qDebug() << "Error: Corrupt clip stream" << filePath;
+        return false;
+    }
+
+    m_blocks.resize(blockCount);
+    m_encodedBytes = 0;
+    for (quint32 ib=0; ib<blockCount; ++ib) {
+        in >> m_blocks[ib].offset >> m_blocks[ib].size;
+        m_encodedBytes += m_blocks[ib].size;
+    }
+    m_dataOffset = file.pos();
+
+    bool blocksInside = true;
+    for (quint32 ib=0; ib<blockCount; ++ib) {
+        blocksInside = blocksInside && m_blocks[ib].offset >= 0
+                && m_blocks[ib].offset <= m_encodedBytes - m_blocks[ib].size;
+    }
+
+    if (in.status() != QDataStream::Ok || blockCount == 0 || m_blockTicks <= 0.0 || !blocksInside
+            || m_dataOffset + m_encodedBytes > file.size()) {
+        qDebug() << "Error: Corrupt clip stream" << filePath;
+        m_blocks.clear();
+        return false;
+    }
+
+    m_filePath = filePath;
+    return true;
+}
+
+int StreamedClip::blockAt(double tick) const
+{
+    return qBound(0, int(std::floor(tick / m_blockTicks)), m_blocks.size() - 1);
+}
+
+QSharedPointer<AnimationClip> StreamedClip::readBlock(int block) const
+{
+    // Every read opens the file itself, so readers on other threads don't share a position
+    QFile file(m_filePath);
+    QByteArray encoded;
+    if (block >= 0 && block < m_blocks.size() && file.open(QIODevice::ReadOnly)
+            && file.seek(m_dataOffset + m_blocks[block].offset)) {
+        encoded = file.read(m_blocks[block].size);
+    }
+
+    if (encoded.size() != int(m_blocks.value(block).size)) {
+        qDebug() << "Error: Unable to read block" << block << "of clip stream" << m_filePath;
+        return QSharedPointer<AnimationClip>(new AnimationClip);
+    }
+    return ClipLibrary::decode(encoded);
+}
+
+ClipStreamer::ClipStreamer(QSharedPointer<StreamedClip> clip) :
+    m_clip(clip)
+  , m_behind(1)
+  , m_ahead(2)
+  , m_current(-1)
+  , m_direction(1)
+  , m_reads(0)
+{
+    m_reader.setMaxThreadCount(1);
+}
+
+void ClipStreamer::setWindow(int behind, int ahead)
+{
+    m_behind = qMax(0, behind);
+    m_ahead = qMax(0, ahead);
+    if (m_current != -1)
+        updateWindow();
+}
+
+int ClipStreamer::wrap(int block) const
+{
+    const int count = m_clip->blockCount();
+    return ((block % count) + count) % count;
+}
+
+QSharedPointer<const AnimationClip> ClipStreamer::block(double tick)
+{
+    const int index = m_clip->blockAt(tick);
+    const bool moved = index != m_current;
+    if (moved && m_current != -1) {
+        // Looping back to the start still counts as playing forward
+        const bool looped = m_current == m_clip->blockCount() - 1 && index == 0;
+        m_direction = looped || index > m_current ? 1 : -1;
+    }
+    m_current = index;
+
+    collectArrived();
+
+    QSharedPointer<const AnimationClip> current = m_resident.value(index);
+    if (!current) {
+        current = m_clip->readBlock(index);
+        m_resident.insert(index, current);
+        m_statistics.residentBytes += current->bytes;
+        ++m_statistics.stalls;
+    }
+
+    if (moved)
+        updateWindow();
+
+    m_statistics.peakResidentBytes = qMax(m_statistics.peakResidentBytes, m_statistics.residentBytes);
+    return current;
+}
+
+void ClipStreamer::collectArrived()
+{
+    QMap<int, QSharedPointer<const AnimationClip> > arrived;
+    {
+        QMutexLocker locker(&m_mutex);
+        arrived.swap(m_arrived);
+        m_statistics.reads = m_reads;
+    }
+
+    // Blocks that left the window while they were read are dropped right away
+    for (QMap<int, QSharedPointer<const AnimationClip> >::const_iterator it = arrived.constBegin(); it != arrived.constEnd(); ++it) {
+        if (!m_wanted.contains(it.key()) || m_resident.contains(it.key()))
+            continue;
+        m_resident.insert(it.key(), it.value());
+        m_statistics.residentBytes += it.value()->bytes;
+    }
+}
+
+void ClipStreamer::updateWindow()
+{
+    m_wanted.clear();
+    m_wanted.insert(m_current);
+    for (int ii=1; ii<=m_ahead; ++ii)
+        m_wanted.insert(wrap(m_current + ii * m_direction));
+    for (int ii=1; ii<=m_behind; ++ii)
+        m_wanted.insert(wrap(m_current - ii * m_direction));
+
+    QMap<int, QSharedPointer<const AnimationClip> >::iterator it = m_resident.begin();
+    while (it != m_resident.end()) {
+        if (m_wanted.contains(it.key())) {
+            ++it;
+            continue;
+        }
+        m_statistics.residentBytes -= it.value()->bytes;
+        ++m_statistics.evictions;
+        it = m_resident.erase(it);
+    }
+
+    // Nearest first, in the playback direction
+    QMutexLocker locker(&m_mutex);
+    for (int ii=1; ii<=m_ahead; ++ii) {
+        const int block = wrap(m_current + ii * m_direction);
+        if (m_resident.contains(block) || m_pending.contains(block) || m_arrived.contains(block))
+            continue;
+
+        m_pending.insert(block);
+        QSharedPointer<StreamedClip> clip = m_clip;
+        QtConcurrent::run(&m_reader, [this, clip, block]() {
+            QSharedPointer<const AnimationClip> decoded = clip->readBlock(block);
+            QMutexLocker locker(&m_mutex);
+            m_pending.remove(block);
+            m_arrived.insert(block, decoded);
+            ++m_reads;
+        });
+    }
+}
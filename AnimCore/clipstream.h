@@ -0,0 +1,102 @@
+#ifndef CLIPSTREAM_H
+#define CLIPSTREAM_H
+
+#include <QMutex>
+#include <QMap>
+#include <QSet>
+#include <QThreadPool>
+#include "cliplibrary.h"
+#include "bounds.h"
+
+// Long clip kept on disk, split into blocks of a fixed number of ticks. Every block holds all
+// channels of the clip, interleaved, with the keys inside the block plus the last one before it,
+// so a block alone samples exactly like the whole clip at every tick it covers.
+class StreamedClip
+{
+public:
+    StreamedClip();
+
+    static bool write(const QString &filePath, const QVector<ClipChannel> &channels, double blockTicks,
+                      const BoundingBox &bounds);
+
+    // Reads the block table only, blocks are read on demand
+    bool open(const QString &filePath);
+    QString filePath() const { return m_filePath; }
+
+    int blockCount() const { return m_blocks.size(); }
+    double blockTicks() const { return m_blockTicks; }
+    int blockAt(double tick) const;
+    qint64 encodedBytes() const { return m_encodedBytes; }
+
+    // Of every pose of the clip, computed when the stream was written
+    const BoundingBox &bounds() const { return m_bounds; }
+
+    // Reads and decodes one block, safe to call from any thread
+    QSharedPointer<AnimationClip> readBlock(int block) const;
+
+private:
+    struct Block {
+        qint64 offset;
+        quint32 size;
+    };
+
+    QString m_filePath;
+    double m_blockTicks;
+    BoundingBox m_bounds;
+    QVector<Block> m_blocks;
+    qint64 m_dataOffset;                // where the first block starts
+    qint64 m_encodedBytes;
+};
+
+// Sliding window of decoded blocks around the playhead of one player. A background reader keeps
+// the blocks ahead in the playback direction coming, blocks that fall out of the window are let go,
+// so resident memory depends on the window and block length only, not on the length of the clip.
+// Not thread safe, block() is called by the thread playing the clip.
+class ClipStreamer
+{
+public:
+    explicit ClipStreamer(QSharedPointer<StreamedClip> clip);
+
+    QSharedPointer<StreamedClip> clip() const { return m_clip; }
+
+    // Blocks kept behind and read ahead of the current one. Playback loops, so reading ahead
+    // continues at the start of the clip.
+    void setWindow(int behind, int ahead);
+
+    // Block covering the tick. If the reader doesn't have it yet it's read right away, a stall.
+    QSharedPointer<const AnimationClip> block(double tick);
+
+    struct Statistics {
+        Statistics() : reads(0), stalls(0), evictions(0), residentBytes(0), peakResidentBytes(0) {}
+        int reads;                  // by the background reader
+        int stalls;                 // blocks the player had to wait for
+        int evictions;
+        qint64 residentBytes;
+        qint64 peakResidentBytes;
+    };
+    Statistics statistics() const { return m_statistics; }
+
+private:
+    void collectArrived();
+    void updateWindow();
+    int wrap(int block) const;
+
+    QSharedPointer<StreamedClip> m_clip;
+    int m_behind;
+    int m_ahead;
+    int m_current;
+    int m_direction;                                    // 1 forward, -1 backward
+
+    QMap<int, QSharedPointer<const AnimationClip> > m_resident;
+    QSet<int> m_wanted;
+    Statistics m_statistics;
+
+    QMutex m_mutex;                                     // guards the members shared with the reader
+    QMap<int, QSharedPointer<const AnimationClip> > m_arrived;
+    QSet<int> m_pending;
+    int m_reads;
+
+    QThreadPool m_reader;           // last, so pending reads finish before anything else goes
+};
+
+#endif // CLIPSTREAM_H
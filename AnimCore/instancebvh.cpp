@@ -0,0 +1,198 @@
+#include "instancebvh.h"
+#include <algorithm>
+
+namespace {
+
+// Refitted trees get built again once their inner nodes cover this much more area than when built
+const float RebuildRatio = 2.0f;
+
+float surfaceArea(const BoundingBox &box)
+{
+    if (box.isEmpty())
+        return 0.0f;
+    const Vector3 size = box.size();
+    return 2.0f * (size.x() * size.y() + size.y() * size.z() + size.z() * size.x());
+}
+
+bool sameBox(const BoundingBox &a, const BoundingBox &b)
+{
+    return a.minimum == b.minimum && a.maximum == b.maximum;
+}
+
+struct CenterLessThan
+{
+    CenterLessThan(const QVector<BoundingBox> &boxes, int axis) : boxes(boxes), axis(axis) {}
+    bool operator()(int a, int b) const
+    {
+        return boxes[a].minimum[axis] + boxes[a].maximum[axis] < boxes[b].minimum[axis] + boxes[b].maximum[axis];
+    }
+    const QVector<BoundingBox> &boxes;
+    int axis;
+};
+
+}
+
+InstanceBvh::InstanceBvh() :
+    m_area(0.0f)
+  , m_builtArea(0.0f)
+{
+
+}
+
+void InstanceBvh::clear()
+{
+    m_nodes.clear();
+    m_leaves.clear();
+    m_area = 0.0f;
+    m_builtArea = 0.0f;
+}
+
+void InstanceBvh::update(const QVector<BoundingBox> &boxes)
+{
+    if (boxes.size() != m_leaves.size()) {
+        build(boxes);
+        return;
+    }
+
+    // Compared through the const array first, so a tree shared with a packet in flight is only
+    // copied when something actually moved
+    QVector<int> changed;
+    const Node *nodes = m_nodes.constData();
+    for (int ii=0; ii<boxes.size(); ++ii) {
+        if (!sameBox(nodes[m_leaves[ii]].box, boxes[ii]))
+            changed.append(ii);
+    }
+    if (changed.isEmpty())
+        return;
+
+    for (int ii=0; ii<changed.size(); ++ii)
+        m_nodes[m_leaves[changed[ii]]].box = boxes[changed[ii]];
+
+    if (changed.size() > boxes.size() / 4) {
+        // Children are stored after their parents, one backwards pass fixes every inner node
+        for (int in=m_nodes.size()-1; in>=0; --in) {
+            if (m_nodes[in].instance == -1)
+                refitNode(in);
+        }
+    }
+    else {
+        // Paths stop where a box didn't change, everything above it is still right
+        for (int ii=0; ii<changed.size(); ++ii) {
+            int node = m_nodes[m_leaves[changed[ii]]].parent;
+            while (node != -1) {
+                const BoundingBox before = m_nodes[node].box;
+                refitNode(node);
+                if (sameBox(before, m_nodes[node].box))
+                    break;
+                node = m_nodes[node].parent;
+            }
+        }
+    }
+
+    ++m_statistics.refits;
+    m_statistics.refittedLeaves += changed.size();
+
+    if (m_area > RebuildRatio * m_builtArea)
+        build(boxes);
+}
+
+void InstanceBvh::refitNode(int node)
+{
+    Node &parent = m_nodes[node];
+    BoundingBox box = m_nodes[node + 1].box;
+    box.extend(m_nodes[parent.right].box);
+    m_area += surfaceArea(box) - surfaceArea(parent.box);
+    parent.box = box;
+}
+
+void InstanceBvh::build(const QVector<BoundingBox> &boxes)
+{
+    clear();
+    if (boxes.isEmpty())
+        return;
+
+    QVector<int> instances(boxes.size());
+    for (int ii=0; ii<instances.size(); ++ii)
+        instances[ii] = ii;
+
+    m_nodes.reserve(2 * boxes.size() - 1);
+    m_leaves.resize(boxes.size());
+    buildRange(instances.data(), instances.data() + instances.size(), -1, boxes);
+
+    m_builtArea = m_area;
+    ++m_statistics.builds;
+}
+
+int InstanceBvh::buildRange(int *first, int *last, int parent, const QVector<BoundingBox> &boxes)
+{
+    const int index = m_nodes.size();
+    Node node;
+    node.parent = parent;
+    node.right = -1;
+    node.instance = -1;
+    m_nodes.append(node);
+
+    if (last - first == 1) {
+        m_nodes[index].box = boxes[*first];
+        m_nodes[index].instance = *first;
+        m_nodes[index].end = index + 1;
+        m_leaves[*first] = index;
+        return index;
+    }
+
+    // Halves along the longest axis of the box centers, which keeps the tree balanced
+    BoundingBox centers;
+    for (int *it=first; it!=last; ++it)
+        centers.extend(boxes[*it].center());
+    const Vector3 size = centers.size();
+    const int axis = size.x() >= size.y() && size.x() >= size.z() ? 0 : (size.y() >= size.z() ? 1 : 2);
+
+    int *middle = first + (last - first) / 2;
+    std::nth_element(first, middle, last, CenterLessThan(boxes, axis));
+
+    buildRange(first, middle, index, boxes);
+    const int right = buildRange(middle, last, index, boxes);
+
+    m_nodes[index].right = right;
+    m_nodes[index].end = m_nodes.size();
+    m_nodes[index].box = m_nodes[index + 1].box;
+    m_nodes[index].box.extend(m_nodes[right].box);
+    m_area += surfaceArea(m_nodes[index].box);
+    return index;
+}
+
+int InstanceBvh::cull(const Frustum &frustum, QVector<int> &visible) const
+{
+    visible.clear();
+    if (m_nodes.isEmpty())
+        return 0;
+
+    int tests = 0;
+    QVarLengthArray<int, 64> stack;
+    stack.append(0);
+    while (!stack.isEmpty()) {
+        const int index = stack.last();
+        stack.removeLast();
+
+        const Node &node = m_nodes[index];
+        ++tests;
+        const Frustum::Containment containment = frustum.classify(node.box);
+        if (containment == Frustum::Outside)
+            continue;
+
+        if (containment == Frustum::Inside || node.instance != -1) {
+            for (int ii=index; ii<node.end; ++ii) {
+                if (m_nodes[ii].instance != -1)
+                    visible.append(m_nodes[ii].instance);
+            }
+            continue;
+        }
+
+        stack.append(node.right);
+        stack.append(index + 1);
+    }
+
+    // Same order as the instances, so what's drawn doesn't depend on the shape of the tree
+    std::sort(visible.begin(), visible.end());
+    return tests;
+}
@@ -0,0 +1,107 @@
+#ifndef INSTANCEBVH_H
+#define INSTANCEBVH_H
+
+#include <QVector>
+#include <QVarLengthArray>
+#include <QPair>
+#include "bounds.h"
+
+// Bounding volume hierarchy over the boxes of every instance, so culling and ray queries visit a
+// number of nodes that grows with the log of the instance count instead of every instance.
+// It's built top down once and after that only refitted as instances move, the boxes of leaves
+// that changed are widened up to the root. Once refitting has loosened the tree too much it's
+// built again. Copies share their nodes until one of them is updated, like the Qt containers.
+class InstanceBvh
+{
+public:
+    InstanceBvh();
+
+    void update(const QVector<BoundingBox> &boxes);
+    void clear();
+
+    int instanceCount() const { return m_leaves.size(); }
+    BoundingBox instanceBox(int instance) const { return m_nodes.value(m_leaves.value(instance, -1)).box; }
+
+    // Instances intersecting the frustum, in ascending order. Subtrees completely inside aren't
+    // tested any further. Returns the number of boxes tested.
+    int cull(const Frustum &frustum, QVector<int> &visible) const;
+
+    // Visits the instances whose box the ray hits, nearest boxes first. hit(instance, maxDistance)
+    // returns the distance of a finer hit inside the box, or a negative one for none, and boxes
+    // behind the nearest hit so far are skipped. Returns the nearest hit, negative without any.
+    template <typename HitFunction>
+    float raycast(const Ray &ray, float maxDistance, HitFunction hit) const;
+
+    struct Statistics {
+        Statistics() : builds(0), refits(0), refittedLeaves(0) {}
+        int builds;
+        int refits;             // updates that only moved boxes
+        int refittedLeaves;     // summed over the refits
+    };
+    Statistics statistics() const { return m_statistics; }
+    qint64 bytes() const { return m_nodes.capacity() * sizeof(Node) + m_leaves.capacity() * sizeof(int); }
+
+private:
+    // Stored depth first, so the left child follows its parent and every subtree is a range
+    struct Node {
+        BoundingBox box;
+        int parent;
+        int right;
+        int end;            // one past the last node of the subtree
+        int instance;       // leaves only, -1 for inner nodes
+    };
+
+    void build(const QVector<BoundingBox> &boxes);
+    int buildRange(int *first, int *last, int parent, const QVector<BoundingBox> &boxes);
+    void refitNode(int node);
+
+    QVector<Node> m_nodes;
+    QVector<int> m_leaves;              // node of every instance
+    float m_area;                       // summed over inner nodes, grows as the tree loosens
+    float m_builtArea;
+    Statistics m_statistics;
+};
+
+template <typename HitFunction>
+float InstanceBvh::raycast(const Ray &ray, float maxDistance, HitFunction hit) const
+{
+    float nearest = -1.0f;
+    float entry;
+    if (m_nodes.isEmpty() || !ray.intersects(m_nodes[0].box, maxDistance, entry))
+        return nearest;
+
+    QVarLengthArray<QPair<int, float>, 64> stack;
+    stack.append(qMakePair(0, entry));
+    while (!stack.isEmpty()) {
+        const QPair<int, float> top = stack.last();
+        stack.removeLast();
+        if (top.second > maxDistance)
+            continue;
+
+        const Node &node = m_nodes[top.first];
+        if (node.instance != -1) {
+            const float distance = hit(node.instance, maxDistance);
+            if (distance >= 0.0f && distance <= maxDistance) {
+                maxDistance = distance;
+                nearest = distance;
+            }
+            continue;
+        }
+
+        const int children[2] = { top.first + 1, node.right };
+        float distances[2] = { FLT_MAX, FLT_MAX };
+        bool hits[2];
+        for (int ii=0; ii<2; ++ii)
+            hits[ii] = ray.intersects(m_nodes[children[ii]].box, maxDistance, distances[ii]);
+
+        // The nearer child goes on top
+        const int nearer = distances[0] <= distances[1] ? 0 : 1;
+        if (hits[1 - nearer])
+            stack.append(qMakePair(children[1 - nearer], distances[1 - nearer]));
+        if (hits[nearer])
+            stack.append(qMakePair(children[nearer], distances[nearer]));
+    }
+    return nearest;
+}
+
+#endif // INSTANCEBVH_H
@@ -0,0 +1,149 @@
+#include "mathtypes.h"
+
+Affine3x4 Affine3x4::identity()
+{
+    Affine3x4 affine = {{ 1.0f, 0.0f, 0.0f, 0.0f,
+                          0.0f, 1.0f, 0.0f, 0.0f,
+                          0.0f, 0.0f, 1.0f, 0.0f }};
+    return affine;
+}
+
+Affine3x4 Affine3x4::fromTrs(const Vector3 &translation, const Quaternion &rotation, const Vector3 &scaling)
+{
+    // Same terms as the pose kernels, see PoseKernels::composeTrs()
+    const float x = rotation.x(), y = rotation.y(), z = rotation.z(), w = rotation.scalar();
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float xw = x * w, yw = y * w, zw = z * w;
+    const float sx = scaling.x(), sy = scaling.y(), sz = scaling.z();
+
+    Affine3x4 affine;
+    float *m = affine.m;
+    m[0] = (1.0f - 2.0f * (yy + zz)) * sx;
+    m[1] = 2.0f * (xy - zw) * sy;
+    m[2] = 2.0f * (xz + yw) * sz;
+    m[3] = translation.x();
+    m[4] = 2.0f * (xy + zw) * sx;
+    m[5] = (1.0f - 2.0f * (xx + zz)) * sy;
+    m[6] = 2.0f * (yz - xw) * sz;
+    m[7] = translation.y();
+    m[8] = 2.0f * (xz - yw) * sx;
+    m[9] = 2.0f * (yz + xw) * sy;
+    m[10] = (1.0f - 2.0f * (xx + yy)) * sz;
+    m[11] = translation.z();
+    return affine;
+}
+
+Vector3 Affine3x4::map(const Vector3 &point) const
+{
+    return Vector3(m[0] * point.x() + m[1] * point.y() + m[2] * point.z() + m[3],
+                   m[4] * point.x() + m[5] * point.y() + m[6] * point.z() + m[7],
+                   m[8] * point.x() + m[9] * point.y() + m[10] * point.z() + m[11]);
+}
+
+Vector3 Affine3x4::mapVector(const Vector3 &vector) const
+{
+    return Vector3(m[0] * vector.x() + m[1] * vector.y() + m[2] * vector.z(),
+                   m[4] * vector.x() + m[5] * vector.y() + m[6] * vector.z(),
+                   m[8] * vector.x() + m[9] * vector.y() + m[10] * vector.z());
+}
+
+Affine3x4 Affine3x4::inverted(bool *invertible) const
+{
+    // Adjugate of the 3x3 part, the translation is moved back through the inverse
+    const float a = m[0], b = m[1], c = m[2];
+    const float d = m[4], e = m[5], f = m[6];
+    const float g = m[8], h = m[9], i = m[10];
+    const float c00 = e * i - f * h, c01 = c * h - b * i, c02 = b * f - c * e;
+    const float c10 = f * g - d * i, c11 = a * i - c * g, c12 = c * d - a * f;
+    const float c20 = d * h - e * g, c21 = b * g - a * h, c22 = a * e - b * d;
+
+    const float determinant = a * c00 + b * c10 + c * c20;
+    if (invertible)
+        *invertible = determinant != 0.0f;
+    if (determinant == 0.0f)
+        return identity();
+
+    const float r = 1.0f / determinant;
+    Affine3x4 inverse = {{ c00 * r, c01 * r, c02 * r, 0.0f,
+                           c10 * r, c11 * r, c12 * r, 0.0f,
+                           c20 * r, c21 * r, c22 * r, 0.0f }};
+    const Vector3 translation = inverse.mapVector(Vector3(m[3], m[7], m[11]));
+    inverse.m[3] = -translation.x();
+    inverse.m[7] = -translation.y();
+    inverse.m[11] = -translation.z();
+    return inverse;
+}
+
+Affine3x4 Affine3x4::operator*(const Affine3x4 &other) const
+{
+    Affine3x4 r;
+    for (int row=0; row<3; ++row) {
+        const float *ar = m + row * 4;
+        for (int col=0; col<4; ++col)
+            r.m[row * 4 + col] = ar[0] * other.m[col] + ar[1] * other.m[4 + col] + ar[2] * other.m[8 + col];
+        r.m[row * 4 + 3] += ar[3];
+    }
+    return r;
+}
+
+QDataStream &operator<<(QDataStream &out, const Vector3 &vector)
+{
+    out << vector.x() << vector.y() << vector.z();
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, Vector3 &vector)
+{
+    float x, y, z;
+    in >> x >> y >> z;
+    vector = Vector3(x, y, z);
+    return in;
+}
+
+QDataStream &operator<<(QDataStream &out, const Quaternion &quaternion)
+{
+    out << quaternion.scalar() << quaternion.x() << quaternion.y() << quaternion.z();
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, Quaternion &quaternion)
+{
+    float scalar, x, y, z;
+    in >> scalar >> x >> y >> z;
+    quaternion = Quaternion(scalar, x, y, z);
+    return in;
+}
+
+QDataStream &operator<<(QDataStream &out, const Affine3x4 &affine)
+{
+    for (int ii=0; ii<12; ++ii)
+        out << affine.m[ii];
+    out << 0.0f << 0.0f << 0.0f << 1.0f;
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, Affine3x4 &affine)
+{
+    float bottom;
+    for (int ii=0; ii<12; ++ii)
+        in >> affine.m[ii];
+    for (int ii=0; ii<4; ++ii)
+        in >> bottom;
+    return in;
+}
+
+QDebug operator<<(QDebug debug, const Vector3 &vector)
+{
+    QDebugStateSaver saver(debug);
+    debug.nospace() << "Vector3(" << vector.x() << ", " << vector.y() << ", " << vector.z() << ')';
+    return debug;
+}
+
+QDebug operator<<(QDebug debug, const Quaternion &quaternion)
+{
+    QDebugStateSaver saver(debug);
+    debug.nospace() << "Quaternion(scalar:" << quaternion.scalar() << ", vector:(" << quaternion.x() << ", "
+                    << quaternion.y() << ", " << quaternion.z() << "))";
+    return debug;
+}
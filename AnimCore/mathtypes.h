@@ -0,0 +1,110 @@
+#ifndef MATHTYPES_H
+#define MATHTYPES_H
+
+#include <QDataStream>
+#include <QDebug>
+#include <cmath>
+
+// Vector, quaternion and affine transformation types of the library, so it only needs QtCore.
+// They stream exactly like QVector3D, QQuaternion and QMatrix4x4, assets and clips written
+// before read back unchanged. qtconversions.h converts from and to the QtGui types.
+
+class Vector3
+{
+public:
+    Vector3() { v[0] = v[1] = v[2] = 0.0f; }
+    Vector3(float x, float y, float z) { v[0] = x; v[1] = y; v[2] = z; }
+
+    float x() const { return v[0]; }
+    float y() const { return v[1]; }
+    float z() const { return v[2]; }
+    void setX(float x) { v[0] = x; }
+    void setY(float y) { v[1] = y; }
+    void setZ(float z) { v[2] = z; }
+
+    float operator[](int i) const { return v[i]; }
+    float &operator[](int i) { return v[i]; }
+
+    float length() const { return std::sqrt(dotProduct(*this, *this)); }
+
+    Vector3 &operator+=(const Vector3 &o) { v[0] += o.v[0]; v[1] += o.v[1]; v[2] += o.v[2]; return *this; }
+    Vector3 &operator-=(const Vector3 &o) { v[0] -= o.v[0]; v[1] -= o.v[1]; v[2] -= o.v[2]; return *this; }
+    Vector3 &operator*=(float f) { v[0] *= f; v[1] *= f; v[2] *= f; return *this; }
+    Vector3 &operator/=(float f) { v[0] /= f; v[1] /= f; v[2] /= f; return *this; }
+
+    static float dotProduct(const Vector3 &a, const Vector3 &b) { return a.v[0]*b.v[0] + a.v[1]*b.v[1] + a.v[2]*b.v[2]; }
+    static Vector3 crossProduct(const Vector3 &a, const Vector3 &b)
+    {
+        return Vector3(a.v[1]*b.v[2] - a.v[2]*b.v[1], a.v[2]*b.v[0] - a.v[0]*b.v[2], a.v[0]*b.v[1] - a.v[1]*b.v[0]);
+    }
+
+private:
+    float v[3];
+};
+
+Q_DECLARE_TYPEINFO(Vector3, Q_PRIMITIVE_TYPE);
+
+inline Vector3 operator+(Vector3 a, const Vector3 &b) { return a += b; }
+inline Vector3 operator-(Vector3 a, const Vector3 &b) { return a -= b; }
+inline Vector3 operator-(const Vector3 &a) { return Vector3(-a.x(), -a.y(), -a.z()); }
+inline Vector3 operator*(Vector3 a, float f) { return a *= f; }
+inline Vector3 operator*(float f, Vector3 a) { return a *= f; }
+inline Vector3 operator/(Vector3 a, float f) { return a /= f; }
+inline bool operator==(const Vector3 &a, const Vector3 &b) { return a.x() == b.x() && a.y() == b.y() && a.z() == b.z(); }
+inline bool operator!=(const Vector3 &a, const Vector3 &b) { return !(a == b); }
+
+// Rotation as scalar and vector part, the identity by default
+class Quaternion
+{
+public:
+    Quaternion() : s(1.0f), v(0.0f, 0.0f, 0.0f) {}
+    Quaternion(float scalar, float x, float y, float z) : s(scalar), v(x, y, z) {}
+
+    float scalar() const { return s; }
+    float x() const { return v.x(); }
+    float y() const { return v.y(); }
+    float z() const { return v.z(); }
+    Vector3 vector() const { return v; }
+
+private:
+    float s;
+    Vector3 v;
+};
+
+Q_DECLARE_TYPEINFO(Quaternion, Q_MOVABLE_TYPE);
+
+inline bool operator==(const Quaternion &a, const Quaternion &b) { return a.scalar() == b.scalar() && a.vector() == b.vector(); }
+inline bool operator!=(const Quaternion &a, const Quaternion &b) { return !(a == b); }
+
+// Affine transformation stored as the top three rows of a 4x4 matrix, row major.
+// The bottom row is always (0, 0, 0, 1). Left uninitialized like the arrays the kernels fill.
+struct Affine3x4
+{
+    float m[12];
+
+    static Affine3x4 identity();
+    // translate(translation) * rotate(rotation) * scale(scaling), as QMatrix4x4 builds it
+    static Affine3x4 fromTrs(const Vector3 &translation, const Quaternion &rotation, const Vector3 &scaling);
+
+    Vector3 map(const Vector3 &point) const;
+    Vector3 mapVector(const Vector3 &vector) const;     // without the translation
+    // The identity when the matrix can't be inverted
+    Affine3x4 inverted(bool *invertible = 0) const;
+
+    Affine3x4 operator*(const Affine3x4 &other) const;
+};
+
+Q_DECLARE_TYPEINFO(Affine3x4, Q_PRIMITIVE_TYPE);
+
+QDataStream &operator<<(QDataStream &out, const Vector3 &vector);
+QDataStream &operator>>(QDataStream &in, Vector3 &vector);
+QDataStream &operator<<(QDataStream &out, const Quaternion &quaternion);
+QDataStream &operator>>(QDataStream &in, Quaternion &quaternion);
+// All four rows, the bottom one is ignored when reading
+QDataStream &operator<<(QDataStream &out, const Affine3x4 &affine);
+QDataStream &operator>>(QDataStream &in, Affine3x4 &affine);
+
+QDebug operator<<(QDebug debug, const Vector3 &vector);
+QDebug operator<<(QDebug debug, const Quaternion &quaternion);
+
+#endif // MATHTYPES_H
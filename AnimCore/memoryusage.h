@@ -0,0 +1,28 @@
+#ifndef MEMORYUSAGE_H
+#define MEMORYUSAGE_H
+
+#include <QtGlobal>
+
+// Bytes held for an asset, by category. Data shared between assets counts toward each of them.
+struct MemoryUsage
+{
+    MemoryUsage() : cpuGeometry(0), cpuAnimation(0), gpuBuffers(0), textures(0) {}
+
+    qint64 cpuGeometry;     // vertex, index and mesh arrays kept by the ModelLoader
+    qint64 cpuAnimation;    // encoded clips plus the decoded ones currently resident
+    qint64 gpuBuffers;      // vertex and index buffers
+    qint64 textures;        // texture memory, baked animation textures included
+
+    qint64 total() const { return cpuGeometry + cpuAnimation + gpuBuffers + textures; }
+
+    MemoryUsage &operator+=(const MemoryUsage &other)
+    {
+        cpuGeometry += other.cpuGeometry;
+        cpuAnimation += other.cpuAnimation;
+        gpuBuffers += other.gpuBuffers;
+        textures += other.textures;
+        return *this;
+    }
+};
+
+#endif // MEMORYUSAGE_H
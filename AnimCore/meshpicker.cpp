@@ -0,0 +1,190 @@
+#include "meshpicker.h"
+#include "modelloader.h"
+#include <QHash>
+#include <algorithm>
+
+namespace {
+
+const int BonesPerVertex = 4;
+
+struct Candidate
+{
+    float distance;
+    int group;
+    bool operator<(const Candidate &other) const { return distance < other.distance; }
+};
+
+}
+
+void MeshPicker::clear()
+{
+    m_groups.clear();
+    m_meshIndexOffsets.clear();
+    m_vertices.clear();
+    m_indices.clear();
+    m_boneIndices.clear();
+    m_boneWeights.clear();
+}
+
+void MeshPicker::build(const QVector<QSharedPointer<Mesh> > &meshes, const QVector<float> &vertices,
+                       const QVector<unsigned int> &indices, const QVector<int> &boneIndices,
+                       const QVector<float> &boneWeights)
+{
+    clear();
+    if (vertices.isEmpty() || indices.isEmpty())
+        return;
+
+    m_vertices = vertices;
+    m_indices = indices;
+    const bool hasBoneData = boneIndices.size() == vertices.size() / 3 * BonesPerVertex
+            && boneWeights.size() == boneIndices.size();
+    if (hasBoneData) {
+        m_boneIndices = boneIndices;
+        m_boneWeights = boneWeights;
+    }
+
+    m_meshIndexOffsets.resize(meshes.size());
+    for (int im=0; im<meshes.size(); ++im) {
+        const Mesh &mesh = *meshes[im];
+        m_meshIndexOffsets[im] = mesh.indexOffset;
+        if (mesh.indexOffset + mesh.indexCount > uint(indices.size()))
+            continue;
+
+        QHash<int, int> groupOfBone;
+        for (unsigned int ii=mesh.indexOffset; ii+2<mesh.indexOffset+mesh.indexCount; ii+=3) {
+            // Weights of the three corners summed per bone
+            int bones[3 * BonesPerVertex];
+            float weights[3 * BonesPerVertex];
+            int boneCount = 0;
+            bool unmoved = false;
+            for (int ic=0; ic<3; ++ic) {
+                const unsigned int vertex = indices[ii + ic];
+                bool skinned = false;
+                for (int ib=0; hasBoneData && ib<BonesPerVertex; ++ib) {
+                    const int bone = boneIndices[vertex * BonesPerVertex + ib];
+                    const float weight = boneWeights[vertex * BonesPerVertex + ib];
+                    if (bone < 0 || bone >= mesh.boneNames.size() || weight <= 0.0f)
+                        continue;
+                    skinned = true;
+                    int slot = 0;
+                    while (slot < boneCount && bones[slot] != bone)
+                        ++slot;
+                    if (slot == boneCount) {
+                        bones[boneCount] = bone;
+                        weights[boneCount++] = 0.0f;
+                    }
+                    weights[slot] += weight;
+                }
+                unmoved = unmoved || !skinned;
+            }
+
+            int dominant = -1;
+            for (int ib=0; ib<boneCount; ++ib) {
+                if (dominant == -1 || weights[ib] > weights[dominant])
+                    dominant = ib;
+            }
+            const int bone = dominant == -1 ? -1 : bones[dominant];
+
+            if (!groupOfBone.contains(bone)) {
+                groupOfBone.insert(bone, m_groups.size());
+                Group group;
+                group.mesh = im;
+                group.bone = bone;
+                m_groups.append(group);
+            }
+            Group &group = m_groups[groupOfBone.value(bone)];
+            group.triangles.append(ii);
+            for (int ic=0; ic<3; ++ic) {
+                const unsigned int vertex = indices[ii + ic];
+                group.box.extend(Vector3(vertices[vertex * 3], vertices[vertex * 3 + 1], vertices[vertex * 3 + 2]));
+            }
+            for (int ib=0; ib<boneCount; ++ib) {
+                if (!group.bones.contains(bones[ib]))
+                    group.bones.append(bones[ib]);
+            }
+            if (unmoved && !group.bones.contains(-1))
+                group.bones.append(-1);
+        }
+    }
+}
+
+BoundingBox MeshPicker::posedBox(const Group &group, const QVector<Affine3x4> &palette) const
+{
+    if (palette.isEmpty())
+        return group.box;
+
+    // Skinned vertices are weighted averages of the vertex moved by each of its bones, so they stay
+    // within the box around the group's box moved by all of them
+    BoundingBox box;
+    for (int ii=0; ii<group.bones.size(); ++ii) {
+        const int bone = group.bones[ii];
+        box.extend(bone == -1 ? group.box : group.box.transformed(palette.value(bone, Affine3x4::identity())));
+    }
+    return box;
+}
+
+Vector3 MeshPicker::skinnedPosition(unsigned int vertex, const QVector<Affine3x4> &palette) const
+{
+    const Vector3 position(m_vertices[vertex * 3], m_vertices[vertex * 3 + 1], m_vertices[vertex * 3 + 2]);
+    if (palette.isEmpty() || m_boneIndices.isEmpty())
+        return position;
+
+    // Same blend as the vertex shader, vertices without weights stay where they are
+    Vector3 skinned;
+    float total = 0.0f;
+    for (int ib=0; ib<BonesPerVertex; ++ib) {
+        const int bone = m_boneIndices[vertex * BonesPerVertex + ib];
+        const float weight = m_boneWeights[vertex * BonesPerVertex + ib];
+        if (bone < 0 || bone >= palette.size() || weight <= 0.0f)
+            continue;
+        skinned += weight * palette[bone].map(position);
+        total += weight;
+    }
+    return total > 0.0f ? skinned : position;
+}
+
+bool MeshPicker::intersect(const Ray &ray, const QVector<QVector<Affine3x4> > &palettes, float maxDistance, Hit &hit) const
+{
+    QVector<Candidate> candidates;
+    for (int ig=0; ig<m_groups.size(); ++ig) {
+        Candidate candidate;
+        candidate.group = ig;
+        const Group &group = m_groups[ig];
+        if (ray.intersects(posedBox(group, palettes.value(group.mesh)), maxDistance, candidate.distance))
+            candidates.append(candidate);
+    }
+
+    // Nearest volume first, triangles of volumes behind the nearest hit are never skinned
+    std::sort(candidates.begin(), candidates.end());
+    bool found = false;
+    for (int ic=0; ic<candidates.size() && candidates[ic].distance <= maxDistance; ++ic) {
+        const Group &group = m_groups[candidates[ic].group];
+        const QVector<Affine3x4> palette = palettes.value(group.mesh);
+        for (int it=0; it<group.triangles.size(); ++it) {
+            const int first = group.triangles[it];
+            const Vector3 a = skinnedPosition(m_indices[first], palette);
+            const Vector3 b = skinnedPosition(m_indices[first + 1], palette);
+            const Vector3 c = skinnedPosition(m_indices[first + 2], palette);
+
+            float distance;
+            if (!ray.intersectsTriangle(a, b, c, distance) || distance > maxDistance)
+                continue;
+
+            maxDistance = distance;
+            hit.mesh = group.mesh;
+            hit.bone = group.bone;
+            hit.triangle = (first - m_meshIndexOffsets[group.mesh]) / 3;
+            hit.distance = distance;
+            found = true;
+        }
+    }
+    return found;
+}
+
+qint64 MeshPicker::bytes() const
+{
+    qint64 bytes = m_groups.capacity() * sizeof(Group);
+    for (int ii=0; ii<m_groups.size(); ++ii)
+        bytes += m_groups[ii].triangles.capacity() * sizeof(int) + m_groups[ii].bones.capacity() * sizeof(int);
+    return bytes;
+}
@@ -0,0 +1,61 @@
+#ifndef MESHPICKER_H
+#define MESHPICKER_H
+
+#include <QVector>
+#include <QSharedPointer>
+#include "bounds.h"
+
+struct Mesh;
+
+// Ray queries against the triangles of a skinned model in any pose. Triangles are grouped by the
+// bone weighing most on them, and every group keeps its box in bind space along with the bones
+// moving its vertices. Posed, the group can't leave the union of its box moved by each of those
+// bones, so a query only skins the triangles of groups whose posed box the ray passes through.
+class MeshPicker
+{
+public:
+    struct Hit {
+        Hit() : mesh(-1), bone(-1), triangle(-1), distance(-1.0f) {}
+        int mesh;
+        int bone;           // index into the mesh's boneNames, -1 for unskinned triangles
+        int triangle;       // within the mesh's full index range
+        float distance;     // along the ray
+    };
+
+    MeshPicker() {}
+
+    // Arrays as kept by the ModelLoader, empty ones leave the picker empty
+    void build(const QVector<QSharedPointer<Mesh> > &meshes, const QVector<float> &vertices,
+               const QVector<unsigned int> &indices, const QVector<int> &boneIndices,
+               const QVector<float> &boneWeights);
+    void clear();
+    bool isEmpty() const { return m_groups.isEmpty(); }
+
+    // Ray in the space the palettes map into, palettes as in FramePacket::palettes. Without any
+    // palettes the bind pose is hit. Blend shapes aren't taken into account.
+    bool intersect(const Ray &ray, const QVector<QVector<Affine3x4> > &palettes, float maxDistance, Hit &hit) const;
+
+    // Triangle lists only, the geometry is shared with the ModelLoader
+    qint64 bytes() const;
+
+private:
+    struct Group {
+        int mesh;
+        int bone;
+        BoundingBox box;                // bind space
+        QVector<int> bones;             // moving some vertex, -1 for vertices staying in place
+        QVector<int> triangles;         // first index of each
+    };
+
+    BoundingBox posedBox(const Group &group, const QVector<Affine3x4> &palette) const;
+    Vector3 skinnedPosition(unsigned int vertex, const QVector<Affine3x4> &palette) const;
+
+    QVector<Group> m_groups;
+    QVector<unsigned int> m_meshIndexOffsets;
+    QVector<float> m_vertices;
+    QVector<unsigned int> m_indices;
+    QVector<int> m_boneIndices;
+    QVector<float> m_boneWeights;
+};
+
+#endif // MESHPICKER_H
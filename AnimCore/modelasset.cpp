@@ -0,0 +1,574 @@
+#include "modelasset.h"
+#include "modelloader.h"
+#include "cliplibrary.h"
+#include "clipstream.h"
+#include "skinweights.h"
+#include <QDataStream>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDebug>
+#include <cmath>
+
+static const quint32 AssetMagic = 0x4133444D; // 'A3DM'
+static const quint32 AssetVersion = 4;
+static const int MaxNodeDepth = 256;   // deeper hierarchies are taken as corrupt, readNode() recurses
+
+namespace {
+
+// Large arrays are written as raw host data, the header records the byte order they were written in
+template <typename T>
+void writeArray(QDataStream &out, const QVector<T> &array)
+{
+    out << quint32(array.size());
+    out.writeRawData(reinterpret_cast<const char*>(array.constData()), array.size() * sizeof(T));
+}
+
+// Whether count elements of at least elementBytes each can still follow, so corrupt counts are
+// rejected before anything gets allocated for them
+bool fitsRemaining(QDataStream &in, quint32 count, qint64 elementBytes)
+{
+    return in.device() && qint64(count) * elementBytes <= in.device()->bytesAvailable();
+}
+
+template <typename T>
+bool readArray(QDataStream &in, QVector<T> &array)
+{
+    quint32 size = 0;
+    in >> size;
+    if (in.status() != QDataStream::Ok)
+        return false;
+    if (!fitsRemaining(in, size, sizeof(T))) {
+        qDebug() << "Error: Array of" << size << "elements exceeds the asset";
+        return false;
+    }
+
+    array.resize(size);
+    const qint64 bytes = qint64(size) * sizeof(T);
+    return in.readRawData(reinterpret_cast<char*>(array.data()), bytes) == bytes;
+}
+
+void writeMorphTargets(QDataStream &out, const QVector<MorphTarget> &targets)
+{
+    out << quint32(targets.size());
+    for (int ii=0; ii<targets.size(); ++ii) {
+        const MorphTarget &target = targets[ii];
+        out << target.name << target.defaultWeight << target.positionScale << target.normalScale;
+        writeArray(out, target.vertices);
+        writeArray(out, target.positionDeltas);
+        writeArray(out, target.normalDeltas);
+    }
+}
+
+bool readMorphTargets(QDataStream &in, int vertexCount, QVector<MorphTarget> &targets)
+{
+    quint32 count = 0;
+    in >> count;
+    // Name, weight, scales and the three array sizes at least
+    if (in.status() != QDataStream::Ok || !fitsRemaining(in, count, 28))
+        return false;
+
+    targets.resize(count);
+    bool ok = true;
+    for (quint32 ii=0; ok && ii<count; ++ii) {
+        MorphTarget &target = targets[ii];
+        in >> target.name >> target.defaultWeight >> target.positionScale >> target.normalScale;
+        ok = readArray(in, target.vertices) && readArray(in, target.positionDeltas) && readArray(in, target.normalDeltas);
+        ok = ok && target.positionDeltas.size() == target.vertices.size() * 4
+                && (target.normalDeltas.isEmpty() || target.normalDeltas.size() == target.vertices.size() * 4);
+
+        // Ascending and inside the mesh, the deformer relies on both
+        for (int iv=0; ok && iv<target.vertices.size(); ++iv) {
+            ok = target.vertices[iv] < quint32(vertexCount)
+                    && (iv == 0 || target.vertices[iv - 1] < target.vertices[iv]);
+        }
+    }
+    return ok;
+}
+
+void writeMorphChannels(QDataStream &out, const QVector<MorphChannel> &channels)
+{
+    out << quint32(channels.size());
+    for (int ic=0; ic<channels.size(); ++ic) {
+        out << qint32(channels[ic].mesh) << quint32(channels[ic].keys.size());
+        for (int ik=0; ik<channels[ic].keys.size(); ++ik) {
+            const MorphKey &key = channels[ic].keys[ik];
+            out << key.time;
+            writeArray(out, key.weights);
+        }
+    }
+}
+
+// Channels may only refer to meshes and targets read before them
+bool readMorphChannels(QDataStream &in, const QVector<QSharedPointer<Mesh> > &meshes, QVector<MorphChannel> &channels)
+{
+    quint32 count = 0;
+    in >> count;
+    // Mesh and key count at least
+    if (in.status() != QDataStream::Ok || !fitsRemaining(in, count, 8))
+        return false;
+
+    channels.resize(count);
+    bool ok = true;
+    for (quint32 ic=0; ok && ic<count; ++ic) {
+        qint32 mesh;
+        quint32 keyCount;
+        in >> mesh >> keyCount;
+        // Time and weight count at least
+        ok = in.status() == QDataStream::Ok && mesh >= 0 && mesh < meshes.size()
+                && fitsRemaining(in, keyCount, 12);
+        if (!ok)
+            break;
+
+        channels[ic].mesh = mesh;
+        channels[ic].keys.resize(keyCount);
+        const int targetCount = meshes[mesh]->morphTargets.size();
+        for (quint32 ik=0; ok && ik<keyCount; ++ik) {
+            in >> channels[ic].keys[ik].time;
+            ok = readArray(in, channels[ic].keys[ik].weights);
+
+            const QVector<MorphWeight> &weights = channels[ic].keys[ik].weights;
+            for (int iw=0; ok && iw<weights.size(); ++iw)
+                ok = weights[iw].target >= 0 && weights[iw].target < targetCount;
+        }
+    }
+    return ok;
+}
+
+void writeQuantizedNormals(QDataStream &out, const QVector<float> &normals)
+{
+    QVector<qint16> quantized(normals.size());
+    for (int ii=0; ii<normals.size(); ++ii)
+        quantized[ii] = qint16(qRound(qBound(-1.0f, normals[ii], 1.0f) * 32767.0f));
+    writeArray(out, quantized);
+}
+
+bool readQuantizedNormals(QDataStream &in, QVector<float> &normals)
+{
+    QVector<qint16> quantized;
+    if (!readArray(in, quantized))
+        return false;
+
+    normals.resize(quantized.size());
+    for (int ii=0; ii<quantized.size(); ++ii)
+        normals[ii] = quantized[ii] / 32767.0f;
+    return true;
+}
+
+void writeQuantizedPositions(QDataStream &out, const QVector<float> &positions)
+{
+    Vector3 minimum(0.0f, 0.0f, 0.0f);
+    Vector3 maximum(0.0f, 0.0f, 0.0f);
+    if (!positions.isEmpty()) {
+        minimum = maximum = Vector3(positions[0], positions[1], positions[2]);
+        for (int ii=0; ii<positions.size(); ii+=3) {
+            for (int ic=0; ic<3; ++ic) {
+                minimum[ic] = qMin(minimum[ic], positions[ii+ic]);
+                maximum[ic] = qMax(maximum[ic], positions[ii+ic]);
+            }
+        }
+    }
+    out << minimum << maximum;
+
+    Vector3 extent = maximum - minimum;
+    QVector<quint16> quantized(positions.size());
+    for (int ii=0; ii<positions.size(); ++ii) {
+        const float range = extent[ii % 3];
+        const float normalized = range > 0.0f ? (positions[ii] - minimum[ii % 3]) / range : 0.0f;
+        quantized[ii] = quint16(qRound(normalized * 65535.0f));
+    }
+    writeArray(out, quantized);
+}
+
+bool readQuantizedPositions(QDataStream &in, QVector<float> &positions)
+{
+    Vector3 minimum, maximum;
+    in >> minimum >> maximum;
+
+    QVector<quint16> quantized;
+    if (!readArray(in, quantized))
+        return false;
+
+    Vector3 extent = maximum - minimum;
+    positions.resize(quantized.size());
+    for (int ii=0; ii<quantized.size(); ++ii)
+        positions[ii] = minimum[ii % 3] + (quantized[ii] / 65535.0f) * extent[ii % 3];
+    return true;
+}
+
+void writeNode(QDataStream &out, const Node &node, const QVector<QSharedPointer<Mesh> > &meshes)
+{
+    out << node.name << node.transformation;
+
+    out << quint32(node.meshes.size());
+    for (int ii=0; ii<node.meshes.size(); ++ii)
+        out << qint32(meshes.indexOf(node.meshes[ii]));
+
+    out << quint32(node.nodes.size());
+    for (int ii=0; ii<node.nodes.size(); ++ii)
+        writeNode(out, node.nodes[ii], meshes);
+}
+
+bool readNode(QDataStream &in, Node &node, const QVector<QSharedPointer<Mesh> > &meshes, int depth)
+{
+    if (depth > MaxNodeDepth)
+        return false;
+
+    quint32 count;
+    in >> node.name >> node.transformation;
+
+    in >> count;
+    if (in.status() != QDataStream::Ok || !fitsRemaining(in, count, 4))
+        return false;
+    node.meshes.resize(count);
+    for (quint32 ii=0; ii<count; ++ii) {
+        qint32 meshIndex;
+        in >> meshIndex;
+        if (meshIndex < 0 || meshIndex >= meshes.size())
+            return false;
+        node.meshes[ii] = meshes[meshIndex];
+    }
+
+    // Name, transformation and both counts at least
+    in >> count;
+    if (in.status() != QDataStream::Ok || !fitsRemaining(in, count, 76))
+        return false;
+    node.nodes.resize(count);
+    for (quint32 ii=0; ii<count; ++ii) {
+        if (!readNode(in, node.nodes[ii], meshes, depth + 1))
+            return false;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+bool readHeader(QDataStream &in, QByteArray &sourceHash, qint32 &flags)
+{
+    quint32 magic, version;
+    quint8 littleEndian;
+    in >> magic >> version >> littleEndian;
+    if (in.status() != QDataStream::Ok || magic != AssetMagic || version != AssetVersion)
+        return false;
+
+    // Raw arrays are in the byte order of the machine that converted the asset
+    if (bool(littleEndian) != (Q_BYTE_ORDER == Q_LITTLE_ENDIAN))
+        return false;
+
+    in >> sourceHash >> flags;
+    return in.status() == QDataStream::Ok;
+}
+
+}
+
+bool ModelAsset::isAssetFile(QString filePath)
+{
+    return QFileInfo(filePath).suffix().toLower() == fileSuffix();
+}
+
+bool ModelAsset::write(const ModelLoader &model, QString filePath, QByteArray sourceHash, int flags)
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Error: Unable to write asset" << filePath << file.errorString();
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    out << AssetMagic << AssetVersion << quint8(Q_BYTE_ORDER == Q_LITTLE_ENDIAN);
+    out << sourceHash << qint32(flags);
+
+    // Materials
+    out << quint32(model.m_materials.size());
+    for (int ii=0; ii<model.m_materials.size(); ++ii) {
+        const MaterialInfo &mater = *model.m_materials[ii];
+        out << mater.Name << mater.Ambient << mater.Diffuse << mater.Specular << mater.Shininess;
+    }
+
+    // Meshes
+    out << quint32(model.m_meshes.size());
+    for (int ii=0; ii<model.m_meshes.size(); ++ii) {
+        const Mesh &mesh = *model.m_meshes[ii];
+        out << mesh.name << mesh.indexCount << mesh.indexOffset << mesh.vertexCount << mesh.vertexOffset;
+        out << qint32(model.m_materials.indexOf(mesh.material));
+        out << mesh.boneOffsets << mesh.boneNames;
+        out << quint32(mesh.lods.size());
+        for (int il=0; il<mesh.lods.size(); ++il)
+            out << mesh.lods[il].indexCount << mesh.lods[il].indexOffset;
+        writeMorphTargets(out, mesh.morphTargets);
+    }
+
+    // Vertex buffers
+    if (flags & QuantizePositions)
+        writeQuantizedPositions(out, model.m_vertices);
+    else
+        writeArray(out, model.m_vertices);
+
+    if (flags & QuantizeNormals) {
+        writeQuantizedNormals(out, model.m_normals);
+        writeQuantizedNormals(out, model.m_tangents);
+        writeQuantizedNormals(out, model.m_bitangents);
+    }
+    else {
+        writeArray(out, model.m_normals);
+        writeArray(out, model.m_tangents);
+        writeArray(out, model.m_bitangents);
+    }
+
+    writeArray(out, model.m_indices);
+
+    out << quint32(model.m_textureUV.size());
+    for (int ii=0; ii<model.m_textureUV.size(); ++ii)
+        writeArray(out, model.m_textureUV[ii]);
+    writeArray(out, model.m_textureUVComponents);
+
+    writeArray(out, model.m_vertexBoneIndices);
+    writeArray(out, model.m_vertexBoneWeights);
+
+    // Node hierarchy and animations
+    out << bool(model.m_rootNode);
+    if (model.m_rootNode)
+        writeNode(out, *model.m_rootNode, model.m_meshes);
+
+    out << quint32(model.m_animations.size());
+    for (int ii=0; ii<model.m_animations.size(); ++ii) {
+        const Animation &anim = *model.m_animations[ii];
+        out << anim.name << anim.duration << anim.ticksPerSecond;
+
+        // Clips stay in the library's compressed form, they are only decoded when played.
+        // Streamed clips are referenced by the name of their stream next to the asset.
+        const QSharedPointer<StreamedClip> stream = model.m_clipLibrary->streamedClip(ii);
+        out << (stream ? QFileInfo(stream->filePath()).fileName() : QString());
+        out << model.m_clipLibrary->encodedClip(ii);
+        writeMorphChannels(out, model.morphChannels(ii));
+    }
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        qDebug() << "Error: Failed writing asset" << filePath;
+        return false;
+    }
+    return true;
+}
+
+bool ModelAsset::read(ModelLoader &model, QString filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Error: Unable to open asset" << filePath;
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    QByteArray sourceHash;
+    qint32 flags;
+    if (!readHeader(in, sourceHash, flags)) {
+        qDebug() << "Error: Not a valid asset file" << filePath;
+        return false;
+    }
+
+    quint32 count;
+
+    // Materials, name and ten floats at least
+    in >> count;
+    if (in.status() != QDataStream::Ok || !fitsRemaining(in, count, 44)) {
+        qDebug() << "Error: Corrupt materials in asset" << filePath;
+        return false;
+    }
+    model.m_materials.resize(count);
+    for (quint32 ii=0; ii<count; ++ii) {
+        QSharedPointer<MaterialInfo> mater(new MaterialInfo);
+        in >> mater->Name >> mater->Ambient >> mater->Diffuse >> mater->Specular >> mater->Shininess;
+        model.m_materials[ii] = mater;
+    }
+
+    // Meshes, name, ranges, material and the four counts at least
+    in >> count;
+    if (in.status() != QDataStream::Ok || !fitsRemaining(in, count, 40)) {
+        qDebug() << "Error: Corrupt meshes in asset" << filePath;
+        return false;
+    }
+    model.m_meshes.resize(count);
+    for (quint32 ii=0; ii<count; ++ii) {
+        QSharedPointer<Mesh> mesh(new Mesh);
+        qint32 materialIndex;
+        quint32 lodCount;
+        in >> mesh->name >> mesh->indexCount >> mesh->indexOffset >> mesh->vertexCount >> mesh->vertexOffset;
+        in >> materialIndex;
+        in >> mesh->boneOffsets >> mesh->boneNames;
+        in >> lodCount;
+        if (in.status() != QDataStream::Ok || materialIndex < 0 || materialIndex >= model.m_materials.size()
+                || !fitsRemaining(in, lodCount, 8)) {
+            qDebug() << "Error: Corrupt mesh in asset" << filePath;
+            return false;
+        }
+        mesh->lods.resize(lodCount);
+        for (quint32 il=0; il<lodCount; ++il)
+            in >> mesh->lods[il].indexCount >> mesh->lods[il].indexOffset;
+        if (!readMorphTargets(in, mesh->vertexCount, mesh->morphTargets)) {
+            qDebug() << "Error: Corrupt morph targets in asset" << filePath;
+            return false;
+        }
+        mesh->material = model.m_materials[materialIndex];
+        model.m_meshes[ii] = mesh;
+    }
+
+    // Vertex buffers
+    bool ok = (flags & QuantizePositions) ? readQuantizedPositions(in, model.m_vertices)
+                                          : readArray(in, model.m_vertices);
+
+    if (flags & QuantizeNormals) {
+        ok = ok && readQuantizedNormals(in, model.m_normals);
+        ok = ok && readQuantizedNormals(in, model.m_tangents);
+        ok = ok && readQuantizedNormals(in, model.m_bitangents);
+    }
+    else {
+        ok = ok && readArray(in, model.m_normals);
+        ok = ok && readArray(in, model.m_tangents);
+        ok = ok && readArray(in, model.m_bitangents);
+    }
+
+    ok = ok && readArray(in, model.m_indices);
+
+    in >> count;
+    ok = ok && in.status() == QDataStream::Ok && fitsRemaining(in, count, 4);
+    model.m_textureUV.resize(ok ? count : 0);
+    for (quint32 ii=0; ok && ii<count; ++ii)
+        ok = readArray(in, model.m_textureUV[ii]);
+    ok = ok && readArray(in, model.m_textureUVComponents);
+
+    ok = ok && readArray(in, model.m_vertexBoneIndices);
+    ok = ok && readArray(in, model.m_vertexBoneWeights);
+
+    if (!ok || !validGeometry(model)) {
+        qDebug() << "Error: Corrupt vertex data in asset" << filePath;
+        return false;
+    }
+
+    // Node hierarchy and animations
+    bool hasRootNode;
+    in >> hasRootNode;
+    if (!hasRootNode) {
+        qDebug() << "Error loading model";
+        return false;
+    }
+
+    QSharedPointer<Node> rootNode(new Node);
+    if (!readNode(in, *rootNode, model.m_meshes, 0)) {
+        qDebug() << "Error: Corrupt node hierarchy in asset" << filePath;
+        return false;
+    }
+    model.m_rootNode = rootNode;
+
+    // Name, duration, rate, stream file, clip and morph channel count at least
+    in >> count;
+    if (in.status() != QDataStream::Ok || !fitsRemaining(in, count, 32)) {
+        qDebug() << "Error: Corrupt animations in asset" << filePath;
+        return false;
+    }
+    model.m_animations.resize(count);
+    model.m_morphAnimations.resize(count);
+    for (quint32 ii=0; ii<count; ++ii) {
+        QSharedPointer<Animation> anim(new Animation);
+        QByteArray encodedClip;
+        QString streamFile;
+        in >> anim->name >> anim->duration >> anim->ticksPerSecond;
+        in >> streamFile >> encodedClip;
+        if (!readMorphChannels(in, model.m_meshes, model.m_morphAnimations[ii])) {
+            qDebug() << "Error: Corrupt morph animation in asset" << filePath;
+            return false;
+        }
+        model.m_animations[ii] = anim;
+        if (streamFile.isEmpty()) {
+            model.m_clipLibrary->addEncodedClip(encodedClip);
+            continue;
+        }
+
+        QSharedPointer<StreamedClip> stream(new StreamedClip);
+        if (!stream->open(QFileInfo(filePath).absoluteDir().filePath(streamFile))) {
+            qDebug() << "Error: Missing clip stream of asset" << filePath;
+            return false;
+        }
+        model.m_clipLibrary->addStreamedClip(stream);
+    }
+
+    return in.status() == QDataStream::Ok;
+}
+
+bool ModelAsset::validGeometry(const ModelLoader &model)
+{
+    if (model.m_vertices.size() % 3 != 0)
+        return false;
+    const qint64 vertexCount = model.m_vertices.size() / 3;
+
+    // Every attribute is either missing or there for every vertex
+    const QVector<float> *attributes[] = { &model.m_normals, &model.m_tangents, &model.m_bitangents };
+    for (int ii=0; ii<3; ++ii) {
+        if (!attributes[ii]->isEmpty() && attributes[ii]->size() != model.m_vertices.size())
+            return false;
+    }
+    if (model.m_textureUVComponents.size() != model.m_textureUV.size())
+        return false;
+    for (int ich=0; ich<model.m_textureUV.size(); ++ich) {
+        const unsigned int components = model.m_textureUVComponents[ich];
+        const qint64 floatsPerVertex = components > 2 ? 3 : (components > 1 ? 2 : 1);
+        if (model.m_textureUV[ich].size() != vertexCount * floatsPerVertex)
+            return false;
+    }
+
+    const bool hasBones = !model.m_vertexBoneIndices.isEmpty() || !model.m_vertexBoneWeights.isEmpty();
+    if (hasBones && (model.m_vertexBoneIndices.size() != vertexCount * SkinWeights::MaxInfluences
+                     || model.m_vertexBoneWeights.size() != vertexCount * SkinWeights::MaxInfluences))
+        return false;
+
+    for (int im=0; im<model.m_meshes.size(); ++im) {
+        const Mesh &mesh = *model.m_meshes[im];
+        const qint64 firstVertex = mesh.vertexOffset;
+        const qint64 endVertex = firstVertex + mesh.vertexCount;
+        if (endVertex > vertexCount || mesh.boneOffsets.size() != mesh.boneNames.size())
+            return false;
+
+        // Indices of the full mesh and of every LOD stay inside the mesh's own vertices
+        QVector<MeshLod> ranges = mesh.lods;
+        const MeshLod full = { mesh.indexCount, mesh.indexOffset };
+        ranges.append(full);
+        for (int ir=0; ir<ranges.size(); ++ir) {
+            if (qint64(ranges[ir].indexOffset) + ranges[ir].indexCount > model.m_indices.size())
+                return false;
+            const unsigned int *indices = model.m_indices.constData() + ranges[ir].indexOffset;
+            for (unsigned int ii=0; ii<ranges[ir].indexCount; ++ii) {
+                if (indices[ii] < firstVertex || indices[ii] >= endVertex)
+                    return false;
+            }
+        }
+
+        // Unused slots hold -1, or bone 0 without weight once normalized
+        if (!hasBones)
+            continue;
+        const int boneCount = mesh.boneNames.size();
+        const int *boneIndices = model.m_vertexBoneIndices.constData() + firstVertex * SkinWeights::MaxInfluences;
+        const float *boneWeights = model.m_vertexBoneWeights.constData() + firstVertex * SkinWeights::MaxInfluences;
+        for (qint64 ii=0; ii<qint64(mesh.vertexCount) * SkinWeights::MaxInfluences; ++ii) {
+            const bool unused = boneIndices[ii] == -1 || (boneIndices[ii] == 0 && boneWeights[ii] == 0.0f);
+            if (!unused && (boneIndices[ii] < 0 || boneIndices[ii] >= boneCount))
+                return false;
+        }
+    }
+    return true;
+}
+
+QByteArray ModelAsset::readSourceHash(QString filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    QByteArray sourceHash;
+    qint32 flags;
+    if (!readHeader(in, sourceHash, flags))
+        return QByteArray();
+    return sourceHash;
+}
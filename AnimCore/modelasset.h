@@ -0,0 +1,34 @@
+#ifndef MODELASSET_H
+#define MODELASSET_H
+
+#include <QString>
+#include <QByteArray>
+
+class ModelLoader;
+
+// Binary runtime asset written by the offline converter. ModelLoader::Load reads these
+// directly, so a converted model loads without going through Assimp.
+class ModelAsset
+{
+public:
+    enum Flags {
+        NoFlags           = 0x0,
+        QuantizePositions = 0x1,    // positions stored as 16 bit fixed point inside the model bounds
+        QuantizeNormals   = 0x2     // normals, tangents and bitangents stored as 16 bit snorm
+    };
+
+    static QString fileSuffix() { return "a3dm"; }
+    static bool isAssetFile(QString filePath);
+
+    static bool write(const ModelLoader &model, QString filePath, QByteArray sourceHash, int flags);
+    static bool read(ModelLoader &model, QString filePath);
+
+    // Hash of the source file and options the asset was built from, empty if there is no valid asset
+    static QByteArray readSourceHash(QString filePath);
+
+private:
+    // Ranges, indices and attribute sizes agree with each other, so nothing reads past an array
+    static bool validGeometry(const ModelLoader &model);
+};
+
+#endif // MODELASSET_H
@@ -0,0 +1,1051 @@
+#include "modelloader.h"
+#include "modelasset.h"
+#include "cliplibrary.h"
+#include "skinweights.h"
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <assimp/Importer.hpp>
+#include <QDebug>
+#include <QtConcurrent>
+#include <QElapsedTimer>
+#include <set>
+
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+#define MAX_BONES_PER_VERTEX 4
+
+ImportProfile::ImportProfile(int attributes) :
+    attributes(attributes)
+{
+    if (has(Tangents))
+        this->attributes |= Normals | TextureCoordinates;
+    if (has(AllTextureChannels))
+        this->attributes |= TextureCoordinates;
+}
+
+bool ImportProfile::fromName(const QString &name, ImportProfile &profile)
+{
+    if (name == "full")
+        profile = ImportProfile(Full);
+    else if (name == "rendering")
+        profile = rendering();
+    else if (name == "static")
+        profile = staticShading();
+    else if (name == "skinning")
+        profile = skinningOnly();
+    else
+        return false;
+    return true;
+}
+
+unsigned int ImportProfile::postProcessSteps() const
+{
+    unsigned int steps = aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType;
+    if (has(Normals))
+        steps |= aiProcess_GenSmoothNormals;
+    if (has(Tangents))
+        steps |= aiProcess_CalcTangentSpace;
+    if (has(Skinning))
+        steps |= aiProcess_LimitBoneWeights;
+    if (removedComponents() != 0)
+        steps |= aiProcess_RemoveComponent;
+    return steps;
+}
+
+int ImportProfile::removedComponents() const
+{
+    // Vertex colors are never loaded
+    int components = aiComponent_COLORS;
+    if (!has(Normals))
+        components |= aiComponent_NORMALS;
+    if (!has(Tangents))
+        components |= aiComponent_TANGENTS_AND_BITANGENTS;
+    if (!has(TextureCoordinates)) {
+        components |= aiComponent_TEXCOORDS;
+    }
+    else if (!has(AllTextureChannels)) {
+        for (int ich=1; ich<AI_MAX_NUMBER_OF_TEXTURECOORDS; ++ich)
+            components |= aiComponent_TEXCOORDSn(ich);
+    }
+    if (!has(Skinning))
+        components |= aiComponent_BONEWEIGHTS;
+    if (!has(Animations))
+        components |= aiComponent_ANIMATIONS;
+    return components;
+}
+
+ModelLoader::ModelLoader() :
+      m_nodeHierarchyLevel(0)
+    , m_transformToUnitCoordinates(false)
+    , m_geometryReleased(false)
+    , m_clipLibrary(new ClipLibrary)
+    , m_unitTransformation(Affine3x4::identity())
+{
+
+}
+
+// Index of the last key before tick, or the first key if there is none
+template <typename T>
+static int keyIndexAt(const QVector<QPair<double, T> > &keys, double tick)
+{
+    int low = 0, high = keys.size();
+    while (low < high) {
+        const int mid = (low + high) / 2;
+        if (keys[mid].first < tick)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return qMax(0, low - 1);
+}
+
+Affine3x4 NodeAnimation::transformationAt(double tick) const
+{
+    Vector3 position, scaling;
+    Quaternion rotation;
+    sampleAt(tick, position, rotation, scaling);
+    return Affine3x4::fromTrs(position, rotation, scaling);
+}
+
+void NodeAnimation::sampleAt(double tick, Vector3 &position, Quaternion &rotation, Vector3 &scaling) const
+{
+    position = positionKeys.size() > 0 ? positionKeys[keyIndexAt(positionKeys, tick)].second : Vector3();
+    rotation = rotationKeys.size() > 0 ? rotationKeys[keyIndexAt(rotationKeys, tick)].second : Quaternion();
+    scaling = scalingKeys.size() > 0 ? scalingKeys[keyIndexAt(scalingKeys, tick)].second : Vector3(1.0f, 1.0f, 1.0f);
+}
+
+// Assimp matrices are row major too, the bottom row is dropped
+static Affine3x4 toAffine(const aiMatrix4x4 &matrix)
+{
+    const Affine3x4 affine = {{ matrix.a1, matrix.a2, matrix.a3, matrix.a4,
+                                matrix.b1, matrix.b2, matrix.b3, matrix.b4,
+                                matrix.c1, matrix.c2, matrix.c3, matrix.c4 }};
+    return affine;
+}
+
+// look for file using relative path
+QString findFile(QString relativeFilePath, int scanDepth)
+{
+    QString str = relativeFilePath;
+    for(int ii=-1; ii<scanDepth; ++ii)
+    {
+        if(QFile::exists(str))
+        {
+            return str;
+        }
+        str.prepend("../");
+    }
+    return "";
+}
+
+// Peak resident set size of the whole process, -1 where it isn't available
+static qint64 peakResidentBytes()
+{
+#if defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#if defined(Q_OS_MAC)
+    return usage.ru_maxrss;
+#else
+    return qint64(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return -1;
+#endif
+}
+
+QString ModelLoader::resolveFilePath(QString filePath, PathType pathType)
+{
+    if (pathType == RelativePath)
+        return findFile(filePath, 5);
+    return filePath;
+}
+
+void ModelLoader::flattenNodes(const Node *rootNode, QVector<const Node*> &nodes,
+                               QVector<int> *parents, QVector<int> *levels)
+{
+    nodes.clear();
+    if (parents)
+        parents->clear();
+    if (levels)
+        levels->clear();
+    if (!rootNode)
+        return;
+
+    nodes.append(rootNode);
+    if (parents)
+        parents->append(-1);
+
+    // Each level is a contiguous range whose parents all come before it
+    int levelBegin = 0;
+    while (levelBegin < nodes.size()) {
+        const int levelEnd = nodes.size();
+        if (levels)
+            levels->append(levelBegin);
+        for (int ii=levelBegin; ii<levelEnd; ++ii) {
+            const Node *node = nodes[ii];
+            for (int ic=0; ic<node->nodes.size(); ++ic) {
+                nodes.append(&node->nodes[ic]);
+                if (parents)
+                    parents->append(ii);
+            }
+        }
+        levelBegin = levelEnd;
+    }
+    if (levels)
+        levels->append(nodes.size());
+}
+
+template <typename T>
+void ModelLoader::presize(QVector<T> &array, int size)
+{
+    array.resize(size);
+    m_statistics.allocationCount += 1;
+    m_statistics.allocatedBytes += qint64(size) * sizeof(T);
+}
+
+bool ModelLoader::Load(QString filePath, PathType pathType)
+{
+    QElapsedTimer timer;
+    timer.start();
+    m_statistics = LoadStatistics();
+
+    const bool loaded = importFile(filePath, pathType);
+
+    m_statistics.loadMs = timer.elapsed();
+    m_statistics.peakResidentBytes = peakResidentBytes();
+    if (loaded) {
+        qDebug() << "Load statistics:" << m_statistics.loadMs << "ms,"
+                 << m_statistics.allocationCount << "allocations,"
+                 << m_statistics.allocatedBytes / 1024 << "KB allocated, peak resident"
+                 << m_statistics.peakResidentBytes / 1024 << "KB";
+    }
+    return loaded;
+}
+
+bool ModelLoader::importFile(QString filePath, PathType pathType)
+{
+    QString l_filePath = resolveFilePath(filePath, pathType);
+
+    // Runtime assets written by the offline converter skip the Assimp import entirely
+    if (ModelAsset::isAssetFile(l_filePath)) {
+        if (!ModelAsset::read(*this, l_filePath))
+            return false;
+
+        applyProfile();
+        prepareSkinning();
+        computeBounds();
+        if (m_transformToUnitCoordinates)
+            transformToUnitCoordinates();
+        return true;
+    }
+
+    Assimp::Importer importer;
+
+    importer.SetPropertyInteger(AI_CONFIG_PP_LBW_MAX_WEIGHTS, MAX_BONES_PER_VERTEX);
+    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, m_profile.removedComponents());
+
+    const aiScene* scene = importer.ReadFile( l_filePath.toStdString(), m_profile.postProcessSteps() );
+
+    if( !scene)
+    {
+        qDebug() << "Error loading file: (assimp:) " << importer.GetErrorString();
+        return false;
+    }
+
+    if(scene->HasMaterials())
+    {
+        presize(m_materials, scene->mNumMaterials);
+        for(unsigned int ii=0; ii<scene->mNumMaterials; ++ii)
+        {
+            m_materials[ii] = processMaterial(scene->mMaterials[ii]);
+            m_statistics.allocationCount += 1;
+            m_statistics.allocatedBytes += sizeof(MaterialInfo);
+        }
+    }
+
+    if(scene->HasMeshes())
+    {
+        // Reserve every mesh's range in the shared arrays first, then fill them one mesh per task.
+        // The ranges don't overlap, so the result is the same whatever order the tasks run in.
+        QVector<MeshLayout> layouts = layoutMeshes(scene);
+        presize(m_meshes, scene->mNumMeshes);
+        QSharedPointer<Mesh> *meshes = m_meshes.data();
+        const MeshBuffers buffers = meshBuffers();
+
+        QVector<unsigned int> meshIndices(scene->mNumMeshes);
+        for(unsigned int ii=0; ii<scene->mNumMeshes; ++ii)
+            meshIndices[ii] = ii;
+
+        QtConcurrent::blockingMap(meshIndices, [&](unsigned int ii) {
+            meshes[ii] = processMesh(scene->mMeshes[ii], layouts[ii], buffers);
+        });
+    }
+    else
+    {
+        qDebug() << "Error: No meshes found";
+        return false;
+    }
+
+    if(scene->HasLights())
+    {
+        qDebug() << "Has Lights";
+    }
+
+    if(scene->mRootNode != NULL)
+    {
+        aiNode *aiRootNode = findRootNode(scene->mRootNode);
+        QString nodename = aiRootNode->mName.length != 0 ? aiRootNode->mName.C_Str() : "";
+        qDebug() << "RootNode Is" << nodename;
+        qDebug() << aiRootNode;
+        Node *rootNode = new Node;
+        m_statistics.allocationCount += 1;
+        m_statistics.allocatedBytes += sizeof(Node);
+        m_nodeHierarchyLevel = 0;
+
+        processNode(scene, aiRootNode, 0, *rootNode);
+        m_rootNode.reset(rootNode);
+    }
+    else
+    {
+        qDebug() << "Error loading model";
+        return false;
+    }
+
+    if (scene->HasAnimations() && m_profile.has(ImportProfile::Animations)) {
+        qDebug() << "Num Animations" << scene->mNumAnimations;
+
+        // Channels are bound to joint indices, every node with the channel's name gets it,
+        // as names aren't guaranteed to be unique
+        QVector<const Node*> joints;
+        flattenNodes(m_rootNode.data(), joints);
+        QMultiHash<QString, int> jointsByName;
+        jointsByName.reserve(joints.size());
+        for (int ij=0; ij<joints.size(); ++ij)
+            jointsByName.insert(joints[ij]->name, ij);
+
+        presize(m_animations, scene->mNumAnimations);
+        presize(m_morphAnimations, scene->mNumAnimations);
+        for (uint ii=0; ii<scene->mNumAnimations; ++ii) {
+            AnimationType anim = processAnimation(scene->mAnimations[ii]);
+            m_animations[ii] = anim.first;
+            if (m_profile.has(ImportProfile::MorphTargets))
+                m_morphAnimations[ii] = processMorphChannels(scene->mAnimations[ii], joints);
+
+            qDebug() << "ANIMATION" << ii;
+            qDebug() <<
+                        "\n    Name" << scene->mAnimations[ii]->mName.C_Str() <<
+                        "\n    NumChannels" << scene->mAnimations[ii]->mNumChannels <<
+                        "\n    mNumMeshChannels" << scene->mAnimations[ii]->mNumMeshChannels <<
+                        "\n    Ticks" << scene->mAnimations[ii]->mTicksPerSecond <<
+                        "\n    Duration" << scene->mAnimations[ii]->mDuration;
+
+            QVector<ClipChannel> channels;
+            channels.reserve(anim.second.size());
+            for (int ian=0; ian<anim.second.size(); ++ian) {
+                qDebug() << "AnimSecond" << anim.second[ian].first;
+
+                if (!anim.second[ian].second.isValid())
+                    continue;
+                QMultiHash<QString, int>::const_iterator it = jointsByName.constFind(anim.second[ian].first);
+                for (; it != jointsByName.constEnd() && it.key() == anim.second[ian].first; ++it) {
+                    ClipChannel channel;
+                    channel.joint = it.value();
+                    channel.animation = anim.second[ian].second;
+                    channels.append(channel);
+                }
+            }
+
+            // Only the compressed clip is kept, it is decoded again when played
+            m_clipLibrary->addClip(channels);
+        }
+    }
+
+    prepareSkinning();
+    computeBounds();
+
+    // This will transform the model to unit coordinates, so a model of any size or shape will fit on screen
+    if (m_transformToUnitCoordinates)
+        transformToUnitCoordinates();
+
+    return true;
+}
+
+void ModelLoader::applyProfile()
+{
+    // Assets hold whatever the converter imported, unused arrays are dropped right after reading
+    if (!m_profile.has(ImportProfile::Normals))
+        m_normals = QVector<float>();
+    if (!m_profile.has(ImportProfile::Tangents)) {
+        m_tangents = QVector<float>();
+        m_bitangents = QVector<float>();
+    }
+
+    const int uvChannels = !m_profile.has(ImportProfile::TextureCoordinates) ? 0
+            : (m_profile.has(ImportProfile::AllTextureChannels) ? m_textureUV.size() : qMin(1, m_textureUV.size()));
+    m_textureUV.resize(uvChannels);
+    m_textureUVComponents.resize(qMin(uvChannels, m_textureUVComponents.size()));
+
+    if (!m_profile.has(ImportProfile::MorphTargets)) {
+        for (int ii=0; ii<m_meshes.size(); ++ii)
+            m_meshes[ii]->morphTargets.clear();
+        for (int ii=0; ii<m_morphAnimations.size(); ++ii)
+            m_morphAnimations[ii].clear();
+    }
+
+    // Before prepareSkinning() and computeBounds(), so neither groups or boxes bones that are gone
+    if (!m_profile.has(ImportProfile::Skinning)) {
+        m_vertexBoneIndices = QVector<int>();
+        m_vertexBoneWeights = QVector<float>();
+        for (int ii=0; ii<m_meshes.size(); ++ii) {
+            m_meshes[ii]->boneNames.clear();
+            m_meshes[ii]->boneOffsets.clear();
+        }
+    }
+
+    if (!m_profile.has(ImportProfile::Animations)) {
+        m_animations.clear();
+        m_morphAnimations.clear();
+        const qint64 budget = m_clipLibrary->memoryBudget();
+        m_clipLibrary = QSharedPointer<ClipLibrary>(new ClipLibrary);
+        m_clipLibrary->setMemoryBudget(budget);
+        QMutexLocker locker(&m_clipBoundsMutex);
+        m_clipBounds.clear();
+    }
+}
+
+void ModelLoader::getBufferData( QVector<float> **vertices, QVector<float> **normals, QVector<unsigned int> **indices)
+{
+    if(vertices != 0)
+        *vertices = &m_vertices;
+
+    if(normals != 0)
+        *normals = &m_normals;
+
+    if(indices != 0)
+        *indices = &m_indices;
+}
+
+void ModelLoader::getTextureData(QVector<QVector<float> > **textureUV, QVector<float> **tangents, QVector<float> **bitangents)
+{
+    if(textureUV != 0)
+        *textureUV = &m_textureUV;
+
+    if(tangents != 0)
+        *tangents = &m_tangents;
+
+    if(bitangents != 0)
+        *bitangents = &m_bitangents;
+}
+
+void ModelLoader::getBoneData(QVector<int> **vertexBoneIndexes, QVector<float> **vertexBoneWeights)
+{
+    if (vertexBoneIndexes)
+        *vertexBoneIndexes = &m_vertexBoneIndices;
+
+    if (vertexBoneWeights)
+        *vertexBoneWeights = &m_vertexBoneWeights;
+}
+
+template <typename T>
+static qint64 arrayBytes(const QVector<T> &array)
+{
+    return qint64(array.capacity()) * sizeof(T);
+}
+
+MemoryUsage ModelLoader::memoryUsage() const
+{
+    MemoryUsage usage;
+    usage.cpuGeometry = arrayBytes(m_vertices) + arrayBytes(m_normals) + arrayBytes(m_indices)
+            + arrayBytes(m_tangents) + arrayBytes(m_bitangents)
+            + arrayBytes(m_vertexBoneIndices) + arrayBytes(m_vertexBoneWeights);
+    for (int ii=0; ii<m_textureUV.size(); ++ii)
+        usage.cpuGeometry += arrayBytes(m_textureUV[ii]);
+
+    for (int ii=0; ii<m_meshes.size(); ++ii) {
+        const Mesh &mesh = *m_meshes[ii];
+        usage.cpuGeometry += sizeof(Mesh) + arrayBytes(mesh.lods) + arrayBytes(mesh.influenceGroups)
+                + arrayBytes(mesh.boneOffsets) + arrayBytes(mesh.boneNames);
+        for (int it=0; it<mesh.morphTargets.size(); ++it)
+            usage.cpuGeometry += MorphTargets::bytes(mesh.morphTargets[it]);
+    }
+
+    for (int ii=0; ii<m_morphAnimations.size(); ++ii) {
+        for (int ic=0; ic<m_morphAnimations[ii].size(); ++ic) {
+            const QVector<MorphKey> &keys = m_morphAnimations[ii][ic].keys;
+            usage.cpuAnimation += arrayBytes(keys);
+            for (int ik=0; ik<keys.size(); ++ik)
+                usage.cpuAnimation += arrayBytes(keys[ik].weights);
+        }
+    }
+
+    const ClipLibrary::Statistics clips = m_clipLibrary->statistics();
+    usage.cpuAnimation += clips.encodedBytes + clips.residentBytes;
+    return usage;
+}
+
+void ModelLoader::releaseGeometry(bool keepPickingData)
+{
+    // Assigning empty arrays frees the data unless another model still shares it
+    const bool morphed = hasMorphTargets();
+    if (!morphed)
+        m_normals = QVector<float>();
+    m_tangents = QVector<float>();
+    m_bitangents = QVector<float>();
+    m_textureUV = QVector<QVector<float> >();
+
+    if (!keepPickingData) {
+        if (!morphed)
+            m_vertices = QVector<float>();
+        m_indices = QVector<unsigned int>();
+        m_vertexBoneIndices = QVector<int>();
+        m_vertexBoneWeights = QVector<float>();
+    }
+    m_geometryReleased = true;
+}
+
+QSharedPointer<Node> ModelLoader::getNodeData()
+{
+    return m_rootNode;
+}
+
+void ModelLoader::replaceMaterial(int index, QSharedPointer<MaterialInfo> material)
+{
+    QSharedPointer<MaterialInfo> previous = m_materials.at(index);
+    m_materials[index] = material;
+
+    for (int ii=0; ii<m_meshes.size(); ++ii) {
+        if (m_meshes[ii]->material == previous)
+            m_meshes[ii]->material = material;
+    }
+}
+
+QSharedPointer<MaterialInfo> ModelLoader::processMaterial(aiMaterial *material)
+{
+    QSharedPointer<MaterialInfo> mater(new MaterialInfo);
+
+    aiString mname;
+    material->Get( AI_MATKEY_NAME, mname);
+    if(mname.length > 0)
+        mater->Name = mname.C_Str();
+
+    int shadingModel;
+    material->Get( AI_MATKEY_SHADING_MODEL, shadingModel );
+
+    if(shadingModel != aiShadingMode_Phong && shadingModel != aiShadingMode_Gouraud)
+    {
+        qDebug() << "This mesh's shading model (" << shadingModel << ") is not implemented in this loader, setting to default material";
+        mater->Name = "DefaultMaterial";
+    }
+    else
+    {
+        aiColor3D dif (0.f,0.f,0.f);
+        aiColor3D amb (0.f,0.f,0.f);
+        aiColor3D spec (0.f,0.f,0.f);
+        float shine = 0.0;
+
+        material->Get( AI_MATKEY_COLOR_AMBIENT, amb);
+        material->Get( AI_MATKEY_COLOR_DIFFUSE, dif); //->Get(<material-key>,<where-to-store>))
+        material->Get( AI_MATKEY_COLOR_SPECULAR, spec);
+        material->Get( AI_MATKEY_SHININESS, shine);
+
+        mater->Ambient = Vector3(amb.r, amb.g, amb.b);
+        mater->Diffuse = Vector3(dif.r, dif.g, dif.b);
+        mater->Specular = Vector3(spec.r, spec.g, spec.b);
+        mater->Shininess = shine;
+
+        mater->Ambient *= .2f;
+        if( mater->Shininess == 0.0) mater->Shininess = 30;
+    }
+
+    qDebug() << "Material Name " << mater->Name << mater->Ambient << mater->Diffuse << mater->Specular << mater->Shininess;
+
+    return mater;
+}
+
+// Number of floats stored per vertex for a uv channel with the given component count
+static int uvFloatsPerVertex(unsigned int components)
+{
+    return components > 2 ? 3 : (components > 1 ? 2 : 1);
+}
+
+unsigned int ModelLoader::uvChannelCount(const aiMesh *mesh) const
+{
+    if (!m_profile.has(ImportProfile::TextureCoordinates))
+        return 0;
+    return m_profile.has(ImportProfile::AllTextureChannels) ? mesh->GetNumUVChannels() : qMin(1u, mesh->GetNumUVChannels());
+}
+
+QVector<ModelLoader::MeshLayout> ModelLoader::layoutMeshes(const aiScene *scene)
+{
+    QVector<MeshLayout> layouts(scene->mNumMeshes);
+
+    // Exclusive prefix sums of every per-mesh array, in mesh order
+    unsigned int vertexCount = 0, indexCount = 0, normalCount = 0, tangentCount = 0;
+    QVector<unsigned int> uvCount;
+    bool hasBones = false;
+
+    for (unsigned int ii=0; ii<scene->mNumMeshes; ++ii) {
+        const aiMesh *mesh = scene->mMeshes[ii];
+        MeshLayout &layout = layouts[ii];
+
+        layout.vertexOffset = vertexCount;
+        vertexCount += mesh->mNumVertices;
+
+        layout.indexOffset = indexCount;
+        layout.indexCount = 0;
+        for (unsigned int t=0; t<mesh->mNumFaces; ++t) {
+            if (mesh->mFaces[t].mNumIndices == 3)
+                layout.indexCount += 3;
+        }
+        indexCount += layout.indexCount;
+
+        // Assimp already stripped what the profile leaves out, checked again in case a file
+        // format's importer fills in components on its own
+        const bool normals = mesh->HasNormals() && m_profile.has(ImportProfile::Normals);
+        layout.normalOffset = normals ? int(normalCount) : -1;
+        if (normals)
+            normalCount += mesh->mNumVertices * 3;
+
+        const bool tangents = mesh->HasTangentsAndBitangents() && m_profile.has(ImportProfile::Tangents);
+        layout.tangentOffset = tangents ? int(tangentCount) : -1;
+        if (tangents)
+            tangentCount += mesh->mNumVertices * 3;
+
+        // Caution, assumes all meshes in this model have same number of uv channels
+        const unsigned int uvChannels = uvChannelCount(mesh);
+        if ((unsigned int)uvCount.size() < uvChannels) {
+            uvCount.resize(uvChannels);
+            m_textureUVComponents.resize(uvChannels);
+        }
+        layout.uvOffsets.resize(uvChannels);
+        for (unsigned int ich=0; ich<uvChannels; ++ich) {
+            m_textureUVComponents[ich] = mesh->mNumUVComponents[ich];
+            layout.uvOffsets[ich] = uvCount[ich];
+            uvCount[ich] += mesh->mNumVertices * uvFloatsPerVertex(mesh->mNumUVComponents[ich]);
+        }
+
+        const bool bones = mesh->HasBones() && m_profile.has(ImportProfile::Skinning);
+        hasBones = hasBones || bones;
+
+        // processMesh runs in parallel, so its Mesh and bone arrays are accounted for here
+        m_statistics.allocationCount += bones ? 3 : 1;
+        m_statistics.allocatedBytes += sizeof(Mesh)
+                + (bones ? mesh->mNumBones * (sizeof(Affine3x4) + sizeof(QString)) : 0);
+    }
+
+    presize(m_vertices, vertexCount * 3);
+    presize(m_indices, indexCount);
+    presize(m_normals, normalCount);
+    presize(m_tangents, tangentCount);
+    presize(m_bitangents, tangentCount);
+    presize(m_textureUV, uvCount.size());
+    for (int ich=0; ich<uvCount.size(); ++ich)
+        presize(m_textureUV[ich], uvCount[ich]);
+
+    // Every vertex gets bone slots once any mesh is skinned, unused slots keep index -1
+    if (hasBones) {
+        presize(m_vertexBoneIndices, vertexCount * MAX_BONES_PER_VERTEX);
+        presize(m_vertexBoneWeights, vertexCount * MAX_BONES_PER_VERTEX);
+        m_vertexBoneIndices.fill(-1);
+        m_vertexBoneWeights.fill(0.0f);
+    }
+
+    return layouts;
+}
+
+ModelLoader::MeshBuffers ModelLoader::meshBuffers()
+{
+    MeshBuffers buffers;
+    buffers.vertices = m_vertices.data();
+    buffers.normals = m_normals.data();
+    buffers.tangents = m_tangents.data();
+    buffers.bitangents = m_bitangents.data();
+    buffers.indices = m_indices.data();
+    buffers.boneIndices = m_vertexBoneIndices.data();
+    buffers.boneWeights = m_vertexBoneWeights.data();
+    buffers.textureUV.resize(m_textureUV.size());
+    for (int ich=0; ich<m_textureUV.size(); ++ich)
+        buffers.textureUV[ich] = m_textureUV[ich].data();
+    return buffers;
+}
+
+QSharedPointer<Mesh> ModelLoader::processMesh(aiMesh *mesh, const MeshLayout &layout, const MeshBuffers &buffers)
+{
+    // Runs concurrently for all meshes, so it only writes to the ranges layoutMeshes reserved for it
+
+    QSharedPointer<Mesh> newMesh(new Mesh);
+    newMesh->name = mesh->mName.length != 0 ? mesh->mName.C_Str() : "";
+    newMesh->indexOffset = layout.indexOffset;
+    newMesh->indexCount = layout.indexCount;
+    newMesh->vertexOffset = layout.vertexOffset;
+    newMesh->vertexCount = mesh->mNumVertices;
+
+    // Get Vertices
+    float *vertices = buffers.vertices + layout.vertexOffset * 3;
+    for(uint ii=0; ii<mesh->mNumVertices; ++ii)
+    {
+        aiVector3D &vec = mesh->mVertices[ii];
+        vertices[ii*3]   = vec.x;
+        vertices[ii*3+1] = vec.y;
+        vertices[ii*3+2] = vec.z;
+    }
+
+#ifdef ASSIMP_MORPH_ANIMATIONS
+    // Blend shapes keep the vertices they move, Assimp stores them as complete meshes
+    const uint animMeshes = m_profile.has(ImportProfile::MorphTargets) ? mesh->mNumAnimMeshes : 0;
+    for (uint ia=0; ia<animMeshes; ++ia) {
+        const aiAnimMesh *animMesh = mesh->mAnimMeshes[ia];
+        if (!animMesh->HasPositions() || animMesh->mNumVertices != mesh->mNumVertices)
+            continue;
+
+        const bool normals = mesh->HasNormals() && animMesh->HasNormals();
+        newMesh->morphTargets.append(MorphTargets::build(QString("%1 target %2").arg(newMesh->name).arg(ia), mesh->mNumVertices,
+                                                         &mesh->mVertices[0].x, &animMesh->mVertices[0].x,
+                                                         normals ? &mesh->mNormals[0].x : 0,
+                                                         normals ? &animMesh->mNormals[0].x : 0));
+        newMesh->morphTargets.last().defaultWeight = animMesh->mWeight;
+        qDebug() << "    Morph target" << ia << "moves" << newMesh->morphTargets.last().vertices.size()
+                 << "of" << mesh->mNumVertices << "vertices";
+    }
+#endif
+
+    if (mesh->HasBones() && m_profile.has(ImportProfile::Skinning)) {
+        qDebug() << "MeshName" << newMesh->name << "Has Bones" << mesh->mNumBones;
+
+        int *boneIndices = buffers.boneIndices + layout.vertexOffset * MAX_BONES_PER_VERTEX;
+        float *boneWeights = buffers.boneWeights + layout.vertexOffset * MAX_BONES_PER_VERTEX;
+
+        newMesh->boneNames.resize(mesh->mNumBones);
+        newMesh->boneOffsets.resize(mesh->mNumBones);
+        for (uint ii=0; ii<mesh->mNumBones; ++ii) {
+            qDebug() << "    BoneName" << mesh->mBones[ii]->mName.C_Str();
+            newMesh->boneNames[ii] = mesh->mBones[ii]->mName.length != 0 ? mesh->mBones[ii]->mName.C_Str() : "";
+            newMesh->boneOffsets[ii] = toAffine(mesh->mBones[ii]->mOffsetMatrix);
+
+            for (uint ib=0; ib<mesh->mBones[ii]->mNumWeights; ++ib) {
+                int vertexBoneIndex = mesh->mBones[ii]->mWeights[ib].mVertexId * MAX_BONES_PER_VERTEX;
+                const int lastBoneIndex = vertexBoneIndex + MAX_BONES_PER_VERTEX;
+                while (vertexBoneIndex < lastBoneIndex && boneIndices[vertexBoneIndex] != -1)
+                    ++vertexBoneIndex;
+                if (vertexBoneIndex == lastBoneIndex)
+                    continue;
+                boneIndices[vertexBoneIndex] = ii;
+                boneWeights[vertexBoneIndex] = mesh->mBones[ii]->mWeights[ib].mWeight;
+            }
+        }
+    }
+    else
+        qDebug() << "MeshName" << newMesh->name;
+
+    // Get Normals
+    if(layout.normalOffset != -1)
+    {
+        float *normals = buffers.normals + layout.normalOffset;
+        for(uint ii=0; ii<mesh->mNumVertices; ++ii)
+        {
+            aiVector3D &vec = mesh->mNormals[ii];
+            normals[ii*3]   = vec.x;
+            normals[ii*3+1] = vec.y;
+            normals[ii*3+2] = vec.z;
+        }
+    }
+
+    // Get Texture coordinates
+    for( int ich = 0; ich < layout.uvOffsets.size(); ++ich)
+    {
+        const int components = uvFloatsPerVertex(mesh->mNumUVComponents[ich]);
+        float *textureUV = buffers.textureUV[ich] + layout.uvOffsets[ich];
+        for(uint iind = 0; iind<mesh->mNumVertices; ++iind)
+        {
+            const aiVector3D &uv = mesh->mTextureCoords[ich][iind];
+            for (int ic=0; ic<components; ++ic)
+                *textureUV++ = uv[ic];
+        }
+    }
+
+    // Get Tangents and bitangents
+    if(layout.tangentOffset != -1)
+    {
+        float *tangents = buffers.tangents + layout.tangentOffset;
+        float *bitangents = buffers.bitangents + layout.tangentOffset;
+        for(uint ii=0; ii<mesh->mNumVertices; ++ii)
+        {
+            aiVector3D &vec = mesh->mTangents[ii];
+            tangents[ii*3]   = vec.x;
+            tangents[ii*3+1] = vec.y;
+            tangents[ii*3+2] = vec.z;
+
+            aiVector3D &vec2 = mesh->mBitangents[ii];
+            bitangents[ii*3]   = vec2.x;
+            bitangents[ii*3+1] = vec2.y;
+            bitangents[ii*3+2] = vec2.z;
+        }
+    }
+
+    // Get mesh indexes
+    unsigned int *indices = buffers.indices + layout.indexOffset;
+    for(uint t = 0; t<mesh->mNumFaces; ++t)
+    {
+        aiFace* face = &mesh->mFaces[t];
+        if(face->mNumIndices != 3)
+        {
+            qDebug() << "Warning: Mesh face with not exactly 3 indices, ignoring this primitive.";
+            continue;
+        }
+
+        *indices++ = face->mIndices[0]+layout.vertexOffset;
+        *indices++ = face->mIndices[1]+layout.vertexOffset;
+        *indices++ = face->mIndices[2]+layout.vertexOffset;
+    }
+
+    newMesh->material = m_materials.at(mesh->mMaterialIndex);
+
+    return newMesh;
+}
+
+aiNode *ModelLoader::findRootNode(aiNode *node)
+{
+    return node;
+
+    QString nodename = node->mName.length != 0 ? node->mName.C_Str() : "";
+
+    if (QString(nodename) == QString("root"))
+        return node;
+    else
+    {
+        for (int ii=0; ii<node->mNumChildren; ++ii) {
+            aiNode *n = findRootNode(node->mChildren[ii]);
+            if (n != 0)
+                return n;
+        }
+    }
+    return 0;
+}
+
+void ModelLoader::processNode(const aiScene *scene, aiNode *node, Node *parentNode, Node &newNode)
+{
+    newNode.name = node->mName.length != 0 ? node->mName.C_Str() : "";
+
+    QString indentation("");
+    for (int ii=0; ii<m_nodeHierarchyLevel; ++ii)
+        indentation.append("    ");
+    qDebug() << QString("%1NodeName: %2, NumMeshes:%3").arg(indentation).arg(newNode.name).arg(node->mNumMeshes);
+
+    newNode.transformation = toAffine(node->mTransformation);
+
+    presize(newNode.meshes, node->mNumMeshes);
+    for(uint imesh = 0; imesh < node->mNumMeshes; ++imesh)
+    {
+        QSharedPointer<Mesh> mesh = m_meshes[node->mMeshes[imesh]];
+        newNode.meshes[imesh] = mesh;
+    }
+
+    m_nodeHierarchyLevel += 1;
+    presize(newNode.nodes, node->mNumChildren);
+    for(uint ich = 0; ich < node->mNumChildren; ++ich)
+    {
+        processNode(scene, node->mChildren[ich], parentNode, newNode.nodes[ich]);
+    }
+    m_nodeHierarchyLevel -= 1;
+}
+
+AnimationType ModelLoader::processAnimation(aiAnimation *anim)
+{
+    QSharedPointer<Animation> animation(new Animation);
+    animation->name = anim->mName.length != 0 ? anim->mName.C_Str() : "";
+    animation->duration = anim->mDuration;
+    animation->ticksPerSecond = anim->mTicksPerSecond;
+
+    QVector<NodeAnimationPair> nodeAnimations;
+    presize(nodeAnimations, anim->mNumChannels);
+
+    for (uint ii=0; ii<anim->mNumChannels; ++ii) {
+        aiNodeAnim *nodeAnim = anim->mChannels[ii];
+
+        nodeAnimations[ii].first = nodeAnim->mNodeName.length != 0 ? nodeAnim->mNodeName.C_Str() : "";
+        NodeAnimation &nodeAnimation = nodeAnimations[ii].second;
+
+        nodeAnimation.preState = AnimState_Invalid;
+
+        if (nodeAnim->mPreState == aiAnimBehaviour_DEFAULT)
+            nodeAnimation.preState = AnimState_Default;
+        else if (nodeAnim->mPreState == aiAnimBehaviour_CONSTANT)
+            nodeAnimation.preState = AnimState_Constant;
+        else if (nodeAnim->mPreState == aiAnimBehaviour_LINEAR)
+            nodeAnimation.preState = AnimState_Linear;
+        else if (nodeAnim->mPreState == aiAnimBehaviour_REPEAT)
+            nodeAnimation.preState = AnimState_Repeat;
+
+        nodeAnimation.postState = AnimState_Invalid;
+
+        if (nodeAnim->mPostState == aiAnimBehaviour_DEFAULT)
+            nodeAnimation.postState = AnimState_Default;
+        else if (nodeAnim->mPostState == aiAnimBehaviour_CONSTANT)
+            nodeAnimation.postState = AnimState_Constant;
+        else if (nodeAnim->mPostState == aiAnimBehaviour_LINEAR)
+            nodeAnimation.postState = AnimState_Linear;
+        else if (nodeAnim->mPostState == aiAnimBehaviour_REPEAT)
+            nodeAnimation.postState = AnimState_Repeat;
+
+        presize(nodeAnimation.scalingKeys, nodeAnim->mNumScalingKeys);
+        for (uint ip=0; ip<nodeAnim->mNumScalingKeys; ++ip) {
+            const aiVectorKey &vk = nodeAnim->mScalingKeys[ip];
+            nodeAnimation.scalingKeys[ip] = qMakePair(vk.mTime, Vector3(vk.mValue.x, vk.mValue.y, vk.mValue.z));
+        }
+        presize(nodeAnimation.rotationKeys, nodeAnim->mNumRotationKeys);
+        for (uint ip=0; ip<nodeAnim->mNumRotationKeys; ++ip) {
+            const aiQuatKey &vk = nodeAnim->mRotationKeys[ip];
+            nodeAnimation.rotationKeys[ip] = qMakePair(vk.mTime, Quaternion(vk.mValue.w, vk.mValue.x, vk.mValue.y, vk.mValue.z));
+        }
+        presize(nodeAnimation.positionKeys, nodeAnim->mNumPositionKeys);
+        for (uint ip=0; ip<nodeAnim->mNumPositionKeys; ++ip) {
+            const aiVectorKey &vk = nodeAnim->mPositionKeys[ip];
+            nodeAnimation.positionKeys[ip] = qMakePair(vk.mTime, Vector3(vk.mValue.x, vk.mValue.y, vk.mValue.z));
+        }
+    }
+
+    return qMakePair(animation, nodeAnimations);
+}
+
+QVector<MorphChannel> ModelLoader::processMorphChannels(aiAnimation *anim, const QVector<const Node*> &nodes)
+{
+    QVector<MorphChannel> channels;
+#ifdef ASSIMP_MORPH_ANIMATIONS
+    for (uint ii=0; ii<anim->mNumMorphMeshChannels; ++ii) {
+        const aiMeshMorphAnim *morphAnim = anim->mMorphMeshChannels[ii];
+        const QString name = morphAnim->mName.length != 0 ? morphAnim->mName.C_Str() : "";
+
+        // Importers name the channel after the mesh or after the node holding it
+        QVector<int> meshes;
+        for (int im=0; im<m_meshes.size(); ++im) {
+            if (m_meshes[im]->name == name && !m_meshes[im]->morphTargets.isEmpty())
+                meshes.append(im);
+        }
+        for (int in=0; meshes.isEmpty() && in<nodes.size(); ++in) {
+            if (nodes[in]->name != name)
+                continue;
+            for (int im=0; im<nodes[in]->meshes.size(); ++im) {
+                if (!nodes[in]->meshes[im]->morphTargets.isEmpty())
+                    meshes.append(m_meshes.indexOf(nodes[in]->meshes[im]));
+            }
+        }
+
+        MorphChannel channel;
+        presize(channel.keys, morphAnim->mNumKeys);
+        for (uint ik=0; ik<morphAnim->mNumKeys; ++ik) {
+            const aiMeshMorphKey &key = morphAnim->mKeys[ik];
+            channel.keys[ik].time = key.mTime;
+            channel.keys[ik].weights.resize(key.mNumValuesAndWeights);
+            for (uint iv=0; iv<key.mNumValuesAndWeights; ++iv) {
+                channel.keys[ik].weights[iv].target = key.mValues[iv];
+                channel.keys[ik].weights[iv].weight = float(key.mWeights[iv]);
+            }
+        }
+
+        for (int im=0; im<meshes.size(); ++im) {
+            channel.mesh = meshes[im];
+            channels.append(channel);
+        }
+        if (meshes.isEmpty())
+            qDebug() << "Morph channel" << name << "matches no mesh with targets";
+    }
+#else
+    Q_UNUSED(nodes);
+    if (anim->mNumMeshChannels > 0)
+        qDebug() << "Morph animations need Assimp 4 or later, ignoring them";
+#endif
+    return channels;
+}
+
+bool ModelLoader::hasMorphTargets() const
+{
+    for (int ii=0; ii<m_meshes.size(); ++ii) {
+        if (!m_meshes[ii]->morphTargets.isEmpty())
+            return true;
+    }
+    return false;
+}
+
+void ModelLoader::prepareSkinning()
+{
+    // Runs on assets too, their weights are already normalized but the groups aren't stored
+    const int dropped = SkinWeights::normalize(m_vertexBoneIndices, m_vertexBoneWeights);
+
+    int groupCounts[SkinWeights::VariantCount] = {};
+    for (int im=0; im<m_meshes.size(); ++im) {
+        Mesh &mesh = *m_meshes[im];
+        SkinWeights::groupTriangles(mesh, m_indices, m_vertexBoneWeights);
+        for (int ig=0; ig<mesh.influenceGroups.size(); ++ig)
+            groupCounts[mesh.influenceGroups[ig].variant] += mesh.influenceGroups[ig].indexCount / 3;
+    }
+
+    qDebug() << "Skinning: dropped" << dropped << "influences, triangles by influence count"
+             << groupCounts[0] << groupCounts[1] << groupCounts[2] << groupCounts[3] << groupCounts[4]
+             << "mixed" << groupCounts[SkinWeights::Variant_Mixed];
+}
+
+void ModelLoader::computeBounds()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    m_meshBounds = Bounds::meshBounds(m_vertices, m_meshes);
+    m_bounds = Bounds::nodeBounds(m_rootNode.data(), m_vertices);
+    // Clip boxes come later from these, decoding every clip here would slow down every load
+    m_skinnedBoxes = Bounds::skinnedBoxes(m_rootNode.data(), m_meshes, m_vertices,
+                                          m_vertexBoneIndices, m_vertexBoneWeights);
+    m_unitTransformation = Affine3x4::identity();
+    QMutexLocker locker(&m_clipBoundsMutex);
+    m_clipBounds.clear();
+
+    qDebug() << "Bounds" << m_bounds.minimum << m_bounds.maximum << "in" << timer.elapsed() << "ms";
+}
+
+BoundingBox ModelLoader::clipBounds(int animation) const
+{
+    if (animation < 0 || animation >= m_animations.size())
+        return m_bounds;
+
+    QMutexLocker locker(&m_clipBoundsMutex);
+    QHash<int, BoundingBox>::const_iterator it = m_clipBounds.constFind(animation);
+    if (it != m_clipBounds.constEnd())
+        return it.value();
+
+    QElapsedTimer timer;
+    timer.start();
+    BoundingBox box = Bounds::clipBounds(m_rootNode.data(), m_skinnedBoxes, m_clipLibrary, animation);
+    box = box.isEmpty() ? m_bounds : box.transformed(m_unitTransformation);
+    m_clipBounds.insert(animation, box);
+    qDebug() << "Bounds of animation" << animation << "in" << timer.elapsed() << "ms";
+    return box;
+}
+
+void ModelLoader::transformToUnitCoordinates()
+{
+    // This will transform the model to unit coordinates, so a model of any size or shape will fit on screen
+    if (m_bounds.isEmpty())
+        return;
+
+    // Calculate scale and translation needed to center and fit on screen
+    const Vector3 size = m_bounds.size();
+    float dist = qMax(size.x(), qMax(size.y(), size.z()));
+    float sc = dist > 0.0f ? 1.0/dist : 1.0f;
+    Vector3 trans = -m_bounds.center();
+
+    qDebug() << "Min" << m_bounds.minimum << m_bounds.maximum;
+
+    // Scale after the translation, which is the same as translating by the scaled amount
+    const Affine3x4 transformation = Affine3x4::fromTrs(trans * sc, Quaternion(), Vector3(sc, sc, sc));
+
+    // Multiply the transformation to the root node transformation matrix
+    m_rootNode.data()->transformation = transformation * m_rootNode.data()->transformation;
+
+    // Model space boxes move along, scaling and translation keep them exact. Clip boxes taken later
+    // are moved the same way.
+    m_bounds = m_bounds.transformed(transformation);
+    m_unitTransformation = transformation;
+}
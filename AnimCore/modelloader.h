@@ -0,0 +1,304 @@
+#ifndef MODELLOADER_H
+#define MODELLOADER_H
+
+#include <string>
+#include <vector>
+#include <QFile>
+#include <QSharedPointer>
+#include <QDir>
+#include <QHash>
+#include <QMutex>
+#include "bounds.h"
+#include "memoryusage.h"
+#include "morphtargets.h"
+
+struct aiScene;
+struct aiNode;
+struct aiMesh;
+struct aiMaterial;
+struct aiAnimation;
+class ClipLibrary;
+
+struct MaterialInfo
+{
+    QString Name;
+    Vector3 Ambient;
+    Vector3 Diffuse;
+    Vector3 Specular;
+    float Shininess;
+};
+
+struct MeshLod
+{
+    unsigned int indexCount;
+    unsigned int indexOffset;
+};
+
+// Triangles drawn with one skinning shader variant, see SkinWeights
+struct InfluenceGroup
+{
+    int variant;
+    unsigned int indexCount;
+    unsigned int indexOffset;
+};
+
+struct Mesh
+{
+    QString name;
+    unsigned int indexCount;
+    unsigned int indexOffset;
+    unsigned int vertexCount;
+    unsigned int vertexOffset;
+    QVector<MeshLod> lods; // Reduced detail index ranges, coarsest last
+    QVector<InfluenceGroup> influenceGroups; // Together the full index range, rebuilt on every load
+    QSharedPointer<MaterialInfo> material;
+    QVector<Affine3x4> boneOffsets;
+    QVector<QString> boneNames;
+    QVector<MorphTarget> morphTargets;
+};
+
+enum AnimState {
+    AnimState_Invalid,
+    AnimState_Default,
+    AnimState_Constant,
+    AnimState_Linear,
+    AnimState_Repeat
+};
+
+struct NodeAnimation {
+    NodeAnimation() :
+        positionIndex(0)
+      , rotationIndex(0)
+      , scalingIndex(0)
+      , preState(AnimState_Invalid)
+      , postState(AnimState_Invalid)
+    {}
+
+    QVector<QPair<double, Vector3> > positionKeys;
+    QVector<QPair<double, Quaternion> > rotationKeys;
+    QVector<QPair<double, Vector3> > scalingKeys;
+
+    mutable int positionIndex;
+    mutable int rotationIndex;
+    mutable int scalingIndex;
+
+    AnimState preState;
+    AnimState postState;
+
+    bool isValid() const {
+        return (preState != AnimState_Invalid && postState != AnimState_Invalid) && (!positionKeys.empty() || !rotationKeys.empty() || !scalingKeys.empty());
+    }
+
+    // Local transformation at the given tick, using the same keys Scene playback steps to.
+    // Doesn't touch the playback indexes, so any number of ticks can be sampled.
+    Affine3x4 transformationAt(double tick) const;
+
+    // The same keys as separate parts, identity parts for channels without keys
+    void sampleAt(double tick, Vector3 &position, Quaternion &rotation, Vector3 &scaling) const;
+};
+
+struct Node
+{
+    Node() : transformation(Affine3x4::identity()) {}
+
+    QString name;
+
+    Affine3x4 transformation;
+    QVector<QSharedPointer<Mesh> > meshes;
+    QVector<Node> nodes;
+};
+
+struct Animation {
+    QString name;
+    double duration;
+    double ticksPerSecond;
+};
+
+typedef QPair<QString, NodeAnimation> NodeAnimationPair;
+typedef QPair<QSharedPointer<Animation>, QVector<NodeAnimationPair> > AnimationType;
+
+// Cost of the last ModelLoader::Load call
+struct LoadStatistics
+{
+    LoadStatistics() : loadMs(0), allocationCount(0), allocatedBytes(0), peakResidentBytes(-1) {}
+
+    qint64 loadMs;
+    int allocationCount;        // destination arrays and objects allocated by the loader
+    qint64 allocatedBytes;
+    qint64 peakResidentBytes;   // process wide high water mark after the load, -1 if unknown
+};
+
+// Vertex attributes and data a consumer of a model needs. The import only runs the Assimp steps
+// producing them and only allocates their arrays, components left out are stripped before
+// identical vertices are joined, so fewer vertices remain. Positions and indices always load.
+struct ImportProfile
+{
+    enum Attribute {
+        Normals             = 0x01,
+        TextureCoordinates  = 0x02,     // first channel only
+        AllTextureChannels  = 0x04,     // implies TextureCoordinates
+        Tangents            = 0x08,     // and bitangents, implies Normals and TextureCoordinates
+        Skinning            = 0x10,     // bones, their offsets and the vertex weights
+        MorphTargets        = 0x20,
+        Animations          = 0x40
+    };
+
+    explicit ImportProfile(int attributes = Full);
+
+    static const int Full = Normals | AllTextureChannels | Tangents | Skinning | MorphTargets | Animations;
+    // What the OpenGL 3.3 renderer draws with
+    static ImportProfile rendering() { return ImportProfile(Normals | TextureCoordinates | Skinning | MorphTargets | Animations); }
+    // Unanimated shaded meshes, what the OpenGL ES renderer draws with
+    static ImportProfile staticShading() { return ImportProfile(Normals | TextureCoordinates); }
+    // Positions posed by the skeleton, e.g. for bounds or picking only
+    static ImportProfile skinningOnly() { return ImportProfile(Skinning | Animations); }
+
+    // By name as the converter takes it, full, rendering, static or skinning
+    static bool fromName(const QString &name, ImportProfile &profile);
+
+    bool has(Attribute attribute) const { return (attributes & attribute) != 0; }
+    unsigned int postProcessSteps() const;
+    int removedComponents() const;      // aiComponent flags
+
+    int attributes;
+};
+
+class ModelLoader
+{
+public:
+    enum PathType {
+        RelativePath,
+        AbsolutePath
+    };
+
+    ModelLoader();
+    static QString resolveFilePath(QString filePath, PathType pathType);
+
+    // Nodes breadth first, the order joint indices in clips and skeletons refer to.
+    // parents gets -1 for the root, levels the first node of every depth followed by the node count.
+    static void flattenNodes(const Node *rootNode, QVector<const Node*> &nodes,
+                             QVector<int> *parents = 0, QVector<int> *levels = 0);
+    void setTransformToUnitCoordinates(bool arg) { m_transformToUnitCoordinates = arg; }
+    // Applies to the next Load(). Runtime assets were imported by the converter already, only the
+    // arrays the profile leaves out are dropped from them.
+    void setImportProfile(const ImportProfile &profile) { m_profile = profile; }
+    ImportProfile importProfile() const { return m_profile; }
+    bool Load(QString filePath, PathType pathType);
+    void getBufferData( QVector<float> **vertices, QVector<float> **normals,
+                        QVector<unsigned int> **indices);
+
+    void getTextureData( QVector<QVector<float> > **textureUV,                   // For texture mapping
+                         QVector<float> **tangents, QVector<float> **bitangents);// For normal mapping
+
+    void getBoneData( QVector<int> **vertexBoneIndexes, QVector<float> **vertexBoneWeights );
+
+    QSharedPointer<Node> getNodeData();
+    QVector<QSharedPointer<Mesh> > getMeshes() { return m_meshes; }
+    QVector<QSharedPointer<Animation> > getNodeAnimations() { return m_animations; }
+    QSharedPointer<ClipLibrary> getClipLibrary() { return m_clipLibrary; }
+
+    // Blend shape weights of an animation, by mesh index. Needs Assimp 4 or later to import.
+    bool hasMorphTargets() const;
+    QVector<MorphChannel> morphChannels(int animation) const { return m_morphAnimations.value(animation); }
+
+    // Texture information
+    int numUVChannels() { return m_textureUV.size(); }
+    int numUVComponents(int channel) { return m_textureUVComponents.at(channel); }
+
+    QVector<QSharedPointer<MaterialInfo> > getMaterials() { return m_materials; }
+    void replaceMaterial(int index, QSharedPointer<MaterialInfo> material);
+
+    LoadStatistics loadStatistics() const { return m_statistics; }
+
+    // CPU side bytes of the geometry and animation data, GPU categories are left at zero
+    MemoryUsage memoryUsage() const;
+
+    // Frees the vertex arrays once they have been uploaded. Positions, indices and bone data stay
+    // when keepPickingData is set, bounds, meshes and nodes always stay. Models with morph targets
+    // keep positions and normals, they are morphed from them.
+    void releaseGeometry(bool keepPickingData);
+    bool geometryReleased() const { return m_geometryReleased; }
+
+    // Bind pose box of the whole model, after the unit transformation if that is enabled
+    BoundingBox bounds() const { return m_bounds; }
+    // Bind pose box of every mesh in its own space
+    QVector<BoundingBox> meshBounds() const { return m_meshBounds; }
+    // Box of the whole model over all poses of an animation, in the same space as bounds(). Worked out
+    // from the bone boxes the first time an animation asks and kept, callable from any thread.
+    BoundingBox clipBounds(int animation) const;
+private:
+    friend class ModelAsset;
+
+    bool importFile(QString filePath, PathType pathType);
+    template <typename T> void presize(QVector<T> &array, int size);
+
+    QSharedPointer<MaterialInfo> processMaterial(aiMaterial *mater);
+    // Where a mesh's data goes in the shared vertex/index arrays
+    struct MeshLayout {
+        unsigned int vertexOffset;
+        unsigned int indexOffset;
+        unsigned int indexCount;
+        int normalOffset;           // -1 when the mesh has no normals
+        int tangentOffset;          // -1 when the mesh has no tangents
+        QVector<unsigned int> uvOffsets;
+    };
+    // Start of each shared array, taken once so the parallel mesh tasks never touch the QVectors
+    struct MeshBuffers {
+        float *vertices;
+        float *normals;
+        float *tangents;
+        float *bitangents;
+        unsigned int *indices;
+        int *boneIndices;
+        float *boneWeights;
+        QVector<float*> textureUV;
+    };
+    unsigned int uvChannelCount(const aiMesh *mesh) const;
+    QVector<MeshLayout> layoutMeshes(const aiScene *scene);
+    MeshBuffers meshBuffers();
+    QSharedPointer<Mesh> processMesh(aiMesh *mesh, const MeshLayout &layout, const MeshBuffers &buffers);
+    aiNode* findRootNode(aiNode *node);
+    void processNode(const aiScene *scene, aiNode *node, Node *parentNode, Node &newNode);
+    AnimationType processAnimation(aiAnimation *anim);
+    QVector<MorphChannel> processMorphChannels(aiAnimation *anim, const QVector<const Node*> &nodes);
+    int m_nodeHierarchyLevel;
+
+    void applyProfile();
+    void prepareSkinning();
+    void computeBounds();
+    void transformToUnitCoordinates();
+
+    QVector<float> m_vertices;
+    QVector<float> m_normals;
+    QVector<unsigned int> m_indices;
+
+    QVector<QVector<float> > m_textureUV; // multiple channels
+    QVector<float> m_tangents;
+    QVector<float> m_bitangents;
+    QVector<unsigned int > m_textureUVComponents; // multiple channels
+
+    QVector<QSharedPointer<MaterialInfo> > m_materials;
+    QVector<QSharedPointer<Mesh> > m_meshes;
+    QSharedPointer<Node> m_rootNode;
+    bool m_transformToUnitCoordinates;
+    bool m_geometryReleased;
+    ImportProfile m_profile;
+
+    QVector<QSharedPointer<Animation> > m_animations;
+    QSharedPointer<ClipLibrary> m_clipLibrary;
+    QVector<QVector<MorphChannel> > m_morphAnimations;  // by animation
+
+    QVector<int> m_vertexBoneIndices;
+    QVector<float> m_vertexBoneWeights;
+
+    BoundingBox m_bounds;
+    QVector<BoundingBox> m_meshBounds;
+    SkinnedBoxes m_skinnedBoxes;
+    Affine3x4 m_unitTransformation;                 // identity unless transformed to unit coordinates
+    mutable QMutex m_clipBoundsMutex;
+    mutable QHash<int, BoundingBox> m_clipBounds;   // of the animations asked for so far
+
+    LoadStatistics m_statistics;
+};
+
+#endif // MODELLOADER_H
@@ -0,0 +1,238 @@
+#include "morphtargets.h"
+#include "modelloader.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define MORPH_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// out[vertex] += factor * delta for every moved vertex, all xyzw
+void addDeltas(const quint32 *vertices, const qint16 *deltas, int count, float factor, float *out)
+{
+#ifdef MORPH_SSE
+    const __m128 scale = _mm_set1_ps(factor);
+    for (int ii=0; ii<count; ++ii) {
+        // Four int16 sign extended to int32 by shifting them down from the high halves
+        const __m128i raw = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(deltas + ii * 4));
+        const __m128 delta = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16)), scale);
+        float *p = out + vertices[ii] * 4;
+        _mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p), delta));
+    }
+#else
+    for (int ii=0; ii<count; ++ii) {
+        float *p = out + vertices[ii] * 4;
+        const qint16 *delta = deltas + ii * 4;
+        p[0] += delta[0] * factor;
+        p[1] += delta[1] * factor;
+        p[2] += delta[2] * factor;
+    }
+#endif
+}
+
+// Padded copy, w is 1 for positions and 0 for normals
+void toXyzw(const QVector<float> &xyz, float w, QVector<float> &xyzw)
+{
+    const int count = xyz.size() / 3;
+    xyzw.resize(count * 4);
+    for (int ii=0; ii<count; ++ii) {
+        xyzw[ii*4] = xyz[ii*3];
+        xyzw[ii*4+1] = xyz[ii*3+1];
+        xyzw[ii*4+2] = xyz[ii*3+2];
+        xyzw[ii*4+3] = w;
+    }
+}
+
+bool sameWeights(const QVector<MorphWeight> &a, const QVector<MorphWeight> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (int ii=0; ii<a.size(); ++ii) {
+        if (a[ii].target != b[ii].target || a[ii].weight != b[ii].weight)
+            return false;
+    }
+    return true;
+}
+
+}
+
+MorphTarget MorphTargets::build(const QString &name, int vertexCount,
+                                const float *basePositions, const float *targetPositions,
+                                const float *baseNormals, const float *targetNormals, float threshold)
+{
+    MorphTarget target;
+    target.name = name;
+
+    const bool hasNormals = baseNormals && targetNormals;
+    float maxPosition = 0.0f, maxNormal = 0.0f;
+    for (int ii=0; ii<vertexCount; ++ii) {
+        bool moved = false;
+        for (int ic=0; ic<3; ++ic) {
+            const float position = std::fabs(targetPositions[ii*3+ic] - basePositions[ii*3+ic]);
+            const float normal = hasNormals ? std::fabs(targetNormals[ii*3+ic] - baseNormals[ii*3+ic]) : 0.0f;
+            moved = moved || position > threshold || normal > threshold;
+            maxPosition = qMax(maxPosition, position);
+            maxNormal = qMax(maxNormal, normal);
+        }
+        if (moved)
+            target.vertices.append(ii);
+    }
+
+    target.positionScale = maxPosition > 0.0f ? maxPosition / 32767.0f : 1.0f;
+    target.normalScale = maxNormal > 0.0f ? maxNormal / 32767.0f : 1.0f;
+
+    target.positionDeltas.resize(target.vertices.size() * 4);
+    if (hasNormals)
+        target.normalDeltas.resize(target.vertices.size() * 4);
+    for (int ii=0; ii<target.vertices.size(); ++ii) {
+        const int vertex = target.vertices[ii];
+        for (int ic=0; ic<3; ++ic) {
+            target.positionDeltas[ii*4+ic] = qint16(qRound((targetPositions[vertex*3+ic] - basePositions[vertex*3+ic]) / target.positionScale));
+            if (hasNormals)
+                target.normalDeltas[ii*4+ic] = qint16(qRound((targetNormals[vertex*3+ic] - baseNormals[vertex*3+ic]) / target.normalScale));
+        }
+        target.positionDeltas[ii*4+3] = 0;
+        if (hasNormals)
+            target.normalDeltas[ii*4+3] = 0;
+    }
+    return target;
+}
+
+void MorphTargets::accumulate(const MorphTarget &target, float weight, float *positions, float *normals)
+{
+    addDeltas(target.vertices.constData(), target.positionDeltas.constData(), target.vertices.size(),
+              weight * target.positionScale, positions);
+    if (normals && !target.normalDeltas.isEmpty()) {
+        addDeltas(target.vertices.constData(), target.normalDeltas.constData(), target.vertices.size(),
+                  weight * target.normalScale, normals);
+    }
+}
+
+qint64 MorphTargets::bytes(const MorphTarget &target)
+{
+    return sizeof(MorphTarget) + qint64(target.vertices.capacity()) * sizeof(quint32)
+            + qint64(target.positionDeltas.capacity() + target.normalDeltas.capacity()) * sizeof(qint16);
+}
+
+void MorphTargets::sampleWeights(const QVector<QSharedPointer<Mesh> > &meshes, const QVector<MorphChannel> &channels,
+                                 double tick, QVector<QVector<MorphWeight> > &weights)
+{
+    weights.resize(meshes.size());
+    for (int im=0; im<meshes.size(); ++im) {
+        weights[im].clear();
+        const QVector<MorphTarget> &targets = meshes[im]->morphTargets;
+        for (int it=0; it<targets.size(); ++it) {
+            if (targets[it].defaultWeight != 0.0f) {
+                MorphWeight weight = { it, targets[it].defaultWeight };
+                weights[im].append(weight);
+            }
+        }
+    }
+
+    for (int ic=0; ic<channels.size(); ++ic) {
+        const MorphChannel &channel = channels[ic];
+        if (channel.keys.isEmpty() || channel.mesh < 0 || channel.mesh >= meshes.size())
+            continue;
+
+        // The last key at or before the tick, the first one before the clip starts
+        QVector<MorphKey>::const_iterator key = std::upper_bound(channel.keys.constBegin(), channel.keys.constEnd(), tick,
+                                                                 [](double t, const MorphKey &k) { return t < k.time; });
+        if (key != channel.keys.constBegin())
+            --key;
+
+        QVector<MorphWeight> &meshWeights = weights[channel.mesh];
+        meshWeights.clear();
+        const int targetCount = meshes[channel.mesh]->morphTargets.size();
+        for (int iw=0; iw<key->weights.size(); ++iw) {
+            if (key->weights[iw].weight != 0.0f && key->weights[iw].target < targetCount)
+                meshWeights.append(key->weights[iw]);
+        }
+    }
+}
+
+MorphDeformer::MorphDeformer()
+{
+
+}
+
+void MorphDeformer::initialize(const QVector<QSharedPointer<Mesh> > &meshes, const QVector<float> &positions,
+                               const QVector<float> &normals)
+{
+    m_meshes.clear();
+    m_meshIndices.clear();
+    for (int im=0; im<meshes.size(); ++im) {
+        if (!meshes[im]->morphTargets.isEmpty()) {
+            m_meshes.append(meshes[im]);
+            m_meshIndices.append(im);
+        }
+    }
+    m_applied = QVector<QVector<MorphWeight> >(m_meshes.size());
+    if (m_meshes.isEmpty())
+        return;
+
+    toXyzw(positions, 1.0f, m_basePositions);
+    if (normals.size() == positions.size())
+        toXyzw(normals, 0.0f, m_baseNormals);
+    else
+        m_baseNormals.clear();
+    m_positions = m_basePositions;
+    m_normals = m_baseNormals;
+}
+
+void MorphDeformer::restore(const Mesh &mesh, const MorphTarget &target, int &first, int &last)
+{
+    for (int ii=0; ii<target.vertices.size(); ++ii) {
+        const int offset = (mesh.vertexOffset + target.vertices[ii]) * 4;
+        memcpy(m_positions.data() + offset, m_basePositions.constData() + offset, 4 * sizeof(float));
+        if (!m_normals.isEmpty())
+            memcpy(m_normals.data() + offset, m_baseNormals.constData() + offset, 4 * sizeof(float));
+    }
+    if (!target.vertices.isEmpty()) {
+        first = qMin(first, int(mesh.vertexOffset + target.vertices.first()));
+        last = qMax(last, int(mesh.vertexOffset + target.vertices.last()));
+    }
+}
+
+bool MorphDeformer::apply(const QVector<QVector<MorphWeight> > &weights, int &firstVertex, int &vertexCount)
+{
+    int first = INT_MAX, last = -1;
+    for (int im=0; im<m_meshes.size(); ++im) {
+        const QVector<MorphWeight> active = weights.value(m_meshIndices[im]);
+        if (sameWeights(active, m_applied[im]))
+            continue;
+
+        const Mesh &mesh = *m_meshes[im];
+        const QVector<MorphWeight> &applied = m_applied[im];
+        for (int iw=0; iw<applied.size(); ++iw)
+            restore(mesh, mesh.morphTargets[applied[iw].target], first, last);
+
+        float *positions = m_positions.data() + mesh.vertexOffset * 4;
+        float *normals = m_normals.isEmpty() ? 0 : m_normals.data() + mesh.vertexOffset * 4;
+        for (int iw=0; iw<active.size(); ++iw) {
+            const MorphTarget &target = mesh.morphTargets[active[iw].target];
+            MorphTargets::accumulate(target, active[iw].weight, positions, normals);
+            if (!target.vertices.isEmpty()) {
+                first = qMin(first, int(mesh.vertexOffset + target.vertices.first()));
+                last = qMax(last, int(mesh.vertexOffset + target.vertices.last()));
+            }
+        }
+        m_applied[im] = active;
+    }
+
+    if (last < 0)
+        return false;
+    firstVertex = first;
+    vertexCount = last - first + 1;
+    return true;
+}
+
+qint64 MorphDeformer::bytes() const
+{
+    return qint64(m_basePositions.capacity() + m_baseNormals.capacity() + m_positions.capacity()
+                  + m_normals.capacity()) * sizeof(float);
+}
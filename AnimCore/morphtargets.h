@@ -0,0 +1,97 @@
+#ifndef MORPHTARGETS_H
+#define MORPHTARGETS_H
+
+#include <QVector>
+#include <QString>
+#include <QSharedPointer>
+
+struct Mesh;
+
+// One blend shape of a mesh, only the vertices it moves are stored.
+// Deltas are quantized to 16 bits against a per target scale and padded to four components, so a
+// vertex is dequantized and added in one SIMD operation.
+struct MorphTarget
+{
+    MorphTarget() : defaultWeight(0.0f), positionScale(0.0f), normalScale(0.0f) {}
+
+    QString name;
+    float defaultWeight;            // used while no animation channel drives the mesh
+    QVector<quint32> vertices;      // mesh relative, ascending
+    QVector<qint16> positionDeltas; // xyz0 per moved vertex, times positionScale
+    QVector<qint16> normalDeltas;   // xyz0 per moved vertex, empty without normals
+    float positionScale;
+    float normalScale;
+};
+
+struct MorphWeight
+{
+    int target;
+    float weight;
+};
+
+// Target weights of one mesh over time, played with step keys like the node channels
+struct MorphKey
+{
+    double time;
+    QVector<MorphWeight> weights;   // targets missing from a key have weight 0
+};
+
+struct MorphChannel
+{
+    int mesh;
+    QVector<MorphKey> keys;         // sorted by time
+};
+
+class MorphTargets
+{
+public:
+    // Sparse target from absolute target positions and normals (either normal array may be 0),
+    // vertices that move less than threshold are left out
+    static MorphTarget build(const QString &name, int vertexCount,
+                             const float *basePositions, const float *targetPositions,
+                             const float *baseNormals, const float *targetNormals,
+                             float threshold = 1e-6f);
+
+    // Adds weight times the target's deltas to xyzw positions and normals of the mesh
+    static void accumulate(const MorphTarget &target, float weight, float *positions, float *normals);
+
+    static qint64 bytes(const MorphTarget &target);
+
+    // Active weights of every mesh at the tick. Meshes without a channel play their targets'
+    // default weights. Zero weights are left out, so playback only touches active targets.
+    static void sampleWeights(const QVector<QSharedPointer<Mesh> > &meshes, const QVector<MorphChannel> &channels,
+                              double tick, QVector<QVector<MorphWeight> > &weights);
+};
+
+// Morphed copy of a model's positions and normals, as xyzw so they can be uploaded as they are.
+// Every apply() first restores the vertices the previous one moved, then adds the active targets,
+// so its cost follows the moved vertices of the active targets, not the size of the model.
+class MorphDeformer
+{
+public:
+    MorphDeformer();
+
+    void initialize(const QVector<QSharedPointer<Mesh> > &meshes, const QVector<float> &positions,
+                    const QVector<float> &normals);
+    bool isEmpty() const { return m_meshes.isEmpty(); }
+
+    // Returns false if nothing changed, otherwise the range of vertices to upload again
+    bool apply(const QVector<QVector<MorphWeight> > &weights, int &firstVertex, int &vertexCount);
+
+    const QVector<float> &positions() const { return m_positions; }
+    const QVector<float> &normals() const { return m_normals; }
+    qint64 bytes() const;
+
+private:
+    void restore(const Mesh &mesh, const MorphTarget &target, int &first, int &last);
+
+    QVector<QSharedPointer<Mesh> > m_meshes;        // only those with targets
+    QVector<int> m_meshIndices;                     // into the weights passed to apply()
+    QVector<float> m_basePositions;
+    QVector<float> m_baseNormals;
+    QVector<float> m_positions;
+    QVector<float> m_normals;
+    QVector<QVector<MorphWeight> > m_applied;       // per entry of m_meshes
+};
+
+#endif // MORPHTARGETS_H
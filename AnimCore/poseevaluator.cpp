@@ -0,0 +1,70 @@
+#include "poseevaluator.h"
+
+PoseEvaluator::PoseEvaluator()
+{
+
+}
+
+bool PoseEvaluator::initialize(QSharedPointer<ModelLoader> model)
+{
+    m_model = model;
+    if (!m_model || !m_model->getNodeData())
+        return false;
+
+    const QSharedPointer<Node> rootNode = m_model->getNodeData();
+    m_skeleton.setClipLibrary(m_model->getClipLibrary());
+    m_skeleton.build(rootNode.data());
+    m_skeleton.setAnimation(-1);
+    m_inverseRoot = rootNode->transformation.inverted();
+
+    const QVector<QSharedPointer<Mesh> > meshes = m_model->getMeshes();
+    m_boneJoints.resize(meshes.size());
+    m_boneOffsets.resize(meshes.size());
+    m_palettes.resize(meshes.size());
+    for (int im=0; im<meshes.size(); ++im) {
+        const Mesh &mesh = *meshes.at(im);
+        m_boneJoints[im].resize(mesh.boneNames.size());
+        m_boneOffsets[im] = mesh.boneOffsets;
+        // Bones without a joint never move
+        m_palettes[im].fill(Affine3x4::identity(), mesh.boneNames.size());
+        for (int ii=0; ii<mesh.boneNames.size(); ++ii)
+            m_boneJoints[im][ii] = m_skeleton.jointIndex(mesh.boneNames[ii]);
+    }
+    return true;
+}
+
+void PoseEvaluator::setAnimation(int animation)
+{
+    if (m_model && animation >= m_model->getNodeAnimations().size())
+        animation = -1;
+    m_skeleton.setAnimation(animation);
+}
+
+void PoseEvaluator::evaluate(double tick)
+{
+    if (!m_model)
+        return;
+
+    // Static subtrees keep their world matrices, so only bones below animated or moved nodes change
+    m_skeleton.update(tick);
+
+    for (int im=0; im<m_palettes.size(); ++im) {
+        const QVector<int> &joints = m_boneJoints[im];
+        const QVector<Affine3x4> &boneOffsets = m_boneOffsets[im];
+
+        for (int ii=0; ii<joints.size(); ++ii) {
+            if (joints[ii] == -1 || !m_skeleton.worldChanged(joints[ii]))
+                continue;
+
+            Affine3x4 &palette = m_palettes[im][ii];
+            PoseKernels::multiply(m_inverseRoot, m_skeleton.worldMatrix(joints[ii]), palette);
+            PoseKernels::multiply(palette, boneOffsets[ii], palette);
+        }
+    }
+}
+
+void PoseEvaluator::sampleMorphWeights(double tick, QVector<QVector<MorphWeight> > &weights) const
+{
+    if (m_model)
+        MorphTargets::sampleWeights(m_model->getMeshes(), m_model->morphChannels(m_skeleton.animation()), tick, weights);
+}
@@ -0,0 +1,50 @@
+#ifndef POSEEVALUATOR_H
+#define POSEEVALUATOR_H
+
+#include <QVector>
+#include <QSharedPointer>
+#include "modelloader.h"
+#include "skeleton.h"
+#include "morphtargets.h"
+
+// Skinning palettes of every mesh of a model at any clip position, without a GL context or a
+// window. The renderers upload what it produces, headless tools use it directly.
+// Not thread safe, but evaluators of the same model on different threads don't share any state.
+class PoseEvaluator
+{
+public:
+    PoseEvaluator();
+
+    // Binds to the model's skeleton and bones, the model is kept alive by the evaluator
+    bool initialize(QSharedPointer<ModelLoader> model);
+    bool isValid() const { return !m_model.isNull(); }
+    QSharedPointer<ModelLoader> model() const { return m_model; }
+
+    // -1 for the bind pose
+    void setAnimation(int animation);
+    int animation() const { return m_skeleton.animation(); }
+
+    // Poses the skeleton at the tick, only palette entries of bones that moved are rebuilt
+    void evaluate(double tick);
+
+    // Of every mesh, indexed like its boneNames. They map bind space into the model's space without
+    // its root transformation. Implicitly shared, handing out an unchanged pose copies nothing.
+    const QVector<QVector<Affine3x4> > &palettes() const { return m_palettes; }
+
+    // Blend shape weights of the current clip at the tick
+    void sampleMorphWeights(double tick, QVector<QVector<MorphWeight> > &weights) const;
+
+    // For nodes moved by hand, see Skeleton::setLocalTransformation()
+    Skeleton &skeleton() { return m_skeleton; }
+    const Skeleton &skeleton() const { return m_skeleton; }
+
+private:
+    QSharedPointer<ModelLoader> m_model;
+    Skeleton m_skeleton;
+    Affine3x4 m_inverseRoot;
+    QVector<QVector<int> > m_boneJoints;            // skeleton joint of every mesh bone, -1 if missing
+    QVector<QVector<Affine3x4> > m_boneOffsets;
+    QVector<QVector<Affine3x4> > m_palettes;       // only entries of changed joints are rebuilt
+};
+
+#endif // POSEEVALUATOR_H
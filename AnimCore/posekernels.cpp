@@ -0,0 +1,304 @@
+#include "posekernels.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define POSEKERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Scalar versions, also used for the leftovers of the vector loops
+
+inline void composeOne(const TrsArrays &trs, int i, Affine3x4 &out)
+{
+    const float x = trs.qx[i], y = trs.qy[i], z = trs.qz[i], w = trs.qw[i];
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float xw = x * w, yw = y * w, zw = z * w;
+    const float sx = trs.sx[i], sy = trs.sy[i], sz = trs.sz[i];
+
+    float *m = out.m;
+    m[0] = (1.0f - 2.0f * (yy + zz)) * sx;
+    m[1] = 2.0f * (xy - zw) * sy;
+    m[2] = 2.0f * (xz + yw) * sz;
+    m[3] = trs.tx[i];
+    m[4] = 2.0f * (xy + zw) * sx;
+    m[5] = (1.0f - 2.0f * (xx + zz)) * sy;
+    m[6] = 2.0f * (yz - xw) * sz;
+    m[7] = trs.ty[i];
+    m[8] = 2.0f * (xz - yw) * sx;
+    m[9] = 2.0f * (yz + xw) * sy;
+    m[10] = (1.0f - 2.0f * (xx + yy)) * sz;
+    m[11] = trs.tz[i];
+}
+
+inline void multiplyOne(const Affine3x4 &a, const Affine3x4 &b, Affine3x4 &out)
+{
+    Affine3x4 r;
+    for (int row=0; row<3; ++row) {
+        const float *ar = a.m + row * 4;
+        for (int col=0; col<4; ++col)
+            r.m[row * 4 + col] = ar[0] * b.m[col] + ar[1] * b.m[4 + col] + ar[2] * b.m[8 + col];
+        r.m[row * 4 + 3] += ar[3];
+    }
+    out = r;
+}
+
+void composeTrsScalar(const TrsArrays &trs, int begin, int count, Affine3x4 *out, const int *outIndex)
+{
+    for (int i=begin; i<count; ++i)
+        composeOne(trs, i, out[outIndex ? outIndex[i] : i]);
+}
+
+void multiplyParentsScalar(Affine3x4 *world, const Affine3x4 *local, const int *parents,
+                           const int *joints, int count)
+{
+    for (int i=0; i<count; ++i) {
+        const int joint = joints[i];
+        multiplyOne(world[parents[joint]], local[joint], world[joint]);
+    }
+}
+
+#ifdef POSEKERNELS_X86
+
+// Writes the rows of four joints computed lane wise, a 4x4 transpose per row
+__attribute__((target("sse4.1")))
+inline void storeRows4(__m128 m00, __m128 m01, __m128 m02, __m128 m03,
+                       __m128 m10, __m128 m11, __m128 m12, __m128 m13,
+                       __m128 m20, __m128 m21, __m128 m22, __m128 m23,
+                       int i, Affine3x4 *out, const int *outIndex)
+{
+    _MM_TRANSPOSE4_PS(m00, m01, m02, m03);
+    _MM_TRANSPOSE4_PS(m10, m11, m12, m13);
+    _MM_TRANSPOSE4_PS(m20, m21, m22, m23);
+
+    const __m128 rows0[4] = { m00, m01, m02, m03 };
+    const __m128 rows1[4] = { m10, m11, m12, m13 };
+    const __m128 rows2[4] = { m20, m21, m22, m23 };
+    for (int lane=0; lane<4; ++lane) {
+        float *m = out[outIndex ? outIndex[i + lane] : i + lane].m;
+        _mm_storeu_ps(m, rows0[lane]);
+        _mm_storeu_ps(m + 4, rows1[lane]);
+        _mm_storeu_ps(m + 8, rows2[lane]);
+    }
+}
+
+__attribute__((target("sse4.1")))
+int composeTrsSse41(const TrsArrays &trs, int count, Affine3x4 *out, const int *outIndex)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 x = _mm_loadu_ps(trs.qx + i), y = _mm_loadu_ps(trs.qy + i);
+        const __m128 z = _mm_loadu_ps(trs.qz + i), w = _mm_loadu_ps(trs.qw + i);
+        const __m128 sx = _mm_loadu_ps(trs.sx + i), sy = _mm_loadu_ps(trs.sy + i), sz = _mm_loadu_ps(trs.sz + i);
+
+        const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        const __m128 xw = _mm_mul_ps(x, w), yw = _mm_mul_ps(y, w), zw = _mm_mul_ps(z, w);
+
+        storeRows4(_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+                   _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, zw)), sy),
+                   _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, yw)), sz),
+                   _mm_loadu_ps(trs.tx + i),
+                   _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, zw)), sx),
+                   _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+                   _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, xw)), sz),
+                   _mm_loadu_ps(trs.ty + i),
+                   _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, yw)), sx),
+                   _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, xw)), sy),
+                   _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz),
+                   _mm_loadu_ps(trs.tz + i),
+                   i, out, outIndex);
+    }
+    return i;
+}
+
+__attribute__((target("sse4.1")))
+void multiplyParentsSse41(Affine3x4 *world, const Affine3x4 *local, const int *parents,
+                          const int *joints, int count)
+{
+    // Row wise on the stored matrices rather than lane wise over several joints like composeTrs.
+    // World and local matrices are stored per joint and the parents are gathered by index, so a
+    // structure of arrays batch needs a 4x4 transpose per row of every parent and local, and again
+    // for the results. Measured on a level of 96 joints that costs more than it saves, about 18 ns
+    // per joint against 11 ns for this version. composeTrs gets its input as arrays already.
+    // Each result row is a combination of the local rows, weighted by one row of the parent.
+    for (int i=0; i<count; ++i) {
+        const int joint = joints[i];
+        const float *p = world[parents[joint]].m;
+        const float *l = local[joint].m;
+        const __m128 l0 = _mm_loadu_ps(l), l1 = _mm_loadu_ps(l + 4), l2 = _mm_loadu_ps(l + 8);
+        const __m128 zero = _mm_setzero_ps();
+
+        __m128 rows[3];
+        for (int row=0; row<3; ++row) {
+            const __m128 pr = _mm_loadu_ps(p + row * 4);
+            __m128 r = _mm_blend_ps(zero, pr, 0x8);     // parent translation goes to w only
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(pr, pr, _MM_SHUFFLE(0, 0, 0, 0)), l0));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(pr, pr, _MM_SHUFFLE(1, 1, 1, 1)), l1));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(pr, pr, _MM_SHUFFLE(2, 2, 2, 2)), l2));
+            rows[row] = r;
+        }
+
+        float *w = world[joint].m;
+        _mm_storeu_ps(w, rows[0]);
+        _mm_storeu_ps(w + 4, rows[1]);
+        _mm_storeu_ps(w + 8, rows[2]);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+int composeTrsAvx2(const TrsArrays &trs, int count, Affine3x4 *out, const int *outIndex)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 x = _mm256_loadu_ps(trs.qx + i), y = _mm256_loadu_ps(trs.qy + i);
+        const __m256 z = _mm256_loadu_ps(trs.qz + i), w = _mm256_loadu_ps(trs.qw + i);
+        const __m256 sx = _mm256_loadu_ps(trs.sx + i), sy = _mm256_loadu_ps(trs.sy + i), sz = _mm256_loadu_ps(trs.sz + i);
+
+        const __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+        const __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+        const __m256 xw = _mm256_mul_ps(x, w), yw = _mm256_mul_ps(y, w), zw = _mm256_mul_ps(z, w);
+
+        __m256 m[12];
+        m[0] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), sx);
+        m[1] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, zw)), sy);
+        m[2] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, yw)), sz);
+        m[3] = _mm256_loadu_ps(trs.tx + i);
+        m[4] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, zw)), sx);
+        m[5] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), sy);
+        m[6] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, xw)), sz);
+        m[7] = _mm256_loadu_ps(trs.ty + i);
+        m[8] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, yw)), sx);
+        m[9] = _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, xw)), sy);
+        m[10] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))), sz);
+        m[11] = _mm256_loadu_ps(trs.tz + i);
+
+        // The transposes are 4 wide, so the two halves are stored separately
+        __m128 lo[12], hi[12];
+        for (int k=0; k<12; ++k) {
+            lo[k] = _mm256_castps256_ps128(m[k]);
+            hi[k] = _mm256_extractf128_ps(m[k], 1);
+        }
+        storeRows4(lo[0], lo[1], lo[2], lo[3], lo[4], lo[5], lo[6], lo[7], lo[8], lo[9], lo[10], lo[11],
+                   i, out, outIndex);
+        storeRows4(hi[0], hi[1], hi[2], hi[3], hi[4], hi[5], hi[6], hi[7], hi[8], hi[9], hi[10], hi[11],
+                   i + 4, out, outIndex);
+    }
+    return i;
+}
+
+__attribute__((target("avx2,fma")))
+void multiplyParentsAvx2(Affine3x4 *world, const Affine3x4 *local, const int *parents,
+                         const int *joints, int count)
+{
+    // Row wise for the same reason as the SSE4.1 version, 5 ns per joint in the same measurement.
+    // Rows one and two of the result are computed together in one 256 bit register.
+    for (int i=0; i<count; ++i) {
+        const int joint = joints[i];
+        const float *p = world[parents[joint]].m;
+        const float *l = local[joint].m;
+        const __m128 l0 = _mm_loadu_ps(l), l1 = _mm_loadu_ps(l + 4), l2 = _mm_loadu_ps(l + 8);
+        const __m256 l0x2 = _mm256_set_m128(l0, l0);
+        const __m256 l1x2 = _mm256_set_m128(l1, l1);
+        const __m256 l2x2 = _mm256_set_m128(l2, l2);
+
+        const __m256 p01 = _mm256_loadu_ps(p);
+        __m256 r01 = _mm256_blend_ps(_mm256_setzero_ps(), p01, 0x88);
+        r01 = _mm256_fmadd_ps(_mm256_permute_ps(p01, _MM_SHUFFLE(0, 0, 0, 0)), l0x2, r01);
+        r01 = _mm256_fmadd_ps(_mm256_permute_ps(p01, _MM_SHUFFLE(1, 1, 1, 1)), l1x2, r01);
+        r01 = _mm256_fmadd_ps(_mm256_permute_ps(p01, _MM_SHUFFLE(2, 2, 2, 2)), l2x2, r01);
+
+        const __m128 p2 = _mm_loadu_ps(p + 8);
+        __m128 r2 = _mm_blend_ps(_mm_setzero_ps(), p2, 0x8);
+        r2 = _mm_fmadd_ps(_mm_permute_ps(p2, _MM_SHUFFLE(0, 0, 0, 0)), l0, r2);
+        r2 = _mm_fmadd_ps(_mm_permute_ps(p2, _MM_SHUFFLE(1, 1, 1, 1)), l1, r2);
+        r2 = _mm_fmadd_ps(_mm_permute_ps(p2, _MM_SHUFFLE(2, 2, 2, 2)), l2, r2);
+
+        float *w = world[joint].m;
+        _mm256_storeu_ps(w, r01);
+        _mm_storeu_ps(w + 8, r2);
+    }
+}
+
+#endif // POSEKERNELS_X86
+
+PoseKernels::Isa detectIsa()
+{
+#ifdef POSEKERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return PoseKernels::Isa_Avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return PoseKernels::Isa_Sse41;
+#endif
+    return PoseKernels::Isa_Scalar;
+}
+
+PoseKernels::Isa &currentIsa()
+{
+    static PoseKernels::Isa isa = detectIsa();
+    return isa;
+}
+
+}
+
+PoseKernels::Isa PoseKernels::bestIsa()
+{
+    static const Isa best = detectIsa();
+    return best;
+}
+
+PoseKernels::Isa PoseKernels::isa()
+{
+    return currentIsa();
+}
+
+void PoseKernels::setIsa(Isa isa)
+{
+    currentIsa() = isa < bestIsa() ? isa : bestIsa();
+}
+
+const char *PoseKernels::isaName(Isa isa)
+{
+    switch (isa) {
+    case Isa_Avx2:  return "AVX2";
+    case Isa_Sse41: return "SSE4.1";
+    default:        return "scalar";
+    }
+}
+
+void PoseKernels::composeTrs(const TrsArrays &trs, int count, Affine3x4 *out, const int *outIndex)
+{
+    int done = 0;
+#ifdef POSEKERNELS_X86
+    if (currentIsa() == Isa_Avx2)
+        done = composeTrsAvx2(trs, count, out, outIndex);
+    else if (currentIsa() == Isa_Sse41)
+        done = composeTrsSse41(trs, count, out, outIndex);
+#endif
+    composeTrsScalar(trs, done, count, out, outIndex);
+}
+
+void PoseKernels::multiplyParents(Affine3x4 *world, const Affine3x4 *local, const int *parents,
+                                  const int *joints, int count)
+{
+#ifdef POSEKERNELS_X86
+    if (currentIsa() == Isa_Avx2)
+        return multiplyParentsAvx2(world, local, parents, joints, count);
+    if (currentIsa() == Isa_Sse41)
+        return multiplyParentsSse41(world, local, parents, joints, count);
+#endif
+    multiplyParentsScalar(world, local, parents, joints, count);
+}
+
+void PoseKernels::multiply(const Affine3x4 &a, const Affine3x4 &b, Affine3x4 &out)
+{
+    multiplyOne(a, b, out);
+}
@@ -0,0 +1,42 @@
+#ifndef POSEKERNELS_H
+#define POSEKERNELS_H
+
+#include "mathtypes.h"
+
+// Translation, rotation (unit quaternion) and scale of many joints as structure of arrays
+struct TrsArrays
+{
+    const float *tx, *ty, *tz;
+    const float *qx, *qy, *qz, *qw;
+    const float *sx, *sy, *sz;
+};
+
+// Batch kernels for pose evaluation, with SSE4.1 and AVX2/FMA versions picked at runtime on x86
+// and a scalar version everywhere else. All versions produce the same results as
+// Affine3x4::fromTrs() and Affine3x4::operator*() up to float rounding.
+namespace PoseKernels
+{
+    enum Isa {
+        Isa_Scalar,
+        Isa_Sse41,
+        Isa_Avx2
+    };
+
+    Isa bestIsa();                  // best one this CPU supports
+    Isa isa();                      // the one currently used
+    void setIsa(Isa isa);           // clamped to bestIsa(), for benchmarks and comparisons
+    const char *isaName(Isa isa);
+
+    // out[outIndex[i]] = T(i) * R(i) * S(i) for i < count, outIndex may be 0 for out[i]
+    void composeTrs(const TrsArrays &trs, int count, Affine3x4 *out, const int *outIndex);
+
+    // world[j] = world[parents[j]] * local[j] for each j in joints.
+    // Meant for one hierarchy level at a time, so the parents are final and nothing aliases.
+    void multiplyParents(Affine3x4 *world, const Affine3x4 *local, const int *parents,
+                         const int *joints, int count);
+
+    // out = a * b, out may alias either input
+    void multiply(const Affine3x4 &a, const Affine3x4 &b, Affine3x4 &out);
+}
+
+#endif // POSEKERNELS_H
@@ -0,0 +1,308 @@
+#include "posepublisher.h"
+#include "poseevaluator.h"
+#include <QDebug>
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#if defined(Q_OS_UNIX)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const quint32 SegmentMagic = 0x41335053;     // "A3PS"
+const quint32 SegmentVersion = 2;
+
+// Shared by processes that may have been built differently, so only fixed size fields
+struct SegmentHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 slotCount;
+    quint32 slotBytes;
+    quint32 jointCount;
+    quint32 meshCount;
+    quint32 paletteCount;           // matrices of all meshes together
+    quint32 slotOffset;             // of the first slot, the palette offsets come before it
+    std::atomic<quint64> published; // frames completely written
+};
+
+struct SlotHeader
+{
+    std::atomic<quint64> sequence;  // odd while the slot is written
+    quint64 frame;
+    double tick;
+    qint32 animation;
+    quint32 reserved;
+};
+
+const int SlotHeaderBytes = (sizeof(SlotHeader) + 15) & ~15;
+
+quint32 slotBytes(quint32 jointCount, quint32 paletteCount)
+{
+    const quint32 bytes = SlotHeaderBytes + (jointCount + paletteCount) * sizeof(Affine3x4);
+    return (bytes + 63) & ~63u;     // slots don't share cache lines
+}
+
+QByteArray segmentName(const QString &name)
+{
+    return name.startsWith('/') ? name.toUtf8() : '/' + name.toUtf8();
+}
+
+}
+
+PosePublisher::PosePublisher() :
+    m_memory(0)
+  , m_bytes(0)
+  , m_frames(0)
+{
+
+}
+
+PosePublisher::~PosePublisher()
+{
+    close();
+}
+
+bool PosePublisher::open(const QString &name, const PoseEvaluator &pose, int slotCount)
+{
+    close();
+#if defined(Q_OS_UNIX)
+    if (!pose.isValid() || slotCount < 2 || !std::atomic<quint64>().is_lock_free()) {
+        qDebug() << "Error: Unable to publish poses of this model";
+        return false;
+    }
+
+    const quint32 jointCount = pose.skeleton().jointCount();
+    const QVector<QVector<Affine3x4> > &palettes = pose.palettes();
+    QVector<quint32> paletteOffsets(palettes.size() + 1);
+    for (int im=0; im<palettes.size(); ++im)
+        paletteOffsets[im + 1] = paletteOffsets[im] + palettes[im].size();
+
+    const quint32 slotOffset = (sizeof(SegmentHeader) + paletteOffsets.size() * sizeof(quint32) + 63) & ~63u;
+    const quint32 bytesPerSlot = slotBytes(jointCount, paletteOffsets.last());
+    const qint64 bytes = slotOffset + qint64(slotCount) * bytesPerSlot;
+
+    const QByteArray segment = segmentName(name);
+    shm_unlink(segment.constData());
+    const int fd = shm_open(segment.constData(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1 || ftruncate(fd, bytes) != 0) {
+        qDebug() << "Error: Unable to create shared memory segment" << segment;
+        if (fd != -1) {
+            ::close(fd);
+            shm_unlink(segment.constData());
+        }
+        return false;
+    }
+    void *memory = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        qDebug() << "Error: Unable to map shared memory segment" << segment;
+        shm_unlink(segment.constData());
+        return false;
+    }
+
+    m_name = segment;
+    m_memory = static_cast<uchar*>(memory);
+    m_bytes = bytes;
+    m_frames = 0;
+
+    // The layout goes in before the magic, so readers never see a half initialized header
+    SegmentHeader *header = new (m_memory) SegmentHeader;
+    header->version = SegmentVersion;
+    header->slotCount = slotCount;
+    header->slotBytes = bytesPerSlot;
+    header->jointCount = jointCount;
+    header->meshCount = palettes.size();
+    header->paletteCount = paletteOffsets.last();
+    header->slotOffset = slotOffset;
+    header->published.store(0, std::memory_order_relaxed);
+    memcpy(m_memory + sizeof(SegmentHeader), paletteOffsets.constData(), paletteOffsets.size() * sizeof(quint32));
+    for (int is=0; is<slotCount; ++is) {
+        SlotHeader *slot = new (m_memory + slotOffset + is * bytesPerSlot) SlotHeader;
+        slot->sequence.store(0, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SegmentMagic;
+    return true;
+#else
+    Q_UNUSED(name);
+    Q_UNUSED(pose);
+    Q_UNUSED(slotCount);
+    qDebug() << "Error: Shared memory pose publishing needs POSIX shared memory";
+    return false;
+#endif
+}
+
+void PosePublisher::close()
+{
+#if defined(Q_OS_UNIX)
+    if (m_memory) {
+        munmap(m_memory, m_bytes);
+        shm_unlink(m_name.constData());
+    }
+#endif
+    m_memory = 0;
+    m_bytes = 0;
+}
+
+void PosePublisher::publish(const PoseEvaluator &pose, double tick)
+{
+    if (!m_memory)
+        return;
+
+    SegmentHeader *header = reinterpret_cast<SegmentHeader*>(m_memory);
+    const QVector<QVector<Affine3x4> > &palettes = pose.palettes();
+    if (int(header->jointCount) != pose.skeleton().jointCount() || int(header->meshCount) != palettes.size()) {
+        qDebug() << "Error: Pose doesn't fit the shared memory segment" << m_name;
+        return;
+    }
+
+    uchar *slotData = m_memory + header->slotOffset + (m_frames % header->slotCount) * header->slotBytes;
+    SlotHeader *slot = reinterpret_cast<SlotHeader*>(slotData);
+
+    // Odd while writing, readers that started on this slot will see the count move on and retry
+    const quint64 sequence = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->frame = m_frames;
+    slot->tick = tick;
+    slot->animation = pose.animation();
+
+    Affine3x4 *joints = reinterpret_cast<Affine3x4*>(slotData + SlotHeaderBytes);
+    for (quint32 ij=0; ij<header->jointCount; ++ij)
+        joints[ij] = pose.skeleton().worldMatrix(ij);
+
+    const quint32 *paletteOffsets = reinterpret_cast<const quint32*>(m_memory + sizeof(SegmentHeader));
+    Affine3x4 *matrices = joints + header->jointCount;
+    for (int im=0; im<palettes.size(); ++im) {
+        const QVector<Affine3x4> &palette = palettes[im];
+        const int count = qMin(palette.size(), int(paletteOffsets[im + 1] - paletteOffsets[im]));
+        memcpy(matrices + paletteOffsets[im], palette.constData(), count * sizeof(Affine3x4));
+    }
+
+    slot->sequence.store(sequence + 2, std::memory_order_release);
+    ++m_frames;
+    header->published.store(m_frames, std::memory_order_release);
+}
+
+PoseReader::PoseReader() :
+    m_memory(0)
+  , m_bytes(0)
+{
+
+}
+
+PoseReader::~PoseReader()
+{
+    close();
+}
+
+bool PoseReader::open(const QString &name)
+{
+    close();
+#if defined(Q_OS_UNIX)
+    const QByteArray segment = segmentName(name);
+    const int fd = shm_open(segment.constData(), O_RDONLY, 0);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) != 0 || info.st_size < qint64(sizeof(SegmentHeader))) {
+        qDebug() << "Error: Unable to open shared memory segment" << segment;
+        if (fd != -1)
+            ::close(fd);
+        return false;
+    }
+    void *memory = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        qDebug() << "Error: Unable to map shared memory segment" << segment;
+        return false;
+    }
+
+    m_memory = static_cast<const uchar*>(memory);
+    m_bytes = info.st_size;
+
+    const SegmentHeader *header = reinterpret_cast<const SegmentHeader*>(m_memory);
+    const bool valid = header->magic == SegmentMagic && header->version == SegmentVersion;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!valid || header->slotCount == 0
+            || header->slotOffset + qint64(header->slotCount) * header->slotBytes > m_bytes) {
+        qDebug() << "Error: Not a pose segment" << segment;
+        close();
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(name);
+    qDebug() << "Error: Shared memory pose reading needs POSIX shared memory";
+    return false;
+#endif
+}
+
+void PoseReader::close()
+{
+#if defined(Q_OS_UNIX)
+    if (m_memory)
+        munmap(const_cast<uchar*>(m_memory), m_bytes);
+#endif
+    m_memory = 0;
+    m_bytes = 0;
+}
+
+quint64 PoseReader::framesPublished() const
+{
+    if (!m_memory)
+        return 0;
+    return reinterpret_cast<const SegmentHeader*>(m_memory)->published.load(std::memory_order_acquire);
+}
+
+bool PoseReader::begin(PoseView &view) const
+{
+    if (!m_memory)
+        return false;
+
+    const SegmentHeader *header = reinterpret_cast<const SegmentHeader*>(m_memory);
+
+    // A slot is only odd here when the publisher lapped the whole ring since the header was read
+    for (int attempt=0; attempt<4; ++attempt) {
+        const quint64 published = header->published.load(std::memory_order_acquire);
+        if (published == 0)
+            return false;
+
+        const int slotIndex = (published - 1) % header->slotCount;
+        const uchar *slotData = m_memory + header->slotOffset + slotIndex * header->slotBytes;
+        const SlotHeader *slot = reinterpret_cast<const SlotHeader*>(slotData);
+        const quint64 sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+            continue;
+
+        view.slot = slotIndex;
+        view.sequence = sequence;
+        view.frame = slot->frame;
+        view.tick = slot->tick;
+        view.animation = slot->animation;
+        view.jointCount = header->jointCount;
+        view.joints = reinterpret_cast<const Affine3x4*>(slotData + SlotHeaderBytes);
+        view.meshCount = header->meshCount;
+        view.paletteOffsets = reinterpret_cast<const quint32*>(m_memory + sizeof(SegmentHeader));
+        view.palettes = view.joints + header->jointCount;
+        return true;
+    }
+    return false;
+}
+
+bool PoseReader::finish(const PoseView &view) const
+{
+    if (!m_memory)
+        return false;
+
+    // Everything read from the slot happens before the second look at its sequence
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const SegmentHeader *header = reinterpret_cast<const SegmentHeader*>(m_memory);
+    const SlotHeader *slot = reinterpret_cast<const SlotHeader*>(m_memory + header->slotOffset + view.slot * header->slotBytes);
+    return slot->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
@@ -0,0 +1,95 @@
+#ifndef POSEPUBLISHER_H
+#define POSEPUBLISHER_H
+
+#include <QString>
+#include <QByteArray>
+#include "posekernels.h"
+
+class PoseEvaluator;
+
+// Evaluated poses shared with other processes through a POSIX shared memory segment. The segment
+// is a ring of frame slots, each guarded by a sequence number that is odd while the slot is being
+// written (a seqlock). The publisher never waits for anyone, readers find the newest complete frame
+// through the segment header, read it in place and check the sequence afterwards to see if the
+// publisher lapped them meanwhile. Unix only, open() fails elsewhere.
+//
+// Every slot holds the world matrix of every joint of the skeleton in joint order, followed by the
+// palettes of every mesh, all of them as Affine3x4.
+class PosePublisher
+{
+public:
+    PosePublisher();
+    ~PosePublisher();
+
+    // Creates the segment, replacing one of the same name, sized for the evaluator's model. Readers
+    // have slotCount - 1 frames of time to read a frame before it's overwritten.
+    bool open(const QString &name, const PoseEvaluator &pose, int slotCount = 4);
+    // Removes the segment, readers that mapped it keep their mapping
+    void close();
+    bool isOpen() const { return m_memory != 0; }
+
+    // Writes the evaluator's current pose into the next slot
+    void publish(const PoseEvaluator &pose, double tick);
+    quint64 framesPublished() const { return m_frames; }
+
+private:
+    Q_DISABLE_COPY(PosePublisher)
+
+    QByteArray m_name;
+    uchar *m_memory;
+    qint64 m_bytes;
+    quint64 m_frames;
+};
+
+// One frame inside a reader's mapping. The pointers stay valid while the reader is open, the data
+// only until the publisher comes around the ring again, see PoseReader::finish().
+struct PoseView
+{
+    PoseView() : frame(0), tick(0.0), animation(-1), jointCount(0), joints(0), meshCount(0),
+        paletteOffsets(0), palettes(0), slot(0), sequence(0) {}
+
+    quint64 frame;
+    double tick;
+    int animation;
+
+    int jointCount;
+    const Affine3x4 *joints;
+
+    int meshCount;
+    const quint32 *paletteOffsets;      // meshCount + 1, in matrices
+    const Affine3x4 *palettes;
+
+    int paletteSize(int mesh) const { return paletteOffsets[mesh + 1] - paletteOffsets[mesh]; }
+    const Affine3x4 *palette(int mesh) const { return palettes + paletteOffsets[mesh]; }
+
+    int slot;
+    quint64 sequence;
+};
+
+class PoseReader
+{
+public:
+    PoseReader();
+    ~PoseReader();
+
+    bool open(const QString &name);
+    void close();
+    bool isOpen() const { return m_memory != 0; }
+
+    // The newest complete frame, without copying it. False until something was published.
+    bool begin(PoseView &view) const;
+    // Whether the frame stayed untouched while it was read. If not, whatever was read from the view
+    // may be torn and has to be thrown away, begin() again for a newer frame.
+    bool finish(const PoseView &view) const;
+
+    // Frames published so far, 0 for none
+    quint64 framesPublished() const;
+
+private:
+    Q_DISABLE_COPY(PoseReader)
+
+    const uchar *m_memory;
+    qint64 m_bytes;
+};
+
+#endif // POSEPUBLISHER_H
@@ -0,0 +1,342 @@
+#include "posestream.h"
+#include <QDebug>
+#include <cstring>
+
+namespace {
+
+const quint32 StreamMagic = 0x41335053;     // "A3PS"
+const quint32 StreamVersion = 1;
+
+// Column major elements of the affine part, the last row is always 0 0 0 1
+const int AffineElements[12] = { 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14 };
+
+// Element of the full 4x4 matrix at a column major index
+float columnMajor(const Affine3x4 &matrix, int index)
+{
+    const int row = index % 4, col = index / 4;
+    if (row == 3)
+        return col == 3 ? 1.0f : 0.0f;
+    return matrix.m[row * 4 + col];
+}
+
+void setColumnMajor(Affine3x4 &matrix, int index, float value)
+{
+    const int row = index % 4, col = index / 4;
+    if (row < 3)
+        matrix.m[row * 4 + col] = value;
+}
+
+quint32 floatBits(float value)
+{
+    quint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float bitsFloat(quint32 bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+quint32 fnv(quint32 word, quint32 hash)
+{
+    for (int ii=0; ii<4; ++ii) {
+        hash ^= (word >> (ii * 8)) & 0xff;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void writeVarint(QByteArray &out, quint32 value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+bool readVarint(const QByteArray &in, int &pos, quint32 &value)
+{
+    value = 0;
+    for (int shift=0; shift<35; shift+=7) {
+        if (pos >= in.size())
+            return false;
+        const quint8 byte = quint8(in[pos++]);
+        value |= quint32(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// Frame laid out as words: animation, tick, instance and mesh counts, bone counts, instance
+// matrices, palettes, checksum
+void toWords(const PoseFrame &frame, QVector<quint32> &words)
+{
+    words.clear();
+    quint64 tick;
+    memcpy(&tick, &frame.tick, sizeof(tick));
+    words << quint32(frame.animation) << quint32(tick) << quint32(tick >> 32)
+          << quint32(frame.instanceMatrices.size()) << quint32(frame.palettes.size());
+    for (int im=0; im<frame.palettes.size(); ++im)
+        words << quint32(frame.palettes[im].size());
+
+    for (int ii=0; ii<frame.instanceMatrices.size(); ++ii) {
+        for (int ie=0; ie<16; ++ie)
+            words << floatBits(columnMajor(frame.instanceMatrices[ii], ie));
+    }
+    for (int im=0; im<frame.palettes.size(); ++im) {
+        for (int ib=0; ib<frame.palettes[im].size(); ++ib) {
+            for (int ie=0; ie<12; ++ie)
+                words << floatBits(columnMajor(frame.palettes[im][ib], AffineElements[ie]));
+        }
+    }
+    words << frame.checksum;
+}
+
+bool fromWords(const QVector<quint32> &words, PoseFrame &frame)
+{
+    int pos = 0;
+    if (words.size() < 6)
+        return false;
+
+    frame.animation = int(words[pos++]);
+    const quint64 tick = quint64(words[pos]) | (quint64(words[pos+1]) << 32);
+    pos += 2;
+    memcpy(&frame.tick, &tick, sizeof(tick));
+    const int instanceCount = int(words[pos++]);
+    const int meshCount = int(words[pos++]);
+    if (instanceCount < 0 || meshCount < 0 || pos + meshCount > words.size())
+        return false;
+
+    QVector<int> boneCounts(meshCount);
+    qint64 needed = pos + meshCount + qint64(instanceCount) * 16 + 1;
+    for (int im=0; im<meshCount; ++im) {
+        boneCounts[im] = int(words[pos++]);
+        needed += qint64(boneCounts[im]) * 12;
+    }
+    if (needed != words.size())
+        return false;
+
+    frame.instanceMatrices.resize(instanceCount);
+    for (int ii=0; ii<instanceCount; ++ii) {
+        for (int ie=0; ie<16; ++ie)
+            setColumnMajor(frame.instanceMatrices[ii], ie, bitsFloat(words[pos++]));
+    }
+
+    frame.palettes.resize(meshCount);
+    for (int im=0; im<meshCount; ++im) {
+        frame.palettes[im].resize(boneCounts[im]);
+        for (int ib=0; ib<boneCounts[im]; ++ib) {
+            for (int ie=0; ie<12; ++ie)
+                setColumnMajor(frame.palettes[im][ib], AffineElements[ie], bitsFloat(words[pos++]));
+        }
+    }
+    frame.checksum = words[pos];
+    return true;
+}
+
+}
+
+quint32 PoseStream::checksum(const QVector<QVector<Affine3x4> > &palettes)
+{
+    quint32 hash = 2166136261u;
+    for (int im=0; im<palettes.size(); ++im) {
+        for (int ib=0; ib<palettes[im].size(); ++ib) {
+            for (int ie=0; ie<16; ++ie)
+                hash = fnv(floatBits(columnMajor(palettes[im][ib], ie)), hash);
+        }
+    }
+    return hash;
+}
+
+bool PoseStream::compare(const PoseFrame &expected, const QVector<QVector<Affine3x4> > &palettes, QString *error)
+{
+    if (checksum(palettes) == expected.checksum)
+        return true;
+
+    // Find out where, for the report
+    QString description = "checksum differs";
+    if (palettes.size() != expected.palettes.size()) {
+        description = QString("%1 meshes instead of %2").arg(palettes.size()).arg(expected.palettes.size());
+    }
+    else {
+        for (int im=0; im<palettes.size(); ++im) {
+            if (palettes[im].size() != expected.palettes[im].size()) {
+                description = QString("mesh %1 has %2 bones instead of %3").arg(im)
+                        .arg(palettes[im].size()).arg(expected.palettes[im].size());
+                break;
+            }
+            int ib = 0;
+            for (; ib<palettes[im].size(); ++ib) {
+                if (memcmp(palettes[im][ib].m, expected.palettes[im][ib].m, sizeof(Affine3x4)) != 0)
+                    break;
+            }
+            if (ib < palettes[im].size()) {
+                description = QString("mesh %1 bone %2 differs").arg(im).arg(ib);
+                break;
+            }
+        }
+    }
+
+    if (error)
+        *error = description;
+    return false;
+}
+
+PoseRecorder::PoseRecorder() :
+    m_frames(0)
+  , m_bytes(0)
+{
+
+}
+
+PoseRecorder::~PoseRecorder()
+{
+    close();
+}
+
+bool PoseRecorder::open(const QString &filePath, const QString &modelPath)
+{
+    close();
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::WriteOnly)) {
+        qDebug() << "PoseRecorder: unable to write" << filePath << m_file.errorString();
+        return false;
+    }
+
+    m_stream.setDevice(&m_file);
+    m_stream.setVersion(QDataStream::Qt_5_0);
+    m_stream << StreamMagic << StreamVersion << modelPath;
+
+    m_frames = 0;
+    m_previous.clear();
+    m_bytes = m_file.pos();
+    return true;
+}
+
+void PoseRecorder::record(const PoseFrame &frame)
+{
+    if (!m_file.isOpen())
+        return;
+
+    toWords(frame, m_words);
+    if (m_previous.size() < m_words.size())
+        m_previous.resize(m_words.size());
+
+    // Runs of unchanged words, each followed by the XOR of the next changed one
+    m_encoded.clear();
+    writeVarint(m_encoded, m_words.size());
+    quint32 run = 0;
+    for (int ii=0; ii<m_words.size(); ++ii) {
+        const quint32 delta = m_words[ii] ^ m_previous[ii];
+        if (delta == 0) {
+            ++run;
+            continue;
+        }
+        writeVarint(m_encoded, run);
+        writeVarint(m_encoded, delta);
+        run = 0;
+    }
+    if (run > 0)
+        writeVarint(m_encoded, run);
+
+    m_stream << m_encoded;
+    m_bytes += m_encoded.size() + 4;
+    m_previous = m_words;
+    ++m_frames;
+}
+
+bool PoseRecorder::close()
+{
+    if (!m_file.isOpen())
+        return true;
+
+    const bool ok = m_stream.status() == QDataStream::Ok;
+    m_stream.setDevice(0);
+    m_file.close();
+    if (!ok)
+        qDebug() << "PoseRecorder: writing" << m_file.fileName() << "failed";
+    return ok;
+}
+
+PoseReplay::PoseReplay()
+{
+
+}
+
+bool PoseReplay::open(const QString &filePath)
+{
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qDebug() << "PoseReplay: unable to read" << filePath << m_file.errorString();
+        return false;
+    }
+
+    m_stream.setDevice(&m_file);
+    m_stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version;
+    m_stream >> magic >> version >> m_modelPath;
+    if (m_stream.status() != QDataStream::Ok || magic != StreamMagic || version != StreamVersion) {
+        qDebug() << "PoseReplay:" << filePath << "is not a pose stream";
+        m_file.close();
+        return false;
+    }
+
+    m_previous.clear();
+    return true;
+}
+
+bool PoseReplay::atEnd() const
+{
+    return !m_file.isOpen() || m_file.atEnd();
+}
+
+bool PoseReplay::next(PoseFrame &frame)
+{
+    if (atEnd())
+        return false;
+
+    m_stream >> m_encoded;
+    if (m_stream.status() != QDataStream::Ok) {
+        qDebug() << "PoseReplay: truncated stream";
+        return false;
+    }
+
+    int pos = 0;
+    quint32 count;
+    if (!readVarint(m_encoded, pos, count)) {
+        qDebug() << "PoseReplay: damaged frame";
+        return false;
+    }
+    if (m_previous.size() < int(count))
+        m_previous.resize(count);
+
+    QVector<quint32> words = m_previous.mid(0, count);
+    quint32 index = 0;
+    while (index < count) {
+        quint32 run, delta;
+        if (!readVarint(m_encoded, pos, run) || index + run > count) {
+            qDebug() << "PoseReplay: damaged frame";
+            return false;
+        }
+        index += run;
+        if (index == count)
+            break;
+        if (!readVarint(m_encoded, pos, delta)) {
+            qDebug() << "PoseReplay: damaged frame";
+            return false;
+        }
+        words[index++] ^= delta;
+    }
+
+    m_previous = words;
+    if (!fromWords(words, frame)) {
+        qDebug() << "PoseReplay: damaged frame";
+        return false;
+    }
+    return true;
+}
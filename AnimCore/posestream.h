@@ -0,0 +1,80 @@
+#ifndef POSESTREAM_H
+#define POSESTREAM_H
+
+#include <QFile>
+#include <QDataStream>
+#include <QVector>
+#include <QString>
+#include "mathtypes.h"
+
+// One evaluated frame: what went into the evaluator and the palettes that came out
+struct PoseFrame
+{
+    PoseFrame() : animation(-1), tick(0.0), checksum(0) {}
+
+    int animation;
+    double tick;
+    QVector<Affine3x4> instanceMatrices;       // before the model's root transformation
+    QVector<QVector<Affine3x4> > palettes;     // skinning matrices of every mesh
+    quint32 checksum;                           // of the palettes, see PoseStream::checksum()
+};
+
+// Binary stream of evaluated frames, for reproducing a run exactly.
+// Matrices are stored column major like QMatrix4x4 holds them, palettes without their constant
+// bottom row. Every frame is XORed with the one before it word
+// by word, so unchanged values turn into runs of zeros and changed floats keep few significant
+// bits, and the result is written as variable length integers.
+class PoseStream
+{
+public:
+    // FNV-1a over the bits of every palette matrix, as the 16 column major values of the full matrix
+    static quint32 checksum(const QVector<QVector<Affine3x4> > &palettes);
+
+    // Bit for bit, describes the first difference in error
+    static bool compare(const PoseFrame &expected, const QVector<QVector<Affine3x4> > &palettes, QString *error = 0);
+};
+
+class PoseRecorder
+{
+public:
+    PoseRecorder();
+    ~PoseRecorder();
+
+    bool open(const QString &filePath, const QString &modelPath);
+    void record(const PoseFrame &frame);
+    bool close();
+
+    int frameCount() const { return m_frames; }
+    qint64 bytesWritten() const { return m_bytes; }
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    int m_frames;
+    qint64 m_bytes;
+    QVector<quint32> m_previous;        // words of the last frame
+    QVector<quint32> m_words;
+    QByteArray m_encoded;
+};
+
+class PoseReplay
+{
+public:
+    PoseReplay();
+
+    bool open(const QString &filePath);
+    QString modelPath() const { return m_modelPath; }
+
+    // False at the end of the stream or when it is damaged
+    bool next(PoseFrame &frame);
+    bool atEnd() const;
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    QString m_modelPath;
+    QVector<quint32> m_previous;
+    QByteArray m_encoded;
+};
+
+#endif // POSESTREAM_H
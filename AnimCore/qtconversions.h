@@ -0,0 +1,42 @@
+#ifndef QTCONVERSIONS_H
+#define QTCONVERSIONS_H
+
+#include <QVector3D>
+#include <QQuaternion>
+#include <QMatrix4x4>
+#include "mathtypes.h"
+
+// Between the library's math types and the QtGui ones, for the applications drawing with them.
+// Header only, the library itself never includes it and so doesn't depend on QtGui.
+namespace QtConversions
+{
+    inline QVector3D toQt(const Vector3 &vector) { return QVector3D(vector.x(), vector.y(), vector.z()); }
+    inline QQuaternion toQt(const Quaternion &quaternion)
+    {
+        return QQuaternion(quaternion.scalar(), quaternion.x(), quaternion.y(), quaternion.z());
+    }
+    inline QMatrix4x4 toQt(const Affine3x4 &affine)
+    {
+        return QMatrix4x4(affine.m[0], affine.m[1], affine.m[2], affine.m[3],
+                          affine.m[4], affine.m[5], affine.m[6], affine.m[7],
+                          affine.m[8], affine.m[9], affine.m[10], affine.m[11],
+                          0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    inline Vector3 fromQt(const QVector3D &vector) { return Vector3(vector.x(), vector.y(), vector.z()); }
+    inline Quaternion fromQt(const QQuaternion &quaternion)
+    {
+        return Quaternion(quaternion.scalar(), quaternion.x(), quaternion.y(), quaternion.z());
+    }
+    // Drops the bottom row, expects an affine transformation
+    inline Affine3x4 fromQt(const QMatrix4x4 &matrix)
+    {
+        Affine3x4 affine;
+        for (int row=0; row<3; ++row)
+            for (int col=0; col<4; ++col)
+                affine.m[row * 4 + col] = matrix(row, col);
+        return affine;
+    }
+}
+
+#endif // QTCONVERSIONS_H
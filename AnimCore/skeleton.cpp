@@ -0,0 +1,163 @@
+#include "skeleton.h"
+
+Skeleton::Skeleton() :
+    m_animation(-1)
+  , m_tick(0.0)
+  , m_sampled(false)
+{
+
+}
+
+void Skeleton::build(const Node *rootNode)
+{
+    // Breadth first, so each level is a contiguous range whose parents all come before it
+    ModelLoader::flattenNodes(rootNode, m_nodes, &m_parents, &m_levels);
+    m_jointsByName.clear();
+
+    const int count = m_nodes.size();
+    m_names.resize(count);
+    m_local.resize(count);
+    m_world.resize(count);
+    for (int ii=0; ii<count; ++ii) {
+        m_names[ii] = m_nodes[ii]->name;
+        if (!m_jointsByName.contains(m_names[ii]))
+            m_jointsByName.insert(m_names[ii], ii);
+        m_local[ii] = m_nodes[ii]->transformation;
+    }
+
+    m_channels.fill(0, count);
+    m_localDirty.fill(1, count);
+    m_changed.fill(0, count);
+    m_dirtyJoints.reserve(count);
+
+    m_sampled = false;
+    setAnimation(m_animation);
+}
+
+void Skeleton::setAnimation(int animation)
+{
+    m_animation = animation;
+    m_sampled = false;
+
+    QSharedPointer<StreamedClip> stream;
+    if (m_clipLibrary && animation >= 0)
+        stream = m_clipLibrary->streamedClip(animation);
+    m_streamer = stream ? QSharedPointer<ClipStreamer>(new ClipStreamer(stream)) : QSharedPointer<ClipStreamer>();
+
+    if (m_streamer)
+        bindClip(m_streamer->block(0.0));
+    else
+        bindClip(m_clipLibrary && animation >= 0 ? m_clipLibrary->clip(animation) : QSharedPointer<const AnimationClip>());
+}
+
+void Skeleton::bindClip(QSharedPointer<const AnimationClip> clip)
+{
+    m_clip = clip;
+
+    QVector<const NodeAnimation*> channels(m_nodes.size(), 0);
+    if (m_clip) {
+        for (int ii=0; ii<m_clip->channels.size(); ++ii) {
+            const ClipChannel &channel = m_clip->channels[ii];
+            if (channel.joint >= 0 && channel.joint < channels.size() && channel.animation.isValid())
+                channels[channel.joint] = &channel.animation;
+        }
+    }
+
+    m_animatedJoints.clear();
+    for (int ii=0; ii<m_nodes.size(); ++ii) {
+        // Joints that stop being animated go back to their bind transformation
+        if (m_channels[ii] && !channels[ii]) {
+            m_local[ii] = m_nodes[ii]->transformation;
+            m_localDirty[ii] = 1;
+        }
+        if (channels[ii])
+            m_animatedJoints.append(ii);
+    }
+    m_channels = channels;
+
+    for (int ii=0; ii<10; ++ii)
+        m_trs[ii].resize(m_animatedJoints.size());
+}
+
+void Skeleton::setLocalTransformation(int joint, const Affine3x4 &transformation)
+{
+    m_local[joint] = transformation;
+    m_localDirty[joint] = 1;
+}
+
+void Skeleton::clearLocalTransformation(int joint)
+{
+    setLocalTransformation(joint, m_nodes[joint]->transformation);
+}
+
+void Skeleton::sampleChannels(double tick)
+{
+    Vector3 position, scaling;
+    Quaternion rotation;
+
+    for (int ii=0; ii<m_animatedJoints.size(); ++ii) {
+        const int joint = m_animatedJoints[ii];
+        m_channels[joint]->sampleAt(tick, position, rotation, scaling);
+
+        m_trs[0][ii] = position.x();
+        m_trs[1][ii] = position.y();
+        m_trs[2][ii] = position.z();
+        m_trs[3][ii] = rotation.x();
+        m_trs[4][ii] = rotation.y();
+        m_trs[5][ii] = rotation.z();
+        m_trs[6][ii] = rotation.scalar();
+        m_trs[7][ii] = scaling.x();
+        m_trs[8][ii] = scaling.y();
+        m_trs[9][ii] = scaling.z();
+        m_localDirty[joint] = 1;
+    }
+
+    const TrsArrays trs = {
+        m_trs[0].constData(), m_trs[1].constData(), m_trs[2].constData(),
+        m_trs[3].constData(), m_trs[4].constData(), m_trs[5].constData(), m_trs[6].constData(),
+        m_trs[7].constData(), m_trs[8].constData(), m_trs[9].constData()
+    };
+    PoseKernels::composeTrs(trs, m_animatedJoints.size(), m_local.data(), m_animatedJoints.constData());
+}
+
+int Skeleton::update(double tick)
+{
+    if (!m_sampled || tick != m_tick) {
+        // Every block has a channel for each animated joint, so moving on keeps the same joints
+        if (m_streamer) {
+            QSharedPointer<const AnimationClip> block = m_streamer->block(tick);
+            if (block != m_clip)
+                bindClip(block);
+        }
+        sampleChannels(tick);
+    }
+    m_tick = tick;
+    m_sampled = true;
+
+    if (m_nodes.isEmpty())
+        return 0;
+
+    // The root has no parent to multiply with
+    m_changed[0] = m_localDirty[0];
+    if (m_localDirty[0])
+        m_world[0] = m_local[0];
+    m_localDirty[0] = 0;
+    int recomputed = m_changed[0];
+
+    for (int level=1; level<m_levels.size()-1; ++level) {
+        m_dirtyJoints.clear();
+        for (int ii=m_levels[level]; ii<m_levels[level+1]; ++ii) {
+            // Parents are in earlier levels, so their change flag is already final
+            const bool dirty = m_localDirty[ii] || m_changed[m_parents[ii]];
+            m_changed[ii] = dirty;
+            m_localDirty[ii] = 0;
+            if (dirty)
+                m_dirtyJoints.append(ii);
+        }
+
+        PoseKernels::multiplyParents(m_world.data(), m_local.constData(), m_parents.constData(),
+                                     m_dirtyJoints.constData(), m_dirtyJoints.size());
+        recomputed += m_dirtyJoints.size();
+    }
+    return recomputed;
+}
@@ -0,0 +1,80 @@
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <QVector>
+#include <QHash>
+#include "modelloader.h"
+#include "cliplibrary.h"
+#include "clipstream.h"
+#include "posekernels.h"
+
+// Flattened node hierarchy with cached world matrices.
+// Joints are stored level by level, parents first, so every level can be multiplied with its parents
+// in one batch. Only joints animated by the current clip, set through setLocalTransformation() or
+// below such a joint are recomputed, everything else keeps its world matrix from earlier frames.
+// Node transformations are expected to be affine.
+class Skeleton
+{
+public:
+    Skeleton();
+
+    void build(const Node *rootNode);
+
+    int jointCount() const { return m_names.size(); }
+    int jointIndex(const QString &name) const { return m_jointsByName.value(name, -1); }
+    int parentIndex(int joint) const { return m_parents[joint]; }
+    const QString &jointName(int joint) const { return m_names[joint]; }
+
+    // Clips are taken from the library, joint indices of their channels match this skeleton's
+    void setClipLibrary(QSharedPointer<ClipLibrary> library) { m_clipLibrary = library; }
+
+    // Switching clips changes which joints are animated, so the whole tree is refreshed once.
+    // The clip is decoded here if it isn't resident, prefetch it to avoid the hitch. Streamed
+    // clips only read their first block here, update() moves through the rest.
+    void setAnimation(int animation);
+    int animation() const { return m_animation; }
+
+    // Overrides the local transformation of a joint until cleared, an animated joint's channel wins
+    void setLocalTransformation(int joint, const Affine3x4 &transformation);
+    void clearLocalTransformation(int joint);
+
+    // Brings the world matrices up to date, returns how many joints had to be recomputed.
+    // Sampling the same tick again only recomputes joints changed through the transform API.
+    int update(double tick);
+
+    const Affine3x4 &worldMatrix(int joint) const { return m_world[joint]; }
+    bool worldChanged(int joint) const { return m_changed[joint]; }    // by the last update()
+
+    // Decoded blocks of a streamed clip held for this skeleton, 0 for other clips
+    qint64 streamedBytes() const { return m_streamer ? m_streamer->statistics().residentBytes : 0; }
+    ClipStreamer::Statistics streamStatistics() const { return m_streamer ? m_streamer->statistics() : ClipStreamer::Statistics(); }
+
+private:
+    void bindClip(QSharedPointer<const AnimationClip> clip);
+    void sampleChannels(double tick);
+
+    QVector<QString> m_names;
+    QVector<int> m_parents;                         // -1 for the root
+    QVector<int> m_levels;                          // first joint of every level, plus the end
+    QVector<const Node*> m_nodes;
+    QHash<QString, int> m_jointsByName;
+
+    QSharedPointer<ClipLibrary> m_clipLibrary;
+    QSharedPointer<const AnimationClip> m_clip;     // held while playing, even if evicted, or the current block
+    QSharedPointer<ClipStreamer> m_streamer;        // of a streamed clip
+    QVector<const NodeAnimation*> m_channels;       // of the current clip, 0 for static joints
+    QVector<int> m_animatedJoints;
+    QVector<float> m_trs[10];                       // sampled parts of the animated joints, see TrsArrays
+
+    QVector<Affine3x4> m_local;
+    QVector<Affine3x4> m_world;
+    QVector<char> m_localDirty;
+    QVector<char> m_changed;
+    QVector<int> m_dirtyJoints;                     // scratch list of one level
+
+    int m_animation;
+    double m_tick;
+    bool m_sampled;                                 // animated joints hold the pose at m_tick
+};
+
+#endif // SKELETON_H
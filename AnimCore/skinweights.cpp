@@ -0,0 +1,118 @@
+#include "skinweights.h"
+#include "modelloader.h"
+
+int SkinWeights::normalize(QVector<int> &boneIndices, QVector<float> &boneWeights, float minWeight)
+{
+    int dropped = 0;
+    const int vertexCount = qMin(boneIndices.size(), boneWeights.size()) / MaxInfluences;
+    int *indices = boneIndices.data();
+    float *weights = boneWeights.data();
+
+    for (int iv=0; iv<vertexCount; ++iv) {
+        int *vertexIndices = indices + iv * MaxInfluences;
+        float *vertexWeights = weights + iv * MaxInfluences;
+
+        // Insertion sort of the used slots, heaviest first
+        int bones[MaxInfluences];
+        float values[MaxInfluences];
+        int count = 0;
+        for (int ii=0; ii<MaxInfluences; ++ii) {
+            if (vertexIndices[ii] < 0 || vertexWeights[ii] <= 0.0f)
+                continue;
+            int slot = count++;
+            while (slot > 0 && values[slot-1] < vertexWeights[ii]) {
+                bones[slot] = bones[slot-1];
+                values[slot] = values[slot-1];
+                --slot;
+            }
+            bones[slot] = vertexIndices[ii];
+            values[slot] = vertexWeights[ii];
+        }
+
+        // The heaviest influence always stays, however light
+        const int used = count;
+        while (count > 1 && values[count-1] < minWeight)
+            --count;
+        dropped += used - count;
+
+        float sum = 0.0f;
+        for (int ii=0; ii<count; ++ii)
+            sum += values[ii];
+
+        for (int ii=0; ii<MaxInfluences; ++ii) {
+            vertexIndices[ii] = ii < count ? bones[ii] : 0;
+            vertexWeights[ii] = ii < count ? values[ii] / sum : 0.0f;
+        }
+    }
+    return dropped;
+}
+
+int SkinWeights::influenceCount(const float *weights)
+{
+    int count = 0;
+    while (count < MaxInfluences && weights[count] > 0.0f)
+        ++count;
+    return count;
+}
+
+void SkinWeights::groupTriangles(Mesh &mesh, QVector<unsigned int> &indices, const QVector<float> &boneWeights)
+{
+    mesh.influenceGroups.clear();
+    if (mesh.indexCount == 0)
+        return;
+
+    // Meshes without bones keep their triangle order and are drawn unskinned
+    const bool hasBoneData = boneWeights.size() >= int(mesh.vertexOffset + mesh.vertexCount) * MaxInfluences;
+    if (!hasBoneData || mesh.boneNames.isEmpty()) {
+        InfluenceGroup group = { Variant_Influences0, mesh.indexCount, mesh.indexOffset };
+        mesh.influenceGroups.append(group);
+        return;
+    }
+
+    const unsigned int triangleCount = mesh.indexCount / 3;
+    unsigned int *triangles = indices.data() + mesh.indexOffset;
+
+    QVector<unsigned char> variants(triangleCount);
+    unsigned int counts[VariantCount] = {};
+    for (unsigned int it=0; it<triangleCount; ++it) {
+        int minimum = MaxInfluences, maximum = 0;
+        for (int ic=0; ic<3; ++ic) {
+            const int count = influenceCount(boneWeights.constData() + triangles[it*3+ic] * MaxInfluences);
+            minimum = qMin(minimum, count);
+            maximum = qMax(maximum, count);
+        }
+
+        // An unskinned vertex only stays in place when the shader checks for it
+        const int variant = minimum == 0 && maximum > 0 ? int(Variant_Mixed) : Variant_Influences0 + maximum;
+        variants[it] = variant;
+        ++counts[variant];
+    }
+
+    unsigned int offsets[VariantCount];
+    unsigned int offset = 0;
+    for (int variant=0; variant<VariantCount; ++variant) {
+        offsets[variant] = offset;
+        if (counts[variant] > 0) {
+            InfluenceGroup group = { variant, counts[variant] * 3, mesh.indexOffset + offset * 3 };
+            mesh.influenceGroups.append(group);
+        }
+        offset += counts[variant];
+    }
+
+    // Counting sort keeps the order within a group, so the vertex cache optimization survives
+    QVector<unsigned int> sorted(triangleCount * 3);
+    for (unsigned int it=0; it<triangleCount; ++it) {
+        unsigned int *destination = sorted.data() + offsets[variants[it]]++ * 3;
+        destination[0] = triangles[it*3];
+        destination[1] = triangles[it*3+1];
+        destination[2] = triangles[it*3+2];
+    }
+    std::copy(sorted.constBegin(), sorted.constEnd(), triangles);
+}
+
+QByteArray SkinWeights::shaderDefines(int variant)
+{
+    if (variant == Variant_Mixed)
+        return QByteArray();
+    return "#define INFLUENCES " + QByteArray::number(variant - Variant_Influences0) + "\n";
+}
@@ -0,0 +1,38 @@
+#ifndef SKINWEIGHTS_H
+#define SKINWEIGHTS_H
+
+#include <QVector>
+#include <QByteArray>
+
+struct Mesh;
+
+// Load time preparation of the per vertex bone influences for the skinning shader variants.
+// Every vertex has four slots, after normalize() its influences come first, heaviest first, and the
+// slots it doesn't use hold bone 0 with weight 0. A shader compiled for n influences can then read
+// the first n slots without checking any of them.
+class SkinWeights
+{
+public:
+    enum Variant {
+        Variant_Influences0 = 0,    // Variant_Influences0 + n for triangles needing at most n influences
+        Variant_Mixed = 5,          // skinned and unskinned vertices in one triangle, every slot is checked
+        VariantCount
+    };
+
+    static const int MaxInfluences = 4;
+
+    // Sorts every vertex's influences by weight, drops those below minWeight and rescales the rest
+    // to add up to one. Returns the number of influences dropped.
+    static int normalize(QVector<int> &boneIndices, QVector<float> &boneWeights, float minWeight = 1.0f / 255.0f);
+
+    // Number of slots in use of a normalized vertex
+    static int influenceCount(const float *weights);
+
+    // Stable sorts the mesh's triangles by variant and records the index range of each one
+    static void groupTriangles(Mesh &mesh, QVector<unsigned int> &indices, const QVector<float> &boneWeights);
+
+    // Prepended to the vertex shader source, after its #version line
+    static QByteArray shaderDefines(int variant);
+};
+
+#endif // SKINWEIGHTS_H
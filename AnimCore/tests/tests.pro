@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# Unit tests and benchmarks of AnimCore, headless
+#
+#-------------------------------------------------
+
+# QtGui only for the QMatrix4x4 reference the palettes are checked against, no window is created
+QT       += core gui testlib
+QT       -= widgets
+CONFIG      += C++11 console testcase
+CONFIG      -= app_bundle
+
+TARGET = tst_animcore
+TEMPLATE = app
+
+SOURCES += tst_animcore.cpp
+
+# Skinned and animated model the pose tests load
+DEFINES += ANIMCORE_TEST_DATA=\\\"$$PWD/../../AstroBoy_Walk\\\"
+
+include(../AnimCore.pri)
@@ -0,0 +1,423 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "modelloader.h"
+#include "cliplibrary.h"
+#include "clipstream.h"
+#include "poseevaluator.h"
+#include "posekernels.h"
+#include "posepublisher.h"
+#include "qtconversions.h"
+
+using namespace QtConversions;
+
+namespace {
+
+// Step keys of jointCount joints, listed in reverse so decoding has to sort them. Joints leave
+// gaps like clips only holding the animated ones, and the key types have different key counts.
+QVector<ClipChannel> makeChannels(int jointCount, int keyCount, double tickStep)
+{
+    QVector<ClipChannel> channels;
+    for (int ij=jointCount-1; ij>=0; --ij) {
+        ClipChannel channel;
+        channel.joint = ij * 2;
+        NodeAnimation &anim = channel.animation;
+        anim.preState = AnimState_Default;
+        anim.postState = AnimState_Repeat;
+        for (int ik=0; ik<keyCount; ++ik) {
+            const double time = ik * tickStep;
+            const float angle = 0.1f * ik + ij;
+            if (ik % 2 == 0)
+                anim.positionKeys.append(qMakePair(time, Vector3(ij, 0.5f * ik, -1.0f)));
+            anim.rotationKeys.append(qMakePair(time, Quaternion(std::cos(angle), 0.0f, std::sin(angle), 0.0f)));
+            if (ij % 2 == 0)
+                anim.scalingKeys.append(qMakePair(time, Vector3(1.0f, 1.0f + 0.01f * ik, 1.0f)));
+        }
+        channels.append(channel);
+    }
+    return channels;
+}
+
+bool sameKeys(const NodeAnimation &a, const NodeAnimation &b)
+{
+    return a.positionKeys == b.positionKeys && a.rotationKeys == b.rotationKeys && a.scalingKeys == b.scalingKeys
+            && a.preState == b.preState && a.postState == b.postState;
+}
+
+bool sameChannels(QVector<ClipChannel> expected, const QVector<ClipChannel> &actual)
+{
+    std::sort(expected.begin(), expected.end(),
+              [](const ClipChannel &a, const ClipChannel &b) { return a.joint < b.joint; });
+    if (expected.size() != actual.size())
+        return false;
+    for (int ii=0; ii<expected.size(); ++ii) {
+        if (expected[ii].joint != actual[ii].joint || !sameKeys(expected[ii].animation, actual[ii].animation))
+            return false;
+    }
+    return true;
+}
+
+// World matrix of every node at the tick, straight from the node tree and the clip's keys
+QVector<QMatrix4x4> referenceWorld(const Node *rootNode, const AnimationClip *clip, double tick)
+{
+    QVector<const Node*> nodes;
+    QVector<int> parents;
+    ModelLoader::flattenNodes(rootNode, nodes, &parents);
+
+    QVector<const NodeAnimation*> channels(nodes.size(), 0);
+    for (int ii=0; clip && ii<clip->channels.size(); ++ii) {
+        const ClipChannel &channel = clip->channels[ii];
+        if (channel.joint >= 0 && channel.joint < nodes.size() && channel.animation.isValid())
+            channels[channel.joint] = &channel.animation;
+    }
+
+    QVector<QMatrix4x4> world(nodes.size());
+    for (int ii=0; ii<nodes.size(); ++ii) {
+        QMatrix4x4 local = toQt(nodes[ii]->transformation);
+        if (channels[ii]) {
+            Vector3 position, scaling;
+            Quaternion rotation;
+            channels[ii]->sampleAt(tick, position, rotation, scaling);
+            local.setToIdentity();
+            local.translate(toQt(position));
+            local.rotate(toQt(rotation));
+            local.scale(toQt(scaling));
+        }
+        world[ii] = parents[ii] == -1 ? local : world[parents[ii]] * local;
+    }
+    return world;
+}
+
+// Up to float rounding, relative to the largest element
+bool fuzzyEqual(const QMatrix4x4 &expected, const QMatrix4x4 &actual)
+{
+    float largest = 1.0f;
+    for (int ii=0; ii<16; ++ii)
+        largest = qMax(largest, std::fabs(expected.constData()[ii]));
+    for (int ii=0; ii<16; ++ii) {
+        if (std::fabs(expected.constData()[ii] - actual.constData()[ii]) > 1e-4f * largest)
+            return false;
+    }
+    return true;
+}
+
+}
+
+class TestAnimCore : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanup();
+
+    void clipRoundTrip();
+    void clipLibraryReplace();
+    void corruptClip();
+    void streamedBlocks();
+    void evaluatorPalettes();
+    void evaluatorPalettes_data();
+    void evaluateBenchmark();
+    void evaluateBenchmark_data();
+    void poseRing();
+
+private:
+    bool comparePalettes(const PoseEvaluator &evaluator, const AnimationClip *clip, double tick);
+
+    QSharedPointer<ModelLoader> m_model;
+};
+
+void TestAnimCore::initTestCase()
+{
+    m_model = QSharedPointer<ModelLoader>(new ModelLoader);
+    QVERIFY(m_model->Load(QString(ANIMCORE_TEST_DATA) + "/astroBoy_walk_Maya.dae", ModelLoader::AbsolutePath));
+    QVERIFY(!m_model->getNodeAnimations().isEmpty());
+}
+
+void TestAnimCore::cleanup()
+{
+    PoseKernels::setIsa(PoseKernels::bestIsa());
+}
+
+void TestAnimCore::clipRoundTrip()
+{
+    const QVector<ClipChannel> channels = makeChannels(8, 40, 0.5);
+    const QSharedPointer<AnimationClip> decoded = ClipLibrary::decode(ClipLibrary::encode(channels));
+    QVERIFY(sameChannels(channels, decoded->channels));
+    QVERIFY(decoded->bytes > 0);
+
+    ClipLibrary library;
+    const int clip = library.addClip(channels);
+    QVERIFY(sameChannels(channels, library.clip(clip)->channels));
+    QVERIFY(sameChannels(channels, ClipLibrary::decode(library.encodedClip(clip))->channels));
+}
+
+void TestAnimCore::clipLibraryReplace()
+{
+    ClipLibrary library;
+    const int clip = library.addClip(makeChannels(4, 10, 1.0));
+    library.prefetch(QVector<int>() << clip);
+    const QSharedPointer<const AnimationClip> before = library.clip(clip);
+
+    // Clips handed out stay as they were, the library only serves the new keys
+    const QVector<ClipChannel> replacement = makeChannels(3, 20, 0.25);
+    library.replaceClip(clip, replacement);
+    QVERIFY(sameChannels(makeChannels(4, 10, 1.0), before->channels));
+    QVERIFY(sameChannels(replacement, library.clip(clip)->channels));
+
+    // Prefetches racing with a replacement never bring back the old keys
+    const QVector<ClipChannel> other = makeChannels(2, 5, 1.0);
+    for (int ii=0; ii<20; ++ii) {
+        library.prefetch(QVector<int>() << clip);
+        library.replaceClip(clip, ii % 2 == 0 ? replacement : other);
+    }
+    QVERIFY(sameChannels(other, library.clip(clip)->channels));
+}
+
+void TestAnimCore::corruptClip()
+{
+    QVERIFY(ClipLibrary::decode(QByteArray("not a clip")).data() != 0);
+    QVERIFY(ClipLibrary::decode(QByteArray("not a clip"))->channels.isEmpty());
+
+    QByteArray truncated = ClipLibrary::encode(makeChannels(4, 10, 1.0));
+    truncated.chop(truncated.size() / 2);
+    QVERIFY(ClipLibrary::decode(truncated)->channels.isEmpty());
+
+    // A channel count far beyond the data is rejected before anything is allocated for it
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << quint32(0xFFFFFFF0) << qint32(0);
+    QVERIFY(ClipLibrary::decode(qCompress(data))->channels.isEmpty());
+}
+
+void TestAnimCore::streamedBlocks()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const double blockTicks = 4.0;
+    const QVector<ClipChannel> channels = makeChannels(6, 50, 0.75);
+    const BoundingBox bounds(Vector3(-1.0f, -2.0f, -3.0f), Vector3(1.0f, 2.0f, 3.0f));
+    const QString filePath = dir.filePath("clip.a3cs");
+    QVERIFY(StreamedClip::write(filePath, channels, blockTicks, bounds));
+
+    StreamedClip stream;
+    QVERIFY(stream.open(filePath));
+    QCOMPARE(stream.blockTicks(), blockTicks);
+    QVERIFY(stream.blockCount() > 1);
+    QVERIFY(stream.bounds().minimum == bounds.minimum && stream.bounds().maximum == bounds.maximum);
+
+    const QSharedPointer<AnimationClip> whole = ClipLibrary::decode(ClipLibrary::encode(channels));
+    const double lastTick = 49 * 0.75;
+
+    // Every tick, also the ones right on key and block boundaries, samples the same in the block
+    for (double tick = -1.0; tick <= lastTick + blockTicks; tick += 0.125) {
+        const QSharedPointer<AnimationClip> block = stream.readBlock(stream.blockAt(tick));
+        QCOMPARE(block->channels.size(), whole->channels.size());
+        for (int ic=0; ic<whole->channels.size(); ++ic) {
+            QCOMPARE(block->channels[ic].joint, whole->channels[ic].joint);
+            const Affine3x4 expected = whole->channels[ic].animation.transformationAt(tick);
+            const Affine3x4 actual = block->channels[ic].animation.transformationAt(tick);
+            QVERIFY2(memcmp(expected.m, actual.m, sizeof(expected.m)) == 0, qPrintable(QString("tick %1").arg(tick)));
+        }
+    }
+}
+
+bool TestAnimCore::comparePalettes(const PoseEvaluator &evaluator, const AnimationClip *clip, double tick)
+{
+    const Node *rootNode = m_model->getNodeData().data();
+    const QVector<QMatrix4x4> world = referenceWorld(rootNode, clip, tick);
+    const QMatrix4x4 inverseRoot = toQt(rootNode->transformation).inverted();
+
+    QVector<const Node*> nodes;
+    ModelLoader::flattenNodes(rootNode, nodes);
+    QHash<QString, int> joints;
+    for (int ii=0; ii<nodes.size(); ++ii) {
+        if (!joints.contains(nodes[ii]->name))
+            joints.insert(nodes[ii]->name, ii);
+    }
+
+    const QVector<QSharedPointer<Mesh> > meshes = m_model->getMeshes();
+    const QVector<QVector<Affine3x4> > &palettes = evaluator.palettes();
+    if (palettes.size() != meshes.size())
+        return false;
+
+    for (int im=0; im<meshes.size(); ++im) {
+        const Mesh &mesh = *meshes[im];
+        if (palettes[im].size() != mesh.boneNames.size())
+            return false;
+        for (int ib=0; ib<mesh.boneNames.size(); ++ib) {
+            const int joint = joints.value(mesh.boneNames[ib], -1);
+            const QMatrix4x4 expected = joint == -1 ? QMatrix4x4()
+                    : inverseRoot * world[joint] * toQt(mesh.boneOffsets[ib]);
+            if (!fuzzyEqual(expected, toQt(palettes[im][ib]))) {
+                qDebug() << "Palette of bone" << mesh.boneNames[ib] << "of mesh" << im << "at tick" << tick
+                         << expected << toQt(palettes[im][ib]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void TestAnimCore::evaluatorPalettes_data()
+{
+    QTest::addColumn<int>("isa");
+    for (int ii=PoseKernels::Isa_Scalar; ii<=PoseKernels::bestIsa(); ++ii)
+        QTest::newRow(PoseKernels::isaName(PoseKernels::Isa(ii))) << ii;
+}
+
+void TestAnimCore::evaluatorPalettes()
+{
+    QFETCH(int, isa);
+    PoseKernels::setIsa(PoseKernels::Isa(isa));
+
+    PoseEvaluator evaluator;
+    QVERIFY(evaluator.initialize(m_model));
+
+    evaluator.evaluate(0.0);
+    QVERIFY(comparePalettes(evaluator, 0, 0.0));
+
+    const QSharedPointer<const AnimationClip> clip = m_model->getClipLibrary()->clip(0);
+    QVERIFY(clip);
+    evaluator.setAnimation(0);
+
+    // Forwards, the same tick again and backwards, palettes are only partly rebuilt in between
+    const double duration = m_model->getNodeAnimations().first()->duration;
+    QVector<double> ticks;
+    for (int ii=0; ii<=40; ++ii)
+        ticks << duration * ii / 40;
+    ticks << duration << duration / 3 << duration / 3 << 0.0;
+    foreach (double tick, ticks) {
+        evaluator.evaluate(tick);
+        QVERIFY(comparePalettes(evaluator, clip.data(), tick));
+    }
+
+    // Back to the bind pose
+    evaluator.setAnimation(-1);
+    evaluator.evaluate(0.0);
+    QVERIFY(comparePalettes(evaluator, 0, 0.0));
+}
+
+void TestAnimCore::evaluateBenchmark_data()
+{
+    evaluatorPalettes_data();
+}
+
+void TestAnimCore::evaluateBenchmark()
+{
+    QFETCH(int, isa);
+    PoseKernels::setIsa(PoseKernels::Isa(isa));
+
+    PoseEvaluator evaluator;
+    QVERIFY(evaluator.initialize(m_model));
+    evaluator.setAnimation(0);
+
+    // A different tick every call, like playback, so every animated joint is sampled each time
+    const int tickCount = 1000;
+    const double step = m_model->getNodeAnimations().first()->duration / tickCount;
+    QBENCHMARK {
+        for (int ii=0; ii<tickCount; ++ii)
+            evaluator.evaluate(ii * step);
+    }
+}
+
+void TestAnimCore::poseRing()
+{
+#if !defined(Q_OS_UNIX)
+    QSKIP("Pose publishing needs POSIX shared memory");
+#else
+    // The frames the publisher cycles through, evaluated up front for comparison
+    const int tickCount = 16;
+    const double duration = m_model->getNodeAnimations().first()->duration;
+    PoseEvaluator reference;
+    QVERIFY(reference.initialize(m_model));
+    reference.setAnimation(0);
+    QVector<double> ticks;
+    QVector<QVector<Affine3x4> > expectedJoints;
+    QVector<QVector<QVector<Affine3x4> > > expectedPalettes;
+    for (int ii=0; ii<tickCount; ++ii) {
+        ticks << duration * ii / tickCount;
+        reference.evaluate(ticks.last());
+        QVector<Affine3x4> joints;
+        for (int ij=0; ij<reference.skeleton().jointCount(); ++ij)
+            joints << reference.skeleton().worldMatrix(ij);
+        expectedJoints << joints;
+        expectedPalettes << reference.palettes();
+    }
+
+    PoseEvaluator pose;
+    QVERIFY(pose.initialize(m_model));
+    pose.setAnimation(0);
+    const int slotCount = 2;        // small, so the publisher laps the reader often
+    const QString name = QString("animcore_test_%1").arg(QCoreApplication::applicationPid());
+    PosePublisher publisher;
+    QVERIFY(publisher.open(name, pose, slotCount));
+    PoseReader reader;
+    QVERIFY(reader.open(name));
+    PoseView view;
+    QVERIFY(!reader.begin(view));
+
+    const int frameCount = 20000;
+    QFuture<void> publishing = QtConcurrent::run([&]() {
+        for (int ii=0; ii<frameCount; ++ii) {
+            pose.evaluate(ticks[ii % tickCount]);
+            publisher.publish(pose, ticks[ii % tickCount]);
+        }
+    });
+
+    // Frames are copied out like a consumer would, then kept only if finish() vouches for them.
+    // Every kept frame has to match the pose its number was published with, a torn one wouldn't.
+    QString error;
+    int complete = 0, torn = 0;
+    quint64 lastFrame = 0;
+    QVector<Affine3x4> joints, palettes;
+    bool last = false;
+    while (error.isEmpty() && !last) {
+        last = publishing.isFinished();
+        if (!reader.begin(view))
+            continue;
+        joints = QVector<Affine3x4>(view.jointCount);
+        memcpy(joints.data(), view.joints, view.jointCount * sizeof(Affine3x4));
+        palettes = QVector<Affine3x4>(view.paletteOffsets[view.meshCount]);
+        memcpy(palettes.data(), view.palettes, palettes.size() * sizeof(Affine3x4));
+        if (!reader.finish(view)) {
+            ++torn;
+            continue;
+        }
+        ++complete;
+
+        const int index = view.frame % tickCount;
+        if (view.frame < lastFrame || view.frame >= quint64(frameCount))
+            error = QString("frame %1 after %2").arg(view.frame).arg(lastFrame);
+        else if (view.sequence != 2 * (view.frame / slotCount + 1))
+            error = QString("sequence %1 of frame %2").arg(view.sequence).arg(view.frame);
+        else if (view.tick != ticks[index] || view.animation != 0)
+            error = QString("tick %1 of frame %2").arg(view.tick).arg(view.frame);
+        else if (joints.size() != expectedJoints[index].size()
+                 || memcmp(joints.constData(), expectedJoints[index].constData(), joints.size() * sizeof(Affine3x4)) != 0)
+            error = QString("joints of frame %1").arg(view.frame);
+        for (int im=0; error.isEmpty() && im<view.meshCount; ++im) {
+            const QVector<Affine3x4> &palette = expectedPalettes[index][im];
+            if (view.paletteSize(im) != palette.size()
+                    || memcmp(palettes.constData() + view.paletteOffsets[im], palette.constData(), palette.size() * sizeof(Affine3x4)) != 0)
+                error = QString("palette %1 of frame %2").arg(im).arg(view.frame);
+        }
+        lastFrame = view.frame;
+    }
+    publishing.waitForFinished();
+
+    QVERIFY2(error.isEmpty(), qPrintable(error));
+    QCOMPARE(reader.framesPublished(), quint64(frameCount));
+    QCOMPARE(lastFrame, quint64(frameCount - 1));
+    qDebug() << complete << "frames read," << torn << "torn ones thrown away";
+#endif
+}
+
+QTEST_GUILESS_MAIN(TestAnimCore)
+
+#include "tst_animcore.moc"
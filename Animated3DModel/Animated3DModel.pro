@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui quick
+QT       += core gui quick concurrent
 CONFIG      += C++11
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
@@ -17,31 +17,37 @@ TEMPLATE = app
 SOURCES += main.cpp\
         window.cpp \
     scene.cpp \
-    modelloader.cpp \
-    scene_gles.cpp
+    scene_gles.cpp \
+    animationbaker.cpp \
+    assetmanager.cpp \
+    benchmark.cpp \
+    renderthread.cpp \
+    glstatecache.cpp \
+    commandlist.cpp \
+    texturestreamer.cpp \
+    framecapture.cpp
 
 HEADERS  += window.h \
     scene.h \
-    modelloader.h \
     scene_gles.h \
-    scenebase.h
-
-unix: !macx {
-    INCLUDEPATH +=  /usr/include
-    LIBS += /usr/lib/libassimp.so
-}
-
-macx {
-    INCLUDEPATH +=  /usr/local/include
-    LIBS += /usr/local/lib/libassimp.dylib
-}
-
-win32 {
-    INCLUDEPATH += "C:/Assimp3/include"
-    LIBS += -L"C:/Assimp3/lib/Release" -lassimp
-}
+    scenebase.h \
+    animationbaker.h \
+    assetmanager.h \
+    benchmark.h \
+    renderthread.h \
+    triplebuffer.h \
+    framepacket.h \
+    sceneview.h \
+    glstatecache.h \
+    commandlist.h \
+    texturestreamer.h \
+    framecapture.h
+
+# Loading, clips and pose evaluation
+include(../AnimCore/AnimCore.pri)
 
 OTHER_FILES += ads_fragment.vert ads_fragment.frag \
+    baked_ads_fragment.vert \
     es_ads_fragment.frag \
     es_ads_fragment.vert \
     main.qml
@@ -10,12 +10,17 @@ uniform vec3 Kd;
 uniform vec3 Ks;
 uniform float shininess;
 
+// Multiplies Kd once it has been streamed in
+uniform sampler2D diffuseTexture;
+uniform bool hasDiffuseTexture;
+
 in vec3 normal;
 in vec3 position;
+in vec2 uv;
 
 layout (location = 0) out vec4 fragColor;
 
-vec3 adsModel(const in vec3 norm)
+vec3 adsModel(const in vec3 norm, const in vec3 diffuse)
 {
     // Calculate light direction
     vec3 s = normalize( lightPosition.xyz - position);
@@ -36,12 +41,15 @@ vec3 adsModel(const in vec3 norm)
 
     // Calculate final color
     return lightIntensity * (Ka +
-                                           Kd * diffuseIntensity +
+                                           diffuse * diffuseIntensity +
                                            Ks * specularIntensity);
 }
 
 void main()
 {
+    vec3 diffuse = Kd;
+    if (hasDiffuseTexture)
+        diffuse *= texture(diffuseTexture, uv).rgb;
 
-    fragColor = vec4(adsModel(normalize(normal)), 1.0);
+    fragColor = vec4(adsModel(normalize(normal), diffuse), 1.0);
 }
@@ -2,11 +2,14 @@
 
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexNormal;
+layout (location = 2) in vec2 vertexUV;
 
-layout (location = 3) in vec4 boneIndexes;
+layout (location = 3) in ivec4 boneIndexes;
 layout (location = 4) in vec4 boneWeights;
 
-uniform mat4 boneModelMatrix[100];
+// Skinning matrices of all meshes, four texels per matrix, uploaded once per frame for every view
+uniform samplerBuffer bonePalette;
+uniform int paletteOffset;
 
 uniform mat4 MV;
 uniform mat3 N;
@@ -14,33 +17,51 @@ uniform mat4 MVP;
 
 out vec3 normal;
 out vec3 position;
+out vec2 uv;
+
+mat4 boneModelMatrix(int bone)
+{
+    int texel = (paletteOffset + bone) * 4;
+    return mat4(texelFetch(bonePalette, texel), texelFetch(bonePalette, texel + 1),
+                texelFetch(bonePalette, texel + 2), texelFetch(bonePalette, texel + 3));
+}
+
+// Compiled once per influence count, see SkinWeights. Influences are sorted and normalized and
+// unused slots hold bone 0 with weight 0, so the first INFLUENCES slots are read as they are.
+// Without INFLUENCES a vertex may have none, which leaves it in place.
+mat4 skinningMatrix()
+{
+#if !defined(INFLUENCES)
+    if (boneWeights[0] == 0.0)
+        return mat4(1.0);
+    return boneModelMatrix(boneIndexes[0]) * boneWeights[0]
+         + boneModelMatrix(boneIndexes[1]) * boneWeights[1]
+         + boneModelMatrix(boneIndexes[2]) * boneWeights[2]
+         + boneModelMatrix(boneIndexes[3]) * boneWeights[3];
+#elif INFLUENCES == 0
+    return mat4(1.0);
+#elif INFLUENCES == 1
+    return boneModelMatrix(boneIndexes[0]);
+#else
+    mat4 boneTransform = boneModelMatrix(boneIndexes[0]) * boneWeights[0]
+                       + boneModelMatrix(boneIndexes[1]) * boneWeights[1];
+#if INFLUENCES > 2
+    boneTransform += boneModelMatrix(boneIndexes[2]) * boneWeights[2];
+#endif
+#if INFLUENCES > 3
+    boneTransform += boneModelMatrix(boneIndexes[3]) * boneWeights[3];
+#endif
+    return boneTransform;
+#endif
+}
 
 void main()
 {
-    mat4 boneTransform = mat4(1.0);
-
-    if (boneIndexes[0] != -1) {
-        boneTransform = boneModelMatrix[int(boneIndexes[0])] * boneWeights[0];
-        //boneTransform = boneModelMatrix[0] * boneWeights[0];
-        //boneTransform = mat4(1.0) * boneWeights[0];
-    }
-
-    for (int ii=1; ii<4; ++ii) {
-        if (boneIndexes[ii] != -1) {
-            boneTransform += boneModelMatrix[int(boneIndexes[ii])] * boneWeights[ii];
-            //boneTransform += boneModelMatrix[1] * boneWeights[ii];
-            //boneTransform += mat4(1.0) * boneWeights[ii];
-        }
-    }
-
-    //normal = normalize( N * norm.xyz );
+    mat4 boneTransform = skinningMatrix();
+
     normal = normalize((MV * boneTransform * vec4(vertexNormal, 0.0)).xyz);
     position = vec3( MV * boneTransform * vec4( vertexPosition, 1.0 ) );
 
+    uv = vertexUV;
     gl_Position = MVP * boneTransform * vec4( vertexPosition, 1.0 );
-
-//    normal = normalize( N * vertexNormal );
-//    position = vec3( MV * vec4( vertexPosition, 1.0 ) );
-
-//    gl_Position = MVP * vec4( vertexPosition, 1.0 );
 }
@@ -0,0 +1,94 @@
+#include "animationbaker.h"
+#include "skeleton.h"
+#include <QDebug>
+#include <cmath>
+#include <cstring>
+
+AnimationBaker::AnimationBaker() :
+    m_sampleRate(30.0f)
+  , m_halfFloat(true)
+  , m_width(0)
+  , m_height(0)
+{
+
+}
+
+bool AnimationBaker::bake(const Node *rootNode, const QVector<QSharedPointer<Mesh> > &meshes,
+                          const QVector<QSharedPointer<Animation> > &animations, QSharedPointer<ClipLibrary> clips)
+{
+    m_meshPaletteOffsets.resize(meshes.size());
+    int paletteSize = 0;
+    for (int im=0; im<meshes.size(); ++im) {
+        m_meshPaletteOffsets[im] = paletteSize;
+        paletteSize += meshes[im]->boneNames.size();
+    }
+
+    // Clips are stacked vertically, each one sampled from tick 0 up to and including its duration
+    m_clips.resize(animations.size());
+    m_height = 0;
+    for (int ia=0; ia<animations.size(); ++ia) {
+        const Animation &anim = *animations[ia];
+        const double ticksPerSecond = anim.ticksPerSecond != 0 ? anim.ticksPerSecond : 25.0;
+        BakedClip &clip = m_clips[ia];
+        clip.firstFrame = m_height;
+        clip.frameCount = qMax(1, int(std::ceil(anim.duration / ticksPerSecond * m_sampleRate)) + 1);
+        clip.framesPerTick = m_sampleRate / ticksPerSecond;
+        m_height += clip.frameCount;
+    }
+
+    m_width = paletteSize * 3;
+    if (rootNode == 0 || m_width == 0 || m_height == 0) {
+        qDebug() << "Nothing to bake, the model has no bones or no animations";
+        m_texels.clear();
+        return false;
+    }
+
+    m_texels.resize(m_width * m_height * 4);
+    const Affine3x4 inverseRootMatrix = rootNode->transformation.inverted();
+
+    Skeleton skeleton;
+    skeleton.setClipLibrary(clips);
+    skeleton.build(rootNode);
+
+    QVector<QVector<int> > meshBoneJoints(meshes.size());
+    for (int im=0; im<meshes.size(); ++im) {
+        meshBoneJoints[im].resize(meshes[im]->boneNames.size());
+        for (int ib=0; ib<meshes[im]->boneNames.size(); ++ib)
+            meshBoneJoints[im][ib] = skeleton.jointIndex(meshes[im]->boneNames[ib]);
+    }
+
+    for (int ia=0; ia<animations.size(); ++ia) {
+        const BakedClip &clip = m_clips[ia];
+        skeleton.setAnimation(ia);
+
+        for (int frame=0; frame<clip.frameCount; ++frame) {
+            const double tick = qMin(animations[ia]->duration, frame / clip.framesPerTick);
+            skeleton.update(tick);
+
+            float *texel = m_texels.data() + (clip.firstFrame + frame) * m_width * 4;
+            for (int im=0; im<meshes.size(); ++im) {
+                const Mesh &mesh = *meshes[im];
+                for (int ib=0; ib<mesh.boneNames.size(); ++ib) {
+                    Affine3x4 boneMatrix = Affine3x4::identity();
+                    const int joint = meshBoneJoints[im][ib];
+                    if (joint != -1)
+                        boneMatrix = inverseRootMatrix * skeleton.worldMatrix(joint) * mesh.boneOffsets[ib];
+
+                    // The three rows are the texels of the bone
+                    memcpy(texel, boneMatrix.m, sizeof(boneMatrix.m));
+                    texel += 12;
+                }
+            }
+        }
+    }
+
+    qDebug() << "Baked" << animations.size() << "clips at" << m_sampleRate << "fps:"
+             << m_width / 3 << "bones x" << m_height << "frames," << textureBytes() / 1024 << "KB"
+             << (m_halfFloat ? "(half float)" : "(float)");
+    return true;
+}
+
+qint64 AnimationBaker::textureBytes() const
+{
+    return qint64(m_width) * m_height * 4 * (m_halfFloat ? 2 : 4);
+}
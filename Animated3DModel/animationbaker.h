@@ -0,0 +1,52 @@
+#ifndef ANIMATIONBAKER_H
+#define ANIMATIONBAKER_H
+
+#include "modelloader.h"
+#include "cliplibrary.h"
+
+struct BakedClip
+{
+    int firstFrame;     // first texture row of the clip
+    int frameCount;
+    double framesPerTick;
+};
+
+// Samples every animation clip at a fixed rate into a texture of final skinning matrices, so looping
+// characters can be played back entirely in the vertex shader.
+// Each texture row is one frame, each bone takes three RGBA texels holding the rows of its 3x4 matrix.
+// The bones of all meshes are laid out one after the other, see meshPaletteOffset.
+class AnimationBaker
+{
+public:
+    AnimationBaker();
+
+    void setSampleRate(float framesPerSecond) { m_sampleRate = framesPerSecond; }
+    void setHalfFloat(bool arg) { m_halfFloat = arg; }
+    bool halfFloat() const { return m_halfFloat; }
+
+    bool bake(const Node *rootNode, const QVector<QSharedPointer<Mesh> > &meshes,
+              const QVector<QSharedPointer<Animation> > &animations, QSharedPointer<ClipLibrary> clips);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    const QVector<float> &texels() const { return m_texels; }
+    void releaseTexels() { m_texels = QVector<float>(); }
+
+    int meshPaletteOffset(int mesh) const { return m_meshPaletteOffsets.at(mesh); }
+    const BakedClip &clip(int animation) const { return m_clips.at(animation); }
+
+    // Size of the texture once uploaded
+    qint64 textureBytes() const;
+
+private:
+    float m_sampleRate;
+    bool m_halfFloat;
+
+    int m_width;
+    int m_height;
+    QVector<float> m_texels;
+    QVector<int> m_meshPaletteOffsets;
+    QVector<BakedClip> m_clips;
+};
+
+#endif // ANIMATIONBAKER_H
@@ -0,0 +1,323 @@
+#include "assetmanager.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QOpenGLContext>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+
+template <typename T>
+void hashArray(QCryptographicHash &hash, const QVector<T> &array)
+{
+    const int size = array.size();
+    hash.addData(reinterpret_cast<const char*>(&size), sizeof(size));
+    hash.addData(reinterpret_cast<const char*>(array.constData()), array.size() * sizeof(T));
+}
+
+QByteArray materialKey(const MaterialInfo &mater)
+{
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << mater.Name << mater.Ambient << mater.Diffuse << mater.Specular << mater.Shininess;
+    return key;
+}
+
+template <typename T>
+void allocateBuffer(QOpenGLBuffer &buffer, const QVector<T> &data, qint64 &bytes)
+{
+    buffer.create();
+    buffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
+    buffer.bind();
+    buffer.allocate( data.constData(), data.size() * sizeof( T ) );
+    buffer.release();
+    bytes += data.size() * sizeof( T );
+}
+
+}
+
+AssetManager *AssetManager::instance()
+{
+    static AssetManager manager;
+    return &manager;
+}
+
+QSharedPointer<ModelLoader> AssetManager::loadModel(QString filePath, ModelLoader::PathType pathType,
+                                                    bool transformToUnitCoordinates,
+                                                    const ImportProfile &profile)
+{
+    QString resolvedPath = ModelLoader::resolveFilePath(filePath, pathType);
+    if (QFileInfo(resolvedPath).exists())
+        resolvedPath = QFileInfo(resolvedPath).canonicalFilePath();
+    const QString key = QString("%1|unit=%2|profile=%3").arg(resolvedPath).arg(transformToUnitCoordinates)
+            .arg(profile.attributes);
+
+    {
+        QMutexLocker locker(&m_mutex);
+        QSharedPointer<ModelLoader> cached = m_models.value(key).model.toStrongRef();
+        if (cached) {
+            ++m_statistics.modelHits;
+            qDebug() << "AssetManager: reusing" << resolvedPath;
+            return cached;
+        }
+    }
+
+    // Parse without holding the lock, so different models can load at the same time
+    QSharedPointer<ModelLoader> model(new ModelLoader);
+    model->setTransformToUnitCoordinates(transformToUnitCoordinates);
+    model->setImportProfile(profile);
+    if (!model->Load(resolvedPath, ModelLoader::AbsolutePath))
+        return QSharedPointer<ModelLoader>();
+    const QByteArray hash = geometryHash(*model);
+
+    QMutexLocker locker(&m_mutex);
+
+    // Someone else may have finished loading the same model meanwhile
+    QSharedPointer<ModelLoader> cached = m_models.value(key).model.toStrongRef();
+    if (cached) {
+        ++m_statistics.modelHits;
+        return cached;
+    }
+
+    // Forget about models nobody uses anymore
+    for (QHash<QString, ModelEntry>::iterator it = m_models.begin(); it != m_models.end(); ) {
+        if (it.value().model.isNull())
+            it = m_models.erase(it);
+        else
+            ++it;
+    }
+
+    // Identical geometry loaded from a different file shares the same arrays, unless they were released
+    QSharedPointer<ModelLoader> original = m_geometry.value(hash).toStrongRef();
+    if (original && !original->geometryReleased()) {
+        shareGeometry(*model, *original);
+        ++m_statistics.geometryShared;
+    }
+    else {
+        m_geometry.insert(hash, model);
+    }
+
+    shareMaterials(*model);
+
+    ModelEntry entry;
+    entry.model = model;
+    entry.geometryHash = hash;
+    m_models.insert(key, entry);
+    ++m_statistics.modelLoads;
+
+    return model;
+}
+
+QSharedPointer<ModelBuffers> AssetManager::modelBuffers(const QSharedPointer<ModelLoader> &model, int flags)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context || !model) {
+        qWarning() << "AssetManager: buffers requested without a current context or model";
+        return QSharedPointer<ModelBuffers>();
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    QByteArray hash;
+    foreach (const ModelEntry &entry, m_models) {
+        if (entry.model.data() == model.data()) {
+            hash = entry.geometryHash;
+            break;
+        }
+    }
+    if (hash.isEmpty())
+        hash = geometryHash(*model);
+
+    // Buffers can be used by every context in a share group, but not across groups
+    const QByteArray key = QByteArray::number(quintptr(context->shareGroup()), 16) + '/'
+            + hash.toHex() + '/' + QByteArray::number(flags);
+
+    QSharedPointer<ModelBuffers> buffers = m_buffers.value(key).toStrongRef();
+    if (buffers) {
+        ++m_statistics.bufferHits;
+        return buffers;
+    }
+
+    for (QHash<QByteArray, QWeakPointer<ModelBuffers> >::iterator it = m_buffers.begin(); it != m_buffers.end(); ) {
+        if (it.value().isNull())
+            it = m_buffers.erase(it);
+        else
+            ++it;
+    }
+
+    if (model->geometryReleased()) {
+        qWarning() << "AssetManager: geometry was released after upload, can't upload it for another share group";
+        return QSharedPointer<ModelBuffers>();
+    }
+
+    buffers = createBuffers(*model, flags);
+    buffers->geometryHash = hash;
+    m_buffers.insert(key, buffers);
+    ++m_statistics.bufferUploads;
+
+    if (m_geometryPolicy != KeepGeometry)
+        model->releaseGeometry(m_geometryPolicy == KeepPickingGeometry);
+    return buffers;
+}
+
+void AssetManager::setGeometryPolicy(GeometryPolicy policy)
+{
+    QMutexLocker locker(&m_mutex);
+    m_geometryPolicy = policy;
+}
+
+AssetManager::GeometryPolicy AssetManager::geometryPolicy()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_geometryPolicy;
+}
+
+QVector<AssetManager::AssetMemory> AssetManager::memoryReport()
+{
+    QMutexLocker locker(&m_mutex);
+
+    QVector<AssetMemory> report;
+    for (QHash<QString, ModelEntry>::const_iterator it = m_models.constBegin(); it != m_models.constEnd(); ++it) {
+        QSharedPointer<ModelLoader> model = it.value().model.toStrongRef();
+        if (!model)
+            continue;
+
+        AssetMemory asset;
+        asset.asset = it.key();
+        asset.usage = model->memoryUsage();
+
+        // Buffers of every share group the model was uploaded to
+        foreach (const QWeakPointer<ModelBuffers> &weak, m_buffers) {
+            QSharedPointer<ModelBuffers> buffers = weak.toStrongRef();
+            if (buffers && buffers->geometryHash == it.value().geometryHash)
+                asset.usage.gpuBuffers += buffers->bytes;
+        }
+        report.append(asset);
+    }
+    return report;
+}
+
+AssetManager::Statistics AssetManager::statistics()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_statistics;
+}
+
+QByteArray AssetManager::geometryHash(ModelLoader &model)
+{
+    QVector<float> *vertices, *normals, *tangents, *bitangents, *vertexBoneWeights;
+    QVector<unsigned int> *indices;
+    QVector<QVector<float> > *textureUV;
+    QVector<int> *vertexBoneIndexes;
+
+    model.getBufferData(&vertices, &normals, &indices);
+    model.getTextureData(&textureUV, &tangents, &bitangents);
+    model.getBoneData(&vertexBoneIndexes, &vertexBoneWeights);
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hashArray(hash, *vertices);
+    hashArray(hash, *normals);
+    hashArray(hash, *indices);
+    hashArray(hash, *tangents);
+    hashArray(hash, *bitangents);
+    hashArray(hash, *vertexBoneIndexes);
+    hashArray(hash, *vertexBoneWeights);
+    for (int ii=0; ii<textureUV->size(); ++ii)
+        hashArray(hash, textureUV->at(ii));
+    return hash.result();
+}
+
+void AssetManager::shareGeometry(ModelLoader &model, ModelLoader &original)
+{
+    // QVector is implicitly shared, assigning the identical arrays frees the duplicates
+    QVector<float> *vertices, *normals, *tangents, *bitangents, *vertexBoneWeights;
+    QVector<unsigned int> *indices;
+    QVector<QVector<float> > *textureUV;
+    QVector<int> *vertexBoneIndexes;
+    QVector<float> *oVertices, *oNormals, *oTangents, *oBitangents, *oVertexBoneWeights;
+    QVector<unsigned int> *oIndices;
+    QVector<QVector<float> > *oTextureUV;
+    QVector<int> *oVertexBoneIndexes;
+
+    model.getBufferData(&vertices, &normals, &indices);
+    model.getTextureData(&textureUV, &tangents, &bitangents);
+    model.getBoneData(&vertexBoneIndexes, &vertexBoneWeights);
+    original.getBufferData(&oVertices, &oNormals, &oIndices);
+    original.getTextureData(&oTextureUV, &oTangents, &oBitangents);
+    original.getBoneData(&oVertexBoneIndexes, &oVertexBoneWeights);
+
+    *vertices = *oVertices;
+    *normals = *oNormals;
+    *indices = *oIndices;
+    *tangents = *oTangents;
+    *bitangents = *oBitangents;
+    *textureUV = *oTextureUV;
+    *vertexBoneIndexes = *oVertexBoneIndexes;
+    *vertexBoneWeights = *oVertexBoneWeights;
+}
+
+void AssetManager::shareMaterials(ModelLoader &model)
+{
+    QVector<QSharedPointer<MaterialInfo> > materials = model.getMaterials();
+    for (int ii=0; ii<materials.size(); ++ii) {
+        const QByteArray key = materialKey(*materials[ii]);
+        QSharedPointer<MaterialInfo> shared = m_materials.value(key).toStrongRef();
+        if (shared) {
+            if (shared != materials[ii]) {
+                model.replaceMaterial(ii, shared);
+                ++m_statistics.materialsShared;
+            }
+        }
+        else {
+            m_materials.insert(key, materials[ii]);
+        }
+    }
+}
+
+QSharedPointer<ModelBuffers> AssetManager::createBuffers(ModelLoader &model, int flags)
+{
+    QSharedPointer<ModelBuffers> buffers(new ModelBuffers);
+    buffers->flags = flags;
+
+    QVector<float> *vertices;
+    QVector<float> *normals;
+    QVector<QVector<float> > *textureUV;
+    QVector<unsigned int> *indices;
+
+    model.getBufferData(&vertices, &normals, &indices);
+    model.getTextureData(&textureUV, 0, 0);
+
+    allocateBuffer(buffers->vertexBuffer, *vertices, buffers->bytes);
+    allocateBuffer(buffers->normalBuffer, *normals, buffers->bytes);
+
+    if(textureUV != 0 && textureUV->size() != 0)
+    {
+        // Only the first uv channel is used for now
+        allocateBuffer(buffers->textureUVBuffer, textureUV->at(0), buffers->bytes);
+    }
+
+    if (flags & ModelBuffers::ShortIndices) {
+        // OpenGL ES -- unsigned long int type indexes are not supported, use unsigned short instead
+        QVector<unsigned short> shortindices(indices->size());
+        std::copy(indices->constBegin(), indices->constEnd(), shortindices.begin());
+        allocateBuffer(buffers->indexBuffer, shortindices, buffers->bytes);
+    }
+    else {
+        allocateBuffer(buffers->indexBuffer, *indices, buffers->bytes);
+    }
+
+    if (flags & ModelBuffers::BoneData) {
+        QVector<int> *vertexBoneIndexes;
+        QVector<float> *vertexBoneWeights;
+        model.getBoneData(&vertexBoneIndexes, &vertexBoneWeights);
+
+        // Integer attribute, the skinning shaders index the palette without converting
+        allocateBuffer(buffers->vertexBoneIndexBuffer, *vertexBoneIndexes, buffers->bytes);
+        allocateBuffer(buffers->vertexBoneWeightBuffer, *vertexBoneWeights, buffers->bytes);
+    }
+
+    qDebug() << "AssetManager: uploaded buffers, vertices" << vertices->size();
+    return buffers;
+}
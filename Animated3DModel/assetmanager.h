@@ -0,0 +1,100 @@
+#ifndef ASSETMANAGER_H
+#define ASSETMANAGER_H
+
+#include <QMutex>
+#include <QOpenGLBuffer>
+#include <QOpenGLContextGroup>
+#include "modelloader.h"
+
+// GL buffers of one loaded model, shared by every scene rendering it in the same share group
+struct ModelBuffers
+{
+    enum Flags {
+        NoFlags       = 0x0,
+        ShortIndices  = 0x1,    // OpenGL ES 2 has no unsigned int indices
+        BoneData      = 0x2     // upload bone indices and weights for skinning
+    };
+
+    ModelBuffers() : indexBuffer(QOpenGLBuffer::IndexBuffer), flags(NoFlags), bytes(0) {}
+
+    QOpenGLBuffer vertexBuffer;
+    QOpenGLBuffer normalBuffer;
+    QOpenGLBuffer textureUVBuffer;
+    QOpenGLBuffer indexBuffer;
+    QOpenGLBuffer vertexBoneIndexBuffer;
+    QOpenGLBuffer vertexBoneWeightBuffer;
+    int flags;
+    qint64 bytes;               // allocated by all buffers together
+    QByteArray geometryHash;    // of the model they were uploaded from
+};
+
+// Process wide, reference counted cache of parsed models and their GL buffers.
+// Entries are only weakly held, so a model is released as soon as the last scene using it lets go.
+class AssetManager
+{
+public:
+    // What happens to a model's CPU side vertex arrays once its buffers have been uploaded. Models
+    // whose arrays are gone can't be uploaded again, e.g. for a context outside the share group.
+    enum GeometryPolicy {
+        KeepGeometry,           // everything stays
+        KeepPickingGeometry,    // positions, indices and bone data stay for picking
+        ReleaseGeometry         // only bounds, meshes and nodes stay
+    };
+
+    struct AssetMemory {
+        QString asset;
+        MemoryUsage usage;
+    };
+
+    static AssetManager *instance();
+
+    void setGeometryPolicy(GeometryPolicy policy);
+    GeometryPolicy geometryPolicy();
+
+    // Every model in use with its own memory and that of the buffers uploaded from it
+    QVector<AssetMemory> memoryReport();
+
+    // Parsed CPU side model data, shared by every request with the same path and options
+    QSharedPointer<ModelLoader> loadModel(QString filePath, ModelLoader::PathType pathType,
+                                          bool transformToUnitCoordinates,
+                                          const ImportProfile &profile = ImportProfile());
+
+    // Buffers of the model for the share group of the current context, created on first use
+    QSharedPointer<ModelBuffers> modelBuffers(const QSharedPointer<ModelLoader> &model, int flags);
+
+    struct Statistics {
+        Statistics() : modelLoads(0), modelHits(0), geometryShared(0), materialsShared(0), bufferUploads(0), bufferHits(0) {}
+        int modelLoads;
+        int modelHits;
+        int geometryShared;     // loads whose geometry matched an already loaded model
+        int materialsShared;    // materials replaced by an identical one from another model
+        int bufferUploads;
+        int bufferHits;
+    };
+    Statistics statistics();
+
+private:
+    AssetManager() : m_geometryPolicy(KeepGeometry) {}
+
+    struct ModelEntry {
+        QWeakPointer<ModelLoader> model;
+        QByteArray geometryHash;
+    };
+
+    QByteArray geometryHash(ModelLoader &model);
+    void shareGeometry(ModelLoader &model, ModelLoader &original);
+    void shareMaterials(ModelLoader &model);
+    QSharedPointer<ModelBuffers> createBuffers(ModelLoader &model, int flags);
+
+    QMutex m_mutex;
+
+    QHash<QString, ModelEntry> m_models;                            // by path and options
+    QHash<QByteArray, QWeakPointer<ModelLoader> > m_geometry;       // by geometry hash
+    QHash<QByteArray, QWeakPointer<MaterialInfo> > m_materials;     // by material contents
+    QHash<QByteArray, QWeakPointer<ModelBuffers> > m_buffers;       // by share group, geometry and flags
+
+    GeometryPolicy m_geometryPolicy;
+    Statistics m_statistics;
+};
+
+#endif // ASSETMANAGER_H
@@ -0,0 +1,85 @@
+#version 330 core
+
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexNormal;
+layout (location = 2) in vec2 vertexUV;
+
+layout (location = 3) in ivec4 boneIndexes;
+layout (location = 4) in vec4 boneWeights;
+
+// Baked skinning matrices, see AnimationBaker
+uniform sampler2D bakedPalette;
+uniform int paletteOffset;
+uniform int clipFirstFrame;
+uniform int clipFrameCount;
+uniform float clipFrame;
+uniform bool interpolateFrames;
+
+uniform mat4 MV;
+uniform mat3 N;
+uniform mat4 MVP;
+
+out vec3 normal;
+out vec3 position;
+out vec2 uv;
+
+mat4 bakedBone(int bone, int frame)
+{
+    ivec2 texel = ivec2((paletteOffset + bone) * 3, clipFirstFrame + frame);
+
+    vec4 row0 = texelFetch(bakedPalette, texel, 0);
+    vec4 row1 = texelFetch(bakedPalette, texel + ivec2(1, 0), 0);
+    vec4 row2 = texelFetch(bakedPalette, texel + ivec2(2, 0), 0);
+
+    return transpose(mat4(row0, row1, row2, vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+mat4 boneModelMatrix(int bone)
+{
+    int frame = min(int(clipFrame), clipFrameCount - 1);
+    mat4 matrix = bakedBone(bone, frame);
+
+    if (interpolateFrames) {
+        int nextFrame = min(frame + 1, clipFrameCount - 1);
+        matrix += (bakedBone(bone, nextFrame) - matrix) * fract(clipFrame);
+    }
+    return matrix;
+}
+
+// Same influence variants as ads_fragment.vert
+mat4 skinningMatrix()
+{
+#if !defined(INFLUENCES)
+    if (boneWeights[0] == 0.0)
+        return mat4(1.0);
+    return boneModelMatrix(boneIndexes[0]) * boneWeights[0]
+         + boneModelMatrix(boneIndexes[1]) * boneWeights[1]
+         + boneModelMatrix(boneIndexes[2]) * boneWeights[2]
+         + boneModelMatrix(boneIndexes[3]) * boneWeights[3];
+#elif INFLUENCES == 0
+    return mat4(1.0);
+#elif INFLUENCES == 1
+    return boneModelMatrix(boneIndexes[0]);
+#else
+    mat4 boneTransform = boneModelMatrix(boneIndexes[0]) * boneWeights[0]
+                       + boneModelMatrix(boneIndexes[1]) * boneWeights[1];
+#if INFLUENCES > 2
+    boneTransform += boneModelMatrix(boneIndexes[2]) * boneWeights[2];
+#endif
+#if INFLUENCES > 3
+    boneTransform += boneModelMatrix(boneIndexes[3]) * boneWeights[3];
+#endif
+    return boneTransform;
+#endif
+}
+
+void main()
+{
+    mat4 boneTransform = skinningMatrix();
+
+    normal = normalize((MV * boneTransform * vec4(vertexNormal, 0.0)).xyz);
+    position = vec3( MV * boneTransform * vec4( vertexPosition, 1.0 ) );
+
+    uv = vertexUV;
+    gl_Position = MVP * boneTransform * vec4( vertexPosition, 1.0 );
+}
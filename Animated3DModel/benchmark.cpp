@@ -0,0 +1,397 @@
+#include "benchmark.h"
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+#include "scene.h"
+#include "scene_gles.h"
+#include "posekernels.h"
+#include "posestream.h"
+#include "framecapture.h"
+
+namespace {
+
+// FNV-1a, cheap enough to run on every frame and stable across platforms
+quint32 checksum(const uchar *data, int size, quint32 hash = 2166136261u)
+{
+    for (int ii=0; ii<size; ++ii) {
+        hash ^= data[ii];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+double toMs(qint64 ns, int frames)
+{
+    return frames > 0 ? ns / 1000000.0 / frames : 0;
+}
+
+}
+
+OffscreenBenchmark::OffscreenBenchmark() :
+    m_frames(500)
+  , m_size(800, 600)
+  , m_instanceCount(1)
+  , m_bakedAnimation(false)
+  , m_viewCount(1)
+{
+
+}
+
+SceneBase *OffscreenBenchmark::createScene(Backend backend)
+{
+    if (backend == Backend_GL33) {
+        Scene *scene = new Scene(m_modelPath, ModelLoader::RelativePath);
+        scene->setBakedAnimation(m_bakedAnimation);
+        return scene;
+    }
+    return new Scene_GLES(m_modelPath, ModelLoader::RelativePath);
+}
+
+bool OffscreenBenchmark::run(Backend backend, Result &result)
+{
+    result = Result();
+    result.backend = backend == Backend_GL33 ? "Scene (OpenGL 3.3)" : "Scene_GLES (OpenGL 2.1/ES 2.0)";
+
+    QSurfaceFormat requestedFormat;
+    requestedFormat.setDepthBufferSize( 24 );
+    requestedFormat.setSwapInterval( 0 );
+    if (backend == Backend_GL33) {
+        requestedFormat.setMajorVersion( 3 );
+        requestedFormat.setMinorVersion( 3 );
+        requestedFormat.setProfile( QSurfaceFormat::CoreProfile );
+    }
+    else {
+        requestedFormat.setMajorVersion( 2 );
+        requestedFormat.setMinorVersion( 1 );
+    }
+
+    // Share with the global context like the windows do, so the AssetManager's buffers are reused
+    QOpenGLContext context;
+    context.setFormat( requestedFormat );
+    context.setShareContext( QOpenGLContext::globalShareContext() );
+    if (!context.create()) {
+        qCritical() << "Benchmark: unable to create an OpenGL context for" << result.backend;
+        return false;
+    }
+    if (backend == Backend_GL33 && context.format().version() < qMakePair(3,3)) {
+        qCritical() << "Benchmark: OpenGL 3.3 is not available, got" << context.format().version();
+        return false;
+    }
+
+    QOffscreenSurface surface;
+    surface.setFormat( context.format() );
+    surface.create();
+    if (!surface.isValid() || !context.makeCurrent( &surface )) {
+        qCritical() << "Benchmark: unable to make the offscreen surface current";
+        return false;
+    }
+
+    QOpenGLFunctions *gl = context.functions();
+    result.renderer = QString::fromLatin1(reinterpret_cast<const char*>(gl->glGetString(GL_RENDERER)));
+
+    bool ok = true;
+    {
+        QOpenGLFramebufferObject fbo(m_size, QOpenGLFramebufferObject::Depth);
+        fbo.bind();
+
+        QScopedPointer<SceneBase> scene(createScene(backend));
+        scene->setInstanceCount(m_instanceCount);
+        if (m_viewCount > 1)
+            scene->setViews(SceneView::split(m_viewCount));
+        scene->initialize();
+        scene->resize(m_size.width(), m_size.height());
+
+        if (scene->hasError()) {
+            qCritical() << "Benchmark: unable to set up" << result.backend;
+            ok = false;
+        }
+        result.memory = scene->memoryUsage();
+
+        PoseRecorder recorder;
+        PoseReplay replay;
+        const bool recording = backend == Backend_GL33 && !m_recordPath.isEmpty();
+        const bool replaying = backend == Backend_GL33 && !m_replayPath.isEmpty();
+        if (recording && !recorder.open(m_recordPath, m_modelPath))
+            ok = false;
+        if (replaying) {
+            if (!replay.open(m_replayPath))
+                ok = false;
+            else if (replay.modelPath() != m_modelPath)
+                qWarning() << "Benchmark: poses were recorded with" << replay.modelPath();
+        }
+        PoseFrame frame;
+
+        FrameCapture capture;
+        capture.setDirectory(m_captureDirectory);
+        const bool capturing = backend == Backend_GL33 && !m_captureDirectory.isEmpty();
+        if (capturing && !capture.initialize())
+            ok = false;
+
+        QVector<uchar> pixels(m_size.width() * m_size.height() * 4);
+        qint64 animationNs = 0, drawNs = 0, finishNs = 0, readbackNs = 0, recordNs = 0, captureNs = 0;
+        qint64 stateCalls = 0, redundantStateCalls = 0, culledInstances = 0, cullTests = 0, drawPackets = 0;
+        QElapsedTimer timer;
+
+        result.frameChecksums.reserve(m_frames);
+        result.checksum = checksum(0, 0);
+
+        for (int ii=0; ok && (replaying ? !replay.atEnd() : ii<m_frames); ++ii) {
+            if (replaying) {
+                if (!replay.next(frame)) {
+                    ok = false;
+                    break;
+                }
+                QVector<QMatrix4x4> instanceMatrices(frame.instanceMatrices.size());
+                for (int ij=0; ij<instanceMatrices.size(); ++ij)
+                    instanceMatrices[ij] = QtConversions::toQt(frame.instanceMatrices[ij]);
+                scene->setInstanceMatrices(instanceMatrices);
+                scene->setAnimationTime(frame.animation, frame.tick);
+            }
+
+            timer.start();
+            scene->update();
+            const FrameTimings timings = scene->frameTimings();
+            animationNs += timings.animationNs;
+            drawNs += timings.drawNs;
+            recordNs += timings.recordNs;
+            drawPackets += timings.drawPackets;
+            stateCalls += timings.stateCalls;
+            redundantStateCalls += timings.redundantStateCalls;
+            culledInstances += timings.culledInstances;
+            cullTests += timings.cullTests;
+            result.views = timings.views;
+
+            // Queued before the finish, so the copy runs along with the frame like it would before a swap
+            if (capturing) {
+                timer.restart();
+                capture.capture(m_size);
+                captureNs += timer.nsecsElapsed();
+            }
+
+            timer.restart();
+            gl->glFinish();
+            finishNs += timer.nsecsElapsed();
+
+            // Frames are compared, not measured, so reading them back is kept out of the frame rate
+            timer.restart();
+            gl->glReadPixels(0, 0, m_size.width(), m_size.height(), GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            const quint32 frameChecksum = checksum(pixels.constData(), pixels.size());
+            readbackNs += timer.nsecsElapsed();
+
+            result.frameChecksums.append(frameChecksum);
+            result.checksum = checksum(reinterpret_cast<const uchar*>(&frameChecksum), sizeof(frameChecksum), result.checksum);
+
+            const FramePacket &packet = scene->lastPacket();
+            if (replaying) {
+                QString error;
+                if (!PoseStream::compare(frame, packet.palettes, &error)) {
+                    if (result.poseMismatches == 0)
+                        qCritical() << "Benchmark: pose of frame" << ii << "doesn't match the recording," << error;
+                    ++result.poseMismatches;
+                }
+                ++result.posesVerified;
+            }
+            if (recording) {
+                PoseFrame recorded;
+                recorded.animation = packet.animation;
+                recorded.tick = packet.animationTick;
+                recorded.instanceMatrices.resize(scene->instanceCount());
+                for (int ij=0; ij<recorded.instanceMatrices.size(); ++ij)
+                    recorded.instanceMatrices[ij] = QtConversions::fromQt(scene->instanceMatrix(ij));
+                recorded.palettes = packet.palettes;
+                recorded.checksum = PoseStream::checksum(packet.palettes);
+                recorder.record(recorded);
+                ++result.posesRecorded;
+            }
+        }
+
+        if (recording) {
+            if (!recorder.close())
+                ok = false;
+            qDebug().noquote() << QString("Benchmark: recorded %1 poses into %2 KB")
+                                  .arg(recorder.frameCount()).arg(recorder.bytesWritten() / 1024);
+        }
+        if (result.poseMismatches > 0)
+            ok = false;
+
+        if (capturing) {
+            timer.restart();
+            capture.cleanup();
+            result.captureFlushMs = timer.nsecsElapsed() / 1000000.0;
+
+            const FrameCapture::Statistics statistics = capture.statistics();
+            result.framesCaptured = statistics.written;
+            result.captureFailures = statistics.failed;
+            result.captureGpuWaits = statistics.gpuWaits;
+            result.captureWriterWaits = statistics.writerWaits;
+            if (statistics.failed > 0)
+                ok = false;
+        }
+
+        result.frames = result.frameChecksums.size();
+        result.totalMs = (animationNs + drawNs + finishNs + captureNs) / 1000000.0;
+        result.animationMs = toMs(animationNs, result.frames);
+        result.drawMs = toMs(drawNs, result.frames);
+        result.finishMs = toMs(finishNs, result.frames);
+        result.readbackMs = toMs(readbackNs, result.frames);
+        result.recordMs = toMs(recordNs, result.frames);
+        result.captureMs = toMs(captureNs, result.frames);
+        if (result.frames > 0) {
+            result.stateCalls = double(stateCalls) / result.frames;
+            result.redundantStateCalls = double(redundantStateCalls) / result.frames;
+            result.culledInstances = double(culledInstances) / result.frames;
+            result.cullTests = double(cullTests) / result.frames;
+            result.drawPackets = double(drawPackets) / result.frames;
+        }
+
+        // GL resources have to go while the context is still current
+        scene->cleanup();
+        fbo.release();
+    }
+    context.doneCurrent();
+
+    return ok;
+}
+
+void OffscreenBenchmark::printResult(const Result &result)
+{
+    qDebug().noquote() << QString("%1 on %2").arg(result.backend).arg(result.renderer);
+    qDebug().noquote() << QString("  %1 frames in %2 ms, %3 fps")
+                          .arg(result.frames).arg(result.totalMs, 0, 'f', 1).arg(result.framesPerSecond(), 0, 'f', 1);
+    qDebug().noquote() << QString("  per frame: animation %1 ms, draw %2 ms, gpu finish %3 ms, readback %4 ms")
+                          .arg(result.animationMs, 0, 'f', 3).arg(result.drawMs, 0, 'f', 3)
+                          .arg(result.finishMs, 0, 'f', 3).arg(result.readbackMs, 0, 'f', 3);
+    if (result.drawPackets > 0)
+        qDebug().noquote() << QString("  per frame: %1 draw packets recorded and sorted in %2 ms")
+                              .arg(result.drawPackets, 0, 'f', 1).arg(result.recordMs, 0, 'f', 3);
+    if (result.stateCalls > 0 || result.redundantStateCalls > 0)
+        qDebug().noquote() << QString("  per frame: %1 GL state calls, %2 redundant ones skipped")
+                              .arg(result.stateCalls, 0, 'f', 1).arg(result.redundantStateCalls, 0, 'f', 1);
+    if (result.views > 1 || result.culledInstances > 0)
+        qDebug().noquote() << QString("  %1 views, %2 instances culled per frame with %3 box tests")
+                              .arg(result.views).arg(result.culledInstances, 0, 'f', 1).arg(result.cullTests, 0, 'f', 1);
+    qDebug().noquote() << QString("  memory: CPU geometry %1 KB, CPU animation %2 KB, GPU buffers %3 KB, textures %4 KB")
+                          .arg(result.memory.cpuGeometry / 1024).arg(result.memory.cpuAnimation / 1024)
+                          .arg(result.memory.gpuBuffers / 1024).arg(result.memory.textures / 1024);
+    if (result.posesVerified > 0)
+        qDebug().noquote() << QString("  replay: %1 of %2 poses identical to the recording")
+                              .arg(result.posesVerified - result.poseMismatches).arg(result.posesVerified);
+    if (result.framesCaptured > 0 || result.captureFailures > 0)
+        qDebug().noquote() << QString("  capture: %1 frames written, %2 ms per frame, %3 ms to flush, %4 GPU waits, %5 writer waits, %6 failed")
+                              .arg(result.framesCaptured).arg(result.captureMs, 0, 'f', 3).arg(result.captureFlushMs, 0, 'f', 1)
+                              .arg(result.captureGpuWaits).arg(result.captureWriterWaits).arg(result.captureFailures);
+    qDebug().noquote() << QString("  image checksum %1").arg(result.checksum, 8, 16, QChar('0'));
+}
+
+bool OffscreenBenchmark::writeChecksums(QString filePath, const QVector<Result> &results)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qCritical() << "Benchmark: unable to write" << filePath << file.errorString();
+        return false;
+    }
+
+    // One line per frame, so runs can be diffed against each other
+    QTextStream stream(&file);
+    foreach (const Result &result, results) {
+        for (int ii=0; ii<result.frameChecksums.size(); ++ii)
+            stream << result.backend << '\t' << ii << '\t'
+                   << QString("%1").arg(result.frameChecksums[ii], 8, 16, QChar('0')) << '\n';
+    }
+    return true;
+}
+
+void PoseKernelBenchmark::run(int joints, int iterations)
+{
+    joints = qMax(2, joints);
+    iterations = qMax(1, iterations);
+
+    // Binary tree, stored level by level like Skeleton does
+    QVector<int> parents(joints);
+    QVector<int> levels;
+    parents[0] = -1;
+    for (int ii=1; ii<joints; ++ii)
+        parents[ii] = (ii - 1) / 2;
+    for (int first=1; first<joints; first = first * 2 + 1)
+        levels.append(first);
+    levels.append(joints);
+
+    QVector<QVector3D> positions(joints), scalings(joints);
+    QVector<QQuaternion> rotations(joints);
+    QVector<float> trs[10];
+    for (int ii=0; ii<10; ++ii)
+        trs[ii].resize(joints);
+    for (int ii=0; ii<joints; ++ii) {
+        positions[ii] = QVector3D(ii * 0.1f, 1.0f, -0.5f);
+        rotations[ii] = QQuaternion::fromAxisAndAngle(QVector3D(1.0f, ii % 3, 0.5f).normalized(), ii * 7.0f);
+        scalings[ii] = QVector3D(1.0f, 1.0f + ii % 2 * 0.1f, 1.0f);
+
+        trs[0][ii] = positions[ii].x(); trs[1][ii] = positions[ii].y(); trs[2][ii] = positions[ii].z();
+        trs[3][ii] = rotations[ii].x(); trs[4][ii] = rotations[ii].y(); trs[5][ii] = rotations[ii].z();
+        trs[6][ii] = rotations[ii].scalar();
+        trs[7][ii] = scalings[ii].x(); trs[8][ii] = scalings[ii].y(); trs[9][ii] = scalings[ii].z();
+    }
+
+    QElapsedTimer timer;
+    const double totalJoints = double(joints) * iterations;
+
+    // What Scene used to do for every node
+    QVector<QMatrix4x4> world(joints);
+    timer.start();
+    for (int it=0; it<iterations; ++it) {
+        for (int ii=0; ii<joints; ++ii) {
+            QMatrix4x4 local;
+            local.translate(positions[ii]);
+            local.rotate(rotations[ii]);
+            local.scale(scalings[ii]);
+            world[ii] = parents[ii] != -1 ? world[parents[ii]] * local : local;
+        }
+    }
+    const qint64 matrixNs = qMax<qint64>(1, timer.nsecsElapsed());
+    qDebug().noquote() << QString("QMatrix4x4: %1 M joints/s").arg(totalJoints / matrixNs * 1000.0, 0, 'f', 2);
+
+    const TrsArrays arrays = {
+        trs[0].constData(), trs[1].constData(), trs[2].constData(),
+        trs[3].constData(), trs[4].constData(), trs[5].constData(), trs[6].constData(),
+        trs[7].constData(), trs[8].constData(), trs[9].constData()
+    };
+    QVector<int> order(joints);
+    for (int ii=0; ii<joints; ++ii)
+        order[ii] = ii;
+
+    const PoseKernels::Isa previous = PoseKernels::isa();
+    for (int isa=PoseKernels::Isa_Scalar; isa<=PoseKernels::bestIsa(); ++isa) {
+        PoseKernels::setIsa(PoseKernels::Isa(isa));
+
+        QVector<Affine3x4> local(joints), affineWorld(joints);
+        timer.restart();
+        for (int it=0; it<iterations; ++it) {
+            PoseKernels::composeTrs(arrays, joints, local.data(), 0);
+            affineWorld[0] = local[0];
+            for (int level=0; level<levels.size()-1; ++level)
+                PoseKernels::multiplyParents(affineWorld.data(), local.constData(), parents.constData(),
+                                             order.constData() + levels[level], levels[level+1] - levels[level]);
+        }
+        const qint64 ns = qMax<qint64>(1, timer.nsecsElapsed());
+
+        // Make sure the kernels compute the same pose
+        float maxError = 0.0f;
+        for (int ii=0; ii<joints; ++ii)
+            for (int row=0; row<3; ++row)
+                for (int col=0; col<4; ++col)
+                    maxError = qMax(maxError, qAbs(affineWorld[ii].m[row * 4 + col] - world[ii](row, col)));
+
+        qDebug().noquote() << QString("%1: %2 M joints/s, %3x, max difference %4")
+                              .arg(PoseKernels::isaName(PoseKernels::Isa(isa)))
+                              .arg(totalJoints / ns * 1000.0, 0, 'f', 2)
+                              .arg(double(matrixNs) / ns, 0, 'f', 1)
+                              .arg(maxError);
+    }
+    PoseKernels::setIsa(previous);
+}
@@ -0,0 +1,104 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QString>
+#include <QSize>
+#include <QVector>
+#include "memoryusage.h"
+
+class SceneBase;
+
+// Renders a fixed number of frames into an offscreen framebuffer as fast as possible,
+// without a window, timer or vsync, and reports throughput, stage timings and image checksums.
+// Works with software rasterizers such as Mesa llvmpipe, e.g. with QT_QPA_PLATFORM=offscreen.
+class OffscreenBenchmark
+{
+public:
+    enum Backend {
+        Backend_GL33,       // Scene, skinned on the GPU
+        Backend_GLES        // Scene_GLES, OpenGL 2.1/ES 2.0 path
+    };
+
+    struct Result {
+        Result() : frames(0), totalMs(0), animationMs(0), drawMs(0), finishMs(0), readbackMs(0),
+            recordMs(0), stateCalls(0), redundantStateCalls(0), views(0), culledInstances(0), cullTests(0), drawPackets(0), checksum(0),
+            posesRecorded(0), posesVerified(0), poseMismatches(0), captureMs(0), captureFlushMs(0),
+            framesCaptured(0), captureFailures(0), captureGpuWaits(0), captureWriterWaits(0) {}
+        QString backend;
+        QString renderer;
+        int frames;
+        double totalMs;         // rendering and capturing, checksum readback excluded
+        double animationMs;     // per frame averages
+        double drawMs;
+        double finishMs;        // waiting for the GPU to finish the frame
+        double readbackMs;
+        double recordMs;        // part of drawMs spent recording and sorting draw packets
+        double stateCalls;          // per frame averages, 0 for backends not tracking GL state
+        double redundantStateCalls;
+        int views;
+        double culledInstances;     // per frame average over all views
+        double cullTests;           // boxes tested to find them, per frame
+        double drawPackets;         // per frame average over all views
+        quint32 checksum;       // of all frame checksums, equal runs produce equal values
+        QVector<quint32> frameChecksums;
+        MemoryUsage memory;     // of the scene after setting it up
+        int posesRecorded;
+        int posesVerified;      // replayed frames compared with the stream
+        int poseMismatches;
+        double captureMs;           // per frame, starting readbacks and handing frames to the writers
+        double captureFlushMs;      // once, writing what was still pending after the last frame
+        int framesCaptured;         // image files written
+        int captureFailures;
+        int captureGpuWaits;        // see FrameCapture::Statistics
+        int captureWriterWaits;
+
+        double framesPerSecond() const { return totalMs > 0 ? frames * 1000.0 / totalMs : 0; }
+    };
+
+    OffscreenBenchmark();
+
+    void setModel(QString filePath) { m_modelPath = filePath; }
+    void setFrames(int frames) { m_frames = frames; }
+    void setSize(QSize size) { m_size = size; }
+    void setInstanceCount(int count) { m_instanceCount = count; }
+    void setBakedAnimation(bool enabled) { m_bakedAnimation = enabled; }
+    // Side by side views of the same frame, see SceneView::split()
+    void setViewCount(int count) { m_viewCount = count; }
+    // Writes every evaluated pose to a PoseRecorder stream. OpenGL 3.3 backend only, the other one
+    // doesn't skin.
+    void setRecordPath(QString filePath) { m_recordPath = filePath; }
+    // Replays a recorded stream instead, frame by frame, and checks the poses come out bit for bit
+    // the same. The stream decides the frame count and instance placement.
+    void setReplayPath(QString filePath) { m_replayPath = filePath; }
+    // Writes every frame to an image file through FrameCapture, counted in the frame rate.
+    // OpenGL 3.3 backend only.
+    void setCaptureDirectory(QString directory) { m_captureDirectory = directory; }
+
+    bool run(Backend backend, Result &result);
+
+    static void printResult(const Result &result);
+    static bool writeChecksums(QString filePath, const QVector<Result> &results);
+
+private:
+    SceneBase *createScene(Backend backend);
+
+    QString m_modelPath;
+    int m_frames;
+    QSize m_size;
+    int m_instanceCount;
+    bool m_bakedAnimation;
+    int m_viewCount;
+    QString m_recordPath;
+    QString m_replayPath;
+    QString m_captureDirectory;
+};
+
+// Compares the joints per second of the QMatrix4x4 pose path with the PoseKernels versions
+// on a synthetic hierarchy, composing local matrices and multiplying them level by level.
+class PoseKernelBenchmark
+{
+public:
+    static void run(int joints, int iterations);
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,154 @@
+#include "commandlist.h"
+#include <QThread>
+#include <QtConcurrent>
+#include <algorithm>
+#include <new>
+
+namespace {
+
+struct RecordRange
+{
+    CommandList *list;
+    int first;
+    int end;
+};
+
+bool packetLessThan(const DrawPacket *a, const DrawPacket *b)
+{
+    return a->key < b->key;
+}
+
+}
+
+quint64 DrawPacket::sortKey(int program, int material, int mesh, float depth)
+{
+    const quint64 depthBits = quint64(qBound(0.0f, depth, 1.0f) * 0xffffff);
+    return (quint64(program & 0xff) << 56) | (quint64(material & 0xffff) << 40)
+            | (quint64(mesh & 0xffff) << 24) | depthBits;
+}
+
+LinearAllocator::LinearAllocator(int blockBytes) :
+    m_blockBytes(blockBytes)
+  , m_block(0)
+  , m_offset(0)
+  , m_capacity(0)
+{
+
+}
+
+LinearAllocator::~LinearAllocator()
+{
+    for (int ii=0; ii<m_blocks.size(); ++ii)
+        delete [] m_blocks[ii];
+}
+
+void *LinearAllocator::allocate(int bytes, int alignment)
+{
+    for (;;) {
+        if (m_block < m_blocks.size()) {
+            const quintptr base = quintptr(m_blocks[m_block]);
+            const quintptr aligned = (base + m_offset + alignment - 1) & ~quintptr(alignment - 1);
+            if (aligned + bytes <= base + m_blockSizes[m_block]) {
+                m_offset = int(aligned + bytes - base);
+                return reinterpret_cast<void*>(aligned);
+            }
+            ++m_block;
+            m_offset = 0;
+            continue;
+        }
+
+        // Every block is full, the new one becomes the current one
+        const int size = qMax(m_blockBytes, bytes + alignment);
+        m_blocks.append(new char[size]);
+        m_blockSizes.append(size);
+        m_capacity += size;
+    }
+}
+
+void LinearAllocator::reset()
+{
+    m_block = 0;
+    m_offset = 0;
+}
+
+DrawPacket *CommandList::add()
+{
+    // Packets only hold plain values, they are never destroyed one by one
+    DrawPacket *packet = new (m_allocator.allocate(sizeof(DrawPacket), Q_ALIGNOF(DrawPacket))) DrawPacket;
+    m_packets.append(packet);
+    return packet;
+}
+
+void CommandList::clear()
+{
+    m_packets.clear();
+    m_allocator.reset();
+}
+
+CommandQueue::CommandQueue() :
+    m_listsUsed(0)
+  , m_minimumItems(16)
+  , m_sortedValid(false)
+{
+    const int count = qMax(1, QThread::idealThreadCount());
+    for (int ii=0; ii<count; ++ii)
+        m_lists.append(new CommandList);
+}
+
+CommandQueue::~CommandQueue()
+{
+    qDeleteAll(m_lists);
+}
+
+void CommandQueue::record(int itemCount, const std::function<void(CommandList &, int, int)> &recorder)
+{
+    for (int ii=0; ii<m_listsUsed; ++ii)
+        m_lists[ii]->clear();
+    m_sortedValid = false;
+
+    m_listsUsed = qBound(1, itemCount / m_minimumItems, m_lists.size());
+    if (itemCount <= 0) {
+        m_listsUsed = 0;
+        return;
+    }
+
+    QVector<RecordRange> ranges(m_listsUsed);
+    for (int ii=0; ii<m_listsUsed; ++ii) {
+        ranges[ii].list = m_lists[ii];
+        ranges[ii].first = qint64(itemCount) * ii / m_listsUsed;
+        ranges[ii].end = qint64(itemCount) * (ii + 1) / m_listsUsed;
+    }
+
+    // Small scenes aren't worth waking up other threads for
+    if (m_listsUsed == 1) {
+        recorder(*ranges[0].list, ranges[0].first, ranges[0].end);
+        return;
+    }
+    QtConcurrent::blockingMap(ranges, [&recorder](RecordRange &range) {
+        recorder(*range.list, range.first, range.end);
+    });
+}
+
+const QVector<const DrawPacket*> &CommandQueue::sorted()
+{
+    if (m_sortedValid)
+        return m_sorted;
+
+    m_sorted.clear();
+    for (int ii=0; ii<m_listsUsed; ++ii) {
+        const QVector<DrawPacket*> &packets = m_lists[ii]->packets();
+        for (int ip=0; ip<packets.size(); ++ip)
+            m_sorted.append(packets[ip]);
+    }
+    std::stable_sort(m_sorted.begin(), m_sorted.end(), packetLessThan);
+    m_sortedValid = true;
+    return m_sorted;
+}
+
+qint64 CommandQueue::bytes() const
+{
+    qint64 bytes = m_sorted.capacity() * sizeof(const DrawPacket*);
+    for (int ii=0; ii<m_lists.size(); ++ii)
+        bytes += m_lists[ii]->bytes();
+    return bytes;
+}
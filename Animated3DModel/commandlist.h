@@ -0,0 +1,102 @@
+#ifndef COMMANDLIST_H
+#define COMMANDLIST_H
+
+#include <QMatrix4x4>
+#include <QVector>
+#include <functional>
+
+// One draw, with everything the backend needs to issue it without looking at the scene again.
+// Packets know nothing about GL, the backend that recorded them interprets program and mesh.
+struct DrawPacket
+{
+    quint64 key;                // sort key, see sortKey()
+    int program;                // shader variant of the backend
+    int mesh;
+    int paletteOffset;
+    quint32 indexOffset;        // in indices
+    quint32 indexCount;
+    QMatrix4x4 modelView;
+    QMatrix3x3 normal;
+    QMatrix4x4 mvp;
+
+    // Program, then material, then mesh, so state changes are grouped, then front to back within
+    // a mesh for early depth rejection. Depth is in [0, 1].
+    static quint64 sortKey(int program, int material, int mesh, float depth);
+};
+
+// Bump allocator, memory is handed out in order and only given back all at once by reset().
+// Blocks are kept, so after the first frames recording doesn't allocate any more.
+class LinearAllocator
+{
+public:
+    explicit LinearAllocator(int blockBytes = 64 * 1024);
+    ~LinearAllocator();
+
+    void *allocate(int bytes, int alignment = 16);
+    void reset();
+    qint64 capacity() const { return m_capacity; }
+
+private:
+    Q_DISABLE_COPY(LinearAllocator)
+
+    int m_blockBytes;
+    QVector<char*> m_blocks;
+    QVector<int> m_blockSizes;
+    int m_block;                // the one being filled
+    int m_offset;
+    qint64 m_capacity;
+};
+
+// Packets recorded by one thread
+class CommandList
+{
+public:
+    CommandList() {}
+
+    // Fill in every field, the matrices start out as identity
+    DrawPacket *add();
+    void clear();
+
+    const QVector<DrawPacket*> &packets() const { return m_packets; }
+    qint64 bytes() const { return m_allocator.capacity() + m_packets.capacity() * sizeof(DrawPacket*); }
+
+private:
+    Q_DISABLE_COPY(CommandList)
+
+    LinearAllocator m_allocator;
+    QVector<DrawPacket*> m_packets;
+};
+
+// Records draws on worker threads, each into its own list, then merges them into one list sorted
+// by key for a single thread to submit.
+class CommandQueue
+{
+public:
+    CommandQueue();
+    ~CommandQueue();
+
+    // Work is only split once every task gets at least this many items
+    void setMinimumItemsPerTask(int items) { m_minimumItems = qMax(1, items); }
+
+    // Clears the lists and calls recorder(list, first, end) for ranges of [0, itemCount), in
+    // parallel when there are enough items. Ranges are handed out in order, so the result doesn't
+    // depend on which thread ran which range.
+    void record(int itemCount, const std::function<void(CommandList &list, int first, int end)> &recorder);
+
+    // Packets of every list, sorted by key, equal keys in recording order
+    const QVector<const DrawPacket*> &sorted();
+
+    int listsUsed() const { return m_listsUsed; }
+    qint64 bytes() const;
+
+private:
+    Q_DISABLE_COPY(CommandQueue)
+
+    QVector<CommandList*> m_lists;
+    int m_listsUsed;
+    int m_minimumItems;
+    QVector<const DrawPacket*> m_sorted;
+    bool m_sortedValid;
+};
+
+#endif // COMMANDLIST_H
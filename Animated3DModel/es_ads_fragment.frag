@@ -10,10 +10,15 @@ uniform lowp vec3 Kd;
 uniform lowp vec3 Ks;
 uniform lowp float shininess;
 
+// Multiplies Kd once it has been streamed in
+uniform sampler2D diffuseTexture;
+uniform bool hasDiffuseTexture;
+
 varying highp vec3 normal;
 varying highp vec3 position;
+varying highp vec2 uv;
 
-highp vec3 adsModel(vec3 norm)
+highp vec3 adsModel(vec3 norm, lowp vec3 diffuse)
 {
     // Calculate light direction
     highp vec3 s = normalize( lightPosition.xyz - position);
@@ -34,11 +39,15 @@ highp vec3 adsModel(vec3 norm)
 
     // Calculate final color
     return lightIntensity * (Ka +
-                                           Kd * diffuseIntensity +
+                                           diffuse * diffuseIntensity +
                                            Ks * specularIntensity);
 }
 
 void main(void)
 {
-    gl_FragColor = highp vec4(adsModel(normalize(normal)), 1.0);
+    lowp vec3 diffuse = Kd;
+    if (hasDiffuseTexture)
+        diffuse *= texture2D(diffuseTexture, uv).rgb;
+
+    gl_FragColor = highp vec4(adsModel(normalize(normal), diffuse), 1.0);
 }
@@ -2,6 +2,7 @@
 
 attribute highp vec3 vertexPosition;
 attribute highp vec3 vertexNormal;
+attribute highp vec2 vertexUV;
 
 uniform highp mat4 qt_ModelViewProjectionMatrix;
 varying highp vec4 qt_TexCoord0;
@@ -12,6 +13,7 @@ uniform highp mat4 MVP;
 
 varying highp vec3 normal;
 varying highp vec3 position;
+varying highp vec2 uv;
 
 void main(void)
 {
@@ -19,5 +21,6 @@ void main(void)
     normal = normalize( N * vertexNormal );
     position = vec3( MV * highp vec4( vertexPosition, 1.0 ) );
 
+    uv = vertexUV;
     gl_Position = MVP * highp vec4( vertexPosition, 1.0 );
 }
@@ -0,0 +1,186 @@
+#include "framecapture.h"
+#include <QOpenGLContext>
+#include <QtConcurrent>
+#include <QImage>
+#include <QDir>
+#include <QDebug>
+#include <cstring>
+
+FrameCapture::FrameCapture() :
+    m_gl(0)
+  , m_format("png")
+  , m_ringSize(3)
+  , m_maxPendingWrites(qMax(2, QThread::idealThreadCount() * 2))
+  , m_nextSlot(0)
+  , m_nextFrame(0)
+  , m_pendingWrites(0)
+{
+    // One core is left to the render and GUI threads
+    m_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+}
+
+FrameCapture::~FrameCapture()
+{
+    m_pool.waitForDone();
+}
+
+bool FrameCapture::initialize()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    QOpenGLFunctions_3_3_Core *gl = context ? context->versionFunctions<QOpenGLFunctions_3_3_Core>() : 0;
+    if (!gl || !gl->initializeOpenGLFunctions()) {
+        qDebug() << "Error: Frame capture needs an OpenGL 3.3 context";
+        return false;
+    }
+    if (!QDir().mkpath(m_directory)) {
+        qDebug() << "Error: Unable to create capture directory" << m_directory;
+        return false;
+    }
+
+    m_gl = gl;
+    m_slots = QVector<Slot>(m_ringSize);
+    for (int is=0; is<m_slots.size(); ++is)
+        m_gl->glGenBuffers(1, &m_slots[is].buffer);
+    m_nextSlot = 0;
+    m_size = QSize();
+    return true;
+}
+
+void FrameCapture::cleanup()
+{
+    if (!m_gl)
+        return;
+
+    finish();
+    for (int is=0; is<m_slots.size(); ++is)
+        m_gl->glDeleteBuffers(1, &m_slots[is].buffer);
+    m_slots.clear();
+    m_gl = 0;
+}
+
+void FrameCapture::capture(const QSize &size)
+{
+    if (!m_gl || size.isEmpty())
+        return;
+
+    if (size != m_size) {
+        retrieveAll();
+        m_size = size;
+        for (int is=0; is<m_slots.size(); ++is) {
+            m_gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_slots[is].buffer);
+            m_gl->glBufferData(GL_PIXEL_PACK_BUFFER, size.width() * size.height() * 4, 0, GL_STREAM_READ);
+        }
+    }
+
+    // Frames whose copy already finished go to the workers oldest first, the oldest one has to in
+    // any case because its buffer is needed now
+    for (int ii=0; ii<m_slots.size(); ++ii) {
+        Slot &slot = m_slots[(m_nextSlot + ii) % m_slots.size()];
+        if (slot.frame != -1 && !retrieve(slot, false))
+            break;
+    }
+    Slot &slot = m_slots[m_nextSlot];
+    if (slot.frame != -1)
+        retrieve(slot, true);
+
+    // With a pack buffer bound the read only queues a copy on the GPU and returns
+    m_gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    m_gl->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    m_gl->glReadPixels(0, 0, m_size.width(), m_size.height(), GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    m_gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = m_gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.frame = m_nextFrame++;
+
+    // Polling without flushing would never see the fence pass if nothing else flushes
+    m_gl->glFlush();
+
+    m_nextSlot = (m_nextSlot + 1) % m_slots.size();
+}
+
+void FrameCapture::finish()
+{
+    if (m_gl)
+        retrieveAll();
+    m_pool.waitForDone();
+}
+
+FrameCapture::Statistics FrameCapture::statistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_statistics;
+}
+
+bool FrameCapture::retrieve(Slot &slot, bool wait)
+{
+    const GLenum status = m_gl->glClientWaitSync(slot.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        if (!wait)
+            return false;
+        m_gl->glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        QMutexLocker locker(&m_mutex);
+        ++m_statistics.gpuWaits;
+    }
+    m_gl->glDeleteSync(slot.fence);
+    slot.fence = 0;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_pendingWrites >= m_maxPendingWrites) {
+            ++m_statistics.writerWaits;
+            while (m_pendingWrites >= m_maxPendingWrites)
+                m_writeFinished.wait(&m_mutex);
+        }
+        ++m_pendingWrites;
+        ++m_statistics.captured;
+    }
+
+    // Rows come bottom up from GL, they are flipped while copying out of the mapping
+    QImage image(m_size, QImage::Format_RGBA8888);
+    const int rowBytes = m_size.width() * 4;
+    m_gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const uchar *pixels = static_cast<const uchar*>(m_gl->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rowBytes * m_size.height(), GL_MAP_READ_BIT));
+    if (pixels) {
+        for (int row=0; row<m_size.height(); ++row)
+            memcpy(image.scanLine(m_size.height() - 1 - row), pixels + row * rowBytes, rowBytes);
+        m_gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    m_gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    const QString filePath = QDir(m_directory).filePath(QString("frame_%1.%2").arg(slot.frame, 6, 10, QChar('0'))
+                                                        .arg(QString::fromLatin1(m_format)));
+    const QByteArray format = m_format;
+    slot.frame = -1;
+
+    if (!pixels) {
+        qDebug() << "Error: Unable to map the pixels of" << filePath;
+        QMutexLocker locker(&m_mutex);
+        --m_pendingWrites;
+        ++m_statistics.failed;
+        return true;
+    }
+
+    QtConcurrent::run(&m_pool, [this, image, filePath, format]() {
+        const bool saved = image.save(filePath, format.constData());
+        if (!saved)
+            qDebug() << "Error: Unable to write" << filePath;
+
+        QMutexLocker locker(&m_mutex);
+        --m_pendingWrites;
+        if (saved)
+            ++m_statistics.written;
+        else
+            ++m_statistics.failed;
+        m_writeFinished.wakeAll();
+    });
+    return true;
+}
+
+void FrameCapture::retrieveAll()
+{
+    // Oldest first, so the workers get the frames in order
+    for (int ii=0; ii<m_slots.size(); ++ii) {
+        Slot &slot = m_slots[(m_nextSlot + ii) % m_slots.size()];
+        if (slot.frame != -1)
+            retrieve(slot, true);
+    }
+}
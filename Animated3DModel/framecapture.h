@@ -0,0 +1,85 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QThreadPool>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QString>
+#include <QByteArray>
+#include <QSize>
+
+// Writes rendered frames to numbered image files without stalling the GL thread.
+// capture() only starts an asynchronous read of the frame into the next pixel buffer object of a
+// ring and puts a fence behind it. Buffers are mapped once their fence has passed, a few frames
+// later, so the CPU never waits for the GPU unless the ring is too short. Encoding and writing the
+// files happens on worker threads. When they fall behind, capture() waits for them instead of
+// queueing frames without limit, which slows rendering down to the rate frames can be written.
+// Everything but the workers runs on the thread of the GL context, it needs OpenGL 3.3.
+class FrameCapture
+{
+public:
+    struct Statistics {
+        Statistics() : captured(0), written(0), failed(0), gpuWaits(0), writerWaits(0) {}
+        int captured;       // frames read back from the GPU
+        int written;        // image files saved by the workers
+        int failed;
+        int gpuWaits;       // frames mapped before their fence passed, the ring is too short
+        int writerWaits;    // frames that had to wait for the workers to catch up
+    };
+
+    FrameCapture();
+    ~FrameCapture();
+
+    // Must be set before initialize(). Files are named frame_000000.png and so on.
+    void setDirectory(const QString &directory) { m_directory = directory; }
+    void setFormat(const QByteArray &format) { m_format = format; }
+    void setRingSize(int frames) { m_ringSize = qMax(1, frames); }
+    // Frames read back but not written yet, beyond that capture() waits for the workers
+    void setMaxPendingWrites(int frames) { m_maxPendingWrites = qMax(1, frames); }
+
+    // Needs a current context, creates the directory and the pixel buffer objects
+    bool initialize();
+    bool isInitialized() const { return m_gl != 0; }
+    // Deletes the GL objects after finish(), needs the context current again
+    void cleanup();
+
+    // Reads the color buffer of the bound read framebuffer, call after rendering and before swapping.
+    // A size change waits for the frames still in the ring.
+    void capture(const QSize &size);
+    // Writes every frame still in the ring and waits for the workers
+    void finish();
+
+    Statistics statistics() const;
+
+private:
+    struct Slot {
+        Slot() : buffer(0), fence(0), frame(-1) {}
+        GLuint buffer;
+        GLsync fence;
+        int frame;          // -1 while the slot is free
+    };
+
+    bool retrieve(Slot &slot, bool wait);
+    void retrieveAll();
+
+    QOpenGLFunctions_3_3_Core *m_gl;
+    QString m_directory;
+    QByteArray m_format;
+    int m_ringSize;
+    int m_maxPendingWrites;
+
+    QVector<Slot> m_slots;
+    int m_nextSlot;         // the oldest one once the ring is full
+    int m_nextFrame;
+    QSize m_size;
+
+    QThreadPool m_pool;
+    mutable QMutex m_mutex;         // guards m_pendingWrites and m_statistics
+    QWaitCondition m_writeFinished;
+    int m_pendingWrites;
+    Statistics m_statistics;
+};
+
+#endif // FRAMECAPTURE_H
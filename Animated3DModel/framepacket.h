@@ -0,0 +1,34 @@
+#ifndef FRAMEPACKET_H
+#define FRAMEPACKET_H
+
+#include <QMatrix4x4>
+#include <QSize>
+#include <QVector>
+#include "sceneview.h"
+#include "morphtargets.h"
+#include "instancebvh.h"
+
+// Everything the renderer needs to draw one frame, produced by SceneBase::evaluate() and
+// consumed by SceneBase::render(), possibly on another thread.
+// Packets are recycled, so the arrays keep their capacity from frame to frame.
+struct FramePacket
+{
+    FramePacket() : frame(0), animation(-1), animationTick(0.0), animationNs(0) {}
+
+    quint64 frame;
+    QSize viewport;                             // empty when the renderer should keep its size
+    QMatrix4x4 camera;
+    QVector<SceneView> views;                   // with their cameras filled in, at least one
+    QVector<QMatrix4x4> instanceMatrices;       // model matrix of every instance
+    InstanceBvh instanceBvh;                    // over the instances' bounds, for culling
+    QVector<QVector<Affine3x4> > palettes;      // skinning matrices of every mesh
+    QVector<QVector<MorphWeight> > morphWeights;    // active blend shapes of every mesh, empty without any
+
+    // Clip position, for renderers that sample baked animations themselves
+    int animation;
+    double animationTick;
+
+    qint64 animationNs;                         // CPU time evaluate() took, see FrameTimings
+};
+
+#endif // FRAMEPACKET_H
@@ -0,0 +1,210 @@
+#include "glstatecache.h"
+#include <QDebug>
+#include <cstring>
+
+namespace {
+
+// Nothing is known about a binding until it has been set through the cache
+const GLuint Unknown = GLuint(-1);
+
+}
+
+GLStateCache::GLStateCache() :
+    m_functions(0)
+  , m_program(Unknown)
+  , m_arrayBuffer(Unknown)
+  , m_vertexArray(0)
+  , m_activeUnit(-1)
+{
+
+}
+
+void GLStateCache::initialize(QOpenGLFunctions *functions)
+{
+    m_functions = functions;
+    if (!m_vao.create())
+        qDebug() << "GLStateCache: no vertex array objects, filtering attribute setup instead";
+    invalidate();
+}
+
+void GLStateCache::destroy()
+{
+    m_vao.destroy();
+    m_programStates.clear();
+    invalidate();
+}
+
+void GLStateCache::invalidate()
+{
+    // Uniform values belong to their programs and stay valid, bindings may have been changed by anyone
+    m_program = Unknown;
+    m_arrayBuffer = Unknown;
+    m_vertexArray = 0;
+    m_vertexStates.clear();
+    m_textures.clear();
+    m_activeUnit = -1;
+}
+
+void GLStateCache::bindVertexArray()
+{
+    if (!m_vao.isCreated())
+        return;
+
+    if (m_vertexArray == m_vao.objectId()) {
+        ++m_statistics.skipped;
+        return;
+    }
+    m_vao.bind();
+    m_vertexArray = m_vao.objectId();
+    ++m_statistics.calls;
+}
+
+void GLStateCache::releaseVertexArray()
+{
+    if (!m_vao.isCreated() || m_vertexArray == 0)
+        return;
+
+    m_vao.release();
+    m_vertexArray = 0;
+    ++m_statistics.calls;
+}
+
+void GLStateCache::bindTexture(int unit, GLuint texture)
+{
+    QHash<int, GLuint>::const_iterator it = m_textures.constFind(unit);
+    if (it != m_textures.constEnd() && it.value() == texture) {
+        ++m_statistics.skipped;
+        return;
+    }
+    if (m_activeUnit != unit) {
+        m_functions->glActiveTexture(GL_TEXTURE0 + unit);
+        m_activeUnit = unit;
+        ++m_statistics.calls;
+    }
+    m_functions->glBindTexture(GL_TEXTURE_2D, texture);
+    m_textures.insert(unit, texture);
+    ++m_statistics.calls;
+}
+
+void GLStateCache::useProgram(QOpenGLShaderProgram &program)
+{
+    if (m_program == program.programId()) {
+        ++m_statistics.skipped;
+        return;
+    }
+    program.bind();
+    m_program = program.programId();
+    ++m_statistics.calls;
+}
+
+void GLStateCache::bindBuffer(QOpenGLBuffer &buffer)
+{
+    // The element array binding is vertex array state, the array buffer binding isn't
+    GLuint &bound = buffer.type() == QOpenGLBuffer::IndexBuffer ? vertexState().elementBuffer : m_arrayBuffer;
+    if (bound == buffer.bufferId()) {
+        ++m_statistics.skipped;
+        return;
+    }
+    buffer.bind();
+    bound = buffer.bufferId();
+    ++m_statistics.calls;
+}
+
+void GLStateCache::enableAttribute(int location)
+{
+    AttributeState &attribute = vertexState().attributes[location];
+    if (attribute.enabled) {
+        ++m_statistics.skipped;
+        return;
+    }
+    m_functions->glEnableVertexAttribArray(location);
+    attribute.enabled = true;
+    ++m_statistics.calls;
+}
+
+void GLStateCache::attributePointer(int location, GLenum type, int tupleSize)
+{
+    // A new entry has no type, so it never matches
+    AttributeState &attribute = vertexState().attributes[location];
+    if (attribute.buffer == m_arrayBuffer && attribute.type == type && attribute.tupleSize == tupleSize) {
+        ++m_statistics.skipped;
+        return;
+    }
+    m_functions->glVertexAttribPointer(location, tupleSize, type, GL_FALSE, 0, 0);
+    attribute.buffer = m_arrayBuffer;
+    attribute.type = type;
+    attribute.tupleSize = tupleSize;
+    ++m_statistics.calls;
+}
+
+int GLStateCache::uniformLocation(const char *name)
+{
+    ProgramState &state = m_programStates[m_program];
+    QHash<QByteArray, int>::const_iterator it = state.locations.constFind(QByteArray::fromRawData(name, int(strlen(name))));
+    if (it != state.locations.constEnd())
+        return it.value();
+
+    const int location = m_functions->glGetUniformLocation(m_program, name);
+    state.locations.insert(QByteArray(name), location);
+    return location;
+}
+
+bool GLStateCache::uniformChanged(const char *name, const void *data, int size, int &location)
+{
+    location = uniformLocation(name);
+    if (location == -1)
+        return false;
+
+    QByteArray &value = m_programStates[m_program].values[location];
+    if (value.size() == size && memcmp(value.constData(), data, size) == 0) {
+        ++m_statistics.skipped;
+        return false;
+    }
+    value = QByteArray(static_cast<const char*>(data), size);
+    ++m_statistics.calls;
+    return true;
+}
+
+void GLStateCache::setUniform(const char *name, const QMatrix4x4 &value)
+{
+    int location;
+    if (uniformChanged(name, value.constData(), 16 * sizeof(float), location))
+        m_functions->glUniformMatrix4fv(location, 1, GL_FALSE, value.constData());
+}
+
+void GLStateCache::setUniform(const char *name, const QMatrix3x3 &value)
+{
+    int location;
+    if (uniformChanged(name, value.constData(), 9 * sizeof(float), location))
+        m_functions->glUniformMatrix3fv(location, 1, GL_FALSE, value.constData());
+}
+
+void GLStateCache::setUniform(const char *name, const QVector4D &value)
+{
+    const GLfloat data[4] = { value.x(), value.y(), value.z(), value.w() };
+    int location;
+    if (uniformChanged(name, data, sizeof(data), location))
+        m_functions->glUniform4fv(location, 1, data);
+}
+
+void GLStateCache::setUniform(const char *name, const QVector3D &value)
+{
+    const GLfloat data[3] = { value.x(), value.y(), value.z() };
+    int location;
+    if (uniformChanged(name, data, sizeof(data), location))
+        m_functions->glUniform3fv(location, 1, data);
+}
+
+void GLStateCache::setUniform(const char *name, float value)
+{
+    int location;
+    if (uniformChanged(name, &value, sizeof(value), location))
+        m_functions->glUniform1f(location, value);
+}
+
+void GLStateCache::setUniform(const char *name, int value)
+{
+    int location;
+    if (uniformChanged(name, &value, sizeof(value), location))
+        m_functions->glUniform1i(location, value);
+}
@@ -0,0 +1,96 @@
+#ifndef GLSTATECACHE_H
+#define GLSTATECACHE_H
+
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+#include <QHash>
+#include <QByteArray>
+
+// Shadows the GL state the ES backend touches, so binds, enables and uniform uploads that wouldn't
+// change anything are never issued. Uniform locations are looked up once per program and name.
+// Only state changed through the cache is known, call invalidate() after touching GL directly.
+class GLStateCache
+{
+public:
+    struct Statistics {
+        Statistics() : calls(0), skipped(0) {}
+        int calls;      // state calls issued
+        int skipped;    // requests dropped because the state was already set
+    };
+
+    GLStateCache();
+
+    // Needs a current context, creates the vertex array object if the context has them
+    // (OpenGL 3, ARB_vertex_array_object or OES_vertex_array_object on ES 2)
+    void initialize(QOpenGLFunctions *functions);
+    void destroy();
+    void invalidate();
+    // After binding textures directly, the rest of the state is still known
+    void invalidateTextures() { m_textures.clear(); m_activeUnit = -1; }
+
+    // Without vertex array objects the attribute state is tracked per context instead, so setting
+    // the same attributes every frame costs nothing after the first time either way
+    bool hasVertexArrayObject() const { return m_vao.isCreated(); }
+    void bindVertexArray();
+    void releaseVertexArray();
+    void bindTexture(int unit, GLuint texture);
+
+    void useProgram(QOpenGLShaderProgram &program);
+    void bindBuffer(QOpenGLBuffer &buffer);
+    void enableAttribute(int location);
+    // Points the attribute at the array buffer currently bound through bindBuffer()
+    void attributePointer(int location, GLenum type, int tupleSize);
+
+    int uniformLocation(const char *name);
+    void setUniform(const char *name, const QMatrix4x4 &value);
+    void setUniform(const char *name, const QMatrix3x3 &value);
+    void setUniform(const char *name, const QVector4D &value);
+    void setUniform(const char *name, const QVector3D &value);
+    void setUniform(const char *name, float value);
+    void setUniform(const char *name, int value);
+
+    // Counted since the last reset, e.g. once per frame
+    void resetStatistics() { m_statistics = Statistics(); }
+    Statistics statistics() const { return m_statistics; }
+
+private:
+    struct AttributeState {
+        AttributeState() : enabled(false), buffer(0), type(0), tupleSize(0) {}
+        bool enabled;
+        GLuint buffer;
+        GLenum type;
+        int tupleSize;
+    };
+
+    // Part of a vertex array object when there is one
+    struct VertexState {
+        VertexState() : elementBuffer(0) {}
+        GLuint elementBuffer;
+        QHash<int, AttributeState> attributes;
+    };
+
+    struct ProgramState {
+        QHash<QByteArray, int> locations;
+        QHash<int, QByteArray> values;      // raw bytes of the last value sent to every location
+    };
+
+    bool uniformChanged(const char *name, const void *data, int size, int &location);
+    VertexState &vertexState() { return m_vertexStates[m_vertexArray]; }
+
+    QOpenGLFunctions *m_functions;
+    QOpenGLVertexArrayObject m_vao;
+
+    GLuint m_program;
+    GLuint m_arrayBuffer;
+    GLuint m_vertexArray;
+    QHash<int, GLuint> m_textures;                  // by texture unit
+    int m_activeUnit;
+    QHash<GLuint, VertexState> m_vertexStates;      // by vertex array object, 0 without one
+    QHash<GLuint, ProgramState> m_programStates;
+
+    Statistics m_statistics;
+};
+
+#endif // GLSTATECACHE_H
@@ -5,6 +5,9 @@
 #include <QQuickView>
 #include <QScreen>
 #include <QQmlContext>
+#include <QCommandLineParser>
+#include "benchmark.h"
+#include "assetmanager.h"
 
 QStringList filepath {
     "animationModels/three_js_models/monster/monster.dae",
@@ -13,10 +16,6 @@ QStringList filepath {
     "animationModels/three_js_models/duck/duck.dae"
 };
 
-QString getFilepath() {
-    return filepath[2];
-}
-
 class SceneSelect : public SceneSelector {
 public:
     SceneBase* createScene(QPair<int, int> glVersion) {
@@ -25,32 +24,121 @@ public:
 
         // use Scene class when GL version is 3.3
         if (glVersion == qMakePair(3,3)) {
-            m_scene = new Scene(getFilepath(), ModelLoader::RelativePath);
+            m_scene = new Scene(m_filepath, ModelLoader::RelativePath, m_texturePath);
         }
         // just use GL ES scene for any other version
         else {
             qCritical() << "Your computer must support OpenGL 3.3";
             exit(1);
-            m_scene = new Scene_GLES(getFilepath(), ModelLoader::RelativePath);
+            m_scene = new Scene_GLES(m_filepath, ModelLoader::RelativePath, m_texturePath);
         }
+        if (m_viewCount > 1)
+            m_scene->setViews(SceneView::split(m_viewCount));
+        if (!m_poseSegment.isEmpty() && glVersion == qMakePair(3,3))
+            static_cast<Scene*>(m_scene)->publishPoses(m_poseSegment);
         return m_scene;
     }
     SceneBase* getScene() {
         return m_scene;
     }
 
-    SceneSelect() : m_scene(0) {}
+    SceneSelect(QString filepath, QString texturePath, int viewCount, QString poseSegment) :
+        m_scene(0), m_filepath(filepath), m_texturePath(texturePath), m_viewCount(viewCount), m_poseSegment(poseSegment) {}
 private:
     SceneBase *m_scene;
+    QString m_filepath;
+    QString m_texturePath;
+    int m_viewCount;
+    QString m_poseSegment;
 };
 
 int main(int argc, char *argv[])
 {
+    // Windows share one GL context group, so models shown in several windows are uploaded once
+    QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
     QGuiApplication app(argc, argv);
 
-    SceneSelect sceneSelect;
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Animated 3D model viewer");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"model", "Model file to show.", "path", filepath[2]},
+        {"benchmark", "Render offscreen as fast as possible and report the throughput instead of opening a window."},
+        {"frames", "Frames to render in benchmark mode.", "count", "500"},
+        {"size", "Framebuffer size in benchmark mode.", "WxH", "800x600"},
+        {"instances", "Number of model instances to draw.", "count", "1"},
+        {"backend", "Benchmark backend: scene, gles or both.", "name", "both"},
+        {"baked", "Play animations from baked skinning matrix textures."},
+        {"checksums", "Write per frame image checksums of the benchmark to this file.", "path"},
+        {"kernel-benchmark", "Compare the pose kernels with the QMatrix4x4 path on this many joints and exit.", "joints"},
+        {"geometry", "CPU side geometry after upload: keep, picking or release.", "policy", "keep"},
+        {"texture", "Diffuse texture, streamed in while the model is shown.", "path"},
+        {"views", "Side by side views of the same frame, the second one looking down on the model.", "count", "1"},
+        {"record-poses", "Record every evaluated pose of the benchmark into this file.", "path"},
+        {"replay-poses", "Replay the poses recorded in this file in the benchmark and verify them bit for bit.", "path"},
+        {"publish-poses", "Share every evaluated pose with other processes through this shared memory segment.", "name"},
+        {"capture", "Write every rendered frame as a numbered image into this directory.", "directory"}
+    });
+    parser.process(app);
+
+    const QString geometryPolicy = parser.value("geometry");
+    if (geometryPolicy == "picking")
+        AssetManager::instance()->setGeometryPolicy(AssetManager::KeepPickingGeometry);
+    else if (geometryPolicy == "release")
+        AssetManager::instance()->setGeometryPolicy(AssetManager::ReleaseGeometry);
+
+    const QString modelPath = parser.value("model");
+
+    if (parser.isSet("kernel-benchmark")) {
+        PoseKernelBenchmark::run(parser.value("kernel-benchmark").toInt(), 20000);
+        return 0;
+    }
+
+    if (parser.isSet("benchmark")) {
+        OffscreenBenchmark benchmark;
+        benchmark.setModel(modelPath);
+        benchmark.setFrames(parser.value("frames").toInt());
+        benchmark.setInstanceCount(parser.value("instances").toInt());
+        benchmark.setBakedAnimation(parser.isSet("baked"));
+        benchmark.setViewCount(parser.value("views").toInt());
+        benchmark.setRecordPath(parser.value("record-poses"));
+        benchmark.setReplayPath(parser.value("replay-poses"));
+        benchmark.setCaptureDirectory(parser.value("capture"));
+
+        const QStringList size = parser.value("size").split('x');
+        if (size.size() == 2)
+            benchmark.setSize(QSize(size[0].toInt(), size[1].toInt()));
+
+        QVector<OffscreenBenchmark::Backend> backends;
+        const QString backend = parser.value("backend");
+        if (backend == "scene" || backend == "both")
+            backends << OffscreenBenchmark::Backend_GL33;
+        if (backend == "gles" || backend == "both")
+            backends << OffscreenBenchmark::Backend_GLES;
+
+        QVector<OffscreenBenchmark::Result> results;
+        bool ok = !backends.isEmpty();
+        foreach (OffscreenBenchmark::Backend b, backends) {
+            OffscreenBenchmark::Result result;
+            ok = benchmark.run(b, result) && ok;
+            OffscreenBenchmark::printResult(result);
+            results << result;
+        }
+
+        if (parser.isSet("checksums") && !OffscreenBenchmark::writeChecksums(parser.value("checksums"), results))
+            ok = false;
+
+        return ok ? 0 : 1;
+    }
+
+    // The default model comes with its texture
+    QString texturePath = parser.value("texture");
+    if (!parser.isSet("texture") && !parser.isSet("model"))
+        texturePath = "../AstroBoy_Walk/boy_10.JPG";
+
+    SceneSelect sceneSelect(modelPath, texturePath, parser.value("views").toInt(), parser.value("publish-poses"));
 
-    OpenGLWindow w1(&sceneSelect, 40, 3, 3);
+    OpenGLWindow w1(&sceneSelect, 40, 3, 3, 0, parser.value("capture"));
 
     w1.show();
 
@@ -0,0 +1,66 @@
+#include "renderthread.h"
+#include <QCoreApplication>
+#include <QOpenGLContext>
+#include <QSurface>
+#include "scenebase.h"
+#include "framecapture.h"
+
+RenderThread::RenderThread(QOpenGLContext *context, QSurface *surface, SceneBase *scene, QObject *parent) :
+    QThread(parent)
+  , m_context(context)
+  , m_surface(surface)
+  , m_scene(scene)
+  , m_capture(0)
+  , m_stop(0)
+{
+    m_context->moveToThread(this);
+}
+
+void RenderThread::stop()
+{
+    m_stop.storeRelease(1);
+    wait();
+}
+
+void RenderThread::run()
+{
+    m_context->makeCurrent( m_surface );
+    m_scene->initialize();
+    if (m_capture)
+        m_capture->initialize();
+
+    emit initialized();
+
+    QSize viewport;
+    while (!m_stop.loadAcquire()) {
+        // Nothing new to show, check again shortly instead of waiting on the simulation thread
+        if (!m_packets.consume()) {
+            msleep(1);
+            continue;
+        }
+
+        const FramePacket &packet = m_packets.readBuffer();
+
+        m_context->makeCurrent( m_surface );
+
+        if (!packet.viewport.isEmpty() && packet.viewport != viewport) {
+            viewport = packet.viewport;
+            m_scene->resize( viewport.width(), viewport.height() );
+        }
+
+        m_scene->render( packet );
+        if (m_capture)
+            m_capture->capture( viewport );
+
+        m_context->swapBuffers( m_surface );
+    }
+
+    m_context->makeCurrent( m_surface );
+    if (m_capture)
+        m_capture->cleanup();
+    m_scene->cleanup();
+    m_context->doneCurrent();
+
+    // Hand the context back so it can be deleted from the thread that created it
+    m_context->moveToThread( QCoreApplication::instance()->thread() );
+}
@@ -0,0 +1,51 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include "framepacket.h"
+#include "triplebuffer.h"
+
+class QOpenGLContext;
+class QSurface;
+class SceneBase;
+class FrameCapture;
+
+// Owns the OpenGL context while running: initializes the scene, then renders and swaps the newest
+// frame packet published by the simulation thread. Pose evaluation of the next frame overlaps with
+// GL submission and swapping of the current one, the two sides only share the triple buffer.
+class RenderThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    // The context must not be current anywhere, it is moved to this thread and back when it finishes
+    RenderThread(QOpenGLContext *context, QSurface *surface, SceneBase *scene, QObject *parent = 0);
+
+    // Reads back every rendered frame before swapping it, must be set before start()
+    void setFrameCapture(FrameCapture *capture) { m_capture = capture; }
+
+    // Simulation thread side, fill the packet and publish it
+    FramePacket &framePacket() { return m_packets.writeBuffer(); }
+    void publishFramePacket() { m_packets.publish(); }
+
+    // Renders no more frames, cleans up the scene and releases the context
+    void stop();
+
+signals:
+    void initialized();
+
+protected:
+    void run();
+
+private:
+    QOpenGLContext *m_context;
+    QSurface *m_surface;
+    SceneBase *m_scene;
+    FrameCapture *m_capture;
+
+    TripleBuffer<FramePacket> m_packets;
+    QAtomicInt m_stop;
+};
+
+#endif // RENDERTHREAD_H
@@ -1,334 +1,623 @@
 #include "scene.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QOpenGLContext>
+#include <algorithm>
+#include <cstring>
 
 Scene::Scene(QString filepath, ModelLoader::PathType pathType, QString texturePath) :
-    m_indexBuffer(QOpenGLBuffer::IndexBuffer)
-  , m_filepath(filepath)
+    m_filepath(filepath)
   , m_pathType(pathType)
   , m_texturePath(texturePath)
   , m_error(false)
   , m_currentAnimation(0)
   , m_currentAnimationTick(0.0f)
+  , m_animationPaused(false)
+  , m_useBakedAnimation(false)
+  , m_interpolateBakedFrames(true)
+  , m_bakedTexture(0)
+  , m_diffuseTexture(-1)
+  , m_paletteBuffer(0)
+  , m_paletteTexture(0)
+  , m_paletteSize(0)
 {
 
 }
 
+void Scene::setBakedAnimation(bool enabled, float sampleRate, bool interpolateFrames)
+{
+    m_useBakedAnimation = enabled;
+    m_interpolateBakedFrames = interpolateFrames;
+    m_baker.setSampleRate(sampleRate);
+}
+
 void Scene::initialize()
 {
     this->initializeOpenGLFunctions();
 
-    createShaderProgram(":/ads_fragment.vert", ":/ads_fragment.frag");
-
     createBuffers();
+    createMorphBuffers();
+    createShaderPrograms(m_shaderPrograms, ":/ads_fragment.vert", ":/ads_fragment.frag");
     createAttributes();
+    createBakedAnimation();
+    createPaletteBuffer();
+    createTextures();
     setupLightingAndMatrices();
 
     glEnable(GL_DEPTH_TEST);
     glClearColor(.5, .5, .5 ,1.0);
 }
 
-void Scene::createShaderProgram(QString vShader, QString fShader)
+void Scene::createShaderProgram(QOpenGLShaderProgram &program, QString vShader, QString fShader, const QByteArray &defines)
 {
+    QFile vertexFile(vShader);
+    QByteArray vertexSource;
+    if (vertexFile.open(QIODevice::ReadOnly))
+        vertexSource = vertexFile.readAll();
+
+    // Defines have to follow the #version line
+    const int versionEnd = vertexSource.indexOf('\n') + 1;
+    vertexSource.insert(versionEnd, defines);
+
     // Compile vertex shader
-    if ( !m_shaderProgram.addShaderFromSourceFile( QOpenGLShader::Vertex, vShader.toUtf8() ) ) {
-        qCritical() << "Unable to compile vertex shader. Log:" << m_shaderProgram.log();
+    if ( !program.addShaderFromSourceCode( QOpenGLShader::Vertex, vertexSource ) ) {
+        qCritical() << "Unable to compile vertex shader. Log:" << program.log();
         m_error = true;
     }
 
     // Compile fragment shader
-    if ( m_error || !m_shaderProgram.addShaderFromSourceFile( QOpenGLShader::Fragment, fShader.toUtf8() ) ) {
-        qCritical() << "Unable to compile fragment shader. Log:" << m_shaderProgram.log();
+    if ( m_error || !program.addShaderFromSourceFile( QOpenGLShader::Fragment, fShader.toUtf8() ) ) {
+        qCritical() << "Unable to compile fragment shader. Log:" << program.log();
         m_error = true;
     }
 
     // Link the shaders together into a program
-    if ( m_error || !m_shaderProgram.link() ) {
-        qCritical() << "Unable to link shader program. Log:" << m_shaderProgram.log();
+    if ( m_error || !program.link() ) {
+        qCritical() << "Unable to link shader program. Log:" << program.log();
         m_error = true;
     }
 }
 
+void Scene::createShaderPrograms(QOpenGLShaderProgram *programs, QString vShader, QString fShader)
+{
+    for (int ii=0; ii<m_variants.size(); ++ii) {
+        const int variant = m_variants[ii];
+        createShaderProgram(programs[variant], vShader, fShader, SkinWeights::shaderDefines(variant));
+    }
+}
+
 void Scene::createBuffers()
 {
-    ModelLoader model;
-    model.setTransformToUnitCoordinates(true);
+    // Parsed data and GL buffers are shared with every other scene showing the same model
+    m_loadedModel = AssetManager::instance()->loadModel(m_filepath, m_pathType, true, ImportProfile::rendering());
+    if(!m_loadedModel)
+    {
+        m_error = true;
+        return;
+    }
 
-    if(!model.Load(m_filepath, m_pathType))
+    m_buffers = AssetManager::instance()->modelBuffers(m_loadedModel, ModelBuffers::BoneData);
+    if(!m_buffers)
     {
         m_error = true;
         return;
     }
 
-    QVector<float> *vertices;
-    QVector<float> *normals;
-    QVector<QVector<float> > *textureUV;
+    // Create a vertex array object, VAOs can't be shared between contexts so every scene has its own
+    m_vao.create();
+
+    m_rootNode = m_loadedModel->getNodeData();
+    m_rootMatrix = QtConversions::toQt(m_rootNode->transformation);
+    m_inverseRootMatrix = m_rootMatrix.inverted();
+    m_meshes = m_loadedModel->getMeshes();
+    m_animations = m_loadedModel->getNodeAnimations();
+
+    const QVector<QSharedPointer<MaterialInfo> > materials = m_loadedModel->getMaterials();
+    m_meshMaterials.resize(m_meshes.size());
+    for (int im=0; im<m_meshes.size(); ++im)
+        m_meshMaterials[im] = materials.indexOf(m_meshes[im]->material);
+
+    m_pose.initialize(m_loadedModel);
+    if (m_currentAnimation >= m_animations.size())
+        m_currentAnimation = -1;
+    m_pose.setAnimation(m_currentAnimation);
+
+    if (!m_poseSegment.isEmpty() && !m_useBakedAnimation)
+        m_publisher.open(m_poseSegment, m_pose);
+
+    for (int im=0; im<m_meshes.size(); ++im) {
+        const Mesh &mesh = *m_meshes.at(im);
+        for (int ig=0; ig<mesh.influenceGroups.size(); ++ig) {
+            if (!m_variants.contains(mesh.influenceGroups[ig].variant))
+                m_variants.append(mesh.influenceGroups[ig].variant);
+        }
+    }
+    std::sort(m_variants.begin(), m_variants.end());
+
+    // Empty when the geometry was released after the upload
+    QVector<float> *vertices, *normals;
     QVector<unsigned int> *indices;
+    QVector<int> *boneIndices;
+    QVector<float> *boneWeights;
+    m_loadedModel->getBufferData(&vertices, &normals, &indices);
+    m_loadedModel->getBoneData(&boneIndices, &boneWeights);
+    m_picker.build(m_meshes, *vertices, *indices, *boneIndices, *boneWeights);
+}
 
-    model.getBufferData(&vertices, &normals, &indices);
-    model.getTextureData(&textureUV, 0, 0);
+void Scene::createMorphBuffers()
+{
+    if (m_error || !m_loadedModel->hasMorphTargets())
+        return;
 
-    // Create a vertex array object
-    m_vao.create();
-    m_vao.bind();
+    QVector<float> *vertices, *normals;
+    m_loadedModel->getBufferData(&vertices, &normals, 0);
+    m_morph.initialize(m_meshes, *vertices, *normals);
 
-    // Create a buffer and copy the vertex data to it
-    m_vertexBuffer.create();
-    m_vertexBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-    m_vertexBuffer.bind();
-    m_vertexBuffer.allocate( &(*vertices)[0], vertices->size() * sizeof( float ) );
+    m_morphPositionBuffer.create();
+    m_morphPositionBuffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    m_morphPositionBuffer.bind();
+    m_morphPositionBuffer.allocate(m_morph.positions().constData(), m_morph.positions().size() * sizeof(float));
 
-    // Create a buffer and copy the vertex data to it
-    m_normalBuffer.create();
-    m_normalBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-    m_normalBuffer.bind();
-    m_normalBuffer.allocate( &(*normals)[0], normals->size() * sizeof( float ) );
+    m_morphNormalBuffer.create();
+    m_morphNormalBuffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    m_morphNormalBuffer.bind();
+    m_morphNormalBuffer.allocate(m_morph.normals().constData(), m_morph.normals().size() * sizeof(float));
+    m_morphNormalBuffer.release();
+}
 
-    if(textureUV != 0 && textureUV->size() != 0)
-    {
-        // Create a buffer and copy the vertex data to it
-        m_textureUVBuffer.create();
-        m_textureUVBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-        m_textureUVBuffer.bind();
-        int texSize = 0;
-        for(int ii=0; ii<textureUV->size(); ++ii)
-            texSize += textureUV->at(ii).size();
-
-        m_textureUVBuffer.allocate( &(*textureUV)[0][0], texSize * sizeof( float ) );
+void Scene::playAnimation(int animation)
+{
+    if (animation >= m_animations.size())
+        animation = -1;
+    m_currentAnimation = animation;
+    m_currentAnimationTick = 0.0;
+    m_pose.setAnimation(animation);
+}
+
+void Scene::setAnimationTime(int animation, double tick)
+{
+    // Switching clips refreshes the whole skeleton, staying on one keeps the incremental updates
+    if (animation != m_currentAnimation)
+        playAnimation(animation);
+    m_currentAnimationTick = tick;
+}
+
+void Scene::prefetchAnimations(const QVector<int> &animations)
+{
+    if (m_loadedModel)
+        m_loadedModel->getClipLibrary()->prefetch(animations);
+}
+
+void Scene::setNodeTransformation(QString name, const QMatrix4x4 &transformation)
+{
+    const int joint = m_pose.skeleton().jointIndex(name);
+    if (joint != -1)
+        m_pose.skeleton().setLocalTransformation(joint, QtConversions::fromQt(transformation));
+}
+
+void Scene::clearNodeTransformation(QString name)
+{
+    const int joint = m_pose.skeleton().jointIndex(name);
+    if (joint != -1)
+        m_pose.skeleton().clearLocalTransformation(joint);
+}
+
+void Scene::createBakedAnimation()
+{
+    if(m_error || !m_useBakedAnimation)
+        return;
+
+    if (!m_baker.bake(m_rootNode.data(), m_meshes, m_animations, m_loadedModel->getClipLibrary())) {
+        m_useBakedAnimation = false;
+        return;
     }
 
-    // Create a buffer and copy the index data to it
-    m_indexBuffer.create();
-    m_indexBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-    m_indexBuffer.bind();
-    m_indexBuffer.allocate( &(*indices)[0], indices->size() * sizeof( unsigned int ) );
+    createShaderPrograms(m_bakedShaderPrograms, ":/baked_ads_fragment.vert", ":/ads_fragment.frag");
 
-    m_rootNode = model.getNodeData();
-    m_inverseRootMatrix = m_rootNode->transformation.inverted();
-    m_meshes = model.getMeshes();
+    glGenTextures(1, &m_bakedTexture);
+    glBindTexture(GL_TEXTURE_2D, m_bakedTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    QVector<int> *vertexBoneIndexes;
-    QVector<float> *vertexBoneWeights;
+    // GL converts to half floats on upload when asked for an RGBA16F texture
+    glTexImage2D(GL_TEXTURE_2D, 0, m_baker.halfFloat() ? GL_RGBA16F : GL_RGBA32F,
+                 m_baker.width(), m_baker.height(), 0, GL_RGBA, GL_FLOAT, m_baker.texels().constData());
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    model.getBoneData(&vertexBoneIndexes, &vertexBoneWeights);
+    m_baker.releaseTexels();
+}
 
-    QVector<float> vbi;
-    for (int ii=0; ii<vertexBoneIndexes->size(); ++ii)
-        vbi.append(vertexBoneIndexes->at(ii));
+void Scene::createPaletteBuffer()
+{
+    if(m_error || m_useBakedAnimation)
+        return;
 
-    m_vertexBoneIndexBuffer.create();
-    m_vertexBoneIndexBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-    m_vertexBoneIndexBuffer.bind();
-    m_vertexBoneIndexBuffer.allocate( &vbi[0], vbi.size() * sizeof( float ) );
+    // Meshes' palettes back to back, like the baked ones, so a mesh only needs its offset
+    m_meshPaletteOffsets.resize(m_meshes.size());
+    m_paletteSize = 0;
+    for (int im=0; im<m_meshes.size(); ++im) {
+        m_meshPaletteOffsets[im] = m_paletteSize;
+        m_paletteSize += m_meshes[im]->boneNames.size();
+    }
+    if (m_paletteSize == 0)
+        return;
+    m_paletteData.resize(m_paletteSize * 16);
+
+    glGenBuffers(1, &m_paletteBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_paletteBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, m_paletteData.size() * sizeof(float), 0, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    // Four RGBA32F texels per matrix, one per column
+    glGenTextures(1, &m_paletteTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, m_paletteTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_paletteBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
 
-    m_vertexBoneWeightBuffer.create();
-    m_vertexBoneWeightBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-    m_vertexBoneWeightBuffer.bind();
-    m_vertexBoneWeightBuffer.allocate( &(*vertexBoneWeights)[0], vertexBoneWeights->size() * sizeof( float ) );
+void Scene::createTextures()
+{
+    if(m_error || m_texturePath.isEmpty())
+        return;
 
-    qDebug() << "Vertices" << vertices->size();
+    if(!m_buffers->textureUVBuffer.isCreated()) {
+        qDebug() << "Model has no texture coordinates, ignoring" << m_texturePath;
+        return;
+    }
 
-    m_meshes = model.getMeshes();
-    m_animations = model.getNodeAnimations();
+    // Decoded in the background, the model is drawn untextured until the first mip levels are up
+    m_textures.initialize(QOpenGLContext::currentContext()->functions());
+    m_diffuseTexture = m_textures.request(ModelLoader::resolveFilePath(m_texturePath, m_pathType));
 }
 
 void Scene::createAttributes()
 {
-    if(m_error)
+    if(m_error || m_variants.isEmpty())
         return;
 
     m_vao.bind();
-    // Set up the vertex array state
-    m_shaderProgram.bind();
+    // Set up the vertex array state, locations are fixed so any variant will do
+    QOpenGLShaderProgram &program = m_shaderPrograms[m_variants.first()];
+    program.bind();
+
+    // The index buffer binding is part of the VAO state
+    m_buffers->indexBuffer.bind();
+
+    // Morphed copies are xyzw, the shader only reads xyz
+    const bool morphed = !m_morph.isEmpty();
 
     // Map vertex data to the vertex shader's layout location '0'
-    m_vertexBuffer.bind();
-    m_shaderProgram.enableAttributeArray( 0 );      // layout location
-    m_shaderProgram.setAttributeBuffer( 0,          // layout location
-                                        GL_FLOAT,   // data's type
-                                        0,          // Offset to data in buffer
-                                        3);         // number of components (3 for x,y,z)
+    if (morphed)
+        m_morphPositionBuffer.bind();
+    else
+        m_buffers->vertexBuffer.bind();
+    program.enableAttributeArray( 0 );      // layout location
+    program.setAttributeBuffer( 0,          // layout location
+                                GL_FLOAT,   // data's type
+                                0,          // Offset to data in buffer
+                                morphed ? 4 : 3);   // number of components (3 for x,y,z)
 
     // Map normal data to the vertex shader's layout location '1'
-    m_normalBuffer.bind();
-    m_shaderProgram.enableAttributeArray( 1 );      // layout location
-    m_shaderProgram.setAttributeBuffer( 1,          // layout location
-                                        GL_FLOAT,   // data's type
-                                        0,          // Offset to data in buffer
-                                        3);         // number of components (3 for x,y,z)
-
-    if(m_textureUVBuffer.isCreated()) {
-        m_textureUVBuffer.bind();
-        m_shaderProgram.enableAttributeArray( 2 );      // layout location
-        m_shaderProgram.setAttributeBuffer( 2,          // layout location
-                                            GL_FLOAT,   // data's type
-                                            0,          // Offset to data in buffer
-                                            2);         // number of components (2 for u,v)
+    if (morphed)
+        m_morphNormalBuffer.bind();
+    else
+        m_buffers->normalBuffer.bind();
+    program.enableAttributeArray( 1 );      // layout location
+    program.setAttributeBuffer( 1,          // layout location
+                                GL_FLOAT,   // data's type
+                                0,          // Offset to data in buffer
+                                morphed ? 4 : 3);   // number of components (3 for x,y,z)
+
+    if(m_buffers->textureUVBuffer.isCreated()) {
+        m_buffers->textureUVBuffer.bind();
+        program.enableAttributeArray( 2 );      // layout location
+        program.setAttributeBuffer( 2,          // layout location
+                                    GL_FLOAT,   // data's type
+                                    0,          // Offset to data in buffer
+                                    2);         // number of components (2 for u,v)
     }
 
-    m_vertexBoneIndexBuffer.bind();
-    m_shaderProgram.enableAttributeArray( 3 );      // layout location
-    m_shaderProgram.setAttributeBuffer( 3,          // layout location
-                                        GL_FLOAT,   // data's type
-                                        0,          // Offset to data in buffer
-                                        4);         // number of components (3 for x,y,z)
+    // Bone indices are integers, QOpenGLShaderProgram only knows float attributes
+    m_buffers->vertexBoneIndexBuffer.bind();
+    glEnableVertexAttribArray( 3 );
+    glVertexAttribIPointer( 3, 4, GL_INT, 0, 0 );
 
-    m_vertexBoneWeightBuffer.bind();
-    m_shaderProgram.enableAttributeArray( 4 );      // layout location
-    m_shaderProgram.setAttributeBuffer( 4,          // layout location
-                                        GL_FLOAT,   // data's type
-                                        0,          // Offset to data in buffer
-                                        4);         // number of components (3 for x,y,z)
+    m_buffers->vertexBoneWeightBuffer.bind();
+    program.enableAttributeArray( 4 );      // layout location
+    program.setAttributeBuffer( 4,          // layout location
+                                GL_FLOAT,   // data's type
+                                0,          // Offset to data in buffer
+                                4);         // number of components (3 for x,y,z)
 
 }
 
 void Scene::setupLightingAndMatrices()
 {
-    float aspect = 4.0f/3.0f;
-    m_projection.setToIdentity();
-    m_projection.perspective(
-                60.0f,          // field of vision
-                aspect,         // aspect ratio
-                0.3f,           // near clipping plane
-                1000.0f);       // far clipping plane
-
+    // Projections come from the views
     m_lightInfo.Position = QVector4D( 2.0f, -2.0f, 3.0f, 1.0f );
     //m_lightInfo.Intensity = QVector3D( .5f, .5f, .f5);
     m_lightInfo.Intensity = QVector3D( 1.0f, 1.0f, 1.0f);
 
-    m_materialInfo.Ambient = QVector3D( 0.1f, 0.05f, 0.0f );
-    m_materialInfo.Diffuse = QVector3D( .9f, .6f, .2f );
-    m_materialInfo.Specular = QVector3D( .2f, .2f, .2f );
+    m_materialInfo.Ambient = Vector3( 0.1f, 0.05f, 0.0f );
+    m_materialInfo.Diffuse = Vector3( .9f, .6f, .2f );
+    m_materialInfo.Specular = Vector3( .2f, .2f, .2f );
     m_materialInfo.Shininess = 50.0f;
 }
 
-void Scene::updateAnimationData(const Mesh &mesh, const Node *node, QMatrix4x4 objectMatrix)
+void Scene::setBakedUniforms(QOpenGLShaderProgram &program, const FramePacket &packet)
 {
-    // Prepare matrices
-    if (m_currentAnimation != -1 && node->animationList[m_currentAnimation].isValid()) {
+    // The pose comes entirely from the baked texture, the only per frame CPU work is the clip time
+    const BakedClip &clip = m_baker.clip(packet.animation);
 
-        const NodeAnimation &nodeAnim = node->animationList[m_currentAnimation];
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_bakedTexture);
 
-        if (m_currentAnimationTick == 0.0f) {
-            nodeAnim.scalingIndex = nodeAnim.rotationIndex = nodeAnim.positionIndex = 0;
-        }
+    program.setUniformValue("bakedPalette", 0);
+    program.setUniformValue("clipFirstFrame", clip.firstFrame);
+    program.setUniformValue("clipFrameCount", clip.frameCount);
+    program.setUniformValue("clipFrame", float(packet.animationTick * clip.framesPerTick));
+    program.setUniformValue("interpolateFrames", GLint(m_interpolateBakedFrames));
+}
 
-        while (nodeAnim.scalingKeys.size()-1 > nodeAnim.scalingIndex
-               && nodeAnim.scalingKeys[nodeAnim.scalingIndex+1].first < m_currentAnimationTick) {
-            ++nodeAnim.scalingIndex;
+void Scene::recordDraws(CommandList &list, const FramePacket &packet, const SceneView &view,
+                        const QMatrix4x4 &projection, int first, int end) const
+{
+    // Runs on worker threads, only reads the scene
+    for (int ii=first; ii<end; ++ii) {
+        const QMatrix4x4 modelViewMatrix = view.camera * packet.instanceMatrices[m_visibleInstances[ii]];
+        const QMatrix3x3 normalMatrix = modelViewMatrix.normalMatrix();
+        const QMatrix4x4 mvp = projection * modelViewMatrix;
+        const float depth = -modelViewMatrix(2, 3) / view.farPlane;
+
+        for (int im=0; im<m_meshes.size(); ++im) {
+            const Mesh &mesh = *m_meshes.at(im);
+            const int paletteOffset = m_useBakedAnimation ? m_baker.meshPaletteOffset(im) : m_meshPaletteOffsets.value(im);
+
+            for (int ig=0; ig<mesh.influenceGroups.size(); ++ig) {
+                const InfluenceGroup &group = mesh.influenceGroups[ig];
+                DrawPacket *draw = list.add();
+                draw->key = DrawPacket::sortKey(group.variant, m_meshMaterials[im], im, depth);
+                draw->program = group.variant;
+                draw->mesh = im;
+                draw->paletteOffset = paletteOffset;
+                draw->indexOffset = group.indexOffset;
+                draw->indexCount = group.indexCount;
+                draw->modelView = modelViewMatrix;
+                draw->normal = normalMatrix;
+                draw->mvp = mvp;
+            }
         }
+    }
+}
 
-        while (nodeAnim.rotationKeys.size()-1 > nodeAnim.rotationIndex
-               && nodeAnim.rotationKeys[nodeAnim.rotationIndex+1].first < m_currentAnimationTick) {
-            ++nodeAnim.rotationIndex;
+void Scene::submitDraws(const FramePacket &packet, const QVector<const DrawPacket*> &draws)
+{
+    // Sorted draws only change program and material uniforms where the key changes
+    QOpenGLShaderProgram *program = 0;
+    int currentVariant = -1, currentMesh = -1;
+    for (int ii=0; ii<draws.size(); ++ii) {
+        const DrawPacket &draw = *draws[ii];
+
+        if (draw.program != currentVariant) {
+            currentVariant = draw.program;
+            currentMesh = -1;
+            program = m_useBakedAnimation ? &m_bakedShaderPrograms[currentVariant] : &m_shaderPrograms[currentVariant];
+            program->bind();
+
+            // Set shader uniforms for light information
+            program->setUniformValue( "lightPosition", m_lightInfo.Position );
+            program->setUniformValue( "lightIntensity", m_lightInfo.Intensity );
+
+            setTextureUniforms(*program);
+            if (m_useBakedAnimation)
+                setBakedUniforms(*program, packet);
+            else
+                program->setUniformValue( "bonePalette", 2 );
         }
 
-        while (nodeAnim.positionKeys.size()-1 > nodeAnim.positionIndex
-               && nodeAnim.positionKeys[nodeAnim.positionIndex+1].first < m_currentAnimationTick) {
-            ++nodeAnim.positionIndex;
-        }
+        if (draw.mesh != currentMesh) {
+            currentMesh = draw.mesh;
+            const Mesh &mesh = *m_meshes.at(currentMesh);
 
-        QMatrix4x4 transformationScale;
-        QMatrix4x4 transformationRotate;
-        QMatrix4x4 transformationTranslate;
+            // Palettes are already on the GPU, a mesh only selects its own
+            program->setUniformValue("paletteOffset", draw.paletteOffset);
 
-        if (nodeAnim.positionKeys.size() > 0)
-            transformationTranslate.translate(nodeAnim.positionKeys[nodeAnim.positionIndex].second);
-        if (nodeAnim.rotationKeys.size() > 0)
-            transformationRotate.rotate(nodeAnim.rotationKeys[nodeAnim.rotationIndex].second);
-        if (nodeAnim.scalingKeys.size() > 0)
-            transformationScale.scale(nodeAnim.scalingKeys[nodeAnim.scalingIndex].second);
+            if(mesh.material->Name == QString("DefaultMaterial"))
+                setMaterialUniforms(*program, m_materialInfo);
+            else
+                setMaterialUniforms(*program, *mesh.material);
+        }
 
-        objectMatrix *= transformationTranslate * transformationRotate * transformationScale;
-    }
-    else {
-        objectMatrix *= node->transformation;
-    }
+        program->setUniformValue( "MV", draw.modelView );// Transforming to eye space
+        program->setUniformValue( "N", draw.normal );    // Transform normal to Eye space
+        program->setUniformValue( "MVP", draw.mvp );     // Matrix for transforming to Clip space
 
-    const int boneIndex = mesh.boneNames.indexOf(node->name);
+        glDrawElements( GL_TRIANGLES, draw.indexCount, GL_UNSIGNED_INT
+                            , (const void*)(draw.indexOffset * sizeof(unsigned int)) );
+    }
+}
 
-    if (boneIndex != -1)
-        m_nodeModelMatrices[node->name] = m_inverseRootMatrix * objectMatrix * mesh.boneOffsets[boneIndex];
-    else
-        m_nodeModelMatrices[node->name] = m_inverseRootMatrix * objectMatrix;
+void Scene::resize(int w, int h)
+{
+    glViewport( 0, 0, w, h );
 
-    // Recursively draw this nodes children nodes
-    for(int inn = 0; inn<node->nodes.size(); ++inn)
-        updateAnimationData(mesh, &node->nodes[inn], objectMatrix);
+    // Every view derives its viewport and aspect ratio from this
+    m_framebufferSize = QSize(w, h);
 }
 
-void Scene::drawMesh(const Mesh &mesh)
+void Scene::evaluate(FramePacket &packet)
 {
-    QVector<QMatrix4x4> modelMatrices;
-    modelMatrices.resize(mesh.boneNames.size()/*100*/);
-    for (int ii=0; ii<mesh.boneNames.size()/*100*/; ++ii) {
-        //modelMatrices[ii] = QMatrix4x4();
-        modelMatrices[ii] = m_nodeModelMatrices.value(mesh.boneNames[ii], QMatrix4x4());
-    }
+    if(m_error)
+        return;
 
-    m_shaderProgram.setUniformValueArray("boneModelMatrix", modelMatrices.data(), modelMatrices.size());
+    QElapsedTimer timer;
+    timer.start();
 
-    if(mesh.material->Name == QString("DefaultMaterial"))
-        setMaterialUniforms(m_materialInfo);
-    else
-        setMaterialUniforms(*mesh.material);
+    ++packet.frame;
+    packet.camera = this->getCamera()->matrix();
+    packet.views = frameViews(packet.camera);
+    packet.animation = m_currentAnimation;
+    packet.animationTick = m_currentAnimationTick;
 
-    // Set bone matrix offset array uniform
-    // Set node matrix M array
-    // set P, V matrix uniforms
+    packet.instanceMatrices.resize(instanceCount());
+    for (int ii=0; ii<instanceCount(); ++ii)
+        packet.instanceMatrices[ii] = instanceMatrix(ii) * m_rootMatrix;
 
-    glDrawElements( GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT
-                        , (const void*)(mesh.indexOffset * sizeof(unsigned int)) );
-}
+    // Clip bounds cover every pose of the clip but not nodes moved through setNodeTransformation()
+    // or blend shapes, turn culling off for views showing those
+    updateInstanceBvh(packet, m_loadedModel->clipBounds(m_currentAnimation), m_inverseRootMatrix);
 
-void Scene::resize(int w, int h)
-{
-    glViewport( 0, 0, w, h );
+    // Implicitly shared with the evaluator, a paused pose is handed over without copying any matrix
+    if (!m_useBakedAnimation) {
+        m_pose.evaluate(m_currentAnimationTick);
+        packet.palettes = m_pose.palettes();
+        m_publisher.publish(m_pose, m_currentAnimationTick);
+    }
+
+    if (!m_morph.isEmpty())
+        m_pose.sampleMorphWeights(m_currentAnimationTick, packet.morphWeights);
 
-    m_projection.setToIdentity();
-    m_projection.perspective(60.0f, (float)w/h, .3f, 1000);
+    if (m_currentAnimation != -1 && !m_animationPaused) {
+        m_currentAnimationTick += m_animations[m_currentAnimation]->ticksPerSecond != 0 ? m_animations[m_currentAnimation]->ticksPerSecond / 25.0 : 1.0;
+        //m_currentAnimationTick += .001;//m_animations[m_currentAnimation]->ticksPerSecond / 25.0;
+        if (m_currentAnimationTick > m_animations[m_currentAnimation]->duration)
+            m_currentAnimationTick = 0.0f;
+        //qDebug() << "CurrentAnimationTick = " << m_currentAnimationTick;
+    }
+
+    packet.animationNs = timer.nsecsElapsed();
 }
 
-void Scene::update()
+void Scene::render(const FramePacket &packet)
 {
     if(m_error)
         return;
 
+    QElapsedTimer timer;
+    timer.start();
+
     // Clear color and depth buffers
+    glViewport( 0, 0, m_framebufferSize.width(), m_framebufferSize.height() );
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Bind shader program
-    m_shaderProgram.bind();
+    prepareFrame(packet);
 
-    m_model.setToIdentity();
+    m_frameTimings.animationNs = packet.animationNs;
+    m_frameTimings.views = packet.views.size();
+    m_frameTimings.culledInstances = 0;
+    m_frameTimings.cullTests = 0;
+    m_frameTimings.recordNs = 0;
+    m_frameTimings.drawPackets = 0;
 
-    // Set shader uniforms for light information
-    m_shaderProgram.setUniformValue( "lightPosition", m_lightInfo.Position );
-    m_shaderProgram.setUniformValue( "lightIntensity", m_lightInfo.Intensity );
+    m_vao.bind();
+    for (int iv=0; iv<packet.views.size(); ++iv)
+        renderView(packet, packet.views[iv], iv);
+    m_vao.release();
 
-    QMatrix4x4 modelMatrix = m_rootNode->transformation;
-    QMatrix4x4 modelViewMatrix = this->getCamera()->matrix() * modelMatrix;
-    QMatrix3x3 normalMatrix = modelViewMatrix.normalMatrix();
-    QMatrix4x4 mvp = m_projection * modelViewMatrix;
+    glViewport( 0, 0, m_framebufferSize.width(), m_framebufferSize.height() );
 
-    m_shaderProgram.setUniformValue( "MV", modelViewMatrix );// Transforming to eye space
-    m_shaderProgram.setUniformValue( "N", normalMatrix );    // Transform normal to Eye space
-    m_shaderProgram.setUniformValue( "MVP", mvp );           // Matrix for transforming to Clip space
+    m_frameTimings.drawNs = timer.nsecsElapsed();
+    publishFrameTimings();
+}
 
-    // Bind VAO and draw everything
-    m_vao.bind();
-    for (int ii=0; ii<m_meshes.size(); ++ii) {
-        updateAnimationData(*m_meshes.at(ii).data(), m_rootNode.data(), QMatrix4x4());
-        drawMesh(*m_meshes.at(ii).data());
+void Scene::prepareFrame(const FramePacket &packet)
+{
+    // A few more mip levels of streamed textures every frame
+    if (m_diffuseTexture != -1) {
+        m_textures.update();
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_textures.texture(m_diffuseTexture));
     }
-    m_vao.release();
 
+    // The pose is uploaded once for all views, and not at all while it's the same packet data
+    // as last time, e.g. when paused
+    if (m_paletteTexture != 0) {
+        if (packet.palettes.constData() != m_uploadedPalettes.constData()) {
+            for (int im=0; im<packet.palettes.size() && im<m_meshPaletteOffsets.size(); ++im) {
+                const QVector<Affine3x4> &palette = packet.palettes[im];
+                float *out = m_paletteData.data() + m_meshPaletteOffsets[im] * 16;
+                // Column major 4x4 for the shader, the bottom row is constant
+                for (int ib=0; ib<palette.size(); ++ib) {
+                    const float *m = palette[ib].m;
+                    for (int col=0; col<4; ++col) {
+                        *out++ = m[col];
+                        *out++ = m[4 + col];
+                        *out++ = m[8 + col];
+                        *out++ = col == 3 ? 1.0f : 0.0f;
+                    }
+                }
+            }
+
+            // Orphaned first, so the driver doesn't wait for last frame's draws
+            glBindBuffer(GL_TEXTURE_BUFFER, m_paletteBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, m_paletteData.size() * sizeof(float), 0, GL_STREAM_DRAW);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, m_paletteData.size() * sizeof(float), m_paletteData.constData());
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            m_uploadedPalettes = packet.palettes;
+        }
 
-    if (m_currentAnimation != -1) {
-        m_currentAnimationTick += m_animations[m_currentAnimation]->ticksPerSecond != 0 ? m_animations[m_currentAnimation]->ticksPerSecond / 25.0 : 1.0;
-        //m_currentAnimationTick += .001;//m_animations[m_currentAnimation]->ticksPerSecond / 25.0;
-        if (m_currentAnimationTick > m_animations[m_currentAnimation]->duration)
-            m_currentAnimationTick = 0.0f;
-        //qDebug() << "CurrentAnimationTick = " << m_currentAnimationTick;
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, m_paletteTexture);
     }
+
+    // Only vertices of targets that were or are active get touched and uploaded again
+    int firstVertex, vertexCount;
+    if (!m_morph.isEmpty() && m_morph.apply(packet.morphWeights, firstVertex, vertexCount)) {
+        const int offset = firstVertex * 4 * sizeof(float);
+        const int bytes = vertexCount * 4 * sizeof(float);
+        m_morphPositionBuffer.bind();
+        m_morphPositionBuffer.write(offset, m_morph.positions().constData() + firstVertex * 4, bytes);
+        if (!m_morph.normals().isEmpty()) {
+            m_morphNormalBuffer.bind();
+            m_morphNormalBuffer.write(offset, m_morph.normals().constData() + firstVertex * 4, bytes);
+        }
+        m_morphNormalBuffer.release();
+    }
+}
+
+void Scene::renderView(const FramePacket &packet, const SceneView &view, int index)
+{
+    const QRect rect = view.pixelRect(m_framebufferSize);
+    if (rect.isEmpty())
+        return;
+    glViewport( rect.x(), rect.y(), rect.width(), rect.height() );
+
+    // Views may overlap, e.g. picture in picture, so later ones start from a clear depth buffer
+    if (index > 0) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor( rect.x(), rect.y(), rect.width(), rect.height() );
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    const QMatrix4x4 projection = view.projection(m_framebufferSize);
+    if (view.culling) {
+        const QMatrix4x4 viewProjection = projection * view.camera;
+        m_frameTimings.cullTests += packet.instanceBvh.cull(Frustum(viewProjection.constData()), m_visibleInstances);
+    }
+    else {
+        m_visibleInstances.resize(packet.instanceMatrices.size());
+        for (int ii=0; ii<m_visibleInstances.size(); ++ii)
+            m_visibleInstances[ii] = ii;
+    }
+    m_frameTimings.culledInstances += packet.instanceMatrices.size() - m_visibleInstances.size();
+    if (m_visibleInstances.isEmpty())
+        return;
+
+    // Draws are recorded per visible instance, spread over worker threads in large scenes, and
+    // submitted here grouped by program, material and mesh
+    QElapsedTimer timer;
+    timer.start();
+    m_commands.record(m_visibleInstances.size(), [&](CommandList &list, int first, int end) {
+        recordDraws(list, packet, view, projection, first, end);
+    });
+    const QVector<const DrawPacket*> &draws = m_commands.sorted();
+    m_frameTimings.recordNs += timer.nsecsElapsed();
+    m_frameTimings.drawPackets += draws.size();
+
+    submitDraws(packet, draws);
 }
 
 //void Scene::drawNode(const Node *node, QMatrix4x4 objectMatrix)
@@ -398,14 +687,91 @@ void Scene::update()
 //        drawNode(&node->nodes[inn], objectMatrix);
 //}
 
-void Scene::setMaterialUniforms(MaterialInfo &mater)
+void Scene::setMaterialUniforms(QOpenGLShaderProgram &program, MaterialInfo &mater)
 {
-    m_shaderProgram.setUniformValue( "Ka", mater.Ambient );
-    m_shaderProgram.setUniformValue( "Kd", mater.Diffuse );
-    m_shaderProgram.setUniformValue( "Ks", mater.Specular );
-    m_shaderProgram.setUniformValue( "shininess", mater.Shininess );
+    program.setUniformValue( "Ka", QtConversions::toQt(mater.Ambient) );
+    program.setUniformValue( "Kd", QtConversions::toQt(mater.Diffuse) );
+    program.setUniformValue( "Ks", QtConversions::toQt(mater.Specular) );
+    program.setUniformValue( "shininess", mater.Shininess );
+}
+
+void Scene::setTextureUniforms(QOpenGLShaderProgram &program)
+{
+    // Unit 0 holds the baked palette
+    program.setUniformValue( "diffuseTexture", 1 );
+    program.setUniformValue( "hasDiffuseTexture", GLint(m_textures.texture(m_diffuseTexture) != 0) );
+}
+
+MemoryUsage Scene::memoryUsage() const
+{
+    MemoryUsage usage;
+    if (m_loadedModel)
+        usage = m_loadedModel->memoryUsage();
+    if (m_buffers)
+        usage.gpuBuffers += m_buffers->bytes;
+    usage.textures += bakedAnimationBytes() + m_textures.statistics().residentBytes;
+    usage.cpuAnimation += m_pose.skeleton().streamedBytes();
+    usage.cpuGeometry += m_picker.bytes();
+    if (!m_morph.isEmpty()) {
+        usage.cpuGeometry += m_morph.bytes();
+        usage.gpuBuffers += (m_morph.positions().size() + m_morph.normals().size()) * sizeof(float);
+    }
+    return usage;
+}
+
+bool Scene::pick(const Ray &ray, PickResult &result) const
+{
+    if (m_error || m_picker.isEmpty())
+        return SceneBase::pick(ray, result);
+
+    // Baked clips are posed on the GPU only, without palettes the bind pose is hit
+    const QVector<QVector<Affine3x4> > palettes = m_useBakedAnimation ? QVector<QVector<Affine3x4> >() : m_pose.palettes();
+
+    result = PickResult();
+    const float distance = m_instanceBvh.raycast(ray, FLT_MAX, [&](int instance, float maxDistance) {
+        // Palettes map into the model's space without its root transformation, which the
+        // packet's instance matrices add back
+        const QMatrix4x4 modelMatrix = instanceMatrix(instance) * m_rootMatrix;
+        MeshPicker::Hit hit;
+        if (!m_picker.intersect(ray.transformed(QtConversions::fromQt(modelMatrix.inverted())), palettes, maxDistance, hit))
+            return -1.0f;
+
+        result.instance = instance;
+        result.mesh = hit.mesh;
+        result.bone = hit.bone;
+        result.triangle = hit.triangle;
+        return hit.distance;
+    });
+    if (distance < 0.0f)
+        return false;
+
+    result.distance = distance;
+    result.position = ray.origin + ray.direction * distance;
+    return true;
 }
 
 void Scene::cleanup()
 {
+    m_textures.cleanup();
+
+    if (m_paletteTexture != 0) {
+        glDeleteTextures(1, &m_paletteTexture);
+        glDeleteBuffers(1, &m_paletteBuffer);
+        m_paletteTexture = m_paletteBuffer = 0;
+    }
+    m_uploadedPalettes.clear();
+
+    if (m_morphPositionBuffer.isCreated()) {
+        m_morphPositionBuffer.destroy();
+        m_morphNormalBuffer.destroy();
+    }
+
+    if (m_bakedTexture != 0) {
+        glDeleteTextures(1, &m_bakedTexture);
+        m_bakedTexture = 0;
+    }
+
+    // Buffers are freed once the last scene using them lets go, while a context of the group is current
+    m_vao.destroy();
+    m_buffers.clear();
 }
@@ -8,6 +8,14 @@
 #include <QOpenGLFunctions_3_3_Core>
 #include <QOpenGLFunctions>
 #include "modelloader.h"
+#include "assetmanager.h"
+#include "animationbaker.h"
+#include "poseevaluator.h"
+#include "posepublisher.h"
+#include "skinweights.h"
+#include "texturestreamer.h"
+#include "commandlist.h"
+#include "meshpicker.h"
 #include "scenebase.h"
 
 class Scene : public QOpenGLFunctions_3_3_Core, public SceneBase
@@ -16,36 +24,78 @@ public:
     Scene(QString filepath, ModelLoader::PathType pathType, QString texturePath="");
     void initialize();
     void resize(int w, int h);
-    void update();
+    void evaluate(FramePacket &packet);
+    void render(const FramePacket &packet);
     void cleanup();
+    bool hasError() const { return m_error; }
+    MemoryUsage memoryUsage() const;
+
+    // Down to the triangle of the posed mesh when the model's geometry was kept on the CPU, see
+    // AssetManager::setGeometryPolicy(). Baked animations are picked in the bind pose.
+    bool pick(const Ray &ray, PickResult &result) const;
+
+    // Play clips from textures of baked skinning matrices instead of evaluating poses on the CPU.
+    // Must be set before initialize().
+    void setBakedAnimation(bool enabled, float sampleRate = 30.0f, bool interpolateFrames = true);
+    qint64 bakedAnimationBytes() const { return m_useBakedAnimation ? m_baker.textureBytes() : 0; }
+
+    // Shares every evaluated pose with other processes through this shared memory segment, see
+    // PosePublisher. Must be set before initialize(), baked animations publish nothing.
+    void publishPoses(const QString &segment) { m_poseSegment = segment; }
+
+    // Switches clips, -1 shows the bind pose. Call from the thread that runs evaluate().
+    void playAnimation(int animation);
+    // Decodes clips in the background that are going to be played soon
+    void prefetchAnimations(const QVector<int> &animations);
+    void setAnimationTime(int animation, double tick);
+
+    // A paused scene keeps its pose, only nodes moved through setNodeTransformation() are updated
+    void setAnimationPaused(bool paused) { m_animationPaused = paused; }
+    bool isAnimationPaused() const { return m_animationPaused; }
+
+    // Moves a node that isn't animated by the current clip, e.g. to attach props. Call from the
+    // thread that runs evaluate(), after initialize().
+    void setNodeTransformation(QString name, const QMatrix4x4 &transformation);
+    void clearNodeTransformation(QString name);
 
 private:
-    void createShaderProgram( QString vShader, QString fShader);
+    void createShaderProgram( QOpenGLShaderProgram &program, QString vShader, QString fShader,
+                              const QByteArray &defines = QByteArray());
+    void createShaderPrograms(QOpenGLShaderProgram *programs, QString vShader, QString fShader);
     void createBuffers();
+    void createBakedAnimation();
     void createAttributes();
+    void createTextures();
+    void createPaletteBuffer();
+    void createMorphBuffers();
     void setupLightingAndMatrices();
 
-    void updateAnimationData(const Mesh &mesh, const Node *node, QMatrix4x4 objectMatrix);
     //void drawNode(const Node *node, QMatrix4x4 objectMatrix);
-    void drawMesh(const Mesh &mesh);
-    void setMaterialUniforms(MaterialInfo &mater);
-
-    QOpenGLShaderProgram m_shaderProgram;
+    void prepareFrame(const FramePacket &packet);
+    void renderView(const FramePacket &packet, const SceneView &view, int index);
+    void setBakedUniforms(QOpenGLShaderProgram &program, const FramePacket &packet);
+    void recordDraws(CommandList &list, const FramePacket &packet, const SceneView &view,
+                     const QMatrix4x4 &projection, int first, int end) const;
+    void submitDraws(const FramePacket &packet, const QVector<const DrawPacket*> &draws);
+    void setMaterialUniforms(QOpenGLShaderProgram &program, MaterialInfo &mater);
+    void setTextureUniforms(QOpenGLShaderProgram &program);
+
+    // One program per skinning variant, only those the meshes use are compiled
+    QOpenGLShaderProgram m_shaderPrograms[SkinWeights::VariantCount];
+    QOpenGLShaderProgram m_bakedShaderPrograms[SkinWeights::VariantCount];
+    QVector<int> m_variants;
 
     QOpenGLVertexArrayObject m_vao;
 
-    QOpenGLBuffer m_vertexBuffer;
-    QOpenGLBuffer m_normalBuffer;
-    QOpenGLBuffer m_textureUVBuffer;
-    QOpenGLBuffer m_indexBuffer;
-
-    QOpenGLBuffer m_vertexBoneIndexBuffer;
-    QOpenGLBuffer m_vertexBoneWeightBuffer;
+    QSharedPointer<ModelLoader> m_loadedModel;
+    QSharedPointer<ModelBuffers> m_buffers;
 
     QSharedPointer<Node> m_rootNode;
     QVector<QSharedPointer<Mesh> > m_meshes;
+    QVector<int> m_meshMaterials;               // material index of every mesh, for sorting draws
 
-    QMatrix4x4 m_projection, m_model;
+    QMatrix4x4 m_model;
+    QSize m_framebufferSize;
 
     QString m_filepath;
     ModelLoader::PathType m_pathType;
@@ -60,9 +110,40 @@ private:
     int m_currentAnimation;
     double m_currentAnimationTick;
 
-    QHash<QString, QMatrix4x4> m_nodeModelMatrices;
+    bool m_animationPaused;
 
+    PoseEvaluator m_pose;
+    QString m_poseSegment;
+    PosePublisher m_publisher;
+
+    QMatrix4x4 m_rootMatrix;
     QMatrix4x4 m_inverseRootMatrix;
+
+    // Palettes of all meshes in one texture buffer, uploaded once per frame and read by every view
+    GLuint m_paletteBuffer;
+    GLuint m_paletteTexture;
+    QVector<int> m_meshPaletteOffsets;
+    int m_paletteSize;
+    QVector<float> m_paletteData;
+    QVector<QVector<Affine3x4> > m_uploadedPalettes;    // holds on to the last upload to spot repeats
+
+    QVector<int> m_visibleInstances;            // of the current view
+    CommandQueue m_commands;
+
+    bool m_useBakedAnimation;
+    bool m_interpolateBakedFrames;
+    AnimationBaker m_baker;
+    GLuint m_bakedTexture;
+
+    // Models with blend shapes draw positions and normals from their own morphed copy
+    MorphDeformer m_morph;
+    QOpenGLBuffer m_morphPositionBuffer;
+    QOpenGLBuffer m_morphNormalBuffer;
+
+    TextureStreamer m_textures;
+    int m_diffuseTexture;       // -1 without a texture
+
+    MeshPicker m_picker;
 };
 
 #endif // SCENE_H
@@ -1,10 +1,11 @@
 #include "scene_gles.h"
+#include <QElapsedTimer>
 
 Scene_GLES::Scene_GLES(QString filepath, ModelLoader::PathType pathType, QString texturePath) :
-    m_indexBuffer(QOpenGLBuffer::IndexBuffer)
-  , m_filepath(filepath)
+    m_filepath(filepath)
   , m_pathType(pathType)
   , m_texturePath(texturePath)
+  , m_diffuseTexture(-1)
   , m_rotationAngle(0.0f)
   , m_error(false)
 {
@@ -14,12 +15,18 @@ Scene_GLES::Scene_GLES(QString filepath, ModelLoader::PathType pathType, QString
 void Scene_GLES::initialize()
 {
     this->initializeOpenGLFunctions();
+    m_state.initialize(this);
 
     // OpenGL ES -- Shaders languages is different
     createShaderProgram(":/es_ads_fragment.vert", ":/es_ads_fragment.frag");
 
     createBuffers();
-    // OpenGL ES -- There are no VAO's in OpenGL ES, so we don't set up the attributes here
+    // OpenGL ES -- VAOs need OES_vertex_array_object, without it the attributes are set every frame
+    if (m_state.hasVertexArrayObject()) {
+        m_state.bindVertexArray();
+        createAttributes();
+    }
+    createTextures();
     setupLightingAndMatrices();
 
     glEnable(GL_DEPTH_TEST);
@@ -39,6 +46,7 @@ void Scene_GLES::createShaderProgram(QString vShader, QString fShader)
     // OpenGL ES -- Vertex shader attributes need to be mapped to location before shader is linked
     m_shaderProgram.bindAttributeLocation("vertexPosition", 0);
     m_shaderProgram.bindAttributeLocation("vertexNormal", 1);
+    m_shaderProgram.bindAttributeLocation("vertexUV", 2);
 
     // Link the shaders together into a program
     if ( !m_shaderProgram.link() )
@@ -47,65 +55,42 @@ void Scene_GLES::createShaderProgram(QString vShader, QString fShader)
 
 void Scene_GLES::createBuffers()
 {
-    ModelLoader model;
-    model.setTransformToUnitCoordinates(true);
-
-    if(!model.Load(m_filepath, m_pathType))
+    // Parsed data and GL buffers are shared with every other scene showing the same model and
+    // profile. Nothing is skinned or animated here, bones and clips aren't even imported.
+    m_loadedModel = AssetManager::instance()->loadModel(m_filepath, m_pathType, true, ImportProfile::staticShading());
+    if(!m_loadedModel)
     {
         m_error = true;
         return;
     }
 
-    QVector<float> *vertices;
-    QVector<float> *normals;
-    QVector<QVector<float> > *textureUV;
-    QVector<unsigned int> *indices;
-
-    model.getBufferData(&vertices, &normals, &indices);
-    model.getTextureData(&textureUV, 0, 0);
-
     // OpenGL ES -- unsigned long int type indexes are not supported, use unsigned short instead
-    QVector<unsigned short> shortindices;
-    shortindices.resize(indices->size());
-    std::copy(indices->begin(), indices->end(), shortindices.begin());
-
-    // Create a buffer and copy the vertex data to it
-    m_vertexBuffer.create();
-    m_vertexBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-    m_vertexBuffer.bind();
-    m_vertexBuffer.allocate( &(*vertices)[0], vertices->size() * sizeof( float ) );
-
-    // Create a buffer and copy the vertex data to it
-    m_normalBuffer.create();
-    m_normalBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-    m_normalBuffer.bind();
-    m_normalBuffer.allocate( &(*normals)[0], normals->size() * sizeof( float ) );
-
-    if(textureUV != 0 && textureUV->size() != 0)
+    m_buffers = AssetManager::instance()->modelBuffers(m_loadedModel, ModelBuffers::ShortIndices);
+    if(!m_buffers)
     {
-        // Create a buffer and copy the vertex data to it
-        m_textureUVBuffer.create();
-        m_textureUVBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-        m_textureUVBuffer.bind();
-        int texSize = 0;
-        for(int ii=0; ii<textureUV->size(); ++ii)
-            texSize += textureUV->at(ii).size();
-
-        m_textureUVBuffer.allocate( &(*textureUV)[0][0], texSize * sizeof( float ) );
+        m_error = true;
+        return;
     }
 
-    // Create a buffer and copy the index data to it
-    m_indexBuffer.create();
-    m_indexBuffer.setUsagePattern( QOpenGLBuffer::StaticDraw );
-    m_indexBuffer.bind();
-    // OpenGL ES -- unsigned long int type indexes are not supported, use unsigned short instead
-    m_indexBuffer.allocate( &(shortindices)[0], shortindices.size() * sizeof( unsigned short ) );
+    m_rootNode = m_loadedModel->getNodeData();
+    m_meshes = m_loadedModel->getMeshes();
+    m_nodeDraws.clear();
+    flattenNode(m_rootNode.data(), QMatrix4x4());
+}
 
-    m_rootNode = model.getNodeData();
+void Scene_GLES::flattenNode(const Node *node, QMatrix4x4 objectMatrix)
+{
+    objectMatrix *= QtConversions::toQt(node->transformation);
+    for (int imm=0; imm<node->meshes.size(); ++imm) {
+        NodeDraw draw;
+        draw.objectMatrix = objectMatrix;
+        draw.mesh = m_meshes.indexOf(node->meshes[imm]);
+        draw.material = m_loadedModel->getMaterials().indexOf(node->meshes[imm]->material);
+        m_nodeDraws.append(draw);
+    }
 
-    m_vertexBuffer.release();
-    m_normalBuffer.release();
-    m_indexBuffer.release();
+    for (int inn=0; inn<node->nodes.size(); ++inn)
+        flattenNode(&node->nodes[inn], objectMatrix);
 }
 
 void Scene_GLES::createAttributes()
@@ -113,40 +98,46 @@ void Scene_GLES::createAttributes()
     if(m_error)
         return;
 
-    // Set up the vertex array state
-    m_shaderProgram.bind();
+    // Set up the vertex array state, calls that wouldn't change anything are dropped by m_state
+    m_state.useProgram(m_shaderProgram);
+    m_state.bindBuffer(m_buffers->indexBuffer);
 
     // Map vertex data to the vertex shader's layout location '0'
-    m_vertexBuffer.bind();
-    m_shaderProgram.enableAttributeArray( 0 );      // layout location
-    m_shaderProgram.setAttributeBuffer( 0,          // layout location
-                                        GL_FLOAT,   // data's type
-                                        0,          // Offset to data in buffer
-                                        3);         // number of components (3 for x,y,z)
+    m_state.bindBuffer(m_buffers->vertexBuffer);
+    m_state.enableAttribute( 0 );                   // layout location
+    m_state.attributePointer( 0, GL_FLOAT, 3 );     // 3 floats for x,y,z
 
     // Map normal data to the vertex shader's layout location '1'
-    m_normalBuffer.bind();
-    m_shaderProgram.enableAttributeArray( 1 );      // layout location
-    m_shaderProgram.setAttributeBuffer( 1,          // layout location
-                                        GL_FLOAT,   // data's type
-                                        0,          // Offset to data in buffer
-                                        3);         // number of components (3 for x,y,z)
-
-    if(!m_textureUVBuffer.isCreated())
+    m_state.bindBuffer(m_buffers->normalBuffer);
+    m_state.enableAttribute( 1 );
+    m_state.attributePointer( 1, GL_FLOAT, 3 );
+
+    if(!m_buffers->textureUVBuffer.isCreated())
         return;
-    m_textureUVBuffer.bind();
-    m_shaderProgram.enableAttributeArray( 2 );      // layout location
-    m_shaderProgram.setAttributeBuffer( 2,          // layout location
-                                        GL_FLOAT,   // data's type
-                                        0,          // Offset to data in buffer
-                                        2);         // number of components (2 for u,v)
+    m_state.bindBuffer(m_buffers->textureUVBuffer);
+    m_state.enableAttribute( 2 );
+    m_state.attributePointer( 2, GL_FLOAT, 2 );     // 2 floats for u,v
+}
 
+void Scene_GLES::createTextures()
+{
+    if(m_error || m_texturePath.isEmpty())
+        return;
+
+    if(!m_buffers->textureUVBuffer.isCreated()) {
+        qDebug() << "Model has no texture coordinates, ignoring" << m_texturePath;
+        return;
+    }
+
+    // OpenGL ES -- without BASE_LEVEL a texture shows up once its whole mip chain is uploaded
+    m_textures.initialize(this);
+    m_diffuseTexture = m_textures.request(ModelLoader::resolveFilePath(m_texturePath, m_pathType));
 }
 
 void Scene_GLES::setupLightingAndMatrices()
 {
-    m_view.setToIdentity();
-    m_view.lookAt(
+    m_camera.setToIdentity();
+    m_camera.lookAt(
                 QVector3D(0.0f, 0.0f, 1.2f),    // Camera Position
                 QVector3D(0.0f, 0.0f, 0.0f),    // Point camera looks towards
                 QVector3D(0.0f, 1.0f, 0.0f));   // Up vector
@@ -163,9 +154,9 @@ void Scene_GLES::setupLightingAndMatrices()
     //m_lightInfo.Intensity = QVector3D( .5, .5, .5);
     m_lightInfo.Intensity = QVector3D( 1.0f, 1.0f, 1.0f);
 
-    m_materialInfo.Ambient = QVector3D( 0.1f, 0.05f, 0.0f );
-    m_materialInfo.Diffuse = QVector3D( .9f, .6f, .2f );
-    m_materialInfo.Specular = QVector3D( .2f, .2f, .2f );
+    m_materialInfo.Ambient = Vector3( 0.1f, 0.05f, 0.0f );
+    m_materialInfo.Diffuse = Vector3( .9f, .6f, .2f );
+    m_materialInfo.Specular = Vector3( .2f, .2f, .2f );
     m_materialInfo.Shininess = 50.0f;
 }
 
@@ -173,81 +164,205 @@ void Scene_GLES::resize(int w, int h)
 {
     glViewport( 0, 0, w, h );
 
-    m_projection.setToIdentity();
-    m_projection.perspective(60.0f, (float)w/h, .3f, 1000);
+    // Every view derives its viewport and aspect ratio from this
+    m_framebufferSize = QSize(w, h);
 }
 
-void Scene_GLES::update()
+void Scene_GLES::evaluate(FramePacket &packet)
 {
     if(m_error)
         return;
 
-    // Clear color and depth buffers
-    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // Bind shader program
-    m_shaderProgram.bind();
+    // There is no skinning in this backend, the animation stage is only the rotation
+    QElapsedTimer timer;
+    timer.start();
 
     // Set the model matrix
     m_rotationAngle += 1.0f;
     if (m_rotationAngle >= 360.0f)
         m_rotationAngle = 0.0f;
-    m_model.setToIdentity();
-    m_model.rotate(m_rotationAngle, 0.0f, 1.0f, 0.0f);
+    QMatrix4x4 rotation;
+    rotation.rotate(m_rotationAngle, 0.0f, 1.0f, 0.0f);
 
-    // Set shader uniforms for light information
-    m_shaderProgram.setUniformValue( "lightPosition", m_lightInfo.Position );
-    m_shaderProgram.setUniformValue( "lightIntensity", m_lightInfo.Intensity );
+    ++packet.frame;
+    packet.camera = m_camera;
+    packet.views = frameViews(m_camera);
+    packet.instanceMatrices.resize(instanceCount());
+    for (int ii=0; ii<instanceCount(); ++ii)
+        packet.instanceMatrices[ii] = instanceMatrix(ii) * rotation;
 
-    // OpenGL ES -- set attributes (with GL 3.3 we would just need to bind the VAO)
-    createAttributes();
+    // Nothing is skinned here, the bind pose box is exact
+    updateInstanceBvh(packet, m_loadedModel->bounds(), QMatrix4x4());
 
-    m_indexBuffer.bind();
-    // Bind VAO and draw everything
-    drawNode(m_rootNode.data(), QMatrix4x4());
+    packet.animationNs = timer.nsecsElapsed();
+}
 
-    m_indexBuffer.release();
+void Scene_GLES::render(const FramePacket &packet)
+{
+    if(m_error)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Clear color and depth buffers
+    glViewport( 0, 0, m_framebufferSize.width(), m_framebufferSize.height() );
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    m_state.resetStatistics();
+
+    // Bind shader program
+    m_state.useProgram(m_shaderProgram);
+
+    // Set shader uniforms for light information
+    m_state.setUniform( "lightPosition", m_lightInfo.Position );
+    m_state.setUniform( "lightIntensity", m_lightInfo.Intensity );
+
+    // The streamer binds textures behind the cache's back while uploading
+    GLuint diffuseTexture = 0;
+    if (m_diffuseTexture != -1) {
+        m_textures.update();
+        m_state.invalidateTextures();
+        diffuseTexture = m_textures.texture(m_diffuseTexture);
+    }
+    m_state.bindTexture( 0, diffuseTexture );
+    m_state.setUniform( "diffuseTexture", 0 );
+    m_state.setUniform( "hasDiffuseTexture", int(diffuseTexture != 0) );
+
+    // OpenGL ES -- bind the VAO, or set the attributes again if there is none
+    if (m_state.hasVertexArrayObject())
+        m_state.bindVertexArray();
+    else
+        createAttributes();
+
+    m_frameTimings.animationNs = packet.animationNs;
+    m_frameTimings.views = packet.views.size();
+    m_frameTimings.culledInstances = 0;
+    m_frameTimings.cullTests = 0;
+    m_frameTimings.recordNs = 0;
+    m_frameTimings.drawPackets = 0;
+    for (int iv=0; iv<packet.views.size(); ++iv)
+        renderView(packet, packet.views[iv], iv);
+    glViewport( 0, 0, m_framebufferSize.width(), m_framebufferSize.height() );
+
+    const GLStateCache::Statistics statistics = m_state.statistics();
+    m_frameTimings.stateCalls = statistics.calls;
+    m_frameTimings.redundantStateCalls = statistics.skipped;
+    m_frameTimings.drawNs = timer.nsecsElapsed();
+    publishFrameTimings();
 }
 
-void Scene_GLES::drawNode(const Node *node, QMatrix4x4 objectMatrix)
+void Scene_GLES::renderView(const FramePacket &packet, const SceneView &view, int index)
 {
-    // Prepare matrices
-    objectMatrix *= node->transformation;
-    QMatrix4x4 modelMatrix = m_model * objectMatrix;
-    QMatrix4x4 modelViewMatrix = m_view * modelMatrix;
-    QMatrix3x3 normalMatrix = modelViewMatrix.normalMatrix();
-    QMatrix4x4 mvp = m_projection * modelViewMatrix;
+    const QRect rect = view.pixelRect(m_framebufferSize);
+    if (rect.isEmpty())
+        return;
+    glViewport( rect.x(), rect.y(), rect.width(), rect.height() );
+
+    // Views may overlap, so later ones start from a clear depth buffer
+    if (index > 0) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor( rect.x(), rect.y(), rect.width(), rect.height() );
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+    }
 
-    m_shaderProgram.setUniformValue( "MV", modelViewMatrix );// Transforming to eye space
-    m_shaderProgram.setUniformValue( "N", normalMatrix );    // Transform normal to Eye space
-    m_shaderProgram.setUniformValue( "MVP", mvp );           // Matrix for transforming to Clip space
+    m_view = view.camera;
+    m_projection = view.projection(m_framebufferSize);
 
-    // Draw each mesh in this node
-    for(int imm = 0; imm<node->meshes.size(); ++imm)
-    {
-        if(node->meshes[imm]->material->Name == QString("DefaultMaterial"))
-            setMaterialUniforms(m_materialInfo);
-        else
-            setMaterialUniforms(*node->meshes[imm]->material);
+    if (view.culling) {
+        const QMatrix4x4 viewProjection = m_projection * m_view;
+        m_frameTimings.cullTests += packet.instanceBvh.cull(Frustum(viewProjection.constData()), m_visibleInstances);
+    }
+    else {
+        m_visibleInstances.resize(packet.instanceMatrices.size());
+        for (int ii=0; ii<m_visibleInstances.size(); ++ii)
+            m_visibleInstances[ii] = ii;
+    }
+    m_frameTimings.culledInstances += packet.instanceMatrices.size() - m_visibleInstances.size();
+
+    // Matrices of every visible instance and node are worked out on worker threads in large
+    // scenes, only the GL calls are left for this one
+    QElapsedTimer timer;
+    timer.start();
+    m_commands.record(m_visibleInstances.size(), [&](CommandList &list, int first, int end) {
+        recordDraws(list, packet, view, first, end);
+    });
+    const QVector<const DrawPacket*> &draws = m_commands.sorted();
+    m_frameTimings.recordNs += timer.nsecsElapsed();
+    m_frameTimings.drawPackets += draws.size();
+
+    submitDraws(draws);
+}
 
-        // OpenGL ES -- unsigned long int type indexes are not supported, use unsigned short instead
-        glDrawElements( GL_TRIANGLES, node->meshes[imm]->indexCount, GL_UNSIGNED_SHORT
-                            , (const void*)(node->meshes[imm]->indexOffset * sizeof(unsigned short)) );
+void Scene_GLES::recordDraws(CommandList &list, const FramePacket &packet, const SceneView &view, int first, int end) const
+{
+    for (int ii=first; ii<end; ++ii) {
+        const QMatrix4x4 modelMatrix = packet.instanceMatrices[m_visibleInstances[ii]];
+        for (int id=0; id<m_nodeDraws.size(); ++id) {
+            const NodeDraw &node = m_nodeDraws[id];
+            const Mesh &mesh = *m_meshes[node.mesh];
+
+            DrawPacket *draw = list.add();
+            draw->modelView = m_view * modelMatrix * node.objectMatrix;
+            draw->normal = draw->modelView.normalMatrix();
+            draw->mvp = m_projection * draw->modelView;
+            draw->key = DrawPacket::sortKey(0, node.material, node.mesh, -draw->modelView(2, 3) / view.farPlane);
+            draw->program = 0;
+            draw->mesh = node.mesh;
+            draw->paletteOffset = 0;
+            draw->indexOffset = mesh.indexOffset;
+            draw->indexCount = mesh.indexCount;
+        }
     }
+}
 
-    // Recursively draw this nodes children nodes
-    for(int inn = 0; inn<node->nodes.size(); ++inn)
-        drawNode(&node->nodes[inn], objectMatrix);
+void Scene_GLES::submitDraws(const QVector<const DrawPacket*> &draws)
+{
+    int currentMesh = -1;
+    for (int ii=0; ii<draws.size(); ++ii) {
+        const DrawPacket &draw = *draws[ii];
+
+        if (draw.mesh != currentMesh) {
+            currentMesh = draw.mesh;
+            MaterialInfo &material = *m_meshes[currentMesh]->material;
+            if(material.Name == QString("DefaultMaterial"))
+                setMaterialUniforms(m_materialInfo);
+            else
+                setMaterialUniforms(material);
+        }
+
+        m_state.setUniform( "MV", draw.modelView );    // Transforming to eye space
+        m_state.setUniform( "N", draw.normal );        // Transform normal to Eye space
+        m_state.setUniform( "MVP", draw.mvp );         // Matrix for transforming to Clip space
+
+        // OpenGL ES -- unsigned long int type indexes are not supported, use unsigned short instead
+        glDrawElements( GL_TRIANGLES, draw.indexCount, GL_UNSIGNED_SHORT
+                            , (const void*)(draw.indexOffset * sizeof(unsigned short)) );
+    }
 }
 
 void Scene_GLES::setMaterialUniforms(MaterialInfo &mater)
 {
-    m_shaderProgram.setUniformValue( "Ka", mater.Ambient );
-    m_shaderProgram.setUniformValue( "Kd", mater.Diffuse );
-    m_shaderProgram.setUniformValue( "Ks", mater.Specular );
-    m_shaderProgram.setUniformValue( "shininess", mater.Shininess );
+    m_state.setUniform( "Ka", QtConversions::toQt(mater.Ambient) );
+    m_state.setUniform( "Kd", QtConversions::toQt(mater.Diffuse) );
+    m_state.setUniform( "Ks", QtConversions::toQt(mater.Specular) );
+    m_state.setUniform( "shininess", mater.Shininess );
+}
+
+MemoryUsage Scene_GLES::memoryUsage() const
+{
+    MemoryUsage usage;
+    if (m_loadedModel)
+        usage = m_loadedModel->memoryUsage();
+    if (m_buffers)
+        usage.gpuBuffers += m_buffers->bytes;
+    usage.textures += m_textures.statistics().residentBytes;
+    return usage;
 }
 
 void Scene_GLES::cleanup()
 {
+    m_textures.cleanup();
+    m_state.destroy();
+    m_buffers.clear();
 }
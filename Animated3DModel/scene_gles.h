@@ -7,7 +7,11 @@
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLFunctions>
 #include "modelloader.h"
+#include "assetmanager.h"
 #include "scenebase.h"
+#include "glstatecache.h"
+#include "texturestreamer.h"
+#include "commandlist.h"
 
 // OpenGL ES -- Inherit from QOpenGLFunctions to get OpenGL 2.1/OpenGL ES 2.0 functions
 class Scene_GLES : public QOpenGLFunctions, public SceneBase
@@ -16,28 +20,49 @@ public:
     Scene_GLES(QString filepath, ModelLoader::PathType pathType, QString texturePath="");
     void initialize();
     void resize(int w, int h);
-    void update();
+    void evaluate(FramePacket &packet);
+    void render(const FramePacket &packet);
     void cleanup();
+    bool hasError() const { return m_error; }
+    MemoryUsage memoryUsage() const;
 
 private:
     void createShaderProgram( QString vShader, QString fShader);
     void createBuffers();
     void createAttributes();
+    void createTextures();
     void setupLightingAndMatrices();
 
-    void drawNode(const Node *node, QMatrix4x4 objectMatrix);
+    void renderView(const FramePacket &packet, const SceneView &view, int index);
+    void flattenNode(const Node *node, QMatrix4x4 objectMatrix);
+    void recordDraws(CommandList &list, const FramePacket &packet, const SceneView &view, int first, int end) const;
+    void submitDraws(const QVector<const DrawPacket*> &draws);
     void setMaterialUniforms(MaterialInfo &mater);
 
     QOpenGLShaderProgram m_shaderProgram;
+    GLStateCache m_state;
+    TextureStreamer m_textures;
+    int m_diffuseTexture;       // -1 without a texture
 
-    QOpenGLBuffer m_vertexBuffer;
-    QOpenGLBuffer m_normalBuffer;
-    QOpenGLBuffer m_textureUVBuffer;
-    QOpenGLBuffer m_indexBuffer;
+    QSharedPointer<ModelLoader> m_loadedModel;
+    QSharedPointer<ModelBuffers> m_buffers;
 
     QSharedPointer<Node> m_rootNode;
+    QVector<QSharedPointer<Mesh> > m_meshes;
 
-    QMatrix4x4 m_projection, m_view, m_model;
+    // Nothing is animated here, so every mesh of the node tree is drawn with a fixed matrix
+    struct NodeDraw {
+        QMatrix4x4 objectMatrix;
+        int mesh;
+        int material;
+    };
+    QVector<NodeDraw> m_nodeDraws;
+    QVector<int> m_visibleInstances;            // of the current view
+    CommandQueue m_commands;
+
+    QMatrix4x4 m_camera;                        // evaluate() side, followed by the default view
+    QMatrix4x4 m_projection, m_view;            // of the view being drawn
+    QSize m_framebufferSize;
 
     QString m_filepath;
     ModelLoader::PathType m_pathType;
@@ -3,6 +3,12 @@
 
 #include <QString>
 #include <QMatrix4x4>
+#include <QMutex>
+#include <QVector4D>
+#include <QtMath>
+#include "framepacket.h"
+#include "memoryusage.h"
+#include "sceneview.h"
 
 class SceneCamera {
 public:
@@ -22,21 +28,189 @@ private:
     QMatrix4x4 m_camera;
 };
 
+// CPU time spent in the last evaluate() and render(), the GPU may still be busy afterwards
+struct FrameTimings {
+    FrameTimings() : animationNs(0), drawNs(0), recordNs(0), stateCalls(0), redundantStateCalls(0), views(0),
+        culledInstances(0), cullTests(0), drawPackets(0) {}
+    qint64 animationNs;     // pose evaluation
+    qint64 drawNs;          // uniform setup and draw call submission
+    qint64 recordNs;        // part of drawNs spent recording and sorting draw packets
+    int stateCalls;         // binds, enables and uniform uploads issued, by backends tracking them
+    int redundantStateCalls;// the ones dropped because they wouldn't have changed anything
+    int views;
+    int culledInstances;    // instances skipped, summed over the views
+    int cullTests;          // boxes tested against view frustums to find them
+    int drawPackets;        // draws recorded, summed over the views
+};
+
+struct LightInfo
+{
+    QVector4D Position;
+    QVector3D Intensity;
+};
+
+// What a ray through the scene hit first
+struct PickResult {
+    PickResult() : instance(-1), mesh(-1), bone(-1), triangle(-1), distance(-1.0f) {}
+    int instance;
+    int mesh;               // -1 when the backend only knows the instance's box
+    int bone;               // index into the mesh's boneNames, -1 for unskinned triangles
+    int triangle;           // within the mesh's full index range
+    float distance;         // along the ray
+    QVector3D position;     // world space
+};
+
 class SceneBase
 {
 public:
-    SceneBase() : m_camera(new SceneCamera) {}
+    SceneBase() : m_camera(new SceneCamera), m_instanceCount(1) {}
     virtual void initialize() = 0;
     virtual void resize(int w, int h) = 0;
-    virtual void update() = 0;
     virtual void cleanup() = 0;
 
+    // evaluate() advances the animation and fills the packet without touching GL, so it can run
+    // on another thread while render() draws the previous packet with the context current.
+    // The model data both read is never modified after initialize().
+    virtual void evaluate(FramePacket &packet) = 0;
+    virtual void render(const FramePacket &packet) = 0;
+
+    // Both stages back to back on the calling thread
+    virtual void update()
+    {
+        evaluate(m_packet);
+        render(m_packet);
+    }
+
+    // The packet update() evaluated last
+    const FramePacket &lastPacket() const { return m_packet; }
+
+    // Makes the next evaluate() sample this clip position, for replaying recorded runs.
+    // Backends without animation ignore it.
+    virtual void setAnimationTime(int animation, double tick) { Q_UNUSED(animation); Q_UNUSED(tick); }
+
     SceneCamera *getCamera() { return m_camera; }
+    virtual bool hasError() const { return false; }
+
+    // What the scene's model costs, valid after initialize()
+    virtual MemoryUsage memoryUsage() const { return MemoryUsage(); }
+
+    // Draw the model this many times, laid out on a square grid that fits the unit sized view
+    void setInstanceCount(int count) { m_instanceCount = qMax(1, count); }
+    int instanceCount() const { return m_instanceMatrices.isEmpty() ? m_instanceCount : m_instanceMatrices.size(); }
+    // Places the instances explicitly instead, e.g. as recorded in a pose stream. Empty for the grid.
+    void setInstanceMatrices(const QVector<QMatrix4x4> &matrices) { m_instanceMatrices = matrices; }
+    QMatrix4x4 instanceMatrix(int instance) const
+    {
+        if (!m_instanceMatrices.isEmpty())
+            return m_instanceMatrices.value(instance);
+
+        QMatrix4x4 matrix;
+        if (m_instanceCount == 1)
+            return matrix;
+
+        const int side = qCeil(qSqrt(m_instanceCount));
+        const float cell = 2.0f / side;
+        matrix.translate(-1.0f + cell * (instance % side + 0.5f), 1.0f - cell * (instance / side + 0.5f), 0.0f);
+        matrix.scale(1.0f / side);
+        return matrix;
+    }
+
+    // Views rendering every frame, one full sized view following the camera by default.
+    // Call from the thread that runs evaluate().
+    void setViews(const QVector<SceneView> &views) { m_views = views; }
+    QVector<SceneView> views() const { return m_views; }
+
+    // Of the last frame render() completed, safe to call while the render thread draws
+    FrameTimings frameTimings() const
+    {
+        QMutexLocker locker(&m_frameTimingsMutex);
+        return m_completedTimings;
+    }
+
+    // Ray through a point of the frontmost view under it, in pixels from the top left of a
+    // framebuffer of the given size. False when no view covers the point.
+    bool viewRay(const QPointF &position, const QSize &framebuffer, Ray &ray)
+    {
+        if (framebuffer.isEmpty())
+            return false;
+
+        const QPointF fraction(position.x() / framebuffer.width(), position.y() / framebuffer.height());
+        const QVector<SceneView> views = frameViews(getCamera()->matrix());
+        for (int ii=views.size()-1; ii>=0; --ii) {
+            if (views[ii].viewport.contains(fraction)) {
+                ray = views[ii].ray(position, framebuffer);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Nearest instance the ray hits in the pose of the last evaluate(), call from the same thread.
+    // Backends refine it down to the triangle where they can, this one stops at instance boxes.
+    virtual bool pick(const Ray &ray, PickResult &result) const
+    {
+        result = PickResult();
+        const float distance = m_instanceBvh.raycast(ray, FLT_MAX, [&](int instance, float maxDistance) {
+            float entry;
+            if (!ray.intersects(m_instanceBvh.instanceBox(instance), maxDistance, entry))
+                return -1.0f;
+            result.instance = instance;
+            return entry;
+        });
+        if (distance < 0.0f)
+            return false;
+        result.distance = distance;
+        result.position = QtConversions::toQt(ray.origin + ray.direction * distance);
+        return true;
+    }
 
     virtual ~SceneBase() {}
 
+protected:
+    // The views of the next packet, those following the camera get the given matrix
+    QVector<SceneView> frameViews(const QMatrix4x4 &camera) const
+    {
+        QVector<SceneView> views = m_views.isEmpty() ? QVector<SceneView>(1) : m_views;
+        for (int ii=0; ii<views.size(); ++ii) {
+            if (views[ii].followCamera)
+                views[ii].camera = camera;
+        }
+        return views;
+    }
+
+    // Refits the instance tree to the model box moved by every instance matrix times correction
+    // and hands it to the packet. The packet shares the tree, it's only copied when the next
+    // update finds an instance that moved while render() may still be culling with it.
+    void updateInstanceBvh(FramePacket &packet, const BoundingBox &modelBox, const QMatrix4x4 &correction)
+    {
+        m_instanceBounds.resize(packet.instanceMatrices.size());
+        for (int ii=0; ii<packet.instanceMatrices.size(); ++ii)
+            m_instanceBounds[ii] = modelBox.transformed(QtConversions::fromQt(packet.instanceMatrices[ii] * correction));
+        m_instanceBvh.update(m_instanceBounds);
+        packet.instanceBvh = m_instanceBvh;
+    }
+
+    // render() fills m_frameTimings on its own thread and publishes it once the frame is done.
+    // evaluate() runs elsewhere in threaded mode, its time reaches render() through the packet.
+    void publishFrameTimings()
+    {
+        QMutexLocker locker(&m_frameTimingsMutex);
+        m_completedTimings = m_frameTimings;
+    }
+
+    FrameTimings m_frameTimings;
+    InstanceBvh m_instanceBvh;                  // evaluate() side, of the last packet
+
 private:
+    QVector<BoundingBox> m_instanceBounds;
+    mutable QMutex m_frameTimingsMutex;
+    FrameTimings m_completedTimings;
+
     SceneCamera *m_camera;
+    FramePacket m_packet;
+    int m_instanceCount;
+    QVector<QMatrix4x4> m_instanceMatrices;
+    QVector<SceneView> m_views;
 };
 
 class SceneBase;
@@ -0,0 +1,86 @@
+#ifndef SCENEVIEW_H
+#define SCENEVIEW_H
+
+#include <QMatrix4x4>
+#include <QRectF>
+#include <QRect>
+#include <QSize>
+#include <QVector>
+#include "bounds.h"
+#include "qtconversions.h"
+
+// One camera and viewport rendering the shared frame. Every view draws the same pose and palettes,
+// so an extra view costs its culling and draw calls only.
+struct SceneView
+{
+    SceneView() : viewport(0.0, 0.0, 1.0, 1.0), followCamera(true), fieldOfView(60.0f),
+        nearPlane(0.3f), farPlane(1000.0f), culling(true) {}
+
+    QRectF viewport;        // fraction of the framebuffer, top left origin
+    bool followCamera;      // use the scene's camera instead of camera below
+    QMatrix4x4 camera;
+    float fieldOfView;
+    float nearPlane;
+    float farPlane;
+    bool culling;           // skip instances whose animated bounds are outside the view
+
+    // In pixels with GL's bottom left origin
+    QRect pixelRect(const QSize &framebuffer) const
+    {
+        const int left = qRound(viewport.left() * framebuffer.width());
+        const int right = qRound(viewport.right() * framebuffer.width());
+        const int top = qRound(viewport.top() * framebuffer.height());
+        const int bottom = qRound(viewport.bottom() * framebuffer.height());
+        return QRect(left, framebuffer.height() - bottom, right - left, bottom - top);
+    }
+
+    QMatrix4x4 projection(const QSize &framebuffer) const
+    {
+        const QRect rect = pixelRect(framebuffer);
+        QMatrix4x4 matrix;
+        matrix.perspective(fieldOfView, rect.height() > 0 ? float(rect.width()) / rect.height() : 1.0f,
+                           nearPlane, farPlane);
+        return matrix;
+    }
+
+    // Through a point in pixels from the top left of the framebuffer, in world space. Starts on
+    // the near plane and reaches the far plane at a distance of 1.
+    Ray ray(const QPointF &pixel, const QSize &framebuffer) const
+    {
+        const QRect rect = pixelRect(framebuffer);
+        const float top = framebuffer.height() - rect.y() - rect.height();
+        const float x = 2.0f * (pixel.x() - rect.x()) / qMax(1, rect.width()) - 1.0f;
+        const float y = 1.0f - 2.0f * (pixel.y() - top) / qMax(1, rect.height());
+
+        const QMatrix4x4 inverse = (projection(framebuffer) * camera).inverted();
+        const QVector3D near = inverse.map(QVector3D(x, y, -1.0f));
+        const QVector3D far = inverse.map(QVector3D(x, y, 1.0f));
+        return Ray(QtConversions::fromQt(near), QtConversions::fromQt(far - near));
+    }
+
+    // Side by side columns, the first following the scene's camera, the second looking down on the
+    // model and the rest orbiting it
+    static QVector<SceneView> split(int count)
+    {
+        QVector<SceneView> views(qMax(1, count));
+        for (int ii=0; ii<views.size(); ++ii) {
+            SceneView &view = views[ii];
+            view.viewport = QRectF(double(ii) / views.size(), 0.0, 1.0 / views.size(), 1.0);
+            if (ii == 0)
+                continue;
+
+            view.followCamera = false;
+            if (ii == 1) {
+                view.camera.lookAt(QVector3D(0.0f, 1.2f, 0.0f), QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 0.0f, -1.0f));
+            }
+            else {
+                QMatrix4x4 orbit;
+                orbit.rotate(360.0f * ii / views.size(), 0.0f, 1.0f, 0.0f);
+                view.camera.lookAt(orbit.map(QVector3D(0.0f, 0.0f, 1.2f)), QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 1.0f, 0.0f));
+            }
+        }
+        return views;
+    }
+};
+
+#endif // SCENEVIEW_H
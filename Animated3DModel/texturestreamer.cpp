@@ -0,0 +1,505 @@
+#include "texturestreamer.h"
+#include <QOpenGLContext>
+#include <QtConcurrent>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <QDebug>
+#include <algorithm>
+#include <climits>
+
+// Not in every OpenGL ES 2 header
+#ifndef GL_TEXTURE_BASE_LEVEL
+#define GL_TEXTURE_BASE_LEVEL 0x813C
+#endif
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+namespace {
+
+const quint32 CacheMagic = 0x41335458;  // "A3TX"
+const quint32 CacheVersion = 1;
+
+// Box filter to half the size, odd edges repeat their last pixel
+QImage downsample(const QImage &image)
+{
+    const int width = image.width(), height = image.height();
+    QImage half(qMax(1, width / 2), qMax(1, height / 2), QImage::Format_RGBA8888);
+
+    for (int y=0; y<half.height(); ++y) {
+        const uchar *row0 = image.constScanLine(qMin(y * 2, height - 1));
+        const uchar *row1 = image.constScanLine(qMin(y * 2 + 1, height - 1));
+        uchar *out = half.scanLine(y);
+        for (int x=0; x<half.width(); ++x) {
+            const int x0 = qMin(x * 2, width - 1) * 4, x1 = qMin(x * 2 + 1, width - 1) * 4;
+            for (int c=0; c<4; ++c)
+                out[x*4+c] = uchar((row0[x0+c] + row0[x1+c] + row1[x0+c] + row1[x1+c] + 2) / 4);
+        }
+    }
+    return half;
+}
+
+int nextPowerOfTwo(int value)
+{
+    int power = 1;
+    while (power < value)
+        power *= 2;
+    return power;
+}
+
+quint16 pack565(const int color[3])
+{
+    return quint16(((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3));
+}
+
+void unpack565(quint16 packed, int color[3])
+{
+    color[0] = ((packed >> 11) & 31) * 255 / 31;
+    color[1] = ((packed >> 5) & 63) * 255 / 63;
+    color[2] = (packed & 31) * 255 / 31;
+}
+
+QSharedPointer<TextureData> readCache(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return QSharedPointer<TextureData>();
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version, levelCount;
+    qint32 format;
+    in >> magic >> version >> format >> levelCount;
+    if (in.status() != QDataStream::Ok || magic != CacheMagic || version != CacheVersion)
+        return QSharedPointer<TextureData>();
+
+    QSharedPointer<TextureData> data(new TextureData);
+    data->format = TextureData::Format(format);
+    data->levels.resize(levelCount);
+    for (quint32 ii=0; ii<levelCount; ++ii) {
+        qint32 width, height;
+        in >> width >> height >> data->levels[ii].data;
+        data->levels[ii].width = width;
+        data->levels[ii].height = height;
+        data->bytes += data->levels[ii].data.size();
+    }
+
+    if (in.status() != QDataStream::Ok || data->levels.isEmpty()) {
+        qDebug() << "TextureStreamer: ignoring corrupt cache file" << filePath;
+        return QSharedPointer<TextureData>();
+    }
+    return data;
+}
+
+void writeCache(const QString &filePath, const TextureData &data)
+{
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+
+    // Written aside and renamed, so a reader never sees half a file
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << CacheMagic << CacheVersion << qint32(data.format) << quint32(data.levels.size());
+    for (int ii=0; ii<data.levels.size(); ++ii)
+        out << qint32(data.levels[ii].width) << qint32(data.levels[ii].height) << data.levels[ii].data;
+
+    if (!file.commit())
+        qDebug() << "TextureStreamer: unable to write cache file" << filePath;
+}
+
+}
+
+TextureStreamer::TextureStreamer() :
+    m_functions(0)
+  , m_memoryBudget(128 * 1024 * 1024)
+  , m_uploadBudget(2 * 1024 * 1024)
+  , m_compression(true)
+  , m_bc1Supported(false)
+  , m_baseLevel(true)
+  , m_powerOfTwo(false)
+{
+    m_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    // Workers report back to this object
+    m_pool.waitForDone();
+}
+
+void TextureStreamer::initialize(QOpenGLFunctions *functions)
+{
+    m_functions = functions;
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    const bool es = context->isOpenGLES();
+    const int major = context->format().majorVersion();
+    m_baseLevel = !es || major >= 3;
+    m_powerOfTwo = es && major < 3;
+    m_bc1Supported = context->hasExtension("GL_EXT_texture_compression_s3tc")
+            || context->hasExtension("GL_EXT_texture_compression_dxt1");
+
+    if (m_cacheDirectory.isEmpty())
+        m_cacheDirectory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/textures";
+}
+
+void TextureStreamer::cleanup()
+{
+    m_pool.waitForDone();
+
+    for (int ii=0; ii<m_entries.size(); ++ii) {
+        if (m_entries[ii].texture != 0)
+            m_functions->glDeleteTextures(1, &m_entries[ii].texture);
+    }
+    m_entries.clear();
+
+    QMutexLocker locker(&m_mutex);
+    m_finished.clear();
+    m_statistics.residentBytes = 0;
+}
+
+int TextureStreamer::request(const QString &filePath, int priority)
+{
+    Entry entry;
+    entry.filePath = filePath;
+    entry.priority = priority;
+    entry.state = State_Loading;
+    entry.texture = 0;
+    entry.nextLevel = -1;
+    entry.bytes = 0;
+    entry.usable = false;
+    m_entries.append(entry);
+
+    startLoading(m_entries.size() - 1);
+    return m_entries.size() - 1;
+}
+
+void TextureStreamer::setPriority(int texture, int priority)
+{
+    if (texture >= 0 && texture < m_entries.size())
+        m_entries[texture].priority = priority;
+}
+
+void TextureStreamer::startLoading(int texture)
+{
+    m_entries[texture].state = State_Loading;
+
+    const QString filePath = m_entries[texture].filePath;
+    const TextureData::Format format = m_compression && m_bc1Supported ? TextureData::Format_BC1 : TextureData::Format_RGBA8;
+    const bool powerOfTwo = m_powerOfTwo;
+    const QString cacheDirectory = m_cacheDirectory;
+
+    QtConcurrent::run(&m_pool, [=]() {
+        bool cacheHit = false;
+        QSharedPointer<TextureData> data = load(filePath, format, powerOfTwo, cacheDirectory, &cacheHit);
+
+        QMutexLocker locker(&m_mutex);
+        m_finished.append(qMakePair(texture, data));
+        if (cacheHit)
+            ++m_statistics.cacheHits;
+        else if (data)
+            ++m_statistics.decodes;
+    });
+}
+
+void TextureStreamer::update()
+{
+    QVector<QPair<int, QSharedPointer<TextureData> > > finished;
+    {
+        QMutexLocker locker(&m_mutex);
+        finished.swap(m_finished);
+    }
+
+    for (int ii=0; ii<finished.size(); ++ii) {
+        Entry &entry = m_entries[finished[ii].first];
+        const QSharedPointer<TextureData> &data = finished[ii].second;
+        if (!data || data->levels.isEmpty()) {
+            entry.state = State_Failed;
+            continue;
+        }
+        entry.state = State_Uploading;
+        entry.data = data;
+        entry.bytes = data->bytes;
+        entry.nextLevel = data->levels.size() - 1;
+    }
+
+    // Highest priority first, equal priorities in request order
+    QVector<int> order;
+    for (int ii=0; ii<m_entries.size(); ++ii) {
+        if (m_entries[ii].state == State_Uploading)
+            order.append(ii);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+        return m_entries[a].priority > m_entries[b].priority;
+    });
+
+    qint64 uploaded = 0;
+    for (int ii=0; ii<order.size() && uploaded < m_uploadBudget; ++ii) {
+        Entry &entry = m_entries[order[ii]];
+
+        // Room for the whole chain is made before its first level goes up
+        if (entry.texture == 0) {
+            if (!makeRoom(entry.bytes, entry.priority, order[ii]))
+                continue;
+
+            m_functions->glGenTextures(1, &entry.texture);
+            m_functions->glBindTexture(GL_TEXTURE_2D, entry.texture);
+            m_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            m_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            m_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            m_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            if (m_baseLevel)
+                m_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, entry.data->levels.size() - 1);
+
+            QMutexLocker locker(&m_mutex);
+            m_statistics.residentBytes += entry.bytes;
+        }
+
+        // At least one level per frame, however large, or big textures would never finish
+        while (entry.nextLevel >= 0) {
+            const qint64 levelBytes = entry.data->levels[entry.nextLevel].data.size();
+            if (uploaded > 0 && uploaded + levelBytes > m_uploadBudget)
+                break;
+            uploaded += levelBytes;
+            uploadLevel(entry);
+        }
+    }
+    m_functions->glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Evicted textures come back once they fit without pushing anything else out
+    QMutexLocker locker(&m_mutex);
+    m_statistics.uploadedBytes = uploaded;
+    qint64 free = m_memoryBudget - m_statistics.residentBytes;
+    locker.unlock();
+
+    for (int ii=0; ii<m_entries.size(); ++ii) {
+        if (m_entries[ii].state == State_Evicted && m_entries[ii].bytes <= free) {
+            free -= m_entries[ii].bytes;
+            startLoading(ii);
+        }
+    }
+}
+
+void TextureStreamer::uploadLevel(Entry &entry)
+{
+    const int level = entry.nextLevel;
+    const TextureData::Level &data = entry.data->levels[level];
+
+    m_functions->glBindTexture(GL_TEXTURE_2D, entry.texture);
+    if (entry.data->format == TextureData::Format_BC1) {
+        m_functions->glCompressedTexImage2D(GL_TEXTURE_2D, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                                            data.width, data.height, 0, data.data.size(), data.data.constData());
+    }
+    else {
+        m_functions->glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, data.width, data.height, 0,
+                                  GL_RGBA, GL_UNSIGNED_BYTE, data.data.constData());
+    }
+
+    // With a base level the uploaded part of the chain can be sampled right away
+    if (m_baseLevel) {
+        m_functions->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        entry.usable = true;
+    }
+
+    --entry.nextLevel;
+    if (entry.nextLevel < 0) {
+        entry.state = State_Resident;
+        entry.usable = true;
+        entry.data.clear();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    ++m_statistics.uploads;
+}
+
+bool TextureStreamer::makeRoom(qint64 bytes, int priority, int keep)
+{
+    for (;;) {
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_statistics.residentBytes + bytes <= m_memoryBudget)
+                return true;
+        }
+
+        int lowest = -1;
+        for (int ii=0; ii<m_entries.size(); ++ii) {
+            if (ii == keep || m_entries[ii].texture == 0 || m_entries[ii].priority >= priority)
+                continue;
+            if (lowest == -1 || m_entries[ii].priority < m_entries[lowest].priority)
+                lowest = ii;
+        }
+        if (lowest == -1)
+            return false;
+        evict(m_entries[lowest]);
+    }
+}
+
+void TextureStreamer::evict(Entry &entry)
+{
+    m_functions->glDeleteTextures(1, &entry.texture);
+    entry.texture = 0;
+    entry.usable = false;
+    entry.data.clear();
+    entry.nextLevel = -1;
+    entry.state = State_Evicted;
+
+    QMutexLocker locker(&m_mutex);
+    m_statistics.residentBytes -= entry.bytes;
+    ++m_statistics.evictions;
+}
+
+GLuint TextureStreamer::texture(int texture) const
+{
+    if (texture < 0 || texture >= m_entries.size() || !m_entries[texture].usable)
+        return 0;
+    return m_entries[texture].texture;
+}
+
+TextureStreamer::Statistics TextureStreamer::statistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_statistics;
+}
+
+QSharedPointer<TextureData> TextureStreamer::load(const QString &filePath, TextureData::Format format,
+                                                  bool powerOfTwo, const QString &cacheDirectory, bool *cacheHit)
+{
+    const QFileInfo info(filePath);
+    if (!info.exists()) {
+        qDebug() << "TextureStreamer: no such file" << filePath;
+        return QSharedPointer<TextureData>();
+    }
+
+    // Only transcoding is worth caching, plain decoding is about as fast as reading the cache
+    QString cacheFile;
+    if (format == TextureData::Format_BC1 && !cacheDirectory.isEmpty()) {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(info.canonicalFilePath().toUtf8());
+        hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+        hash.addData(QByteArray::number(info.size()));
+        hash.addData(powerOfTwo ? "pot" : "any");
+        cacheFile = cacheDirectory + "/" + hash.result().toHex() + ".bc1";
+
+        QSharedPointer<TextureData> cached = readCache(cacheFile);
+        if (cached) {
+            if (cacheHit)
+                *cacheHit = true;
+            return cached;
+        }
+    }
+
+    QImage image(filePath);
+    if (image.isNull()) {
+        qDebug() << "TextureStreamer: unable to decode" << filePath;
+        return QSharedPointer<TextureData>();
+    }
+
+    // GL expects the bottom row first
+    image = image.convertToFormat(QImage::Format_RGBA8888).mirrored();
+    if (powerOfTwo && (nextPowerOfTwo(image.width()) != image.width() || nextPowerOfTwo(image.height()) != image.height())) {
+        image = image.scaled(nextPowerOfTwo(image.width()), nextPowerOfTwo(image.height()),
+                             Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+
+    QSharedPointer<TextureData> data(new TextureData);
+    data->format = format;
+    for (;;) {
+        TextureData::Level level;
+        level.width = image.width();
+        level.height = image.height();
+
+        // RGBA8888 rows have no padding, the image is one block of memory
+        const uchar *pixels = image.constBits();
+        if (format == TextureData::Format_BC1)
+            level.data = encodeBC1(pixels, level.width, level.height);
+        else
+            level.data = QByteArray(reinterpret_cast<const char*>(pixels), level.width * level.height * 4);
+
+        data->bytes += level.data.size();
+        data->levels.append(level);
+
+        if (image.width() == 1 && image.height() == 1)
+            break;
+        image = downsample(image);
+    }
+
+    if (!cacheFile.isEmpty())
+        writeCache(cacheFile, *data);
+    return data;
+}
+
+QByteArray TextureStreamer::encodeBC1(const uchar *rgba, int width, int height)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    QByteArray encoded(blocksX * blocksY * 8, 0);
+    uchar *out = reinterpret_cast<uchar*>(encoded.data());
+
+    for (int by=0; by<blocksY; ++by) {
+        for (int bx=0; bx<blocksX; ++bx, out += 8) {
+            // Pixels beyond the edge repeat the last row or column
+            int pixels[16][3];
+            int minimum[3] = { 255, 255, 255 }, maximum[3] = { 0, 0, 0 };
+            for (int ii=0; ii<16; ++ii) {
+                const int x = qMin(bx * 4 + ii % 4, width - 1), y = qMin(by * 4 + ii / 4, height - 1);
+                const uchar *pixel = rgba + (y * width + x) * 4;
+                for (int c=0; c<3; ++c) {
+                    pixels[ii][c] = pixel[c];
+                    minimum[c] = qMin(minimum[c], int(pixel[c]));
+                    maximum[c] = qMax(maximum[c], int(pixel[c]));
+                }
+            }
+
+            // Endpoints at the corners of the block's color box, four color mode needs color0 > color1
+            quint16 color0 = pack565(maximum), color1 = pack565(minimum);
+            if (color0 < color1)
+                std::swap(color0, color1);
+
+            quint32 indices = 0;
+            if (color0 != color1) {
+                int palette[4][3];
+                unpack565(color0, palette[0]);
+                unpack565(color1, palette[1]);
+                for (int c=0; c<3; ++c) {
+                    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                }
+
+                for (int ii=0; ii<16; ++ii) {
+                    int best = 0, bestDistance = INT_MAX;
+                    for (int ip=0; ip<4; ++ip) {
+                        int distance = 0;
+                        for (int c=0; c<3; ++c)
+                            distance += (pixels[ii][c] - palette[ip][c]) * (pixels[ii][c] - palette[ip][c]);
+                        if (distance < bestDistance) {
+                            bestDistance = distance;
+                            best = ip;
+                        }
+                    }
+                    indices |= quint32(best) << (ii * 2);
+                }
+            }
+
+            out[0] = uchar(color0 & 0xff);
+            out[1] = uchar(color0 >> 8);
+            out[2] = uchar(color1 & 0xff);
+            out[3] = uchar(color1 >> 8);
+            for (int ii=0; ii<4; ++ii)
+                out[4+ii] = uchar((indices >> (ii * 8)) & 0xff);
+        }
+    }
+    return encoded;
+}
@@ -0,0 +1,128 @@
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include <QOpenGLFunctions>
+#include <QThreadPool>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QVector>
+#include <QString>
+#include <QByteArray>
+
+// Decoded texture with its whole mip chain, level 0 first
+struct TextureData
+{
+    enum Format {
+        Format_RGBA8,
+        Format_BC1          // S3TC DXT1, 4x4 blocks of 8 bytes
+    };
+
+    struct Level {
+        int width;
+        int height;
+        QByteArray data;
+    };
+
+    TextureData() : format(Format_RGBA8), bytes(0) {}
+
+    Format format;
+    QVector<Level> levels;
+    qint64 bytes;
+};
+
+// Loads textures without stalling the GL thread.
+// Images are decoded, flipped for GL and mipmapped on worker threads, and optionally transcoded to
+// BC1 with the result kept in a disk cache, so the transcoding only happens once per image.
+// update() uploads a few mip levels per frame, coarsest first, within an upload budget, so a texture
+// appears blurry early and sharpens over the following frames. Textures stay resident by priority:
+// uploading one that doesn't fit the memory budget evicts lower priority ones, which are loaded
+// again once there is room.
+// Everything but the workers runs on the thread of the GL context.
+class TextureStreamer
+{
+public:
+    struct Statistics {
+        Statistics() : decodes(0), cacheHits(0), uploads(0), evictions(0), residentBytes(0), uploadedBytes(0) {}
+        int decodes;            // images decoded by the workers
+        int cacheHits;          // transcoded images read from the disk cache instead
+        int uploads;            // mip levels uploaded
+        int evictions;
+        qint64 residentBytes;   // in GL textures
+        qint64 uploadedBytes;   // by the last update()
+    };
+
+    TextureStreamer();
+    ~TextureStreamer();
+
+    // Needs a current context, picks the formats and mipmapping it supports
+    void initialize(QOpenGLFunctions *functions);
+    // Waits for the workers and deletes all textures, needs the context current again
+    void cleanup();
+
+    void setMemoryBudget(qint64 bytes) { m_memoryBudget = bytes; }
+    void setUploadBudget(qint64 bytesPerFrame) { m_uploadBudget = bytesPerFrame; }
+    // Transcode to BC1 where the context supports it, must be set before requesting textures
+    void setCompression(bool enabled) { m_compression = enabled; }
+    void setCacheDirectory(const QString &directory) { m_cacheDirectory = directory; }
+
+    // Starts loading an image, higher priorities are uploaded first and evicted last
+    int request(const QString &filePath, int priority = 0);
+    void setPriority(int texture, int priority);
+
+    // Uploads what the workers have finished, once per frame
+    void update();
+
+    // 0 until the texture can be sampled
+    GLuint texture(int texture) const;
+
+    Statistics statistics() const;
+
+    // Runs on a worker, public for the asset converter and tools
+    static QSharedPointer<TextureData> load(const QString &filePath, TextureData::Format format,
+                                            bool powerOfTwo, const QString &cacheDirectory, bool *cacheHit = 0);
+    static QByteArray encodeBC1(const uchar *rgba, int width, int height);
+
+private:
+    enum State {
+        State_Loading,
+        State_Uploading,
+        State_Resident,
+        State_Evicted,
+        State_Failed
+    };
+
+    struct Entry {
+        QString filePath;
+        int priority;
+        State state;
+        GLuint texture;
+        QSharedPointer<TextureData> data;   // while uploading
+        int nextLevel;                      // next level to upload, counting down to 0
+        qint64 bytes;                       // of the whole chain once resident
+        bool usable;
+    };
+
+    void startLoading(int texture);
+    void uploadLevel(Entry &entry);
+    bool makeRoom(qint64 bytes, int priority, int keep);
+    void evict(Entry &entry);
+
+    QOpenGLFunctions *m_functions;
+    QThreadPool m_pool;
+
+    mutable QMutex m_mutex;                         // guards m_finished and m_statistics
+    QVector<QPair<int, QSharedPointer<TextureData> > > m_finished;
+    Statistics m_statistics;
+
+    QVector<Entry> m_entries;
+    qint64 m_memoryBudget;
+    qint64 m_uploadBudget;
+    bool m_compression;
+    QString m_cacheDirectory;
+
+    bool m_bc1Supported;
+    bool m_baseLevel;           // GL_TEXTURE_BASE_LEVEL works, partial mip chains can be sampled
+    bool m_powerOfTwo;          // OpenGL ES 2 can't mipmap other sizes
+};
+
+#endif // TEXTURESTREAMER_H
@@ -0,0 +1,43 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <QAtomicInt>
+
+// Lock-free single producer, single consumer handoff of the latest value.
+// The producer fills writeBuffer() and publishes it, the consumer picks up the newest published
+// value with consume() and reads it from readBuffer(). Neither side ever waits for the other,
+// values published faster than they are consumed are simply skipped.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : m_middle(1), m_back(2), m_front(0) {}
+
+    // Producer side
+    T &writeBuffer() { return m_slots[m_back]; }
+    void publish()
+    {
+        // Swap the finished back slot with the middle one and mark it as fresh
+        m_back = m_middle.fetchAndStoreOrdered(m_back | Fresh) & IndexMask;
+    }
+
+    // Consumer side, returns false when nothing new was published since the last call
+    bool consume()
+    {
+        if (!(m_middle.loadAcquire() & Fresh))
+            return false;
+        m_front = m_middle.fetchAndStoreOrdered(m_front) & IndexMask;
+        return true;
+    }
+    const T &readBuffer() const { return m_slots[m_front]; }
+
+private:
+    enum { IndexMask = 0x3, Fresh = 0x4 };
+
+    T m_slots[3];
+    QAtomicInt m_middle;    // slot index plus the fresh flag, the only state both threads touch
+    int m_back;             // owned by the producer
+    int m_front;            // owned by the consumer
+};
+
+#endif // TRIPLEBUFFER_H
@@ -1,15 +1,26 @@
 #include "window.h"
 
 #include <QKeyEvent>
+#include <QMouseEvent>
 #include <QOpenGLContext>
 #include <QTimer>
 #include <QDebug>
 #include "scenebase.h"
+#include "renderthread.h"
+#include "framecapture.h"
 #include <QCoreApplication>
 
-OpenGLWindow::OpenGLWindow( SceneSelector *sceneSelector, int refreshRate, int major, int minor, QScreen* screen )
+OpenGLWindow::OpenGLWindow( SceneSelector *sceneSelector, int refreshRate, int major, int minor, QScreen* screen,
+                            const QString &captureDirectory )
     : QWindow(screen)
+    , m_renderThread(0)
+    , m_capture(0)
 {
+    if (!captureDirectory.isEmpty()) {
+        m_capture = new FrameCapture;
+        m_capture->setDirectory(captureDirectory);
+    }
+
     QSurfaceFormat requestedFormat;
     requestedFormat.setDepthBufferSize( 24 );
     requestedFormat.setMajorVersion( major );
@@ -18,8 +29,10 @@ OpenGLWindow::OpenGLWindow( SceneSelector *sceneSelector, int refreshRate, int m
     requestedFormat.setSamples( 4 );
     requestedFormat.setProfile( QSurfaceFormat::CoreProfile );
 
+    // Share with the global context so every window can use the AssetManager's buffers
     m_context = new QOpenGLContext;
     m_context->setFormat( requestedFormat );
+    m_context->setShareContext( QOpenGLContext::globalShareContext() );
     m_context->create();
 
     if(m_context->format().version() == qMakePair(3,3)) {
@@ -32,6 +45,7 @@ OpenGLWindow::OpenGLWindow( SceneSelector *sceneSelector, int refreshRate, int m
         requestedFormat.setMinorVersion(1);
         m_context = new QOpenGLContext;
         m_context->setFormat( requestedFormat );
+        m_context->setShareContext( QOpenGLContext::globalShareContext() );
         m_context->create();
 
         if (m_context->format().version().first < 2) {
@@ -50,19 +64,40 @@ OpenGLWindow::OpenGLWindow( SceneSelector *sceneSelector, int refreshRate, int m
 
     connect( this, SIGNAL( widthChanged( int ) ), this, SLOT( resizeGL() ) );
     connect( this, SIGNAL( heightChanged( int ) ), this, SLOT( resizeGL() ) );
-    connect( m_context, SIGNAL(aboutToBeDestroyed()), this, SLOT(cleanup()), Qt::DirectConnection );
-
-    initializeGL();
-    resizeGL();
 
     m_timer = new QTimer;
     m_timer->setInterval(refreshRate);
     connect(m_timer, &QTimer::timeout, this, &OpenGLWindow::updateGL);
-    m_timer->start();
+
+    if (QOpenGLContext::supportsThreadedOpenGL()) {
+        // Rendering and swapping happen on their own thread, this thread only evaluates poses
+        m_renderThread = new RenderThread(m_context, this, m_scene, this);
+        m_renderThread->setFrameCapture(m_capture);
+        connect(m_renderThread, SIGNAL(initialized()), m_timer, SLOT(start()));
+        m_renderThread->start();
+    }
+    else {
+        qDebug() << "Threaded OpenGL is not supported, rendering on the GUI thread";
+        connect( m_context, SIGNAL(aboutToBeDestroyed()), this, SLOT(cleanup()), Qt::DirectConnection );
+
+        initializeGL();
+        resizeGL();
+        m_timer->start();
+    }
 }
 
 OpenGLWindow::~OpenGLWindow()
 {
+    m_timer->stop();
+    if (m_renderThread)
+        m_renderThread->stop();
+    else if (m_capture) {
+        // Frames still in flight are written while the context is around
+        m_context->makeCurrent( this );
+        m_capture->cleanup();
+    }
+    delete m_capture;
+    m_capture = 0;
     m_context->deleteLater();
 }
 
@@ -71,6 +106,8 @@ void OpenGLWindow::initializeGL()
     m_context->makeCurrent( this );
 
     m_scene->initialize();
+    if (m_capture)
+        m_capture->initialize();
 }
 
 void OpenGLWindow::updateGL()
@@ -78,15 +115,52 @@ void OpenGLWindow::updateGL()
     if(!isExposed())
         return;
 
+    if (m_renderThread) {
+        // The timer starts once the render thread has initialized the scene
+        if (!m_timer->isActive())
+            return;
+
+        // Never waits for the render thread, a packet it hasn't picked up yet is simply replaced
+        FramePacket &packet = m_renderThread->framePacket();
+        packet.viewport = size();
+        m_scene->evaluate( packet );
+        m_renderThread->publishFramePacket();
+        return;
+    }
+
     m_context->makeCurrent( this );
 
     m_scene->update();
+    if (m_capture)
+        m_capture->capture( size() );
 
     m_context->swapBuffers( this );
 }
 
+void OpenGLWindow::mousePressEvent(QMouseEvent *event)
+{
+    // Poses are evaluated on this thread, so the scene can be asked right away
+    if (!m_timer->isActive() || event->button() != Qt::LeftButton)
+        return;
+
+    Ray ray;
+    PickResult result;
+    if (!m_scene->viewRay(event->localPos(), size(), ray) || !m_scene->pick(ray, result)) {
+        qDebug() << "Picked nothing";
+        return;
+    }
+    qDebug() << "Picked instance" << result.instance << "mesh" << result.mesh << "bone" << result.bone
+             << "triangle" << result.triangle << "at" << result.position;
+}
+
 void OpenGLWindow::resizeGL()
 {
+    // The render thread picks up the new size with the next frame packet
+    if (m_renderThread) {
+        updateGL();
+        return;
+    }
+
     m_context->makeCurrent( this );
 
     m_scene->resize( width(), height() );
@@ -97,5 +171,7 @@ void OpenGLWindow::cleanup()
 {
     m_context->makeCurrent( this );
 
+    if (m_capture)
+        m_capture->cleanup();
     m_scene->cleanup();
 }
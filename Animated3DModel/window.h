@@ -6,22 +6,29 @@
 
 class SceneSelector;
 class SceneBase;
+class RenderThread;
+class FrameCapture;
 
 class OpenGLWindow : public QWindow
 {
     Q_OBJECT
 
 public:
-    OpenGLWindow( SceneSelector *scene, int refreshRate, int major=3, int minor=3, QScreen* screen = 0 );
+    // Frames are written to captureDirectory when it's set, see FrameCapture
+    OpenGLWindow( SceneSelector *scene, int refreshRate, int major=3, int minor=3, QScreen* screen = 0,
+                  const QString &captureDirectory = QString() );
     ~OpenGLWindow();
 
 protected:
     void initializeGL();
+    void mousePressEvent(QMouseEvent *event);
 
 private:
     QTimer *m_timer;
     SceneBase *m_scene;
     QOpenGLContext* m_context;
+    RenderThread *m_renderThread;
+    FrameCapture *m_capture;
 
 protected slots:
     void updateGL();
@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# Builds the core library first, then the viewer, the converter and the tests on top of it
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS = AnimCore \
+    Animated3DModel \
+    AssetConverter \
+    AnimCoreTests
+
+Animated3DModel.depends = AnimCore
+AssetConverter.depends = AnimCore
+
+# Headless, run with make check
+AnimCoreTests.subdir = AnimCore/tests
+AnimCoreTests.depends = AnimCore
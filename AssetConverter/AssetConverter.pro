@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Headless batch converter producing runtime assets for Animated3DModel
+#
+#-------------------------------------------------
+
+QT       += core concurrent
+QT       -= gui widgets
+CONFIG      += C++11 console
+CONFIG      -= app_bundle
+
+TARGET = AssetConverter
+TEMPLATE = app
+
+SOURCES += main.cpp
+
+include(../AnimCore/AnimCore.pri)
@@ -0,0 +1,308 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCryptographicHash>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include "modelloader.h"
+#include "modelasset.h"
+#include "assetoptimizer.h"
+
+// Bump when the optimization stages change so existing outputs are rebuilt
+static const char *ConverterVersion = "1";
+
+static bool s_verbose = false;
+
+static void messageHandler(QtMsgType type, const QMessageLogContext &, const QString &msg)
+{
+    // ModelLoader is chatty, only pass its debug output through when asked to
+    if (type == QtDebugMsg && !s_verbose)
+        return;
+    QTextStream(stderr) << msg << endl;
+}
+
+struct ConversionOptions
+{
+    QString outputDirectory;
+    bool force;
+    bool vertexCache;
+    bool quantize;
+    bool compressClips;
+    float clipTolerance;
+    int lodLevels;
+    double streamSeconds;       // clips at least this long are streamed, 0 streams none
+    double streamBlockSeconds;
+    ImportProfile profile;
+
+    // Everything that changes the output, folded into the content hash
+    QByteArray signature() const {
+        return QString("v%1 vc%2 q%3 cc%4 tol%5 lod%6 st%7 sb%8 pr%9")
+                .arg(ConverterVersion).arg(vertexCache).arg(quantize)
+                .arg(compressClips).arg(clipTolerance).arg(lodLevels)
+                .arg(streamSeconds).arg(streamBlockSeconds).arg(profile.attributes).toUtf8();
+    }
+};
+
+struct ConversionJob
+{
+    enum Status {
+        Pending,
+        Converted,
+        UpToDate,
+        Failed
+    };
+
+    QString input;
+    QString output;
+
+    Status status;
+    qint64 importMs;
+    qint64 optimizeMs;
+    qint64 writeMs;
+    qint64 inputBytes;
+    qint64 outputBytes;
+    int lodCount;
+    int keysRemoved;
+    int streamedClips;
+
+    ConversionJob() : status(Pending), importMs(0), optimizeMs(0), writeMs(0),
+        inputBytes(0), outputBytes(0), lodCount(0), keysRemoved(0), streamedClips(0) {}
+};
+
+struct ConvertFile
+{
+    typedef void result_type;
+
+    ConvertFile(const ConversionOptions &options) : m_options(options) {}
+
+    void operator()(ConversionJob &job) const
+    {
+        QFile source(job.input);
+        if (!source.open(QIODevice::ReadOnly)) {
+            qWarning() << "Unable to read" << job.input;
+            job.status = ConversionJob::Failed;
+            return;
+        }
+
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(&source);
+        hash.addData(m_options.signature());
+        const QByteArray sourceHash = hash.result();
+        job.inputBytes = source.size();
+        source.close();
+
+        // Reading the asset back also opens its clip streams, a missing one makes it stale
+        ModelLoader existing;
+        if (!m_options.force && ModelAsset::readSourceHash(job.output) == sourceHash
+                && ModelAsset::read(existing, job.output)) {
+            job.status = ConversionJob::UpToDate;
+            job.outputBytes = QFileInfo(job.output).size();
+            return;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        // Every worker runs its own ModelLoader, and with it its own Assimp importer
+        ModelLoader model;
+        model.setImportProfile(m_options.profile);
+        if (!model.Load(job.input, ModelLoader::AbsolutePath)) {
+            qWarning() << "Unable to import" << job.input;
+            job.status = ConversionJob::Failed;
+            return;
+        }
+        job.importMs = timer.restart();
+
+        if (m_options.lodLevels > 0)
+            job.lodCount = AssetOptimizer::generateLods(model, m_options.lodLevels);
+        if (m_options.vertexCache)
+            AssetOptimizer::optimizeVertexCache(model);
+        if (m_options.compressClips)
+            job.keysRemoved = AssetOptimizer::compressClips(model, m_options.clipTolerance);
+        job.optimizeMs = timer.restart();
+
+        QDir().mkpath(QFileInfo(job.output).absolutePath());
+        if (m_options.streamSeconds > 0.0)
+            job.streamedClips = AssetOptimizer::streamClips(model, job.output, m_options.streamSeconds,
+                                                            m_options.streamBlockSeconds);
+        int flags = ModelAsset::NoFlags;
+        if (m_options.quantize)
+            flags |= ModelAsset::QuantizePositions | ModelAsset::QuantizeNormals;
+        if (!ModelAsset::write(model, job.output, sourceHash, flags)) {
+            job.status = ConversionJob::Failed;
+            return;
+        }
+        job.writeMs = timer.elapsed();
+        job.outputBytes = QFileInfo(job.output).size();
+        job.status = ConversionJob::Converted;
+    }
+
+    ConversionOptions m_options;
+};
+
+static bool isWildcard(const QString &path)
+{
+    return path.contains('*') || path.contains('?') || path.contains('[');
+}
+
+static QVector<ConversionJob> collectJobs(const QStringList &inputs, const QString &outputDirectory)
+{
+    const QStringList modelFilters = QStringList() << "*.dae" << "*.fbx" << "*.obj" << "*.3ds" << "*.blend" << "*.x";
+    QDir outputDir(outputDirectory);
+    QVector<ConversionJob> jobs;
+
+    foreach (const QString &input, inputs) {
+        QFileInfo info(input);
+        QStringList files;
+        QDir baseDir;
+
+        if (info.isDir()) {
+            // Directories are searched recursively and their layout is kept in the output directory
+            baseDir = QDir(info.absoluteFilePath());
+            QDirIterator it(baseDir.absolutePath(), modelFilters, QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext())
+                files.append(it.next());
+            files.sort();
+        }
+        else if (isWildcard(info.fileName())) {
+            baseDir = info.absoluteDir();
+            foreach (const QFileInfo &match, baseDir.entryInfoList(QStringList(info.fileName()), QDir::Files, QDir::Name))
+                files.append(match.absoluteFilePath());
+        }
+        else if (info.isFile()) {
+            baseDir = info.absoluteDir();
+            files.append(info.absoluteFilePath());
+        }
+        else {
+            qWarning() << "No such file or directory" << input;
+        }
+
+        foreach (const QString &file, files) {
+            const QString relative = baseDir.relativeFilePath(file);
+            ConversionJob job;
+            job.input = file;
+            job.output = outputDir.absoluteFilePath(QFileInfo(relative).path() + "/"
+                                                    + QFileInfo(relative).completeBaseName() + "."
+                                                    + ModelAsset::fileSuffix());
+            jobs.append(job);
+        }
+    }
+    return jobs;
+}
+
+// Inputs differing only in their suffix, e.g. walk.dae and walk.fbx, would be converted concurrently
+// into the same asset and clip streams
+static bool uniqueOutputs(const QVector<ConversionJob> &jobs)
+{
+    QHash<QString, QString> inputs;
+    bool unique = true;
+    foreach (const ConversionJob &job, jobs) {
+        const QString other = inputs.value(job.output);
+        if (!other.isEmpty()) {
+            qWarning() << "Error:" << other << "and" << job.input << "both convert to" << job.output;
+            unique = false;
+        }
+        else
+            inputs.insert(job.output, job.input);
+    }
+    return unique;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("AssetConverter");
+    qInstallMessageHandler(messageHandler);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Batch converts model files into runtime assets loadable by ModelLoader.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("inputs", "Model files, directories or wildcard patterns to convert.", "inputs...");
+
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Output directory.", "directory", ".");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs", "Number of files converted in parallel.", "count",
+                                  QString::number(QThread::idealThreadCount()));
+    QCommandLineOption forceOption(QStringList() << "f" << "force", "Convert even if the output is up to date.");
+    QCommandLineOption lodOption("lods", "Number of reduced detail levels generated per mesh.", "count", "2");
+    QCommandLineOption toleranceOption("clip-tolerance", "Tolerance used when dropping repeated animation keys.", "value", "0.0001");
+    QCommandLineOption streamOption("stream-clips", "Stream clips lasting at least this many seconds from disk, 0 for none.",
+                                    "seconds", "30");
+    QCommandLineOption streamBlockOption("stream-block", "Length of the blocks streamed clips are read in.", "seconds", "1");
+    QCommandLineOption profileOption("profile", "Attributes imported: full, rendering (no tangents or extra uv channels), "
+                                     "static (no skinning or animation) or skinning (positions and bones only).",
+                                     "name", "full");
+    QCommandLineOption noVertexCacheOption("no-vertex-cache", "Skip vertex cache optimization.");
+    QCommandLineOption noQuantizeOption("no-quantize", "Store vertex data at full precision.");
+    QCommandLineOption noClipOption("no-clip-compression", "Keep every animation key.");
+    QCommandLineOption verboseOption(QStringList() << "v" << "verbose", "Print loader debug output.");
+    parser.addOptions(QList<QCommandLineOption>() << outputOption << jobsOption << forceOption << lodOption
+                      << toleranceOption << streamOption << streamBlockOption << profileOption << noVertexCacheOption << noQuantizeOption << noClipOption << verboseOption);
+    parser.process(app);
+
+    if (parser.positionalArguments().isEmpty())
+        parser.showHelp(1);
+
+    s_verbose = parser.isSet(verboseOption);
+
+    ConversionOptions options;
+    options.outputDirectory = parser.value(outputOption);
+    options.force = parser.isSet(forceOption);
+    options.vertexCache = !parser.isSet(noVertexCacheOption);
+    options.quantize = !parser.isSet(noQuantizeOption);
+    options.compressClips = !parser.isSet(noClipOption);
+    options.clipTolerance = parser.value(toleranceOption).toFloat();
+    options.lodLevels = qMax(0, parser.value(lodOption).toInt());
+    options.streamSeconds = qMax(0.0, parser.value(streamOption).toDouble());
+    options.streamBlockSeconds = qMax(0.05, parser.value(streamBlockOption).toDouble());
+    if (!ImportProfile::fromName(parser.value(profileOption), options.profile)) {
+        qWarning() << "Unknown import profile" << parser.value(profileOption);
+        return 1;
+    }
+
+    QVector<ConversionJob> jobs = collectJobs(parser.positionalArguments(), options.outputDirectory);
+    if (jobs.isEmpty()) {
+        qWarning() << "No model files found";
+        return 1;
+    }
+    if (!uniqueOutputs(jobs))
+        return 1;
+
+    QThreadPool::globalInstance()->setMaxThreadCount(qMax(1, parser.value(jobsOption).toInt()));
+
+    QElapsedTimer timer;
+    timer.start();
+    QtConcurrent::blockingMap(jobs, ConvertFile(options));
+    const qint64 totalMs = timer.elapsed();
+
+    // Report in input order, independent of which worker finished first
+    QTextStream out(stdout);
+    int failed = 0, converted = 0, upToDate = 0;
+    qint64 inputBytes = 0, outputBytes = 0;
+    foreach (const ConversionJob &job, jobs) {
+        QString status;
+        switch (job.status) {
+        case ConversionJob::Converted: status = "converted"; ++converted; break;
+        case ConversionJob::UpToDate: status = "up-to-date"; ++upToDate; break;
+        default: status = "FAILED"; ++failed; break;
+        }
+        inputBytes += job.inputBytes;
+        outputBytes += job.outputBytes;
+
+        out << QString("%1 %2  import %3 ms  optimize %4 ms  write %5 ms  %6 KB -> %7 KB  lods %8  keys removed %9")
+               .arg(status, -10).arg(job.input)
+               .arg(job.importMs).arg(job.optimizeMs).arg(job.writeMs)
+               .arg(job.inputBytes / 1024).arg(job.outputBytes / 1024)
+               .arg(job.lodCount).arg(job.keysRemoved)
+            << QString("  streamed clips %1").arg(job.streamedClips) << endl;
+    }
+
+    out << QString("%1 files: %2 converted, %3 up to date, %4 failed in %5 ms (%6 KB -> %7 KB)")
+           .arg(jobs.size()).arg(converted).arg(upToDate).arg(failed).arg(totalMs)
+           .arg(inputBytes / 1024).arg(outputBytes / 1024) << endl;
+
+    return failed == 0 ? 0 : 1;
+}